@@ -0,0 +1,64 @@
+#include "../src/daemon.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+  Thin client of erlisp --daemon: sends a program to the daemon, which
+  writes the output straight to our stdout and stderr, and exits with
+  the status of the request.
+ */
+
+static char *
+read_all (FILE *f, size_t *len)
+{
+  size_t alloc = 4096;
+  char *buf = malloc (alloc);
+  *len = 0;
+  size_t n;
+  while ((n = fread (buf + *len, 1, alloc - *len, f)) > 0)
+    {
+      *len += n;
+      if (*len == alloc)
+        buf = realloc (buf, alloc *= 2);
+    }
+  return buf;
+}
+
+int
+main (int argc, char **argv)
+{
+  if (argc < 2 || argc > 4 || (argc == 4 && strcmp (argv[2], "-e") != 0))
+    {
+      fprintf (stderr, "usage: %s SOCKET [FILE | -e FORMS]\n", argv[0]);
+      return 2;
+    }
+
+  char *text;
+  size_t len;
+  if (argc == 4)
+    {
+      text = argv[3];
+      len = strlen (text);
+    }
+  else if (argc == 2 || strcmp (argv[2], "-") == 0)
+    text = read_all (stdin, &len);
+  else
+    {
+      FILE *f = fopen (argv[2], "r");
+      if (!f)
+        {
+          fprintf (stderr, "%s: cannot open file\n", argv[2]);
+          return 2;
+        }
+      text = read_all (f, &len);
+      fclose (f);
+    }
+
+  int status;
+  if (daemon_request (argv[1], text, len, STDOUT_FILENO, STDERR_FILENO,
+                      &status))
+    return 2;
+  return status;
+}
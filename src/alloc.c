@@ -1,11 +1,13 @@
 #include "alloc.h"
 #include "blkalloc.h"
+#include "bytecode.h"
 #include "debug.h"
 #include "env.h"
 #include "lisp.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 
 #define SMALL_STRG_NCHRS 16
 #define SMALL_VECT_NELTS 16
@@ -17,9 +19,42 @@
 #define SMALL_LMBD_SIZE                                                       \
   (sizeof (Lisp_Lambda) + SMALL_LMBD_NARGS * sizeof (Lisp_Object))
 
-struct stackframe stack[STACKSIZE];
+// the stack starts in stackbase and moves to the heap, doubling, when
+// it gets full. only its index is kept across moves
+static struct stackframe stackbase[STACKSIZE];
+struct stackframe *stack = stackbase;
+size_t stacksize = STACKSIZE;
 int stackind = 0;
 
+struct specbinding
+{
+  Lisp_Object symbol;
+  Lisp_Object old_value;
+};
+
+static struct specbinding specpdlbase[SPECPDLSIZE];
+struct specbinding *specpdl = specpdlbase;
+size_t specpdlsize = SPECPDLSIZE;
+size_t specpdlind = 0;
+
+struct valuechunk
+{
+  struct valuechunk *prev;
+  Lisp_Object *top;
+  Lisp_Object *end;
+  Lisp_Object slots[];
+};
+
+// the chunk in use, and the one left last time, kept for the next
+static struct valuechunk *values;
+static struct valuechunk *sparevalues;
+static size_t nvaluechunks;
+
+size_t stack_limit = STACKLIMIT;
+// the C stack grows down from cstackbase for at most cstacklimit bytes
+static char *cstackbase;
+static size_t cstacklimit;
+
 blkallocator *all_cons;
 blkallocator *all_symbol;
 blkallocator *all_smallstring;
@@ -29,25 +64,32 @@ blkallocator *all_smalllambda;
 struct varsizeblk
 {
   Lisp_Object obj;
+  size_t size;
+  char gcmark;
   struct varsizeblk *next;
 };
 
+// variable sized objects are preceded by a pointer to their
+// varsizeblk: the gc mark is kept there, out of the object memory
+#define VARSIZE_HEADER sizeof (struct varsizeblk *)
+
 struct varsizeblk *varsizeheap;
 unsigned long int varsizeheaplength;
 size_t varsizeheapsize;
 
-static int is_obj_unmarked (Lisp_Object obj);
+static void *stack_grow (void *stack, void *base, size_t *size,
+                         size_t eltsize, const char *name);
+static void check_c_stack ();
+static struct valuechunk *valuechunk_new (struct valuechunk *prev);
+static struct varsizeblk *varsizealloc (size_t allocsize, void **ptr);
+static blkallocator *allocator_of (Lisp_Object obj);
+static int is_obj_marked (Lisp_Object obj);
+static void mark_obj (Lisp_Object obj);
 static int is_cons_unmarked (void *ptr);
 static int is_symbol_unmarked (void *ptr);
 static int is_string_unmarked (void *ptr);
 static int is_vector_unmarked (void *ptr);
 static int is_lambda_unmarked (void *ptr);
-static void unmark_obj (Lisp_Object obj);
-static void unmark_cons (void *ptr);
-static void unmark_symbol (void *ptr);
-static void unmark_string (void *ptr);
-static void unmark_vector (void *ptr);
-static void unmark_lambda (void *ptr);
 
 static void gcmarkobj (Lisp_Object obj);
 static void gcmark ();
@@ -66,6 +108,19 @@ init_alloc ()
   all_smallstring = blkalloc_init (SMALL_STRG_SIZE, is_string_unmarked);
   all_smallvector = blkalloc_init (SMALL_VECT_SIZE, is_vector_unmarked);
   all_smalllambda = blkalloc_init (SMALL_LMBD_SIZE, is_lambda_unmarked);
+
+  const char *limit = getenv ("ERLISP_STACK_LIMIT");
+  if (limit && atol (limit) > 0)
+    stack_limit = (size_t)atol (limit) << 20;
+  byte_stack_init ();
+
+  // the evaluator recurses from here on, see check_c_stack
+  cstackbase = __builtin_frame_address (0);
+  struct rlimit rl;
+  cstacklimit = CSTACKDEFAULT;
+  if (getrlimit (RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+    cstacklimit = rl.rlim_cur;
+  cstacklimit = cstacklimit > CSTACKMARGIN ? cstacklimit - CSTACKMARGIN : 0;
 }
 
 Lisp_Object
@@ -92,13 +147,8 @@ make_vector (size_t size)
     {
       // allocate in variable sized heap
       size_t allocsize = sizeof (Lisp_Vector) + size * sizeof (Lisp_Object);
-      vec = malloc (allocsize);
-      struct varsizeblk *blk = malloc (sizeof (struct varsizeblk));
+      struct varsizeblk *blk = varsizealloc (allocsize, (void **)&vec);
       blk->obj = box_vector (vec);
-      blk->next = varsizeheap;
-      varsizeheap = blk;
-      varsizeheaplength++;
-      varsizeheapsize += allocsize;
     }
 
   vec->size = size;
@@ -109,6 +159,23 @@ make_vector (size_t size)
   return box_vector (vec);
 }
 
+Lisp_Object
+make_bignum (size_t nlimbs)
+{
+  // a pseudovector: always in the variable sized heap, see lisp.h
+  Lisp_Bignum *big;
+  size_t allocsize = sizeof (Lisp_Bignum) + nlimbs * sizeof (uint64_t);
+  struct varsizeblk *blk = varsizealloc (allocsize, (void **)&big);
+  blk->obj = box_bignum (big);
+
+  big->size = PSEUDOVECTOR_FLAG;
+  big->sign = 1;
+  big->nlimbs = nlimbs;
+  memset (big->limbs, 0, nlimbs * sizeof (uint64_t));
+
+  return box_bignum (big);
+}
+
 Lisp_Object
 make_string (const char *s)
 {
@@ -128,18 +195,13 @@ make_nstring (const char *s, size_t size)
     {
       // allocate in variable sized heap
       size_t allocsize = sizeof (Lisp_String) + size * sizeof (char);
-      string = malloc (allocsize);
-      struct varsizeblk *blk = malloc (sizeof (struct varsizeblk));
+      struct varsizeblk *blk = varsizealloc (allocsize, (void **)&string);
       blk->obj = box_string (string);
-      blk->next = varsizeheap;
-      varsizeheap = blk;
-      varsizeheaplength++;
-      varsizeheapsize += allocsize;
     }
 
-  string->gcmark = 0;
   string->size = size;
-  strncpy (string->data, s, size);
+  // memcpy and not strncpy: strings can hold binary data (see term.h)
+  memcpy (string->data, s, size);
 
   return box_string (string);
 }
@@ -151,8 +213,9 @@ make_symbol (Lisp_Object name)
 
   symbol->name = name;
   symbol->value = q_unbound;
+  symbol->special = 0;
+  symbol->form = SF_NONE;
   symbol->next = NULL;
-  symbol->gcmark = 0;
 
   return box_symbol (symbol);
 }
@@ -170,61 +233,66 @@ make_nstr_symbol (const char *name, size_t size)
 }
 
 Lisp_Object
-make_subr (const char *name, int minargs, int maxargs, union lisp_subr_fun fun)
+make_subr (const char *name, int minargs, int maxargs, union lisp_subr_fun fun,
+           lisp_subr_call call)
 {
   // plain allocation, SUBR is not subject to memory management and gc
   Lisp_Subr *subr = malloc (sizeof (Lisp_Subr));
 
   subr->name = name; // TODO probably safer to copy name
   subr->function = fun;
+  subr->call = call;
   subr->minargs = minargs;
   subr->maxargs = maxargs;
+  subr->pure = 0;
 
   return box_subr (subr);
 }
 
 Lisp_Object
-make_lambda (int minargs, int maxargs, Lisp_Object *args, Lisp_Object form)
+make_lambda (int minargs, int maxargs, enum lambda_rest rest,
+             Lisp_Object *args, Lisp_Object form)
 {
   Lisp_Lambda *lambda;
+  int nslots = maxargs + (rest == REST_LIST);
   // TODO maybe use a lisp list args instead of c array?
-  if (maxargs <= SMALL_LMBD_NARGS)
+  if (nslots <= SMALL_LMBD_NARGS)
     {
-      lambda = blkalloc (all_smallvector);
+      lambda = blkalloc (all_smalllambda);
     }
   else
     {
       // allocate in variable sized heap
-      size_t allocsize = sizeof (Lisp_Lambda) + maxargs * sizeof (Lisp_Object);
-      lambda = malloc (allocsize);
-      struct varsizeblk *blk = malloc (sizeof (struct varsizeblk));
+      size_t allocsize = sizeof (Lisp_Lambda) + nslots * sizeof (Lisp_Object);
+      struct varsizeblk *blk = varsizealloc (allocsize, (void **)&lambda);
       blk->obj = box_lambda (lambda);
-      blk->next = varsizeheap;
-      varsizeheap = blk;
-      varsizeheaplength++;
-      varsizeheapsize += allocsize;
     }
 
   lambda->minargs = minargs;
   lambda->maxargs = maxargs;
-  for (int i = 0; i < maxargs; i++)
+  lambda->rest = rest;
+  for (int i = 0; i < nslots; i++)
     lambda->args[i] = args[i];
   lambda->form = form;
-  lambda->gcmark = 0;
+  lambda->env = q_nil;
+  lambda->resolved = 0;
+  lambda->bytecode = q_nil;
+  lambda->constants = q_nil;
+  lambda->maxdepth = 0;
+  lambda->stackargs = 0;
+  lambda->jitcode = NULL;
+  lambda->ncalls = 0;
 
   return box_lambda (lambda);
 }
 
 Lisp_Object
-defsubr (const char *name, int minargs, int maxargs, union lisp_subr_fun fun)
+defsubr (const char *name, int minargs, int maxargs, union lisp_subr_fun fun,
+         lisp_subr_call call)
 {
-  Lisp_Object subr = make_subr (name, minargs, maxargs, fun);
+  Lisp_Object subr = make_subr (name, minargs, maxargs, fun, call);
+  // builtin symbols are protected from gc by the obarray
   Lisp_Object symb = make_str_symbol (name);
-  {
-    // TODO implement pure storage and remove this HORROR
-    unbox_symbol (symb)->gcmark = 1;
-    unbox_string (unbox_symbol (symb)->name)->gcmark = 1;
-  }
   unbox_symbol (symb)->value = subr;
   return symb;
 }
@@ -239,18 +307,18 @@ free_lisp_obj (Lisp_Object o)
     // integer is immediate, not a pointer. nothing to do
     return;
 
-  free (unbox_pointer (o));
+  // only objects of the variable sized heap are freed this way
+  free ((char *)unbox_pointer (o) - VARSIZE_HEADER);
 }
 
 void
 stack_push (struct stackframe sf)
 {
-  if (stackind >= STACKSIZE)
-    {
-      // TODO err
-      fprintf (stderr, "stack size exceeded: %d\n", STACKSIZE);
-      exit (9);
-    }
+  if ((size_t)stackind + 1 >= stacksize)
+    stack = stack_grow (stack, stackbase, &stacksize,
+                        sizeof (struct stackframe), "stack");
+  // every lisp call goes through here, interpreted or compiled
+  check_c_stack ();
 
   stack[++stackind] = sf;
 }
@@ -268,6 +336,18 @@ stack_pop ()
   return stack[--stackind];
 }
 
+int
+stack_index ()
+{
+  return stackind;
+}
+
+struct stackframe
+stack_at (int i)
+{
+  return stack[i];
+}
+
 struct stackframe
 stack_current ()
 {
@@ -275,18 +355,96 @@ stack_current ()
 }
 
 void
-stack_parent_set_env (Lisp_Object env)
+stack_current_set_env (Lisp_Object env)
+{
+  // TODO unmark gc?
+  stack[stackind].env = env;
+}
+
+Lisp_Object *
+values_top ()
+{
+  if (!values)
+    values = valuechunk_new (NULL);
+  return values->top;
+}
+
+Lisp_Object *
+values_push (Lisp_Object *base, Lisp_Object value)
+{
+  if (values->top == values->end)
+    {
+      // the values since BASE move along: nobody else refers to them
+      size_t n = values->top - base;
+      if (n == VALUECHUNKSIZE)
+        {
+          // TODO err
+          fprintf (stderr, "too many arguments: %d\n", VALUECHUNKSIZE);
+          exit (9);
+        }
+      values->top = base;
+      struct valuechunk *next = sparevalues;
+      if (next)
+        {
+          next->prev = values;
+          sparevalues = NULL;
+        }
+      else
+        next = valuechunk_new (values);
+      memcpy (next->slots, base, n * sizeof (Lisp_Object));
+      next->top = next->slots + n;
+      values = next;
+      base = next->slots;
+    }
+
+  *values->top++ = value;
+  return base;
+}
+
+void
+values_unwind (Lisp_Object *base)
 {
-  int effind = stackind > 0 ? stackind - 1 : 0;
+  values->top = base;
+  if (base == values->slots && values->prev)
+    {
+      // back to the previous chunk, keeping this one for later
+      if (sparevalues)
+        {
+          free (sparevalues);
+          nvaluechunks--;
+        }
+      sparevalues = values;
+      values = values->prev;
+    }
+}
 
-  stack[effind].env = env;
+size_t
+specpdl_index ()
+{
+  return specpdlind;
 }
 
 void
-stack_current_set_env (Lisp_Object env)
+specbind (Lisp_Object symbol, Lisp_Object value)
 {
-  // TODO unmark gc?
-  stack[stackind].env = env;
+  if (specpdlind >= specpdlsize)
+    specpdl = stack_grow (specpdl, specpdlbase, &specpdlsize,
+                          sizeof (struct specbinding), "specpdl");
+
+  Lisp_Symbol *usymbol = unbox_symbol (symbol);
+  specpdl[specpdlind++]
+      = (struct specbinding){ .symbol = symbol, .old_value = usymbol->value };
+  usymbol->value = value;
+}
+
+void
+unbind_to (size_t count)
+{
+  while (specpdlind > count)
+    {
+      struct specbinding *b = &specpdl[--specpdlind];
+      unbox_symbol (b->symbol)->value = b->old_value;
+    }
 }
 
 struct stackframe
@@ -308,6 +466,81 @@ stack_pop_free ()
   return pop;
 }
 
+static void *
+stack_grow (void *stack, void *base, size_t *size, size_t eltsize,
+            const char *name)
+{
+  // returns STACK of *SIZE elements, doubled. BASE is its initial
+  // static storage
+  size_t newsize = *size * 2;
+  if (newsize * eltsize > stack_limit)
+    {
+      // TODO err
+      fprintf (stderr, "%s size exceeded: %zu bytes\n", name, stack_limit);
+      exit (9);
+    }
+
+  void *newstack;
+  if (stack == base)
+    {
+      newstack = malloc (newsize * eltsize);
+      if (newstack)
+        memcpy (newstack, stack, *size * eltsize);
+    }
+  else
+    newstack = realloc (stack, newsize * eltsize);
+  if (!newstack)
+    {
+      // TODO err
+      fprintf (stderr, "%s: out of memory\n", name);
+      exit (9);
+    }
+
+  *size = newsize;
+  return newstack;
+}
+
+static struct valuechunk *
+valuechunk_new (struct valuechunk *prev)
+{
+  size_t size = sizeof (struct valuechunk)
+                + VALUECHUNKSIZE * sizeof (Lisp_Object);
+  if ((nvaluechunks + 1) * size > stack_limit)
+    {
+      // TODO err
+      fprintf (stderr, "value stack size exceeded: %zu bytes\n",
+               stack_limit);
+      exit (9);
+    }
+
+  struct valuechunk *chunk = malloc (size);
+  if (!chunk)
+    {
+      // TODO err
+      fprintf (stderr, "value stack: out of memory\n");
+      exit (9);
+    }
+  chunk->prev = prev;
+  chunk->top = chunk->slots;
+  chunk->end = chunk->slots + VALUECHUNKSIZE;
+  nvaluechunks++;
+  return chunk;
+}
+
+static void
+check_c_stack ()
+{
+  // a clean error instead of a segfault when the C stack is about to
+  // overflow. the stack grows down
+  char here;
+  if (cstackbase && (size_t)(cstackbase - &here) > cstacklimit)
+    {
+      // TODO err
+      fprintf (stderr, "C stack size exceeded: %zu bytes\n", cstacklimit);
+      exit (9);
+    }
+}
+
 struct memstats
 gc ()
 {
@@ -321,8 +554,13 @@ gc ()
 static void
 gcmarkobj (Lisp_Object obj)
 {
-  if (eq (obj, q_nil) || eq (obj, q_t) || eq (obj, q_unbound))
+  if (type_of (obj) == LISP_INTG || type_of (obj) == LISP_SUBR
+      || type_of (obj) == LISP_LREF)
     return;
+  if (is_obj_marked (obj))
+    return;
+
+  mark_obj (obj);
 
   // TODO this marks ALL. awful. use three-color approach:
   //  black -> collect
@@ -330,42 +568,34 @@ gcmarkobj (Lisp_Object obj)
   //  white -> untouchable
   switch (type_of (obj))
     {
-    case LISP_STRG:
-      if (unbox_string (obj)->gcmark == 1)
-        break;
-      unbox_string (obj)->gcmark = 1;
-      break;
     case LISP_SYMB:
-      if (unbox_symbol (obj)->gcmark == 1)
-        break;
-      unbox_symbol (obj)->gcmark = 1;
       gcmarkobj (unbox_symbol (obj)->name);
       gcmarkobj (unbox_symbol (obj)->value);
       break;
     case LISP_LMBD:
-      if (unbox_lambda (obj)->gcmark == 1)
-        break;
-      unbox_lambda (obj)->gcmark = 1;
       // TODO arg list as lisp list? -> add here gcmark of that
       gcmarkobj (unbox_lambda (obj)->form);
-      for (int i = 0; i < unbox_lambda (obj)->maxargs; i++)
+      gcmarkobj (unbox_lambda (obj)->env);
+      gcmarkobj (unbox_lambda (obj)->bytecode);
+      gcmarkobj (unbox_lambda (obj)->constants);
+      for (int i = 0; i < lambda_nslots (unbox_lambda (obj)); i++)
         gcmarkobj (unbox_lambda (obj)->args[i]);
       break;
     case LISP_CONS:
-      // TODO
-      if (unbox_cons (obj)->gcmark == 1)
-        break;
-      unbox_cons (obj)->gcmark = 1;
       gcmarkobj (f_car (obj));
       gcmarkobj (f_cdr (obj));
       break;
     case LISP_VECT:
-      if (unbox_vector (obj)->gcmark == 1)
+      if (pseudovector_p (obj))
+        // no lisp objects in there
         break;
-      unbox_vector (obj)->gcmark = 1;
+      for (size_t i = 0; i < unbox_vector (obj)->size; i++)
+        gcmarkobj (unbox_vector (obj)->contents[i]);
       break;
+    case LISP_STRG:
     case LISP_INTG:
     case LISP_SUBR:
+    case LISP_LREF:
       break;
     }
 }
@@ -373,7 +603,24 @@ gcmarkobj (Lisp_Object obj)
 static void
 gcmark ()
 {
-  gcmarkobj (env_current ());
+  gcmarkobj (l_globalenv);
+  for (int i = 0; i <= stackind; i++)
+    {
+      // an anonymous lambda is only referred to by its frame
+      gcmarkobj (stack[i].fun);
+      gcmarkobj (stack[i].env);
+    }
+  for (Lisp_Object *p = byte_stack; p < byte_stack_top; p++)
+    gcmarkobj (*p);
+  for (struct valuechunk *c = values; c; c = c->prev)
+    for (Lisp_Object *p = c->slots; p < c->top; p++)
+      gcmarkobj (*p);
+  // values shadowed by dynamic bindings come back on unwind
+  for (size_t i = 0; i < specpdlind; i++)
+    {
+      gcmarkobj (specpdl[i].symbol);
+      gcmarkobj (specpdl[i].old_value);
+    }
 
   // TODO: obarray symbols should be protected from gc in other
   // way. maybe definining a "pure lisp" memory like in Emacs Lisp
@@ -412,9 +659,9 @@ gcsweep ()
   while (blk)
     {
       next = blk->next;
-      if (is_obj_unmarked (blk->obj))
+      if (!blk->gcmark)
         {
-          size_t freesize = sizeof (unbox_pointer (blk->obj));
+          size_t freesize = blk->size;
           free_lisp_obj (blk->obj);
 
           // pop from var size heap
@@ -424,7 +671,7 @@ gcsweep ()
           else
             // pop from start
             varsizeheap = blk->next;
-          blk->next = NULL;
+          free (blk);
 
           varsizeheaplength--;
           varsizeheapsize -= freesize;
@@ -443,19 +690,15 @@ static void
 gcunmark ()
 {
   // unmark fixed block memory
-  blkwalk (all_cons, unmark_cons);
-  blkwalk (all_symbol, unmark_symbol);
-  blkwalk (all_smallstring, unmark_string);
-  blkwalk (all_smallvector, unmark_vector);
-  blkwalk (all_smalllambda, unmark_lambda);
+  blkunmarkall (all_cons);
+  blkunmarkall (all_symbol);
+  blkunmarkall (all_smallstring);
+  blkunmarkall (all_smallvector);
+  blkunmarkall (all_smalllambda);
 
   // unmark variable sized heap
-  struct varsizeblk *blk = varsizeheap;
-  while (blk)
-    {
-      unmark_obj (blk->obj);
-      blk = blk->next;
-    }
+  for (struct varsizeblk *blk = varsizeheap; blk; blk = blk->next)
+    blk->gcmark = 0;
 }
 
 struct memstats
@@ -529,98 +772,65 @@ memdump ()
     }
 }
 
-static void
-unmark_obj (Lisp_Object obj)
+static struct varsizeblk *
+varsizealloc (size_t allocsize, void **ptr)
+{
+  struct varsizeblk **header = malloc (VARSIZE_HEADER + allocsize);
+  struct varsizeblk *blk = malloc (sizeof (struct varsizeblk));
+  *header = blk;
+  *ptr = header + 1;
+
+  blk->size = allocsize;
+  blk->gcmark = 0;
+  blk->next = varsizeheap;
+  varsizeheap = blk;
+  varsizeheaplength++;
+  varsizeheapsize += allocsize;
+  return blk;
+}
+
+static blkallocator *
+allocator_of (Lisp_Object obj)
 {
+  // NULL for objects in the variable sized heap, see make_* functions
   switch (type_of (obj))
     {
-    case LISP_STRG:
-      unmark_string (unbox_string (obj));
-      break;
-    case LISP_SYMB:
-      unmark_symbol (unbox_symbol (obj));
-      break;
     case LISP_CONS:
-      unmark_cons (unbox_cons (obj));
-      break;
+      return all_cons;
+    case LISP_SYMB:
+      return all_symbol;
+    case LISP_STRG:
+      return unbox_string (obj)->size < SMALL_STRG_NCHRS ? all_smallstring
+                                                         : NULL;
     case LISP_VECT:
-      unmark_vector (unbox_vector (obj));
-      break;
+      return unbox_vector (obj)->size < SMALL_VECT_NELTS ? all_smallvector
+                                                         : NULL;
     case LISP_LMBD:
-      unmark_lambda (unbox_lambda (obj));
-      break;
-    case LISP_INTG:
-    case LISP_SUBR:
-      break;
+      return lambda_nslots (unbox_lambda (obj)) <= SMALL_LMBD_NARGS
+                 ? all_smalllambda
+                 : NULL;
+    default:
+      return NULL;
     }
 }
 
-static void
-unmark_cons (void *ptr)
-{
-  if (!ptr)
-    return;
-  Lisp_Cons *l = ptr;
-  l->gcmark = 0;
-}
-
-static void
-unmark_symbol (void *ptr)
-{
-  if (!ptr)
-    return;
-  Lisp_Symbol *l = ptr;
-  l->gcmark = 0;
-}
-
-static void
-unmark_string (void *ptr)
-{
-  if (!ptr)
-    return;
-  Lisp_String *l = ptr;
-  l->gcmark = 0;
-}
-
-static void
-unmark_vector (void *ptr)
+static int
+is_obj_marked (Lisp_Object obj)
 {
-  if (!ptr)
-    return;
-  Lisp_Vector *l = ptr;
-  l->gcmark = 0;
+  blkallocator *blka = allocator_of (obj);
+  if (blka)
+    return blkmarked (blka, unbox_pointer (obj));
+  return ((struct varsizeblk **)unbox_pointer (obj))[-1]->gcmark;
 }
 
 static void
-unmark_lambda (void *ptr)
+mark_obj (Lisp_Object obj)
 {
-  if (!ptr)
-    return;
-  Lisp_Lambda *l = ptr;
-  l->gcmark = 0;
-}
-
-static int
-is_obj_unmarked (Lisp_Object obj)
-{
-  switch (type_of (obj))
-    {
-    case LISP_INTG:
-    case LISP_SUBR:
-      return 0;
-    case LISP_STRG:
-      return is_string_unmarked (unbox_string (obj));
-    case LISP_SYMB:
-      return is_symbol_unmarked (unbox_symbol (obj));
-    case LISP_CONS:
-      return is_cons_unmarked (unbox_cons (obj));
-    case LISP_VECT:
-      return is_vector_unmarked (unbox_vector (obj));
-    case LISP_LMBD:
-      return is_lambda_unmarked (unbox_lambda (obj));
-    default:
-      return -1;
-    }
+  blkallocator *blka = allocator_of (obj);
+  if (blka)
+    blkmark (blka, unbox_pointer (obj));
+  else
+    ((struct varsizeblk **)unbox_pointer (obj))[-1]->gcmark = 1;
 }
 
 static int
@@ -628,8 +838,7 @@ is_cons_unmarked (void *ptr)
 {
   if (!ptr)
     return 1;
-  Lisp_Cons *l = ptr;
-  return l->gcmark == 0;
+  return !blkmarked (all_cons, ptr);
 }
 
 static int
@@ -646,7 +855,7 @@ is_symbol_unmarked (void *ptr)
   if (l == unbox_symbol (q_t))
     return 0;
 
-  return l->gcmark == 0;
+  return !blkmarked (all_symbol, ptr);
 }
 
 static int
@@ -654,8 +863,7 @@ is_string_unmarked (void *ptr)
 {
   if (!ptr)
     return 0;
-  Lisp_String *l = ptr;
-  return l->gcmark == 0;
+  return !blkmarked (all_smallstring, ptr);
 }
 
 static int
@@ -663,8 +871,7 @@ is_vector_unmarked (void *ptr)
 {
   if (!ptr)
     return 0;
-  Lisp_Vector *l = ptr;
-  return l->gcmark == 0;
+  return !blkmarked (all_smallvector, ptr);
 }
 
 static int
@@ -672,6 +879,5 @@ is_lambda_unmarked (void *ptr)
 {
   if (!ptr)
     return 0;
-  Lisp_Lambda *l = ptr;
-  return l->gcmark == 0;
+  return !blkmarked (all_smalllambda, ptr);
 }
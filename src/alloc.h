@@ -5,14 +5,28 @@
 #include "lisp.h"
 #include <stddef.h>
 
+// initial number of frames of the stack and of the specpdl. both grow
+// on demand up to STACKLIMIT bytes each, or to ERLISP_STACK_LIMIT
+// megabytes if set in the environment
 #define STACKSIZE 1024
+#define SPECPDLSIZE 1024
+#define STACKLIMIT (64 << 20)
+// values in a chunk of the value stack, see values_push
+#define VALUECHUNKSIZE 4096
+// kept free below the C stack limit (ulimit -s), CSTACKDEFAULT when
+// unlimited, for the C code running past the last check
+#define CSTACKMARGIN (256 << 10)
+#define CSTACKDEFAULT (64 << 20)
 
 #define DEFSUBR(name, minargs, maxargs, fun)                                  \
-  defsubr (name, minargs, maxargs, NSUBR (maxargs, fun))
+  defsubr (name, minargs, maxargs, NSUBR (maxargs, fun), SUBR_CALL (maxargs))
 
 struct stackframe
 {
-  const char *fname;
+  // the subr or lambda called, or the symbol of the special form
+  // (let, dotimes, ...) entering a frame. named only when a backtrace
+  // is printed, see print_backtrace
+  Lisp_Object fun;
   Lisp_Object env;
 };
 
@@ -28,12 +42,39 @@ struct memstats
   size_t varsizeheapsize;
 };
 
+extern size_t stack_limit;
+
 void stack_push (struct stackframe sf);
 struct stackframe stack_pop ();
 struct stackframe stack_pop_free ();
 struct stackframe stack_current ();
+/* frame I of the stack, the current one being at stack_index () */
+int stack_index ();
+struct stackframe stack_at (int i);
 void stack_current_set_env (Lisp_Object env);
-void stack_parent_set_env (Lisp_Object env);
+
+/*
+  The value stack holds the evaluated arguments of the calls in
+  progress, marked by the gc.  A call takes the values_top, pushes its
+  arguments and passes them on as an array, then unwinds to where it
+  started.  The stack is made of chunks that never move, so an array
+  of arguments stays valid while the calls it is passed to push more.
+  values_push returns where the arguments pushed since BASE now start:
+  they are moved to a new chunk when the current one is full.
+ */
+Lisp_Object *values_top ();
+Lisp_Object *values_push (Lisp_Object *base, Lisp_Object value);
+void values_unwind (Lisp_Object *base);
+
+/*
+  Special variables (see defvar) are shallow bound: their value is
+  always in the symbol value cell.  specbind saves the old value on the
+  specpdl and sets the new one, unbind_to restores the values saved
+  since COUNT, a specpdl_index taken before binding.
+ */
+size_t specpdl_index ();
+void specbind (Lisp_Object symbol, Lisp_Object value);
+void unbind_to (size_t count);
 
 Lisp_Object make_string (const char *s);
 Lisp_Object make_nstring (const char *s, size_t size);
@@ -42,12 +83,17 @@ Lisp_Object make_str_symbol (const char *s);
 Lisp_Object make_nstr_symbol (const char *s, size_t size);
 Lisp_Object make_cons (Lisp_Object car, Lisp_Object cdr);
 Lisp_Object make_vector (size_t size);
+/* a bignum of NLIMBS zero limbs, to be filled and normalized by the
+   caller, see bignum.h */
+Lisp_Object make_bignum (size_t nlimbs);
 Lisp_Object make_subr (const char *name, int minargs, int maxargs,
-                       union lisp_subr_fun fun);
-Lisp_Object make_lambda (int minargs, int maxargs, Lisp_Object *args,
-                         Lisp_Object form);
+                       union lisp_subr_fun fun, lisp_subr_call call);
+/* ARGS holds the names of the args, followed by the one of the &rest
+   arg for REST_LIST */
+Lisp_Object make_lambda (int minargs, int maxargs, enum lambda_rest rest,
+                         Lisp_Object *args, Lisp_Object form);
 Lisp_Object defsubr (const char *name, int minargs, int maxargs,
-                     union lisp_subr_fun fun);
+                     union lisp_subr_fun fun, lisp_subr_call call);
 void free_lisp_obj (Lisp_Object o);
 
 void init_alloc ();
@@ -0,0 +1,645 @@
+#include "bignum.h"
+#include "alloc.h"
+#include "lisp.h"
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef unsigned __int128 dlimb;
+
+// 10^19, the largest power of ten in a limb
+#define CHUNK_BASE 10000000000000000000ULL
+#define CHUNK_DIGITS 19
+// below that many digits, reading multiplies by 10^19 chunk by chunk
+#define READ_BASECASE_DIGITS (CHUNK_DIGITS * KARATSUBA_THRESHOLD)
+
+// an integer operand: its sign and its magnitude, in BUF for a fixnum
+struct operand
+{
+  int sign; // 1 or -1, 1 for 0
+  size_t n; // 0 for 0
+  const uint64_t *limbs;
+  uint64_t buf;
+};
+
+static void operand_of (Lisp_Object x, struct operand *o);
+static Lisp_Object add_operands (const struct operand *a,
+                                 const struct operand *b);
+static int fixnum_of (int sign, const uint64_t *limbs, size_t n,
+                      Lisp_Object *res);
+static Lisp_Object make_integer (int sign, const uint64_t *limbs, size_t n);
+static size_t mag_length (const uint64_t *a, size_t n);
+static int mag_cmp (const uint64_t *a, size_t an, const uint64_t *b,
+                    size_t bn);
+static void mag_add (uint64_t *r, const uint64_t *a, size_t an,
+                     const uint64_t *b, size_t bn);
+static void mag_add_in (uint64_t *a, size_t an, const uint64_t *b,
+                        size_t bn);
+static void mag_sub_in (uint64_t *a, size_t an, const uint64_t *b,
+                        size_t bn);
+static void mag_mul (uint64_t *r, const uint64_t *a, size_t an,
+                     const uint64_t *b, size_t bn);
+static void mag_mul_basecase (uint64_t *r, const uint64_t *a, size_t an,
+                              const uint64_t *b, size_t bn);
+static void mag_mul_karatsuba (uint64_t *r, const uint64_t *a, size_t an,
+                               const uint64_t *b, size_t bn);
+static size_t mag_mul_1_add (uint64_t *r, size_t n, uint64_t m,
+                             uint64_t a);
+static uint64_t mag_divmod_1 (uint64_t *q, const uint64_t *a, size_t n,
+                              uint64_t d);
+static void mag_divmod (uint64_t *q, uint64_t *r, const uint64_t *a,
+                        size_t an, const uint64_t *b, size_t bn);
+static uint64_t *read_digits (const char *s, size_t size, size_t *n);
+static const uint64_t *pow10_chunks (size_t p, size_t *n);
+
+Lisp_Object
+bignum_from_int (int64_t i)
+{
+  if (i >= MOST_NEGATIVE_FIXNUM && i <= MOST_POSITIVE_FIXNUM)
+    return box_int (i);
+  uint64_t mag = i < 0 ? -(uint64_t)i : (uint64_t)i;
+  return make_integer (i < 0 ? -1 : 1, &mag, 1);
+}
+
+Lisp_Object
+bignum_normalize (Lisp_Object big)
+{
+  Lisp_Bignum *b = unbox_bignum (big);
+  Lisp_Object res;
+  b->nlimbs = mag_length (b->limbs, b->nlimbs);
+  if (fixnum_of (b->sign, b->limbs, b->nlimbs, &res))
+    return res;
+  return big;
+}
+
+Lisp_Object
+bignum_add (Lisp_Object x, Lisp_Object y)
+{
+  struct operand a, b;
+  operand_of (x, &a);
+  operand_of (y, &b);
+  return add_operands (&a, &b);
+}
+
+Lisp_Object
+bignum_sub (Lisp_Object x, Lisp_Object y)
+{
+  struct operand a, b;
+  operand_of (x, &a);
+  operand_of (y, &b);
+  b.sign = -b.sign;
+  return add_operands (&a, &b);
+}
+
+Lisp_Object
+bignum_mul (Lisp_Object x, Lisp_Object y)
+{
+  struct operand a, b;
+  operand_of (x, &a);
+  operand_of (y, &b);
+  if (a.n == 0 || b.n == 0)
+    return box_int (0);
+
+  uint64_t *r = malloc ((a.n + b.n) * sizeof (uint64_t));
+  mag_mul (r, a.limbs, a.n, b.limbs, b.n);
+  Lisp_Object res = make_integer (a.sign * b.sign, r, a.n + b.n);
+  free (r);
+  return res;
+}
+
+Lisp_Object
+bignum_div (Lisp_Object x, Lisp_Object y)
+{
+  struct operand a, b;
+  operand_of (x, &a);
+  operand_of (y, &b);
+  if (mag_cmp (a.limbs, a.n, b.limbs, b.n) < 0)
+    return box_int (0);
+
+  size_t qn = a.n - b.n + 1;
+  uint64_t *q = malloc (qn * sizeof (uint64_t));
+  uint64_t *r = malloc (b.n * sizeof (uint64_t));
+  mag_divmod (q, r, a.limbs, a.n, b.limbs, b.n);
+  Lisp_Object res = make_integer (a.sign * b.sign, q, qn);
+  free (q);
+  free (r);
+  return res;
+}
+
+int
+bignum_cmp (Lisp_Object x, Lisp_Object y)
+{
+  if (fixnums (x, y))
+    return (int64_t)x < (int64_t)y ? -1 : (int64_t)x > (int64_t)y;
+
+  struct operand a, b;
+  operand_of (x, &a);
+  operand_of (y, &b);
+  int sa = a.n ? a.sign : 0;
+  int sb = b.n ? b.sign : 0;
+  if (sa != sb)
+    return sa < sb ? -1 : 1;
+  int c = mag_cmp (a.limbs, a.n, b.limbs, b.n);
+  return sa < 0 ? -c : c;
+}
+
+Lisp_Object
+bignum_from_string (const char *s, size_t size)
+{
+  int sign = 1;
+  if (size > 0 && s[0] == '-')
+    {
+      sign = -1;
+      s++;
+      size--;
+    }
+  if (size == 0)
+    return q_nil;
+  for (size_t i = 0; i < size; i++)
+    if (s[i] < '0' || s[i] > '9')
+      return q_nil;
+
+  size_t n;
+  uint64_t *limbs = read_digits (s, size, &n);
+  Lisp_Object res = make_integer (sign, limbs, n);
+  free (limbs);
+  return res;
+}
+
+char *
+bignum_to_string (Lisp_Object x)
+{
+  struct operand a;
+  operand_of (x, &a);
+
+  // the chunks of 19 digits, least significant first.  a limb holds
+  // a bit more than 19 digits
+  size_t n = a.n;
+  uint64_t *t = malloc ((n + 1) * sizeof (uint64_t));
+  memcpy (t, a.limbs, n * sizeof (uint64_t));
+  uint64_t *chunks = malloc ((2 * n + 1) * sizeof (uint64_t));
+  size_t nchunks = 0;
+  while (n > 0)
+    {
+      chunks[nchunks++] = mag_divmod_1 (t, t, n, CHUNK_BASE);
+      n = mag_length (t, n);
+    }
+
+  char *res = malloc (nchunks * CHUNK_DIGITS + 3);
+  char *p = res;
+  if (a.sign < 0 && nchunks > 0)
+    *p++ = '-';
+  if (nchunks == 0)
+    strcpy (p, "0");
+  else
+    {
+      p += sprintf (p, "%" PRIu64, chunks[nchunks - 1]);
+      for (size_t i = nchunks - 1; i-- > 0;)
+        p += sprintf (p, "%019" PRIu64, chunks[i]);
+    }
+
+  free (t);
+  free (chunks);
+  return res;
+}
+
+// helpers
+
+static void
+operand_of (Lisp_Object x, struct operand *o)
+{
+  if (type_of (x) == LISP_INTG)
+    {
+      Lisp_Integer i = unbox_int (x);
+      o->sign = i < 0 ? -1 : 1;
+      o->buf = i < 0 ? -(uint64_t)i : (uint64_t)i;
+      o->n = o->buf != 0;
+      o->limbs = &o->buf;
+      return;
+    }
+  Lisp_Bignum *b = unbox_bignum (x);
+  o->sign = b->sign;
+  o->n = b->nlimbs;
+  o->limbs = b->limbs;
+}
+
+static Lisp_Object
+add_operands (const struct operand *a, const struct operand *b)
+{
+  Lisp_Object res;
+  if (a->sign == b->sign)
+    {
+      size_t n = (a->n > b->n ? a->n : b->n) + 1;
+      uint64_t *r = malloc (n * sizeof (uint64_t));
+      mag_add (r, a->limbs, a->n, b->limbs, b->n);
+      res = make_integer (a->sign, r, n);
+      free (r);
+      return res;
+    }
+
+  // the difference of the magnitudes, with the sign of the larger
+  if (mag_cmp (a->limbs, a->n, b->limbs, b->n) < 0)
+    {
+      const struct operand *t = a;
+      a = b;
+      b = t;
+    }
+  uint64_t *r = malloc ((a->n + 1) * sizeof (uint64_t));
+  memcpy (r, a->limbs, a->n * sizeof (uint64_t));
+  mag_sub_in (r, a->n, b->limbs, b->n);
+  res = make_integer (a->sign, r, a->n);
+  free (r);
+  return res;
+}
+
+static int
+fixnum_of (int sign, const uint64_t *limbs, size_t n, Lisp_Object *res)
+{
+  // the magnitude is normalized
+  if (n == 0)
+    {
+      *res = box_int (0);
+      return 1;
+    }
+  if (n > 1)
+    return 0;
+  if (sign > 0 && limbs[0] <= (uint64_t)MOST_POSITIVE_FIXNUM)
+    {
+      *res = box_int (limbs[0]);
+      return 1;
+    }
+  if (sign < 0 && limbs[0] <= (uint64_t)MOST_POSITIVE_FIXNUM + 1)
+    {
+      *res = box_int (-(int64_t)limbs[0]);
+      return 1;
+    }
+  return 0;
+}
+
+static Lisp_Object
+make_integer (int sign, const uint64_t *limbs, size_t n)
+{
+  Lisp_Object res;
+  n = mag_length (limbs, n);
+  if (fixnum_of (sign, limbs, n, &res))
+    return res;
+
+  res = make_bignum (n);
+  unbox_bignum (res)->sign = sign;
+  memcpy (unbox_bignum (res)->limbs, limbs, n * sizeof (uint64_t));
+  return res;
+}
+
+static size_t
+mag_length (const uint64_t *a, size_t n)
+{
+  while (n > 0 && a[n - 1] == 0)
+    n--;
+  return n;
+}
+
+static int
+mag_cmp (const uint64_t *a, size_t an, const uint64_t *b, size_t bn)
+{
+  // normalized magnitudes
+  if (an != bn)
+    return an < bn ? -1 : 1;
+  for (size_t i = an; i-- > 0;)
+    if (a[i] != b[i])
+      return a[i] < b[i] ? -1 : 1;
+  return 0;
+}
+
+static void
+mag_add (uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b,
+         size_t bn)
+{
+  // R = A + B, R of max (AN, BN) + 1 limbs
+  if (an < bn)
+    {
+      const uint64_t *t = a;
+      a = b;
+      b = t;
+      size_t tn = an;
+      an = bn;
+      bn = tn;
+    }
+  uint64_t carry = 0;
+  for (size_t i = 0; i < an; i++)
+    {
+      dlimb s = (dlimb)a[i] + (i < bn ? b[i] : 0) + carry;
+      r[i] = (uint64_t)s;
+      carry = s >> 64;
+    }
+  r[an] = carry;
+}
+
+static void
+mag_add_in (uint64_t *a, size_t an, const uint64_t *b, size_t bn)
+{
+  // A += B, BN <= AN, the carry out of A's AN limbs dropped
+  uint64_t carry = 0;
+  size_t i;
+  for (i = 0; i < bn; i++)
+    {
+      dlimb s = (dlimb)a[i] + b[i] + carry;
+      a[i] = (uint64_t)s;
+      carry = s >> 64;
+    }
+  for (; carry && i < an; i++)
+    carry = ++a[i] == 0;
+}
+
+static void
+mag_sub_in (uint64_t *a, size_t an, const uint64_t *b, size_t bn)
+{
+  // A -= B, A >= B
+  uint64_t borrow = 0;
+  size_t i;
+  for (i = 0; i < bn; i++)
+    {
+      uint64_t d = a[i] - b[i] - borrow;
+      borrow = a[i] < b[i] || (a[i] == b[i] && borrow);
+      a[i] = d;
+    }
+  for (; borrow && i < an; i++)
+    borrow = a[i]-- == 0;
+}
+
+static void
+mag_mul (uint64_t *r, const uint64_t *a, size_t an, const uint64_t *b,
+         size_t bn)
+{
+  // R = A * B, R of AN + BN limbs
+  if (an < bn)
+    {
+      const uint64_t *t = a;
+      a = b;
+      b = t;
+      size_t tn = an;
+      an = bn;
+      bn = tn;
+    }
+  if (bn < KARATSUBA_THRESHOLD)
+    {
+      mag_mul_basecase (r, a, an, b, bn);
+      return;
+    }
+  if (an < 2 * bn)
+    {
+      mag_mul_karatsuba (r, a, an, b, bn);
+      return;
+    }
+
+  // unbalanced: A in pieces of BN limbs, each one a balanced product
+  memset (r, 0, (an + bn) * sizeof (uint64_t));
+  uint64_t *t = malloc (2 * bn * sizeof (uint64_t));
+  for (size_t i = 0; i < an; i += bn)
+    {
+      size_t n = an - i < bn ? an - i : bn;
+      mag_mul (t, a + i, n, b, bn);
+      mag_add_in (r + i, an + bn - i, t, n + bn);
+    }
+  free (t);
+}
+
+static void
+mag_mul_basecase (uint64_t *r, const uint64_t *a, size_t an,
+                  const uint64_t *b, size_t bn)
+{
+  memset (r, 0, (an + bn) * sizeof (uint64_t));
+  for (size_t j = 0; j < bn; j++)
+    {
+      uint64_t carry = 0;
+      for (size_t i = 0; i < an; i++)
+        {
+          dlimb p = (dlimb)a[i] * b[j] + r[i + j] + carry;
+          r[i + j] = (uint64_t)p;
+          carry = p >> 64;
+        }
+      r[j + an] = carry;
+    }
+}
+
+static void
+mag_mul_karatsuba (uint64_t *r, const uint64_t *a, size_t an,
+                   const uint64_t *b, size_t bn)
+{
+  // with A = A1 B^m + A0 and B = B1 B^m + B0, AN / 2 < BN <= AN:
+  //   A * B = Z2 B^2m + Z1 B^m + Z0
+  //   Z0 = A0 B0, Z2 = A1 B1, Z1 = (A0 + A1) (B0 + B1) - Z0 - Z2
+  // three half size products instead of four
+  size_t m = (an + 1) / 2;
+  size_t a1n = an - m;
+  size_t b1n = bn - m;
+
+  memset (r, 0, (an + bn) * sizeof (uint64_t));
+  mag_mul (r, a, m, b, m);
+  if (b1n > 0)
+    mag_mul (r + 2 * m, a + m, a1n, b + m, b1n);
+
+  uint64_t *sa = malloc ((m + 1) * sizeof (uint64_t));
+  uint64_t *sb = malloc ((m + 1) * sizeof (uint64_t));
+  uint64_t *z1 = malloc (2 * (m + 1) * sizeof (uint64_t));
+  mag_add (sa, a, m, a + m, a1n);
+  mag_add (sb, b, m, b + m, b1n);
+  mag_mul (z1, sa, m + 1, sb, m + 1);
+
+  size_t z1n = 2 * (m + 1);
+  mag_sub_in (z1, z1n, r, 2 * m);
+  mag_sub_in (z1, z1n, r + 2 * m, a1n + b1n);
+  mag_add_in (r + m, an + bn - m, z1, mag_length (z1, z1n));
+
+  free (sa);
+  free (sb);
+  free (z1);
+}
+
+static size_t
+mag_mul_1_add (uint64_t *r, size_t n, uint64_t m, uint64_t a)
+{
+  // R = R * M + A in place, R having room for one more limb.  returns
+  // its new length
+  uint64_t carry = a;
+  for (size_t i = 0; i < n; i++)
+    {
+      dlimb p = (dlimb)r[i] * m + carry;
+      r[i] = (uint64_t)p;
+      carry = p >> 64;
+    }
+  if (carry)
+    r[n++] = carry;
+  return n;
+}
+
+static uint64_t
+mag_divmod_1 (uint64_t *q, const uint64_t *a, size_t n, uint64_t d)
+{
+  // Q = A / D, returns A % D.  Q may be A
+  uint64_t rem = 0;
+  for (size_t i = n; i-- > 0;)
+    {
+      dlimb cur = (dlimb)rem << 64 | a[i];
+      q[i] = (uint64_t)(cur / d);
+      rem = (uint64_t)(cur % d);
+    }
+  return rem;
+}
+
+static void
+mag_divmod (uint64_t *q, uint64_t *r, const uint64_t *a, size_t an,
+            const uint64_t *b, size_t bn)
+{
+  // Q = A / B of AN - BN + 1 limbs and R = A % B of BN limbs, for
+  // normalized A >= B.  knuth's algorithm D (TAOCP 4.3.1)
+  if (bn == 1)
+    {
+      r[0] = mag_divmod_1 (q, a, an, b[0]);
+      return;
+    }
+
+  // shift so that the top limb of the divisor has its high bit set,
+  // which makes the estimated quotient digit at most 2 too large
+  int s = __builtin_clzll (b[bn - 1]);
+  uint64_t *u = malloc ((an + 1) * sizeof (uint64_t));
+  uint64_t *v = malloc (bn * sizeof (uint64_t));
+  for (size_t i = bn - 1; i > 0; i--)
+    v[i] = b[i] << s | (s ? b[i - 1] >> (64 - s) : 0);
+  v[0] = b[0] << s;
+  u[an] = s ? a[an - 1] >> (64 - s) : 0;
+  for (size_t i = an - 1; i > 0; i--)
+    u[i] = a[i] << s | (s ? a[i - 1] >> (64 - s) : 0);
+  u[0] = a[0] << s;
+
+  for (size_t j = an - bn + 1; j-- > 0;)
+    {
+      dlimb num = (dlimb)u[j + bn] << 64 | u[j + bn - 1];
+      dlimb qhat = num / v[bn - 1];
+      dlimb rhat = num % v[bn - 1];
+      while (qhat >> 64
+             || qhat * v[bn - 2] > (rhat << 64 | u[j + bn - 2]))
+        {
+          qhat--;
+          rhat += v[bn - 1];
+          if (rhat >> 64)
+            break;
+        }
+
+      // U[j..j+bn] -= qhat * V
+      uint64_t borrow = 0;
+      uint64_t carry = 0;
+      for (size_t i = 0; i < bn; i++)
+        {
+          dlimb p = qhat * v[i] + carry;
+          uint64_t lo = (uint64_t)p;
+          carry = p >> 64;
+          uint64_t d = u[i + j] - lo - borrow;
+          borrow = u[i + j] < lo || (u[i + j] == lo && borrow);
+          u[i + j] = d;
+        }
+      uint64_t top = u[j + bn];
+      u[j + bn] = top - carry - borrow;
+      if (top < carry || (top == carry && borrow))
+        {
+          // qhat was one too large: add V back
+          qhat--;
+          carry = 0;
+          for (size_t i = 0; i < bn; i++)
+            {
+              dlimb sum = (dlimb)u[i + j] + v[i] + carry;
+              u[i + j] = (uint64_t)sum;
+              carry = sum >> 64;
+            }
+          u[j + bn] += carry;
+        }
+      q[j] = (uint64_t)qhat;
+    }
+
+  for (size_t i = 0; i < bn; i++)
+    r[i] = u[i] >> s | (s ? u[i + 1] << (64 - s) : 0);
+  free (u);
+  free (v);
+}
+
+static uint64_t *
+read_digits (const char *s, size_t size, size_t *n)
+{
+  // the magnitude of the SIZE decimal digits of S, malloc'd, of *N
+  // limbs
+  if (size <= READ_BASECASE_DIGITS)
+    {
+      // a chunk of 19 digits at a time, the first one shorter
+      uint64_t *r = malloc ((size / CHUNK_DIGITS + 1) * sizeof (uint64_t));
+      size_t rn = 0;
+      size_t len = size % CHUNK_DIGITS ? size % CHUNK_DIGITS : CHUNK_DIGITS;
+      for (size_t pos = 0; pos < size; pos += len, len = CHUNK_DIGITS)
+        {
+          uint64_t chunk = 0;
+          for (size_t i = 0; i < len; i++)
+            chunk = chunk * 10 + (s[pos + i] - '0');
+          rn = mag_mul_1_add (r, rn, CHUNK_BASE, chunk);
+        }
+      *n = mag_length (r, rn);
+      return r;
+    }
+
+  // the high digits times 10^k plus the k low ones, with k the
+  // largest 19 * 2^p below SIZE, so that the powers of ten are shared
+  // by every split
+  size_t p = 0;
+  while ((size_t)CHUNK_DIGITS << (p + 1) < size)
+    p++;
+  size_t k = (size_t)CHUNK_DIGITS << p;
+
+  size_t hn, ln, pn;
+  uint64_t *hi = read_digits (s, size - k, &hn);
+  uint64_t *lo = read_digits (s + size - k, k, &ln);
+  const uint64_t *pow = pow10_chunks (p, &pn);
+
+  // LO < 10^k: it fits the PN limbs of the product
+  size_t rn = hn + pn;
+  uint64_t *r = malloc ((rn + 1) * sizeof (uint64_t));
+  if (hn > 0)
+    mag_mul (r, hi, hn, pow, pn);
+  else
+    memset (r, 0, rn * sizeof (uint64_t));
+  mag_add_in (r, rn, lo, ln);
+
+  free (hi);
+  free (lo);
+  *n = mag_length (r, rn);
+  return r;
+}
+
+static const uint64_t *
+pow10_chunks (size_t p, size_t *n)
+{
+  // 10^(19 * 2^p), computed once by squaring
+  static struct
+  {
+    uint64_t *limbs;
+    size_t n;
+  } cache[64];
+
+  if (!cache[p].limbs)
+    {
+      if (p == 0)
+        {
+          cache[0].limbs = malloc (sizeof (uint64_t));
+          cache[0].limbs[0] = CHUNK_BASE;
+          cache[0].n = 1;
+        }
+      else
+        {
+          size_t hn;
+          const uint64_t *half = pow10_chunks (p - 1, &hn);
+          uint64_t *limbs = malloc (2 * hn * sizeof (uint64_t));
+          mag_mul (limbs, half, hn, half, hn);
+          cache[p].n = mag_length (limbs, 2 * hn);
+          cache[p].limbs = limbs;
+        }
+    }
+  *n = cache[p].n;
+  return cache[p].limbs;
+}
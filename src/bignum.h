@@ -0,0 +1,61 @@
+#ifndef BIGNUM_H
+#define BIGNUM_H
+
+/*
+  Arbitrary precision integers.
+
+  An integer is a fixnum when it fits one, between MOST_NEGATIVE_FIXNUM
+  and MOST_POSITIVE_FIXNUM, and a bignum otherwise: a pseudovector
+  (see lisp.h) holding its sign and its magnitude in 64 bit limbs,
+  least significant first.  Every operation here returns its result
+  normalized that way, so that an integer has a single representation
+  and eq? still compares fixnums.
+
+  The arithmetic builtins try the fixnum fast paths of lisp.h first
+  and come here when an operand is a bignum or the result overflows:
+
+    (* 4611686018427387904 4)   ->  18446744073709551616
+
+  Multiplication is schoolbook below KARATSUBA_THRESHOLD limbs and
+  Karatsuba above, the longer operand of an unbalanced product cut in
+  pieces of the shorter one.  Reading splits the digits in two around
+  a power of ten 10^(19 * 2^p), so that it costs a few multiplications
+  of that size by powers computed once.  Printing divides by 10^19,
+  the largest power of ten in a limb, one limb at a time.
+ */
+
+#include "lisp.h"
+
+#define KARATSUBA_THRESHOLD 32
+
+/* whether X is an integer, a fixnum or a bignum */
+static inline int
+integer_p (Lisp_Object x)
+{
+  return type_of (x) == LISP_INTG || bignum_p (x);
+}
+
+/* the integer I */
+Lisp_Object bignum_from_int (int64_t i);
+/* BIG with its leading zero limbs dropped, or the fixnum it is equal
+   to.  for bignums filled limb by limb */
+Lisp_Object bignum_normalize (Lisp_Object big);
+
+/* X + Y, X - Y, X * Y and X / Y, truncated toward zero, for integers
+   X and Y.  Y is not 0 */
+Lisp_Object bignum_add (Lisp_Object x, Lisp_Object y);
+Lisp_Object bignum_sub (Lisp_Object x, Lisp_Object y);
+Lisp_Object bignum_mul (Lisp_Object x, Lisp_Object y);
+Lisp_Object bignum_div (Lisp_Object x, Lisp_Object y);
+/* -1, 0 or 1 as the integer X is lower than, equal to or greater
+   than the integer Y */
+int bignum_cmp (Lisp_Object x, Lisp_Object y);
+
+/* the integer written in decimal in the SIZE chars of S, digits
+   with an optional leading -.  q_nil if S is anything else */
+Lisp_Object bignum_from_string (const char *s, size_t size);
+/* the decimal representation of the integer X, malloc'd and null
+   terminated */
+char *bignum_to_string (Lisp_Object x);
+
+#endif /* BIGNUM_H */
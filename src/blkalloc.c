@@ -3,6 +3,13 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define META_CHUNK_SIZE 65536
+
+static unsigned char **markslot (blkallocator *blka, uintptr_t page,
+                                 int create);
 
 static struct blk *
 blkpop (struct blk **blklistptr)
@@ -40,6 +47,9 @@ blkalloc_init (size_t blksize, int (*blk_free_pred) (void *ptr))
     .numused = 0,
     .blk_free_pred = blk_free_pred,
     .gcgenerations = 0,
+    .markpages = NULL,
+    .markbits = NULL,
+    .markalloc = 0,
   };
   return blka;
 }
@@ -60,9 +70,18 @@ blkalloc (blkallocator *blka)
       return firstfree->ptr;
     }
 
-  // we have to create another page with all elments in freelist
-  struct blk *page = malloc (PAGE_SIZE);
+  // we have to create another page with all elments in freelist. the
+  // page is aligned to its size, see blkmark
+  struct blk *page;
+  if (posix_memalign ((void **)&page, PAGE_SIZE, PAGE_SIZE))
+    {
+      // FIXME don't know what to do here...
+      fprintf (stderr, "Out of memory!!\n");
+      exit (99);
+    }
   memset (page, 0, PAGE_SIZE);
+  *markslot (blka, (uintptr_t)page, 1)
+      = blkmetaalloc ((blka->blkperpage + 7) / 8);
   ptrdiff_t pageoffset = offsetof (struct blk, ptr);
   page->ptr = (void *)((uintptr_t)page + pageoffset);
   page->next = blka->pages;
@@ -180,6 +199,111 @@ dumpused:
   }
 }
 
+void
+blkmark (blkallocator *blka, void *ptr)
+{
+  uintptr_t page = (uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1);
+  unsigned char **bits = markslot (blka, page, 0);
+  if (!bits)
+    return;
+  size_t ind = ((uintptr_t)ptr - page - offsetof (struct blk, ptr))
+               / blka->blksize;
+  (*bits)[ind / 8] |= 1 << (ind % 8);
+}
+
+int
+blkmarked (blkallocator *blka, void *ptr)
+{
+  uintptr_t page = (uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1);
+  unsigned char **bits = markslot (blka, page, 0);
+  if (!bits)
+    return 0;
+  size_t ind = ((uintptr_t)ptr - page - offsetof (struct blk, ptr))
+               / blka->blksize;
+  return ((*bits)[ind / 8] >> (ind % 8)) & 1;
+}
+
+void
+blkunmarkall (blkallocator *blka)
+{
+  size_t size = (blka->blkperpage + 7) / 8;
+  for (size_t i = 0; i < blka->markalloc; i++)
+    if (blka->markpages[i])
+      memset (blka->markbits[i], 0, size);
+}
+
+void *
+blkmetaalloc (size_t size)
+{
+  // bump allocator on anonymous mappings, never freed. keeping gc
+  // metadata here keeps it away from the pages holding objects
+  static unsigned char *chunk;
+  static size_t used = META_CHUNK_SIZE;
+
+  size = (size + 7) & ~(size_t)7;
+  if (size > META_CHUNK_SIZE / 4)
+    {
+      void *big = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANON, -1, 0);
+      return big == MAP_FAILED ? NULL : big;
+    }
+
+  if (used + size > META_CHUNK_SIZE)
+    {
+      chunk = mmap (NULL, META_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANON, -1, 0);
+      if (chunk == MAP_FAILED)
+        {
+          fprintf (stderr, "Out of memory!!\n");
+          exit (99);
+        }
+      used = 0;
+    }
+
+  void *ptr = chunk + used;
+  used += size;
+  return ptr;
+}
+
+static unsigned char **
+markslot (blkallocator *blka, uintptr_t page, int create)
+{
+  if (create && (blka->numpages + 1) * 2 > blka->markalloc)
+    {
+      // grow the page table (power of two) and rehash
+      uintptr_t *oldpages = blka->markpages;
+      unsigned char **oldbits = blka->markbits;
+      size_t oldalloc = blka->markalloc;
+
+      blka->markalloc = oldalloc ? oldalloc * 2 : 64;
+      blka->markpages = calloc (blka->markalloc, sizeof (uintptr_t));
+      blka->markbits = calloc (blka->markalloc, sizeof (unsigned char *));
+      for (size_t i = 0; i < oldalloc; i++)
+        if (oldpages[i])
+          *markslot (blka, oldpages[i], 1) = oldbits[i];
+      free (oldpages);
+      free (oldbits);
+    }
+
+  if (!blka->markalloc)
+    return NULL;
+
+  size_t mask = blka->markalloc - 1;
+  size_t i = ((page / PAGE_SIZE) * 0x9E3779B97F4A7C15ULL) >> 20;
+  for (i &= mask;; i = (i + 1) & mask)
+    {
+      if (blka->markpages[i] == page)
+        return &blka->markbits[i];
+      if (!blka->markpages[i])
+        {
+          if (!create)
+            return NULL;
+          blka->markpages[i] = page;
+          return &blka->markbits[i];
+        }
+    }
+}
+
 blkmemstats
 blkstats (blkallocator *blka)
 {
@@ -3,9 +3,19 @@
 
 #include "lisp.h"
 #include <stddef.h>
+#include <stdint.h>
 
 #define PAGE_SIZE 2048
 
+/*
+  GC marks are kept out of the pages: every page has a mark bitmap (one
+  bit per block) allocated in a separate metadata arena, see
+  blkmetaalloc.  Marking and unmarking never write to the blocks, so a
+  gc in a forked child does not break the copy-on-write sharing of the
+  heap pages with the parent.  Pages are PAGE_SIZE aligned, so the
+  page of a block is found by masking its address.
+ */
+
 typedef struct blkallocator blkallocator;
 typedef struct blkgcstats blkgcstats;
 typedef struct blkmemstats blkmemstats;
@@ -28,6 +38,9 @@ struct blkallocator
   size_t numused;                   // number of used elements
   int (*blk_free_pred) (void *ptr); // tells when a blk can be freed
   unsigned int gcgenerations;       // count of gc runs
+  uintptr_t *markpages;             // page addresses, open addressing
+  unsigned char **markbits;         // mark bitmap of each page
+  size_t markalloc;                 // size of the two arrays above
 };
 
 struct blkgcstats
@@ -55,5 +68,9 @@ void blkwalk (blkallocator *blka, void (*blk_action) (void *ptr));
 blkgcstats blkgc (blkallocator *blka);
 blkmemstats blkstats (blkallocator *blka);
 void blkmemdump (blkallocator *blka);
+void blkmark (blkallocator *blka, void *ptr);
+int blkmarked (blkallocator *blka, void *ptr);
+void blkunmarkall (blkallocator *blka);
+void *blkmetaalloc (size_t size);
 
 #endif /* BLKALLOC_H */
@@ -1,18 +1,48 @@
 #include "alloc.h"
+#include "bignum.h"
+#include "bytecode.h"
 #include "env.h"
 #include "eval.h"
 #include "lisp.h"
+#include "load.h"
+#include "macro.h"
+#include "node.h"
 #include "obarray.h"
+#include "resolve.h"
+#include "table.h"
+#include "term.h"
 
 Lisp_Object q_nil;
 Lisp_Object q_t;
 Lisp_Object q_unbound;
+Lisp_Object q_quote;
+Lisp_Object q_lambda;
+Lisp_Object q_let;
+Lisp_Object q_let_star;
+Lisp_Object q_define;
+Lisp_Object q_defvar;
+Lisp_Object q_dotimes;
+Lisp_Object q_dolist;
+Lisp_Object q_optional;
+Lisp_Object q_rest;
+Lisp_Object q_progn;
+Lisp_Object q_cons;
+Lisp_Object q_append;
+Lisp_Object q_macro;
+Lisp_Object q_defmacro;
+Lisp_Object q_quasiquote;
+Lisp_Object q_unquote;
+Lisp_Object q_unquote_splicing;
 Lisp_Object v_obarray;
 Lisp_Object l_globalenv;
 
-Lisp_Object *currentenv;
-
 static void obarray_register_builtins (Lisp_Object obarray);
+static void defspecial (const char *name, enum special_form form);
+static void defpure (const char *name, unsigned types);
+static Table *check_table (Lisp_Object table);
+static Lisp_Object check_number (Lisp_Object number);
+static Lisp_Integer check_range (Lisp_Object number, Lisp_Integer min,
+                                 Lisp_Integer max);
 static Lisp_Object assoc_w_pred (Lisp_Object key, Lisp_Object alist,
                                  Lisp_Object (*keypred) (Lisp_Object k1,
                                                          Lisp_Object k2));
@@ -60,7 +90,7 @@ f_symbol_value (Lisp_Object symbol)
   if (type_of (symbol) != LISP_SYMB)
     // TODO
     exit (3);
-  return eval_symbol (env_current (), symbol);
+  return eval_symbol (symbol);
 }
 
 Lisp_Object
@@ -69,6 +99,14 @@ f_eval (Lisp_Object form)
   return eval (env_current (), form);
 }
 
+Lisp_Object
+f_eval_data (Lisp_Object form)
+{
+  // the eval builtin.  FORM is data the caller still holds, the code
+  // the resolver rewrites is a copy of it
+  return eval (env_current (), copy_code (form));
+}
+
 Lisp_Object
 f_car (Lisp_Object cons)
 {
@@ -142,11 +180,15 @@ f_equal_p (Lisp_Object x, Lisp_Object y)
     case LISP_CONS:
       return f_equal_p (f_car (x), f_car (y));
     case LISP_VECT:
+      if (bignum_p (x) && bignum_p (y))
+        return BOOL (bignum_cmp (x, y) == 0);
       break;
     case LISP_SUBR:
       break;
     case LISP_LMBD:
       break;
+    case LISP_LREF:
+      break;
     }
   // TODO
   return q_nil;
@@ -197,68 +239,106 @@ f_length (Lisp_Object list)
   exit (12);
 }
 
+Lisp_Object
+f_append (int argc, Lisp_Object *argv)
+{
+  // the last list is shared, the others copied
+  if (argc == 0)
+    return q_nil;
+
+  Lisp_Object head = q_nil;
+  Lisp_Object tail = q_nil;
+  for (int i = 0; i < argc - 1; i++)
+    for (Lisp_Object l = argv[i]; type_of (l) == LISP_CONS; l = f_cdr (l))
+      {
+        Lisp_Object cell = f_cons (f_car (l), q_nil);
+        if (nil (head))
+          head = cell;
+        else
+          f_setcdr (tail, cell);
+        tail = cell;
+      }
+
+  if (nil (head))
+    return argv[argc - 1];
+  f_setcdr (tail, argv[argc - 1]);
+  return head;
+}
+
 Lisp_Object
 f_sum (int argc, Lisp_Object *argv)
 {
-  // TODO type safety
-  Lisp_Integer accu = 0;
+  Lisp_Object accu = box_int (0);
   for (int i = 0; i < argc; i++)
-    accu += unbox_int (argv[i]);
-  return box_int (accu);
+    if (!fixnum_add (accu, check_number (argv[i]), &accu))
+      accu = bignum_add (accu, argv[i]);
+  return accu;
 }
 
 Lisp_Object
 f_subtract (int argc, Lisp_Object *argv)
 {
-  // TODO type safety
-  Lisp_Integer accu = argv[0];
+  Lisp_Object accu = check_number (argv[0]);
   for (int i = 1; i < argc; i++)
-    accu -= unbox_int (argv[i]);
-  return box_int (accu);
+    if (!fixnum_sub (accu, check_number (argv[i]), &accu))
+      accu = bignum_sub (accu, argv[i]);
+  return accu;
 }
 
 Lisp_Object
 f_multiply (int argc, Lisp_Object *argv)
 {
-  // TODO type safety
-  Lisp_Integer accu = 1;
+  Lisp_Object accu = box_int (1);
   for (int i = 0; i < argc; i++)
-    accu *= unbox_int (argv[i]);
-  return box_int (accu);
+    if (!fixnum_mul (accu, check_number (argv[i]), &accu))
+      accu = bignum_mul (accu, argv[i]);
+  return accu;
 }
 
 Lisp_Object
 f_divide (int argc, Lisp_Object *argv)
 {
-  // TODO type safety
-  Lisp_Integer accu = argv[0];
+  Lisp_Object accu = check_number (argv[0]);
   for (int i = 1; i < argc; i++)
-    accu /= unbox_int (argv[i]);
-  return box_int (accu);
+    {
+      Lisp_Object divisor = check_number (argv[i]);
+      if (eq (divisor, box_int (0)))
+        {
+          // TODO err
+          fprintf (stderr, "arith error: division by zero\n");
+          exit (12);
+        }
+      // the most negative fixnum divided by -1 is a bignum
+      if (fixnums (accu, divisor))
+        accu = bignum_from_int (unbox_int (accu) / unbox_int (divisor));
+      else
+        accu = bignum_div (accu, divisor);
+    }
+  return accu;
 }
 
 Lisp_Object
 f_ge (Lisp_Object x, Lisp_Object y)
 {
-  return BOOL (unbox_int (x) > unbox_int (y));
+  return BOOL (bignum_cmp (check_number (x), check_number (y)) > 0);
 }
 
 Lisp_Object
 f_geq (Lisp_Object x, Lisp_Object y)
 {
-  return BOOL (unbox_int (x) >= unbox_int (y));
+  return BOOL (bignum_cmp (check_number (x), check_number (y)) >= 0);
 }
 
 Lisp_Object
 f_le (Lisp_Object x, Lisp_Object y)
 {
-  return BOOL (unbox_int (x) < unbox_int (y));
+  return BOOL (bignum_cmp (check_number (x), check_number (y)) < 0);
 }
 
 Lisp_Object
 f_leq (Lisp_Object x, Lisp_Object y)
 {
-  return BOOL (unbox_int (x) <= unbox_int (y));
+  return BOOL (bignum_cmp (check_number (x), check_number (y)) <= 0);
 }
 
 Lisp_Object
@@ -285,6 +365,27 @@ f_define (Lisp_Object form)
   return define (env_current (), form);
 }
 
+Lisp_Object
+f_defvar (Lisp_Object form)
+{
+  return defvar (env_current (), form);
+}
+
+Lisp_Object
+f_defmacro (Lisp_Object form)
+{
+  return defmacro (form);
+}
+
+Lisp_Object
+f_macroexpand (Lisp_Object form)
+{
+  // unlike eval, leaves FORM as it is
+  while (macro_call_p (form))
+    form = macroexpand_1 (form);
+  return form;
+}
+
 Lisp_Object
 f_and (Lisp_Object form)
 {
@@ -359,31 +460,80 @@ f_cond (Lisp_Object form)
   while (!nil (tail))
     {
       tem = f_car (tail);
-      if (!nil (f_eval (f_car (tem))))
-        return f_eval (f_car (f_cdr (tem)));
+      Lisp_Object test = f_eval (f_car (tem));
+      if (!nil (test))
+        // a clause without body returns the value of its test
+        return nil (f_cdr (tem)) ? test : f_progn (f_cdr (tem));
       tail = f_cdr (tail);
     }
   return q_nil;
 }
 
+Lisp_Object
+f_setq (Lisp_Object form)
+{
+  return setq (env_current (), form);
+}
+
+Lisp_Object
+f_while (Lisp_Object form)
+{
+  return while_loop (env_current (), form);
+}
+
+Lisp_Object
+f_dotimes (Lisp_Object form)
+{
+  return dotimes (env_current (), form);
+}
+
+Lisp_Object
+f_dolist (Lisp_Object form)
+{
+  return dolist (env_current (), form);
+}
+
 Lisp_Object
 f_lambda (Lisp_Object form)
 {
-  Lisp_Object args = f_car (form);
-  Lisp_Object body = f_cdr (form);
+  return lambda (env_current (), form);
+}
 
-  size_t nargs = unbox_int (f_length (args));
-  Lisp_Object *argv = malloc (nargs * sizeof (Lisp_Object));
+Lisp_Object
+f_byte_compile (Lisp_Object fun)
+{
+  if (type_of (fun) == LISP_SYMB)
+    fun = unbox_symbol (fun)->value;
+  if (type_of (fun) != LISP_LMBD)
+    {
+      // TODO err
+      fprintf (stderr, "byte-compile: not a lambda: %s\n",
+               type_name (type_of (fun)));
+      return q_nil;
+    }
 
-  Lisp_Object argtail = args;
-  for (size_t i = 0; i < nargs; i++)
+  const char *err = byte_compile (unbox_lambda (fun));
+  if (err)
     {
-      argv[i] = f_car (argtail);
-      argtail = f_cdr (argtail);
+      // the lambda stays interpreted
+      fprintf (stderr, "byte-compile: %s\n", err);
+      return q_nil;
     }
+  return fun;
+}
 
-  // TODO &optional and &re st
-  return make_lambda (nargs, nargs, argv, body);
+Lisp_Object
+f_load (Lisp_Object filename)
+{
+  if (type_of (filename) != LISP_STRG)
+    {
+      ERRTYPE (LISP_STRG, type_of (filename));
+    }
+  Lisp_String *ufilename = unbox_string (filename);
+  char *name = strndup (ufilename->data, ufilename->size);
+  Lisp_Object result = load_file (name, NULL);
+  free (name);
+  return result;
 }
 
 Lisp_Object
@@ -433,6 +583,13 @@ f_gc ()
   return q_nil;
 }
 
+Lisp_Object
+f_backtrace ()
+{
+  print_backtrace (stdout);
+  return q_nil;
+}
+
 Lisp_Object
 f_memdump ()
 {
@@ -448,6 +605,172 @@ f_memstats ()
   return q_nil;
 }
 
+Lisp_Object
+f_term_to_binary (Lisp_Object term)
+{
+  size_t size;
+  unsigned char *buf = term_encode (term, &size);
+  Lisp_Object binary = make_nstring ((const char *)buf, size);
+  free (buf);
+  return binary;
+}
+
+Lisp_Object
+f_binary_to_term (Lisp_Object binary)
+{
+  if (type_of (binary) != LISP_STRG)
+    {
+      ERRTYPE (LISP_STRG, type_of (binary));
+    }
+
+  const char *err;
+  Lisp_String *ubinary = unbox_string (binary);
+  Lisp_Object term = term_decode ((const unsigned char *)ubinary->data,
+                                  ubinary->size, &err);
+  if (err)
+    {
+      // TODO err
+      fprintf (stderr, "binary-to-term: %s\n", err);
+      return q_nil;
+    }
+  return term;
+}
+
+Lisp_Object
+f_node_start (Lisp_Object path)
+{
+  if (type_of (path) != LISP_STRG)
+    {
+      ERRTYPE (LISP_STRG, type_of (path));
+    }
+  Lisp_String *upath = unbox_string (path);
+  return BOOL (node_start (upath->data, upath->size) == 0);
+}
+
+Lisp_Object
+f_send (Lisp_Object dest, Lisp_Object term)
+{
+  if (type_of (dest) != LISP_STRG)
+    {
+      ERRTYPE (LISP_STRG, type_of (dest));
+    }
+
+  size_t size;
+  unsigned char *buf = term_encode (term, &size);
+  Lisp_String *udest = unbox_string (dest);
+  int err = node_send (udest->data, udest->size, buf, size);
+  free (buf);
+
+  return err ? q_nil : term;
+}
+
+Lisp_Object
+f_receive (Lisp_Object timeout)
+{
+  // no timeout (nil) blocks until a message arrives
+  if (!nil (timeout) && type_of (timeout) != LISP_INTG)
+    {
+      ERRTYPE (LISP_INTG, type_of (timeout));
+    }
+  int timeoutms = nil (timeout) ? -1 : unbox_int (timeout);
+
+  size_t size;
+  unsigned char *buf = node_receive (timeoutms, &size);
+  if (!buf)
+    return q_nil;
+
+  const char *err;
+  Lisp_Object term = term_decode (buf, size, &err);
+  free (buf);
+  if (err)
+    {
+      // TODO err
+      fprintf (stderr, "receive: %s\n", err);
+      return q_nil;
+    }
+  return term;
+}
+
+Lisp_Object
+f_node_flush (Lisp_Object dest)
+{
+  if (nil (dest))
+    return BOOL (node_flush (NULL, 0) == 0);
+
+  if (type_of (dest) != LISP_STRG)
+    {
+      ERRTYPE (LISP_STRG, type_of (dest));
+    }
+  Lisp_String *udest = unbox_string (dest);
+  return BOOL (node_flush (udest->data, udest->size) == 0);
+}
+
+Lisp_Object
+f_node_batch_size (Lisp_Object bytes)
+{
+  // a size_t: a negative fixnum would wrap to a huge batch
+  node_set_batch (check_range (bytes, 1, MOST_POSITIVE_FIXNUM));
+  return bytes;
+}
+
+Lisp_Object
+f_node_nodelay (Lisp_Object flag)
+{
+  node_set_nodelay (!nil (flag));
+  return flag;
+}
+
+Lisp_Object
+f_table_new (Lisp_Object nshards)
+{
+  Table *t = table_new (
+      nil (nshards) ? 0 : check_range (nshards, 1, TABLE_MAX_SHARDS));
+  int id = table_register (t);
+  if (id < 0)
+    {
+      // TODO err
+      fprintf (stderr, "too many tables: %d\n", TABLE_MAX_TABLES);
+      table_free (t);
+      return q_nil;
+    }
+  return box_int (id);
+}
+
+Lisp_Object
+f_table_put (Lisp_Object table, Lisp_Object key, Lisp_Object val)
+{
+  table_put (check_table (table), key, val);
+  return val;
+}
+
+Lisp_Object
+f_table_get (Lisp_Object table, Lisp_Object key)
+{
+  int found;
+  return table_get (check_table (table), key, &found);
+}
+
+Lisp_Object
+f_table_remove (Lisp_Object table, Lisp_Object key)
+{
+  return BOOL (table_remove (check_table (table), key));
+}
+
+Lisp_Object
+f_table_count (Lisp_Object table)
+{
+  return box_int (table_count (check_table (table)));
+}
+
+Lisp_Object
+f_table_delete (Lisp_Object table)
+{
+  Table *t = check_table (table);
+  table_unregister (unbox_int (table));
+  table_free (t);
+  return q_t;
+}
+
 void
 init_builtins ()
 {
@@ -458,9 +781,83 @@ init_builtins ()
   v_obarray = obarray_init ();
   obarray_register_builtins (v_obarray);
 
+  // special forms the reader and the resolver look for
+  q_quote = obarray_intern (v_obarray, "quote", 5);
+  q_lambda = obarray_intern (v_obarray, "lambda", 6);
+  q_let = obarray_intern (v_obarray, "let", 3);
+  q_let_star = obarray_intern (v_obarray, "let*", 4);
+  q_define = obarray_intern (v_obarray, "define", 6);
+  q_defvar = obarray_intern (v_obarray, "defvar", 6);
+  q_dotimes = obarray_intern (v_obarray, "dotimes", 7);
+  q_dolist = obarray_intern (v_obarray, "dolist", 6);
+  // lambda list keywords
+  q_optional = obarray_intern (v_obarray, "&optional", 9);
+  q_rest = obarray_intern (v_obarray, "&rest", 5);
+  // macros and the code expanding backquotes, see macro.h
+  q_progn = obarray_intern (v_obarray, "progn", 5);
+  q_cons = obarray_intern (v_obarray, "cons", 4);
+  q_append = obarray_intern (v_obarray, "append", 6);
+  q_macro = obarray_intern (v_obarray, "macro", 5);
+  q_defmacro = obarray_intern (v_obarray, "defmacro", 8);
+  q_quasiquote = obarray_intern (v_obarray, "quasiquote", 10);
+  q_unquote = obarray_intern (v_obarray, "unquote", 7);
+  q_unquote_splicing = obarray_intern (v_obarray, "unquote-splicing", 16);
+  unbox_symbol (q_quasiquote)->value
+      = f_cons (q_macro, make_subr ("quasiquote", 1, 1,
+                                    NSUBR (1, quasiquote_expand),
+                                    SUBR_CALL (1)));
+
+  // special forms eval dispatches on without calling their subr
+  defspecial ("quote", SF_QUOTE);
+  defspecial ("progn", SF_PROGN);
+  defspecial ("if", SF_IF);
+  defspecial ("when", SF_WHEN);
+  defspecial ("unless", SF_UNLESS);
+  defspecial ("cond", SF_COND);
+  defspecial ("and", SF_AND);
+  defspecial ("or", SF_OR);
+  defspecial ("let", SF_LET);
+  defspecial ("let*", SF_LET);
+  defspecial ("lambda", SF_LAMBDA);
+  defspecial ("define", SF_DEFINE);
+  defspecial ("defvar", SF_DEFVAR);
+  defspecial ("setq", SF_SETQ);
+  defspecial ("while", SF_WHILE);
+  defspecial ("dotimes", SF_DOTIMES);
+  defspecial ("dolist", SF_DOLIST);
+
+  // builtins the resolver folds on constant args of these types
+  defpure ("+", PURE_ARGS (LISP_INTG));
+  defpure ("-", PURE_ARGS (LISP_INTG));
+  defpure ("*", PURE_ARGS (LISP_INTG));
+  defpure ("/", PURE_ARGS (LISP_INTG));
+  defpure (">", PURE_ARGS (LISP_INTG));
+  defpure (">=", PURE_ARGS (LISP_INTG));
+  defpure ("<", PURE_ARGS (LISP_INTG));
+  defpure ("<=", PURE_ARGS (LISP_INTG));
+  defpure ("eq?", PURE_ANY_ARGS);
+  defpure ("equal?", PURE_ANY_ARGS);
+  defpure ("car", PURE_ANY_ARGS);
+  defpure ("cdr", PURE_ANY_ARGS);
+  defpure ("length", PURE_ARGS (LISP_CONS) | PURE_ARGS (LISP_STRG));
+  defpure ("string-length", PURE_ARGS (LISP_STRG));
+  defpure ("string=?", PURE_ARGS (LISP_STRG));
+
   l_globalenv = env_init ();
-  currentenv = malloc (sizeof (Lisp_Object));
-  *currentenv = l_globalenv;
+}
+
+static void
+defspecial (const char *name, enum special_form form)
+{
+  Lisp_Object symbol = obarray_intern (v_obarray, name, strlen (name));
+  unbox_symbol (symbol)->form = form;
+}
+
+static void
+defpure (const char *name, unsigned types)
+{
+  Lisp_Object symbol = obarray_intern (v_obarray, name, strlen (name));
+  unbox_subr (unbox_symbol (symbol)->value)->pure = types;
 }
 
 static void
@@ -480,7 +877,7 @@ obarray_register_builtins (Lisp_Object o)
   obarray_put (o, DEFSUBR ("cdr", 1, 1, f_cdr));
   obarray_put (o, DEFSUBR ("eq?", 2, 2, f_eq_p));
   obarray_put (o, DEFSUBR ("equal?", 2, 2, f_equal_p));
-  obarray_put (o, DEFSUBR ("eval", 1, 1, f_eval));
+  obarray_put (o, DEFSUBR ("eval", 1, 1, f_eval_data));
   obarray_put (o, DEFSUBR ("assoc", 2, 2, f_assoc));
   obarray_put (o, DEFSUBR ("assq", 2, 2, f_assq));
   obarray_put (o, DEFSUBR ("rassoc", 2, 2, f_rassoc));
@@ -488,6 +885,7 @@ obarray_register_builtins (Lisp_Object o)
   obarray_put (o, DEFSUBR ("string=?", 2, 2, f_string_equal_p));
   obarray_put (o, DEFSUBR ("string-length", 1, 1, f_string_length));
   obarray_put (o, DEFSUBR ("length", 1, 1, f_length));
+  obarray_put (o, DEFSUBR ("append", 0, MANY, f_append));
   obarray_put (o, DEFSUBR ("+", 0, MANY, f_sum));
   obarray_put (o, DEFSUBR ("-", 1, MANY, f_subtract));
   obarray_put (o, DEFSUBR ("*", 0, MANY, f_multiply));
@@ -506,16 +904,92 @@ obarray_register_builtins (Lisp_Object o)
   obarray_put (o, DEFSUBR ("when", 2, UNEVALLED, f_when));
   obarray_put (o, DEFSUBR ("unless", 2, UNEVALLED, f_unless));
   obarray_put (o, DEFSUBR ("cond", 1, UNEVALLED, f_cond));
+  obarray_put (o, DEFSUBR ("setq", 2, UNEVALLED, f_setq));
+  obarray_put (o, DEFSUBR ("while", 1, UNEVALLED, f_while));
+  obarray_put (o, DEFSUBR ("dotimes", 1, UNEVALLED, f_dotimes));
+  obarray_put (o, DEFSUBR ("dolist", 1, UNEVALLED, f_dolist));
   obarray_put (o, DEFSUBR ("lambda", 2, UNEVALLED, f_lambda));
   obarray_put (o, DEFSUBR ("define", 2, UNEVALLED, f_define));
+  obarray_put (o, DEFSUBR ("defvar", 1, UNEVALLED, f_defvar));
+  obarray_put (o, DEFSUBR ("defmacro", 2, UNEVALLED, f_defmacro));
+  obarray_put (o, DEFSUBR ("macroexpand", 1, 1, f_macroexpand));
+  obarray_put (o, DEFSUBR ("byte-compile", 1, 1, f_byte_compile));
+  obarray_put (o, DEFSUBR ("load", 1, 1, f_load));
   obarray_put (o, DEFSUBR ("format", 2, MANY, f_format));
   obarray_put (o, DEFSUBR ("gc", 0, 0, f_gc));
+  obarray_put (o, DEFSUBR ("backtrace", 0, 0, f_backtrace));
   obarray_put (o, DEFSUBR ("memstats", 0, 0, f_memstats));
   obarray_put (o, DEFSUBR ("memdump", 0, 0, f_memdump));
+  obarray_put (o, DEFSUBR ("term-to-binary", 1, 1, f_term_to_binary));
+  obarray_put (o, DEFSUBR ("binary-to-term", 1, 1, f_binary_to_term));
+  obarray_put (o, DEFSUBR ("node-start", 1, 1, f_node_start));
+  obarray_put (o, DEFSUBR ("send", 2, 2, f_send));
+  obarray_put (o, DEFSUBR ("receive", 0, 1, f_receive));
+  obarray_put (o, DEFSUBR ("node-flush", 0, 1, f_node_flush));
+  obarray_put (o, DEFSUBR ("node-batch-size", 1, 1, f_node_batch_size));
+  obarray_put (o, DEFSUBR ("node-nodelay", 1, 1, f_node_nodelay));
+  obarray_put (o, DEFSUBR ("table-new", 0, 1, f_table_new));
+  obarray_put (o, DEFSUBR ("table-put", 3, 3, f_table_put));
+  obarray_put (o, DEFSUBR ("table-get", 2, 2, f_table_get));
+  obarray_put (o, DEFSUBR ("table-remove", 2, 2, f_table_remove));
+  obarray_put (o, DEFSUBR ("table-count", 1, 1, f_table_count));
+  obarray_put (o, DEFSUBR ("table-delete", 1, 1, f_table_delete));
 }
 
 // helpers impl
 
+static Lisp_Object
+check_number (Lisp_Object number)
+{
+  // a fixnum or a bignum
+  if (!integer_p (number))
+    {
+      ERRTYPE (LISP_INTG, type_of (number));
+    }
+  return number;
+}
+
+static Lisp_Integer
+check_range (Lisp_Object number, Lisp_Integer min, Lisp_Integer max)
+{
+  // a fixnum from MIN to MAX
+  if (type_of (number) != LISP_INTG)
+    {
+      ERRTYPE (LISP_INTG, type_of (number));
+    }
+  Lisp_Integer i = unbox_int (number);
+  if (i < min || i > max)
+    {
+      if (max == MOST_POSITIVE_FIXNUM)
+        fprintf (stderr, "type error. expected an integer from %ld, got %ld\n",
+                 (long)min, (long)i);
+      else
+        fprintf (stderr,
+                 "type error. expected an integer from %ld to %ld, got %ld\n",
+                 (long)min, (long)max, (long)i);
+      print_backtrace (stderr);
+      exit (123);
+    }
+  return i;
+}
+
+static Table *
+check_table (Lisp_Object table)
+{
+  if (type_of (table) != LISP_INTG)
+    {
+      ERRTYPE (LISP_INTG, type_of (table));
+    }
+  Table *t = table_by_id (unbox_int (table));
+  if (!t)
+    {
+      // TODO err
+      fprintf (stderr, "no such table: %ld\n", (long)unbox_int (table));
+      exit (41);
+    }
+  return t;
+}
+
 static Lisp_Object
 assoc_w_pred (Lisp_Object key, Lisp_Object alist,
               Lisp_Object (*keypred) (Lisp_Object k1, Lisp_Object k2))
@@ -0,0 +1,700 @@
+#include "bytecode.h"
+#include "alloc.h"
+#include "env.h"
+#include "eval.h"
+#include "jit.h"
+#include "lisp.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#ifdef __GNUC__
+#define BYTE_CODE_THREADED
+#endif /* __GNUC__ */
+
+Lisp_Object *byte_stack;
+Lisp_Object *byte_stack_top;
+static Lisp_Object *byte_stack_end;
+
+// a compiled lambda called from compiled code runs in the C frame of
+// the exec_byte_code of its caller: where to resume the caller
+struct byte_return
+{
+  Lisp_Lambda *lambda;
+  Lisp_Object *base;
+  Lisp_Object *top;
+  const unsigned char *pc;
+  Lisp_Object env;
+};
+
+static struct byte_return *returns;
+static size_t nreturns, allocreturns;
+
+static int accepts (Lisp_Object fun, int nargs);
+static Lisp_Object compiled_callee (Lisp_Object cache, int nargs);
+static Lisp_Object call_checked (Lisp_Object fun, int nargs,
+                                 Lisp_Object *args);
+
+
+#define FETCH (*pc++)
+#define FETCH2 (pc += 2, pc[-2] | pc[-1] << 8)
+#define PUSH(x) (*++top = (x))
+#define POP (*top--)
+#define TOP (*top)
+
+#ifdef BYTE_CODE_THREADED
+#define CASE(op) insn_##op
+#define NEXT goto *targets[FETCH]
+#define FIRST NEXT;
+#define CASE_DEFAULT
+#else /* BYTE_CODE_THREADED */
+#define CASE(op) case op
+#define NEXT break
+#define FIRST                                                                 \
+  for (;;)                                                                    \
+    switch (FETCH)
+#define CASE_DEFAULT default:
+#endif /* BYTE_CODE_THREADED */
+
+Lisp_Object
+exec_byte_code (Lisp_Lambda *lambda, Lisp_Object *args)
+{
+#ifdef BYTE_CODE_THREADED
+  static const void *const targets[] = {
+#define DEFINE(name, value) [name] = &&insn_##name,
+    BYTE_CODES
+#undef DEFINE
+  };
+#endif /* BYTE_CODE_THREADED */
+
+  // base[0] is the running lambda, so that the gc sees it and its
+  // constants even when nothing else references it
+  Lisp_Object *base = byte_stack_top;
+  Lisp_Object *top;
+  Lisp_Object env;
+  Lisp_Object *constants;
+  const unsigned char *code;
+  const unsigned char *pc;
+  Lisp_Object result;
+  Lisp_Object fun;
+  int n;
+  int nslots;
+  // the calls returning to activations of outer exec_byte_codes
+  size_t entry = nreturns;
+
+setup:
+  if (base + lambda->maxdepth > byte_stack_end)
+    {
+      // TODO err
+      fprintf (stderr, "byte stack size exceeded: %zu bytes\n",
+               stack_limit);
+      exit (9);
+    }
+
+  nslots = lambda_nslots (lambda);
+  base[0] = box_lambda (lambda);
+  memmove (base + 1, args, nslots * sizeof (Lisp_Object));
+  // the gc marks the whole window: slots not written yet must not
+  // hold dead objects left by earlier activations
+  memset (base + 1 + nslots, 0,
+          (lambda->maxdepth - 1 - nslots) * sizeof (Lisp_Object));
+  byte_stack_top = base + lambda->maxdepth;
+
+  code = (const unsigned char *)unbox_string (lambda->bytecode)->data;
+  constants = unbox_vector (lambda->constants)->contents;
+  pc = code;
+
+  if (lambda->stackargs)
+    {
+      env = lambda->env;
+      top = base + nslots;
+    }
+  else
+    {
+      env = env_frame_new (lambda->env, nslots);
+      memcpy (unbox_vector (env)->contents + 1, base + 1,
+              nslots * sizeof (Lisp_Object));
+      top = base;
+    }
+  stack_current_set_env (env);
+
+  if (!lambda->jitcode && jit_enabled && ++lambda->ncalls == JIT_THRESHOLD)
+    jit_compile (lambda);
+  if (lambda->jitcode)
+    {
+      struct jit_frame f = { .base = base,
+                             .top = top,
+                             .constants = constants,
+                             .env = env };
+      if (((jit_code)lambda->jitcode) (&f) == JIT_TAIL_CALL)
+        {
+          lambda = f.lambda;
+          args = f.args;
+          goto setup;
+        }
+      result = f.result;
+      goto out;
+    }
+
+dispatch:
+  FIRST
+  {
+    CASE (Bconst):
+      PUSH (constants[FETCH2]);
+      NEXT;
+
+    CASE (Bdiscard):
+      top--;
+      NEXT;
+
+    CASE (Bdiscard_n_keep):
+      n = FETCH2;
+      top[-n] = TOP;
+      top -= n;
+      NEXT;
+
+    CASE (Bstack_ref):
+      PUSH (base[FETCH2]);
+      NEXT;
+
+    CASE (Bstack_set):
+      base[FETCH2] = POP;
+      NEXT;
+
+    CASE (Bvarref):
+      {
+        uint32_t depth = FETCH;
+        PUSH (*env_frame_slot (env, box_lref (depth, FETCH2)));
+        NEXT;
+      }
+
+    CASE (Bvarset):
+      {
+        uint32_t depth = FETCH;
+        *env_frame_slot (env, box_lref (depth, FETCH2)) = POP;
+        NEXT;
+      }
+
+    CASE (Bglobal_ref):
+      {
+        Lisp_Object symbol = constants[FETCH2];
+        Lisp_Object val = unbox_symbol (symbol)->value;
+        if (eq (val, q_unbound))
+          {
+            // todo err
+            fprintf (stderr, "unbound symbol: %s\n",
+                     unbox_string (unbox_symbol (symbol)->name)->data);
+            exit (13);
+          }
+        PUSH (val);
+        NEXT;
+      }
+
+    CASE (Bglobal_set):
+      unbox_symbol (constants[FETCH2])->value = TOP;
+      NEXT;
+
+    CASE (Bspecbind):
+      {
+        Lisp_Object symbol = constants[FETCH2];
+        specbind (symbol, POP);
+        NEXT;
+      }
+
+    CASE (Bunbind):
+      n = FETCH2;
+      unbind_to (specpdl_index () - n);
+      NEXT;
+
+    CASE (Bpush_frame):
+      env = env_frame_new (env, FETCH2);
+      stack_current_set_env (env);
+      NEXT;
+
+    CASE (Bpop_frame):
+      env = unbox_vector (env)->contents[0];
+      stack_current_set_env (env);
+      NEXT;
+
+    CASE (Bgoto):
+      n = FETCH2;
+      pc = code + n;
+      NEXT;
+
+    CASE (Bgoto_if_nil):
+      n = FETCH2;
+      if (nil (POP))
+        pc = code + n;
+      NEXT;
+
+    CASE (Bgoto_if_not_nil):
+      n = FETCH2;
+      if (!nil (POP))
+        pc = code + n;
+      NEXT;
+
+    CASE (Bgoto_if_nil_else_pop):
+      n = FETCH2;
+      if (nil (TOP))
+        pc = code + n;
+      else
+        top--;
+      NEXT;
+
+    CASE (Bgoto_if_not_nil_else_pop):
+      n = FETCH2;
+      if (!nil (TOP))
+        pc = code + n;
+      else
+        top--;
+      NEXT;
+
+    CASE (Bcall):
+      n = FETCH2;
+      top -= n;
+      fun = TOP;
+      if (type_of (fun) == LISP_LMBD && !nil (unbox_lambda (fun)->bytecode)
+          && accepts (fun, n))
+        {
+          args = top + 1;
+          goto call;
+        }
+      TOP = byte_call (fun, n, top + 1);
+      NEXT;
+
+    CASE (Bcall_global):
+      {
+        Lisp_Object cache = constants[FETCH2];
+        n = FETCH2;
+        // the result replaces the args
+        top -= n - 1;
+        fun = compiled_callee (cache, n);
+        if (!nil (fun))
+          {
+            args = top;
+            goto call;
+          }
+        TOP = byte_call_cached (cache, n, top);
+        NEXT;
+      }
+
+    CASE (Btail_call):
+      {
+        n = FETCH2;
+        Lisp_Object fun = top[-n];
+        if (type_of (fun) == LISP_LMBD
+            && !nil (unbox_lambda (fun)->bytecode)
+            && n == unbox_lambda (fun)->maxargs
+            && !unbox_lambda (fun)->rest)
+          {
+            // reuse the window of this activation
+            lambda = unbox_lambda (fun);
+            args = top - n + 1;
+            goto setup;
+          }
+        top -= n;
+        result = byte_call (TOP, n, top + 1);
+        goto out;
+      }
+
+    CASE (Breturn):
+      result = TOP;
+      goto out;
+
+    CASE (Bmake_closure):
+      PUSH (make_closure (constants[FETCH2], env));
+      NEXT;
+
+    CASE (Bplus):
+      {
+        Lisp_Object y = POP;
+        if (!fixnum_add (TOP, y, &TOP))
+          TOP = byte_arith (Bplus, TOP, y);
+        NEXT;
+      }
+
+    CASE (Bminus):
+      {
+        Lisp_Object y = POP;
+        if (!fixnum_sub (TOP, y, &TOP))
+          TOP = byte_arith (Bminus, TOP, y);
+        NEXT;
+      }
+
+    CASE (Bmult):
+      {
+        Lisp_Object y = POP;
+        if (!fixnum_mul (TOP, y, &TOP))
+          TOP = byte_arith (Bmult, TOP, y);
+        NEXT;
+      }
+
+    CASE (Bgtr):
+      {
+        Lisp_Object y = POP;
+        if (fixnums (TOP, y))
+          TOP = BOOL ((int64_t)TOP > (int64_t)y);
+        else
+          TOP = byte_arith (Bgtr, TOP, y);
+        NEXT;
+      }
+
+    CASE (Bgeq):
+      {
+        Lisp_Object y = POP;
+        if (fixnums (TOP, y))
+          TOP = BOOL ((int64_t)TOP >= (int64_t)y);
+        else
+          TOP = byte_arith (Bgeq, TOP, y);
+        NEXT;
+      }
+
+    CASE (Blss):
+      {
+        Lisp_Object y = POP;
+        if (fixnums (TOP, y))
+          TOP = BOOL ((int64_t)TOP < (int64_t)y);
+        else
+          TOP = byte_arith (Blss, TOP, y);
+        NEXT;
+      }
+
+    CASE (Bleq):
+      {
+        Lisp_Object y = POP;
+        if (fixnums (TOP, y))
+          TOP = BOOL ((int64_t)TOP <= (int64_t)y);
+        else
+          TOP = byte_arith (Bleq, TOP, y);
+        NEXT;
+      }
+
+    CASE (Beq):
+      {
+        Lisp_Object y = POP;
+        TOP = BOOL (eq (TOP, y));
+        NEXT;
+      }
+
+    CASE (Bcar):
+      TOP = f_car (TOP);
+      NEXT;
+
+    CASE (Bcdr):
+      TOP = f_cdr (TOP);
+      NEXT;
+
+    CASE (Bcons):
+      {
+        Lisp_Object y = POP;
+        TOP = f_cons (TOP, y);
+        NEXT;
+      }
+
+    CASE (Bsetcar):
+      {
+        Lisp_Object y = POP;
+        TOP = f_setcar (TOP, y);
+        NEXT;
+      }
+
+    CASE (Bconsp):
+      TOP = BOOL (type_of (TOP) == LISP_CONS);
+      NEXT;
+
+    CASE_DEFAULT
+      // TODO err
+      fprintf (stderr, "invalid byte code %d at %ld\n", pc[-1],
+               (long)(pc - code - 1));
+      exit (40);
+  }
+
+call:
+  // FUN, a compiled lambda taking the N ARGS as they are, gets the
+  // window above this one, without recursing in C: compiled code
+  // recurses as deep as the lisp stack goes.  the result goes to TOP
+  if (nreturns == allocreturns)
+    {
+      allocreturns = allocreturns ? 2 * allocreturns : STACKSIZE;
+      returns = realloc (returns, allocreturns * sizeof (struct byte_return));
+    }
+  returns[nreturns++] = (struct byte_return){
+    .lambda = lambda, .base = base, .top = top, .pc = pc, .env = env
+  };
+  stack_push ((struct stackframe){ .fun = fun, .env = env_current () });
+  lambda = unbox_lambda (fun);
+  base = byte_stack_top;
+  goto setup;
+
+out:
+  byte_stack_top = base;
+  if (nreturns > entry)
+    {
+      struct byte_return *caller = &returns[--nreturns];
+      stack_pop ();
+      lambda = caller->lambda;
+      base = caller->base;
+      top = caller->top;
+      pc = caller->pc;
+      env = caller->env;
+      code = (const unsigned char *)unbox_string (lambda->bytecode)->data;
+      constants = unbox_vector (lambda->constants)->contents;
+      byte_stack_top = base + lambda->maxdepth;
+      TOP = result;
+      goto dispatch;
+    }
+  return result;
+}
+
+// helpers
+
+Lisp_Object
+byte_call (Lisp_Object fun, int nargs, Lisp_Object *args)
+{
+  Lisp_Object padded[8];
+
+  switch (type_of (fun))
+    {
+    case LISP_SUBR:
+      {
+        Lisp_Subr *subr = unbox_subr (fun);
+        if (subr->maxargs == UNEVALLED)
+          {
+            // TODO err
+            fprintf (stderr, "special form %s cannot be called\n",
+                     subr->name);
+            exit (23);
+          }
+        if (nargs < subr->minargs
+            || (subr->maxargs != MANY && nargs > subr->maxargs))
+          {
+            // TODO error
+            fprintf (stderr,
+                     "wrong n of arguments: got %d, expected min %d, max "
+                     "%d\n",
+                     nargs, subr->minargs, subr->maxargs);
+            return q_nil;
+          }
+
+        int arity = nargs;
+        if (subr->maxargs != MANY && nargs < subr->maxargs)
+          {
+            // pad with nils
+            memcpy (padded, args, nargs * sizeof (Lisp_Object));
+            for (arity = nargs; arity < subr->maxargs; arity++)
+              padded[arity] = q_nil;
+            args = padded;
+          }
+
+        return call_checked (fun, arity, args);
+      }
+    case LISP_LMBD:
+      {
+        Lisp_Lambda *lambda = unbox_lambda (fun);
+        if (nargs < lambda->minargs
+            || (!lambda->rest && nargs > lambda->maxargs))
+          {
+            // TODO error
+            fprintf (stderr,
+                     "wrong n of arguments: got %d, expected min %d, max "
+                     "%d\n",
+                     nargs, lambda->minargs, lambda->maxargs);
+            return q_nil;
+          }
+        if (nargs == lambda->maxargs && !lambda->rest)
+          return call_checked (fun, nargs, args);
+
+        // optional or &rest args, bound on the value stack
+        Lisp_Object *argvals = values_top ();
+        for (int i = 0; i < nargs; i++)
+          argvals = values_push (argvals, args[i]);
+        argvals = bind_args (lambda, argvals, nargs);
+        Lisp_Object result = call_checked (fun, nargs, argvals);
+        values_unwind (argvals);
+        return result;
+      }
+    default:
+      // TODO error
+      fprintf (stderr, "illegal function type: %s\n",
+               type_name (type_of (fun)));
+      exit (12);
+    }
+}
+
+Lisp_Object
+byte_call_cached (Lisp_Object cache, int nargs, Lisp_Object *args)
+{
+  Lisp_Object *entry = unbox_vector (cache)->contents;
+  Lisp_Object fun = unbox_symbol (entry[0])->value;
+
+  if (!eq (fun, entry[1]))
+    {
+      // miss: the site is new or the symbol was given another value
+      if (eq (fun, q_unbound))
+        {
+          // TODO err unbound function
+          fprintf (stderr, "unbound function: '%s'\n",
+                   unbox_string (unbox_symbol (entry[0])->name)->data);
+          exit (2);
+        }
+      // functions needing padding or reporting an error are not
+      // cached, byte_call takes care of them every time
+      if (!accepts (fun, nargs))
+        return byte_call (fun, nargs, args);
+      entry[1] = fun;
+    }
+
+  return call_checked (fun, nargs, args);
+}
+
+Lisp_Object
+make_closure (Lisp_Object template, Lisp_Object env)
+{
+  Lisp_Lambda *t = unbox_lambda (template);
+  Lisp_Object closure
+      = make_lambda (t->minargs, t->maxargs, t->rest, t->args, t->form);
+  Lisp_Lambda *c = unbox_lambda (closure);
+  // the env of the template lists the captured variables
+  if (!nil (t->env))
+    c->env = env_closure (env, unbox_vector (t->env)->contents,
+                          unbox_vector (t->env)->size);
+  c->resolved = 1;
+  c->bytecode = t->bytecode;
+  c->constants = t->constants;
+  c->maxdepth = t->maxdepth;
+  c->stackargs = t->stackargs;
+  return closure;
+}
+
+Lisp_Object
+byte_arith (int op, Lisp_Object x, Lisp_Object y)
+{
+  Lisp_Object res;
+  switch (op)
+    {
+    case Bplus:
+      if (fixnum_add (x, y, &res))
+        return res;
+      break;
+    case Bminus:
+      if (fixnum_sub (x, y, &res))
+        return res;
+      break;
+    case Bmult:
+      if (fixnum_mul (x, y, &res))
+        return res;
+      break;
+    default:
+      if (!fixnums (x, y))
+        break;
+      switch (op)
+        {
+        case Bgtr:
+          return BOOL ((int64_t)x > (int64_t)y);
+        case Bgeq:
+          return BOOL ((int64_t)x >= (int64_t)y);
+        case Blss:
+          return BOOL ((int64_t)x < (int64_t)y);
+        case Bleq:
+          return BOOL ((int64_t)x <= (int64_t)y);
+        }
+    }
+
+  // not two fixnums, or an overflow
+  Lisp_Object args[2] = { x, y };
+  switch (op)
+    {
+    case Bplus:
+      return f_sum (2, args);
+    case Bminus:
+      return f_subtract (2, args);
+    case Bmult:
+      return f_multiply (2, args);
+    case Bgtr:
+      return f_ge (x, y);
+    case Bgeq:
+      return f_geq (x, y);
+    case Blss:
+      return f_le (x, y);
+    default:
+      return f_leq (x, y);
+    }
+}
+
+void
+byte_stack_init ()
+{
+  // untouched pages cost nothing, see bytecode.h
+  void *stack = mmap (NULL, stack_limit, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (stack == MAP_FAILED)
+    {
+      // TODO err
+      perror ("byte stack");
+      exit (9);
+    }
+  byte_stack = byte_stack_top = stack;
+  byte_stack_end = byte_stack + stack_limit / sizeof (Lisp_Object);
+}
+
+static Lisp_Object
+compiled_callee (Lisp_Object cache, int nargs)
+{
+  // the function of the inline CACHE if it is a compiled lambda taking
+  // the NARGS args as they are, filling the cache.  nil otherwise,
+  // byte_call_cached takes care of everything else
+  Lisp_Object *entry = unbox_vector (cache)->contents;
+  Lisp_Object fun = unbox_symbol (entry[0])->value;
+
+  if (!eq (fun, entry[1]))
+    {
+      if (!accepts (fun, nargs))
+        return q_nil;
+      entry[1] = fun;
+    }
+  if (type_of (fun) != LISP_LMBD || nil (unbox_lambda (fun)->bytecode))
+    return q_nil;
+  return fun;
+}
+
+static int
+accepts (Lisp_Object fun, int nargs)
+{
+  switch (type_of (fun))
+    {
+    case LISP_SUBR:
+      {
+        Lisp_Subr *subr = unbox_subr (fun);
+        if (subr->maxargs == MANY)
+          return nargs >= subr->minargs;
+        return subr->maxargs != UNEVALLED && nargs == subr->maxargs;
+      }
+    case LISP_LMBD:
+      return nargs == unbox_lambda (fun)->maxargs
+             && !unbox_lambda (fun)->rest;
+    default:
+      return 0;
+    }
+}
+
+static Lisp_Object
+call_checked (Lisp_Object fun, int nargs, Lisp_Object *args)
+{
+  // FUN is known to accept the NARGS ARGS as they are
+  Lisp_Object result;
+
+  if (type_of (fun) == LISP_SUBR)
+    {
+      Lisp_Subr *subr = unbox_subr (fun);
+      stack_push ((struct stackframe){ .fun = fun, .env = env_current () });
+      result = call_subr (subr, nargs, args);
+    }
+  else
+    {
+      stack_push ((struct stackframe){ .fun = fun, .env = env_current () });
+      result = call_lambda (unbox_lambda (fun), args);
+    }
+  stack_pop ();
+  return result;
+}
@@ -0,0 +1,151 @@
+#ifndef BYTECODE_H
+#define BYTECODE_H
+
+/*
+  Bytecode compiler and stack virtual machine.
+
+  byte_compile turns the (resolved, see resolve.h) body of a lambda
+  into a string of byte codes and a constants vector, stored in the
+  lambda itself.  call_lambda runs compiled lambdas with
+  exec_byte_code instead of walking their forms.
+
+  The VM is a stack machine.  Every activation gets a window of the
+  byte stack, byte_stack, big enough for the maxdepth computed by the
+  compiler:
+
+    base                                        base + maxdepth
+    | args | let variables and temporaries ...  |
+
+  Activations keep pointers into their window, so the byte stack never
+  moves: byte_stack_init reserves stack_limit bytes of address space
+  for it (see alloc.h), that the system backs with memory only as
+  calls reach it.  It grows on demand up to the limit of the other
+  stacks.  A compiled lambda calling a compiled lambda does not recurse
+  in C either: exec_byte_code saves where to resume the caller and
+  runs the callee in the window above, so compiled code recurses as
+  deep as the lisp stack goes.  Native code (see jit.h) still calls
+  through C.
+
+  Lambdas that create no closures keep their args and let variables
+  there (stackargs), referenced by index from base with
+  Bstack_ref/Bstack_set.  Lambdas that do create closures need their
+  variables in heap frames the closures can capture (see env.h): they
+  use Bvarref/Bvarset and Bpush_frame/Bpop_frame like the interpreter.
+  Variables of enclosing lambdas are always in the closure frame.
+
+  Calls to global functions go through monomorphic inline caches: a
+  [SYMBOL FUNCTION] vector per call site, in the constants.  FUNCTION
+  is the value of SYMBOL last seen there, once checked to accept the
+  arguments of the site.  As long as SYMBOL still holds it, calling
+  costs one compare: no type dispatch and no arity check.  Symbols
+  are interned, so the value cell is the only place a redefinition can
+  go, and comparing with it cannot miss one.
+
+  Operands follow the opcode: one byte for depths, two bytes (little
+  endian) for stack indexes, constants, slots, counts and jump
+  addresses.
+
+  The dispatch loop uses computed gotos when the compiler supports
+  them, a switch otherwise.
+ */
+
+#include "lisp.h"
+
+/* bump whenever the byte codes or their operands change: compiled
+   code cached on disk (see load.h) is only reused by the same VM */
+#define BYTE_CODE_VERSION 4
+
+/*
+  Operands:
+
+    Bconst k                push constants[k]
+    Bdiscard_n_keep n       drop the n values below the top one
+    Bstack_ref i            push base[i]
+    Bstack_set i            pop into base[i]
+    Bvarref d s             push slot s of the frame d levels up
+    Bvarset d s             pop into slot s of the frame d levels up
+    Bglobal_ref k           push the value of the symbol constants[k]
+    Bglobal_set k           set the value of constants[k] to the top
+    Bspecbind k             pop and dynamically bind constants[k]
+    Bunbind n               undo the last n dynamic bindings
+    Bpush_frame n           enter a new heap frame of n slots
+    Bgoto* a                jump to the address a
+    Bcall n                 call the function below the n args
+    Bcall_global k n        call the function named by the inline
+                            cache constants[k] on the n args
+    Btail_call n            same, replacing the current activation
+    Bmake_closure k         close the lambda constants[k] over the
+                            current frame, copying the slots its env
+                            lists (see resolve.h)
+ */
+#define BYTE_CODES                                                            \
+  DEFINE (Bconst, 0)                                                          \
+  DEFINE (Bdiscard, 1)                                                        \
+  DEFINE (Bdiscard_n_keep, 2)                                                 \
+  DEFINE (Bstack_ref, 3)                                                      \
+  DEFINE (Bstack_set, 4)                                                      \
+  DEFINE (Bvarref, 5)                                                         \
+  DEFINE (Bvarset, 6)                                                         \
+  DEFINE (Bglobal_ref, 7)                                                     \
+  DEFINE (Bglobal_set, 8)                                                     \
+  DEFINE (Bspecbind, 9)                                                       \
+  DEFINE (Bunbind, 10)                                                        \
+  DEFINE (Bpush_frame, 11)                                                    \
+  DEFINE (Bpop_frame, 12)                                                     \
+  DEFINE (Bgoto, 13)                                                          \
+  DEFINE (Bgoto_if_nil, 14)                                                   \
+  DEFINE (Bgoto_if_not_nil, 15)                                               \
+  DEFINE (Bgoto_if_nil_else_pop, 16)                                          \
+  DEFINE (Bgoto_if_not_nil_else_pop, 17)                                      \
+  DEFINE (Bcall, 18)                                                          \
+  DEFINE (Btail_call, 19)                                                     \
+  DEFINE (Breturn, 20)                                                        \
+  DEFINE (Bmake_closure, 21)                                                  \
+  DEFINE (Bplus, 22)                                                          \
+  DEFINE (Bminus, 23)                                                         \
+  DEFINE (Bmult, 24)                                                          \
+  DEFINE (Bgtr, 25)                                                           \
+  DEFINE (Bgeq, 26)                                                           \
+  DEFINE (Blss, 27)                                                           \
+  DEFINE (Bleq, 28)                                                           \
+  DEFINE (Beq, 29)                                                            \
+  DEFINE (Bcar, 30)                                                           \
+  DEFINE (Bcdr, 31)                                                           \
+  DEFINE (Bcons, 32)                                                          \
+  DEFINE (Bcall_global, 33)                                                   \
+  DEFINE (Bsetcar, 34)                                                        \
+  DEFINE (Bconsp, 35)
+
+enum byte_code
+{
+#define DEFINE(name, value) name = value,
+  BYTE_CODES
+#undef DEFINE
+};
+
+/* values of the running activations, marked by the gc up to
+   byte_stack_top */
+extern Lisp_Object *byte_stack;
+extern Lisp_Object *byte_stack_top;
+
+/* reserves the byte stack, once stack_limit is known */
+void byte_stack_init ();
+
+/* compiles LAMBDA in place.  returns NULL or an error message, in
+   which case LAMBDA is left as it was */
+const char *byte_compile (Lisp_Lambda *lambda);
+Lisp_Object exec_byte_code (Lisp_Lambda *lambda, Lisp_Object *args);
+/* Bcall, Bcall_global and Bmake_closure, shared with the JIT */
+Lisp_Object byte_call (Lisp_Object fun, int nargs, Lisp_Object *args);
+Lisp_Object byte_call_cached (Lisp_Object cache, int nargs,
+                              Lisp_Object *args);
+Lisp_Object make_closure (Lisp_Object template, Lisp_Object env);
+/* X OP Y, OP one of Bplus to Bleq: the fixnum fast path (see
+   fixnum_add in lisp.h) or else the type checked builtin.  the slow
+   path of the VM and the JIT, and what eval runs for binary
+   arithmetic */
+Lisp_Object byte_arith (int op, Lisp_Object x, Lisp_Object y);
+/* the byte code a call to SUBR on NARGS args compiles to, or -1 */
+int byte_inline_op (Lisp_Subr *subr, int nargs);
+
+#endif /* BYTECODE_H */
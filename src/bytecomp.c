@@ -0,0 +1,916 @@
+#include "alloc.h"
+#include "bytecode.h"
+#include "lisp.h"
+#include "resolve.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE_CODE_MAX 65536
+// stack indexes are two byte operands
+#define BYTE_DEPTH_MAX 65536
+
+// the frames of the lambda being compiled, when its variables live on
+// the byte stack
+struct cframe
+{
+  int *slots; // stack index of each slot, -1 for special variables
+  int n;
+  struct cframe *parent;
+};
+
+struct compiler
+{
+  unsigned char *code;
+  size_t size;
+  size_t alloc;
+  Lisp_Object *constants;
+  size_t nconstants;
+  size_t constalloc;
+  int depth; // stack values above base, base[0] included
+  int maxdepth;
+  int stackargs;
+  int nframes;
+  struct cframe *frame;
+  const char *err;
+};
+
+static char errbuf[128];
+
+static void compile_form (struct compiler *c, Lisp_Object form, int tail);
+static void compile_body (struct compiler *c, Lisp_Object body, int tail);
+static void compile_varref (struct compiler *c, Lisp_Object lref);
+static void compile_varset (struct compiler *c, Lisp_Object lref);
+static void compile_call (struct compiler *c, Lisp_Object form, int tail);
+static void compile_special (struct compiler *c, Lisp_Subr *subr,
+                             Lisp_Object args, int tail);
+static void compile_if (struct compiler *c, Lisp_Object args, int tail);
+static void compile_when (struct compiler *c, Lisp_Object args, int tail,
+                          int unless);
+static void compile_cond (struct compiler *c, Lisp_Object args, int tail);
+static void compile_andor (struct compiler *c, Lisp_Object args, int tail,
+                           int or);
+static void compile_let (struct compiler *c, Lisp_Object args, int tail);
+static void compile_setq (struct compiler *c, Lisp_Object args);
+static void compile_while (struct compiler *c, Lisp_Object args);
+static void compile_iteration (struct compiler *c, Lisp_Object args,
+                               int dolist);
+static void compile_iteration_set (struct compiler *c, Lisp_Object var,
+                                   int slot);
+static void compile_lambda (struct compiler *c, Lisp_Object args);
+static int contains_lambda (Lisp_Object form);
+static void emit (struct compiler *c, int byte);
+static void emit2 (struct compiler *c, int n);
+static void emit_op (struct compiler *c, enum byte_code op, int delta);
+static void emit_const (struct compiler *c, Lisp_Object o);
+static size_t emit_jump (struct compiler *c, enum byte_code op, int delta);
+static void patch_jump (struct compiler *c, size_t pos);
+static int constant (struct compiler *c, Lisp_Object o);
+
+const char *
+byte_compile (Lisp_Lambda *lambda)
+{
+  if (!lambda->resolved)
+    resolve_lambda (lambda);
+
+  struct compiler c = { 0 };
+  int nslots = lambda_nslots (lambda);
+  int *argslots = malloc (nslots * sizeof (int));
+  struct cframe argframe = {
+    .slots = argslots,
+    .n = nslots,
+    .parent = NULL,
+  };
+
+  // base[0] holds the lambda itself, args follow (see bind_args)
+  c.stackargs = !contains_lambda (lambda->form);
+  if (c.stackargs)
+    {
+      for (int i = 0; i < nslots; i++)
+        argslots[i] = 1 + i;
+      c.frame = &argframe;
+      c.nframes = 1;
+      c.depth = 1 + nslots;
+    }
+  else
+    c.depth = 1;
+  c.maxdepth = 1 + nslots;
+
+  compile_body (&c, lambda->form, 1);
+  emit_op (&c, Breturn, 0);
+  free (argslots);
+
+  if (!c.err && c.size >= BYTE_CODE_MAX)
+    c.err = "function too big";
+  if (!c.err && c.maxdepth >= BYTE_DEPTH_MAX)
+    c.err = "function needs too much stack";
+
+  if (c.err)
+    {
+      free (c.code);
+      free (c.constants);
+      return c.err;
+    }
+
+  Lisp_Object constants = make_vector (c.nconstants);
+  for (size_t i = 0; i < c.nconstants; i++)
+    unbox_vector (constants)->contents[i] = c.constants[i];
+
+  lambda->bytecode = make_nstring ((const char *)c.code, c.size);
+  lambda->constants = constants;
+  lambda->maxdepth = c.maxdepth;
+  lambda->stackargs = c.stackargs;
+
+  free (c.code);
+  free (c.constants);
+  return NULL;
+}
+
+int
+byte_inline_op (Lisp_Subr *subr, int nargs)
+{
+  // the few subrs worth an opcode of their own
+  union lisp_subr_fun fun = subr->function;
+
+  if (subr->maxargs == MANY && nargs == 2)
+    {
+      if (fun.f999 == f_sum)
+        return Bplus;
+      if (fun.f999 == f_subtract)
+        return Bminus;
+      if (fun.f999 == f_multiply)
+        return Bmult;
+    }
+  if (subr->maxargs == 2 && nargs == 2)
+    {
+      if (fun.f2 == f_ge)
+        return Bgtr;
+      if (fun.f2 == f_geq)
+        return Bgeq;
+      if (fun.f2 == f_le)
+        return Blss;
+      if (fun.f2 == f_leq)
+        return Bleq;
+      if (fun.f2 == f_eq_p)
+        return Beq;
+      if (fun.f2 == f_cons)
+        return Bcons;
+      if (fun.f2 == f_setcar)
+        return Bsetcar;
+    }
+  if (subr->maxargs == 1 && nargs == 1)
+    {
+      if (fun.f1 == f_car)
+        return Bcar;
+      if (fun.f1 == f_cdr)
+        return Bcdr;
+    }
+  return -1;
+}
+
+// helpers
+
+static void
+compile_form (struct compiler *c, Lisp_Object form, int tail)
+{
+  if (c->err)
+    return;
+
+  switch (type_of (form))
+    {
+    case LISP_SYMB:
+      if (eq (form, q_nil) || eq (form, q_t) || eq (form, q_unbound))
+        emit_const (c, form);
+      else
+        {
+          emit_op (c, Bglobal_ref, 1);
+          emit2 (c, constant (c, form));
+        }
+      break;
+    case LISP_LREF:
+      compile_varref (c, form);
+      break;
+    case LISP_CONS:
+      {
+        Lisp_Object head = f_car (form);
+        if (type_of (head) == LISP_SYMB)
+          {
+            Lisp_Object fun = unbox_symbol (head)->value;
+            if (type_of (fun) == LISP_SUBR
+                && unbox_subr (fun)->maxargs == UNEVALLED)
+              {
+                compile_special (c, unbox_subr (fun), f_cdr (form), tail);
+                break;
+              }
+          }
+        compile_call (c, form, tail);
+        break;
+      }
+    default:
+      emit_const (c, form);
+    }
+}
+
+static void
+compile_body (struct compiler *c, Lisp_Object body, int tail)
+{
+  if (nil (body))
+    {
+      emit_const (c, q_nil);
+      return;
+    }
+
+  for (; !nil (body); body = f_cdr (body))
+    {
+      int last = nil (f_cdr (body));
+      compile_form (c, f_car (body), tail && last);
+      if (!last)
+        emit_op (c, Bdiscard, -1);
+    }
+}
+
+static void
+compile_varref (struct compiler *c, Lisp_Object lref)
+{
+  uint32_t depth = lref_depth (lref);
+  uint32_t slot = lref_slot (lref);
+
+  if (c->stackargs && depth < (uint32_t)c->nframes)
+    {
+      struct cframe *f = c->frame;
+      for (uint32_t d = depth; d > 0; d--)
+        f = f->parent;
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, f->slots[slot]);
+    }
+  else
+    {
+      // variable of an enclosing lambda, in the closure frame
+      if (c->stackargs)
+        depth -= c->nframes;
+      if (depth > 255)
+        {
+          c->err = "lexical variable nested too deep";
+          return;
+        }
+      emit_op (c, Bvarref, 1);
+      emit (c, depth);
+      emit2 (c, slot);
+    }
+
+  if (lref_boxed (lref))
+    emit_op (c, Bcar, 0);
+}
+
+static void
+compile_varset (struct compiler *c, Lisp_Object lref)
+{
+  // pops into the variable, like compile_varref pushes it
+  uint32_t depth = lref_depth (lref);
+  uint32_t slot = lref_slot (lref);
+
+  if (c->stackargs)
+    {
+      if (depth < (uint32_t)c->nframes)
+        {
+          struct cframe *f = c->frame;
+          for (uint32_t d = depth; d > 0; d--)
+            f = f->parent;
+          emit_op (c, Bstack_set, -1);
+          emit2 (c, f->slots[slot]);
+          return;
+        }
+      depth -= c->nframes;
+    }
+
+  if (depth > 255)
+    {
+      c->err = "lexical variable nested too deep";
+      return;
+    }
+  emit_op (c, Bvarset, -1);
+  emit (c, depth);
+  emit2 (c, slot);
+}
+
+static void
+compile_call (struct compiler *c, Lisp_Object form, int tail)
+{
+  Lisp_Object head = f_car (form);
+  Lisp_Object args = f_cdr (form);
+  int nargs = unbox_int (f_length (args));
+
+  if (type_of (head) == LISP_SYMB
+      && type_of (unbox_symbol (head)->value) == LISP_SUBR)
+    {
+      Lisp_Subr *subr = unbox_subr (unbox_symbol (head)->value);
+      int op = byte_inline_op (subr, nargs);
+      if (op >= 0)
+        {
+          for (; !nil (args); args = f_cdr (args))
+            compile_form (c, f_car (args), 0);
+          emit_op (c, op, 1 - nargs);
+          return;
+        }
+    }
+
+  if (!tail && type_of (head) == LISP_SYMB && !eq (head, q_nil)
+      && !eq (head, q_t) && !eq (head, q_unbound))
+    {
+      // a global function: through an inline cache, empty for now
+      Lisp_Object cache = make_vector (2);
+      unbox_vector (cache)->contents[0] = head;
+      unbox_vector (cache)->contents[1] = q_unbound;
+      for (; !nil (args); args = f_cdr (args))
+        compile_form (c, f_car (args), 0);
+      emit_op (c, Bcall_global, 1 - nargs);
+      emit2 (c, constant (c, cache));
+      emit2 (c, nargs);
+      return;
+    }
+
+  compile_form (c, head, 0);
+  for (; !nil (args); args = f_cdr (args))
+    compile_form (c, f_car (args), 0);
+  emit_op (c, tail ? Btail_call : Bcall, -nargs);
+  emit2 (c, nargs);
+}
+
+static void
+compile_special (struct compiler *c, Lisp_Subr *subr, Lisp_Object args,
+                 int tail)
+{
+  lisp_subr_fun_1 fun = subr->function.f888;
+
+  if (fun == f_quote)
+    emit_const (c, f_car (args));
+  else if (fun == f_progn)
+    compile_body (c, args, tail);
+  else if (fun == f_if)
+    compile_if (c, args, tail);
+  else if (fun == f_when)
+    compile_when (c, args, tail, 0);
+  else if (fun == f_unless)
+    compile_when (c, args, tail, 1);
+  else if (fun == f_cond)
+    compile_cond (c, args, tail);
+  else if (fun == f_and)
+    compile_andor (c, args, tail, 0);
+  else if (fun == f_or)
+    compile_andor (c, args, tail, 1);
+  else if (fun == f_let)
+    compile_let (c, args, tail);
+  else if (fun == f_setq)
+    compile_setq (c, args);
+  else if (fun == f_while)
+    compile_while (c, args);
+  else if (fun == f_dotimes)
+    compile_iteration (c, args, 0);
+  else if (fun == f_dolist)
+    compile_iteration (c, args, 1);
+  else if (fun == f_lambda)
+    compile_lambda (c, args);
+  else if (fun == f_define)
+    {
+      compile_form (c, f_car (f_cdr (args)), 0);
+      emit_op (c, Bglobal_set, 0);
+      emit2 (c, constant (c, f_car (args)));
+    }
+  else
+    {
+      snprintf (errbuf, sizeof (errbuf), "cannot compile special form %s",
+                subr->name);
+      c->err = errbuf;
+    }
+}
+
+static void
+compile_if (struct compiler *c, Lisp_Object args, int tail)
+{
+  compile_form (c, f_car (args), 0);
+  size_t elsejump = emit_jump (c, Bgoto_if_nil, -1);
+  int depth = c->depth;
+
+  compile_form (c, f_car (f_cdr (args)), tail);
+  size_t endjump = emit_jump (c, Bgoto, 0);
+
+  patch_jump (c, elsejump);
+  c->depth = depth;
+  compile_body (c, f_cdr (f_cdr (args)), tail);
+  patch_jump (c, endjump);
+}
+
+static void
+compile_when (struct compiler *c, Lisp_Object args, int tail, int unless)
+{
+  compile_form (c, f_car (args), 0);
+
+  if (!unless)
+    {
+      // a nil condition is also the result
+      size_t endjump = emit_jump (c, Bgoto_if_nil_else_pop, -1);
+      compile_body (c, f_cdr (args), tail);
+      patch_jump (c, endjump);
+      return;
+    }
+
+  size_t bodyjump = emit_jump (c, Bgoto_if_nil, -1);
+  int depth = c->depth;
+  emit_const (c, q_nil);
+  size_t endjump = emit_jump (c, Bgoto, 0);
+
+  patch_jump (c, bodyjump);
+  c->depth = depth;
+  compile_body (c, f_cdr (args), tail);
+  patch_jump (c, endjump);
+}
+
+static void
+compile_cond (struct compiler *c, Lisp_Object args, int tail)
+{
+  int n = unbox_int (f_length (args));
+  size_t *endjumps = malloc ((n + 1) * sizeof (size_t));
+  int nendjumps = 0;
+  int depth = c->depth;
+
+  for (; !nil (args); args = f_cdr (args))
+    {
+      Lisp_Object clause = f_car (args);
+      c->depth = depth;
+      compile_form (c, f_car (clause), 0);
+      if (nil (f_cdr (clause)))
+        {
+          // the value of the test is the result
+          endjumps[nendjumps++]
+              = emit_jump (c, Bgoto_if_not_nil_else_pop, -1);
+          continue;
+        }
+
+      size_t nextjump = emit_jump (c, Bgoto_if_nil, -1);
+      compile_body (c, f_cdr (clause), tail);
+      endjumps[nendjumps++] = emit_jump (c, Bgoto, 0);
+      patch_jump (c, nextjump);
+    }
+
+  c->depth = depth;
+  emit_const (c, q_nil);
+  for (int i = 0; i < nendjumps; i++)
+    patch_jump (c, endjumps[i]);
+  free (endjumps);
+}
+
+static void
+compile_andor (struct compiler *c, Lisp_Object args, int tail, int or)
+{
+  if (nil (args))
+    {
+      emit_const (c, or ? q_nil : q_t);
+      return;
+    }
+
+  int n = unbox_int (f_length (args));
+  size_t *endjumps = malloc (n * sizeof (size_t));
+  int nendjumps = 0;
+
+  for (; !nil (f_cdr (args)); args = f_cdr (args))
+    {
+      compile_form (c, f_car (args), 0);
+      endjumps[nendjumps++]
+          = emit_jump (c,
+                       or ? Bgoto_if_not_nil_else_pop : Bgoto_if_nil_else_pop,
+                       -1);
+    }
+  compile_form (c, f_car (args), tail);
+
+  for (int i = 0; i < nendjumps; i++)
+    patch_jump (c, endjumps[i]);
+  free (endjumps);
+}
+
+static void
+compile_let (struct compiler *c, Lisp_Object args, int tail)
+{
+  Lisp_Object bindings = f_car (args);
+  if (type_of (bindings) != LISP_VECT)
+    {
+      c->err = "let not resolved";
+      return;
+    }
+
+  // bindings are [var1 init1 var2 init2 ...], see resolve.h
+  Lisp_Vector *ubindings = unbox_vector (bindings);
+  int n = ubindings->size / 2;
+  int nspecials = 0;
+  int nlocals = 0;
+  struct cframe frame = {
+    .slots = malloc (n * sizeof (int)),
+    .n = n,
+    .parent = c->frame,
+  };
+  for (int i = 0; i < n; i++)
+    frame.slots[i] = -1;
+
+  if (!c->stackargs)
+    {
+      emit_op (c, Bpush_frame, 0);
+      emit2 (c, n);
+    }
+  c->frame = &frame;
+  c->nframes++;
+
+  for (int i = 0; i < n; i++)
+    {
+      Lisp_Object var = ubindings->contents[2 * i];
+      compile_form (c, ubindings->contents[2 * i + 1], 0);
+      if (unbox_symbol (var)->special)
+        {
+          emit_op (c, Bspecbind, -1);
+          emit2 (c, constant (c, var));
+          nspecials++;
+        }
+      else if (c->stackargs)
+        {
+          // the value stays where it is
+          frame.slots[i] = c->depth - 1;
+          nlocals++;
+        }
+      else
+        {
+          emit_op (c, Bvarset, -1);
+          emit (c, 0);
+          emit2 (c, i);
+        }
+    }
+
+  // dynamic bindings must be undone after the body: no tail call
+  compile_body (c, f_cdr (args), tail && !nspecials);
+
+  if (nspecials)
+    {
+      emit_op (c, Bunbind, 0);
+      emit2 (c, nspecials);
+    }
+  if (nlocals)
+    {
+      emit_op (c, Bdiscard_n_keep, -nlocals);
+      emit2 (c, nlocals);
+    }
+  if (!c->stackargs)
+    emit_op (c, Bpop_frame, 0);
+
+  c->frame = frame.parent;
+  c->nframes--;
+  free (frame.slots);
+}
+
+static void
+compile_setq (struct compiler *c, Lisp_Object args)
+{
+  // the value of the last assignment is left on the stack
+  while (!nil (args))
+    {
+      Lisp_Object var = f_car (args);
+      int last = nil (f_cdr (f_cdr (args)));
+      if (type_of (var) == LISP_LREF && lref_boxed (var))
+        {
+          // into the box, see resolve.h
+          compile_varref (c, box_lref (lref_depth (var), lref_slot (var)));
+          compile_form (c, f_car (f_cdr (args)), 0);
+          emit_op (c, Bsetcar, -1);
+          emit_op (c, last ? Bcar : Bdiscard, last ? 0 : -1);
+          args = f_cdr (f_cdr (args));
+          continue;
+        }
+
+      compile_form (c, f_car (f_cdr (args)), 0);
+      if (type_of (var) == LISP_LREF)
+        {
+          compile_varset (c, var);
+          if (last)
+            compile_varref (c, var);
+        }
+      else if (type_of (var) == LISP_SYMB && !eq (var, q_nil)
+               && !eq (var, q_t))
+        {
+          // sets the top, without popping it
+          emit_op (c, Bglobal_set, 0);
+          emit2 (c, constant (c, var));
+          if (!last)
+            emit_op (c, Bdiscard, -1);
+        }
+      else
+        {
+          c->err = "setq of a non variable";
+          return;
+        }
+      args = f_cdr (f_cdr (args));
+    }
+}
+
+static void
+compile_while (struct compiler *c, Lisp_Object args)
+{
+  size_t start = c->size;
+  compile_form (c, f_car (args), 0);
+  size_t exitjump = emit_jump (c, Bgoto_if_nil, -1);
+  compile_body (c, f_cdr (args), 0);
+  emit_op (c, Bdiscard, -1);
+  emit_op (c, Bgoto, 0);
+  emit2 (c, start);
+  patch_jump (c, exitjump);
+  emit_const (c, q_nil);
+}
+
+static void
+compile_iteration (struct compiler *c, Lisp_Object args, int dolist)
+{
+  Lisp_Object spec = f_car (args);
+  if (type_of (spec) != LISP_VECT)
+    {
+      c->err = dolist ? "dolist not resolved" : "dotimes not resolved";
+      return;
+    }
+
+  // spec is [VAR INIT RESULT], see resolve.h.  the state of the loop
+  // stays on the stack below VAR, out of reach of the body: the count
+  // and the index for dotimes, the rest of the list for dolist
+  Lisp_Vector *uspec = unbox_vector (spec);
+  Lisp_Object var = uspec->contents[0];
+  int special = unbox_symbol (var)->special;
+  int slot = -1;
+  struct cframe frame = {
+    .slots = &slot,
+    .n = 1,
+    .parent = c->frame,
+  };
+
+  compile_form (c, uspec->contents[1], 0);
+  int state = c->depth - 1;
+  int nvalues = 1;
+  if (!dolist)
+    {
+      emit_const (c, box_int (0));
+      nvalues++;
+    }
+
+  // VAR gets one slot, like in the frame of the interpreter, or is
+  // bound dynamically to nil until the loop ends
+  if (!c->stackargs)
+    {
+      emit_op (c, Bpush_frame, 0);
+      emit2 (c, 1);
+    }
+  c->frame = &frame;
+  c->nframes++;
+  if (special)
+    {
+      emit_const (c, q_nil);
+      emit_op (c, Bspecbind, -1);
+      emit2 (c, constant (c, var));
+    }
+  else if (c->stackargs)
+    {
+      emit_const (c, q_nil);
+      slot = c->depth - 1;
+      nvalues++;
+    }
+
+  size_t start = c->size;
+  size_t exitjump;
+  if (dolist)
+    {
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, state);
+      emit_op (c, Bconsp, 0);
+      exitjump = emit_jump (c, Bgoto_if_nil, -1);
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, state);
+      emit_op (c, Bcar, 0);
+    }
+  else
+    {
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, state + 1);
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, state);
+      emit_op (c, Blss, -1);
+      exitjump = emit_jump (c, Bgoto_if_nil, -1);
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, state + 1);
+    }
+  compile_iteration_set (c, var, slot);
+
+  compile_body (c, f_cdr (args), 0);
+  emit_op (c, Bdiscard, -1);
+
+  // the next element, or the next index: setting VAR in the body does
+  // not change them
+  emit_op (c, Bstack_ref, 1);
+  emit2 (c, dolist ? state : state + 1);
+  if (dolist)
+    emit_op (c, Bcdr, 0);
+  else
+    {
+      emit_const (c, box_int (1));
+      emit_op (c, Bplus, -1);
+    }
+  emit_op (c, Bstack_set, -1);
+  emit2 (c, dolist ? state : state + 1);
+  emit_op (c, Bgoto, 0);
+  emit2 (c, start);
+  patch_jump (c, exitjump);
+
+  // RESULT sees VAR set to the count, or to nil
+  if (dolist)
+    emit_const (c, q_nil);
+  else
+    {
+      emit_op (c, Bstack_ref, 1);
+      emit2 (c, state);
+    }
+  compile_iteration_set (c, var, slot);
+  compile_form (c, uspec->contents[2], 0);
+
+  if (special)
+    {
+      emit_op (c, Bunbind, 0);
+      emit2 (c, 1);
+    }
+  emit_op (c, Bdiscard_n_keep, -nvalues);
+  emit2 (c, nvalues);
+  if (!c->stackargs)
+    emit_op (c, Bpop_frame, 0);
+
+  c->frame = frame.parent;
+  c->nframes--;
+}
+
+static void
+compile_iteration_set (struct compiler *c, Lisp_Object var, int slot)
+{
+  // pops into the variable of a dotimes or dolist
+  if (unbox_symbol (var)->special)
+    {
+      emit_op (c, Bglobal_set, 0);
+      emit2 (c, constant (c, var));
+      emit_op (c, Bdiscard, -1);
+    }
+  else if (c->stackargs)
+    {
+      emit_op (c, Bstack_set, -1);
+      emit2 (c, slot);
+    }
+  else
+    {
+      emit_op (c, Bvarset, -1);
+      emit (c, 0);
+      emit2 (c, 0);
+    }
+}
+
+static void
+compile_lambda (struct compiler *c, Lisp_Object args)
+{
+  // ARGS is ([ARGS... CAPTURED...] . BODY), resolved with the
+  // enclosing lambda
+  Lisp_Object vargs = f_car (args);
+  if (type_of (vargs) != LISP_VECT)
+    {
+      c->err = "lambda not resolved";
+      return;
+    }
+
+  Lisp_Vector *uvargs = unbox_vector (vargs);
+  size_t nargs = lambda_nargs (uvargs);
+  Lisp_Object *names = malloc (nargs * sizeof (Lisp_Object));
+  int minargs, maxargs;
+  enum lambda_rest rest;
+  lambda_list (uvargs->contents, nargs, names, &minargs, &maxargs, &rest);
+  Lisp_Object template
+      = make_lambda (minargs, maxargs, rest, names, f_cdr (args));
+  unbox_lambda (template)->resolved = 1;
+  free (names);
+  // what Bmake_closure copies
+  if (nargs < uvargs->size)
+    {
+      Lisp_Object captured = make_vector (uvargs->size - nargs);
+      memcpy (unbox_vector (captured)->contents, uvargs->contents + nargs,
+              (uvargs->size - nargs) * sizeof (Lisp_Object));
+      unbox_lambda (template)->env = captured;
+    }
+
+  const char *err = byte_compile (unbox_lambda (template));
+  if (err)
+    {
+      c->err = err;
+      return;
+    }
+
+  emit_op (c, Bmake_closure, 1);
+  emit2 (c, constant (c, template));
+}
+
+static int
+contains_lambda (Lisp_Object form)
+{
+  // lambdas in quoted data count too: they just cost heap frames
+  switch (type_of (form))
+    {
+    case LISP_CONS:
+      if (eq (f_car (form), q_lambda))
+        return 1;
+      for (; type_of (form) == LISP_CONS; form = f_cdr (form))
+        if (contains_lambda (f_car (form)))
+          return 1;
+      return 0;
+    case LISP_VECT:
+      // resolved let bindings
+      if (pseudovector_p (form))
+        return 0;
+      for (size_t i = 0; i < unbox_vector (form)->size; i++)
+        if (contains_lambda (unbox_vector (form)->contents[i]))
+          return 1;
+      return 0;
+    default:
+      return 0;
+    }
+}
+
+static void
+emit (struct compiler *c, int byte)
+{
+  if (c->size == c->alloc)
+    {
+      c->alloc = c->alloc ? 2 * c->alloc : 64;
+      c->code = realloc (c->code, c->alloc);
+    }
+  c->code[c->size++] = byte;
+}
+
+static void
+emit2 (struct compiler *c, int n)
+{
+  if (n < 0 || n >= 65536)
+    {
+      c->err = "operand out of range";
+      return;
+    }
+  emit (c, n & 0xff);
+  emit (c, n >> 8);
+}
+
+static void
+emit_op (struct compiler *c, enum byte_code op, int delta)
+{
+  emit (c, op);
+  c->depth += delta;
+  if (c->depth > c->maxdepth)
+    c->maxdepth = c->depth;
+}
+
+static void
+emit_const (struct compiler *c, Lisp_Object o)
+{
+  emit_op (c, Bconst, 1);
+  emit2 (c, constant (c, o));
+}
+
+static size_t
+emit_jump (struct compiler *c, enum byte_code op, int delta)
+{
+  emit_op (c, op, delta);
+  size_t pos = c->size;
+  emit2 (c, 0);
+  return pos;
+}
+
+static void
+patch_jump (struct compiler *c, size_t pos)
+{
+  if (c->err)
+    return;
+  if (c->size >= BYTE_CODE_MAX)
+    {
+      c->err = "function too big";
+      return;
+    }
+  c->code[pos] = c->size & 0xff;
+  c->code[pos + 1] = c->size >> 8;
+}
+
+static int
+constant (struct compiler *c, Lisp_Object o)
+{
+  for (size_t i = 0; i < c->nconstants; i++)
+    if (eq (c->constants[i], o))
+      return i;
+
+  if (c->nconstants == c->constalloc)
+    {
+      c->constalloc = c->constalloc ? 2 * c->constalloc : 16;
+      c->constants
+          = realloc (c->constants, c->constalloc * sizeof (Lisp_Object));
+    }
+  c->constants[c->nconstants] = o;
+  return c->nconstants++;
+}
@@ -0,0 +1,330 @@
+#include "daemon.h"
+#include "alloc.h"
+#include "debug.h"
+#include "eval.h"
+#include "lexer.h"
+#include "lisp.h"
+#include "parser.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+// not available on macos: a closed peer will raise SIGPIPE there
+#define MSG_NOSIGNAL 0
+#endif /* MSG_NOSIGNAL */
+
+// a request being evaluated: the child and the client waiting for its
+// status
+struct request
+{
+  pid_t pid;
+  int fd;
+};
+
+static volatile sig_atomic_t stopping;
+// written to by the SIGCHLD handler, to wake up the poll of the loop
+static int childpipe[2] = { -1, -1 };
+static struct request *requests;
+static int nrequests, allocrequests;
+
+static void on_stop (int sig);
+static void on_child (int sig);
+static void reap_requests ();
+static void send_status (int fd, int code);
+static void serve_request (int fd);
+static int read_request (int fd, int *outfd, int *errfd, char **text,
+                         size_t *len);
+static void close_received_fds (struct msghdr *msg);
+static void run_request (int outfd, int errfd, char *text, size_t len);
+
+int
+daemon_serve (const char *path)
+{
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      fprintf (stderr, "daemon path too long: %s\n", path);
+      return 1;
+    }
+  strcpy (addr.sun_path, path);
+
+  int listenfd = socket (AF_UNIX, SOCK_STREAM, 0);
+  unlink (path);
+  if (listenfd < 0
+      || bind (listenfd, (struct sockaddr *)&addr, sizeof (addr)) < 0
+      || listen (listenfd, 64) < 0)
+    {
+      perror ("daemon bind");
+      return 1;
+    }
+
+  if (pipe (childpipe) < 0)
+    {
+      perror ("daemon pipe");
+      close (listenfd);
+      return 1;
+    }
+  fcntl (childpipe[0], F_SETFL, O_NONBLOCK);
+  fcntl (childpipe[1], F_SETFL, O_NONBLOCK);
+
+  // no SA_RESTART: a signal must interrupt poll
+  struct sigaction sa = { .sa_handler = on_stop };
+  sigemptyset (&sa.sa_mask);
+  sigaction (SIGINT, &sa, NULL);
+  sigaction (SIGTERM, &sa, NULL);
+  struct sigaction sachild = { .sa_handler = on_child,
+                               .sa_flags = SA_NOCLDSTOP };
+  sigemptyset (&sachild.sa_mask);
+  sigaction (SIGCHLD, &sachild, NULL);
+  stopping = 0;
+
+  // whatever was loaded stays shared with the requests, drop the rest
+  gc ();
+  fflush (stdout);
+  fflush (stderr);
+
+  // every connection is handed to a child right away: a slow request,
+  // or a client that never finishes sending one, delays no other.
+  // the status goes back to each client as its child exits
+  while (!stopping)
+    {
+      struct pollfd fds[2] = {
+        { .fd = listenfd, .events = POLLIN },
+        { .fd = childpipe[0], .events = POLLIN },
+      };
+      if (poll (fds, 2, -1) < 0)
+        {
+          if (errno != EINTR)
+            perror ("daemon poll");
+          continue;
+        }
+      if (fds[1].revents)
+        reap_requests ();
+      if (!(fds[0].revents & POLLIN))
+        continue;
+
+      int fd = accept (listenfd, NULL, NULL);
+      if (fd < 0)
+        {
+          if (errno != EINTR)
+            perror ("daemon accept");
+          continue;
+        }
+
+      pid_t pid = fork ();
+      if (pid == 0)
+        {
+          close (listenfd);
+          serve_request (fd);
+        }
+      if (pid < 0)
+        {
+          send_status (fd, 127);
+          close (fd);
+          continue;
+        }
+
+      if (nrequests == allocrequests)
+        {
+          allocrequests = allocrequests ? 2 * allocrequests : 16;
+          requests = realloc (requests,
+                              allocrequests * sizeof (struct request));
+        }
+      requests[nrequests++] = (struct request){ .pid = pid, .fd = fd };
+    }
+
+  // the clients of the requests still running get no status
+  for (int i = 0; i < nrequests; i++)
+    close (requests[i].fd);
+  free (requests);
+  requests = NULL;
+  nrequests = allocrequests = 0;
+  signal (SIGCHLD, SIG_DFL);
+  close (childpipe[0]);
+  close (childpipe[1]);
+  close (listenfd);
+  unlink (path);
+  return 0;
+}
+
+// helpers
+
+static void
+on_stop (int sig)
+{
+  (void)sig;
+  stopping = 1;
+}
+
+static void
+on_child (int sig)
+{
+  (void)sig;
+  int saved = errno;
+  write (childpipe[1], "", 1);
+  errno = saved;
+}
+
+static void
+reap_requests ()
+{
+  char buf[64];
+  while (read (childpipe[0], buf, sizeof (buf)) > 0)
+    ;
+
+  pid_t pid;
+  int status;
+  while ((pid = waitpid (-1, &status, WNOHANG)) > 0)
+    for (int i = 0; i < nrequests; i++)
+      if (requests[i].pid == pid)
+        {
+          send_status (requests[i].fd, WIFEXITED (status)
+                                           ? WEXITSTATUS (status)
+                                           : 128 + WTERMSIG (status));
+          close (requests[i].fd);
+          requests[i] = requests[--nrequests];
+          break;
+        }
+}
+
+static void
+send_status (int fd, int code)
+{
+  unsigned char reply[4] = { code, code >> 8, code >> 16, code >> 24 };
+  send (fd, reply, sizeof (reply), MSG_NOSIGNAL);
+}
+
+static void
+serve_request (int fd)
+{
+  // this is the forked child.  the connections of the other requests
+  // are the daemon's business
+  signal (SIGCHLD, SIG_DFL);
+  close (childpipe[0]);
+  close (childpipe[1]);
+  for (int i = 0; i < nrequests; i++)
+    close (requests[i].fd);
+
+  int outfd, errfd;
+  char *text;
+  size_t len;
+  if (read_request (fd, &outfd, &errfd, &text, &len))
+    exit (1);
+  // the daemon replies on its own copy
+  close (fd);
+  run_request (outfd, errfd, text, len);
+}
+
+static int
+read_request (int fd, int *outfd, int *errfd, char **text, size_t *len)
+{
+  unsigned char version;
+  int fds[2];
+  char control[CMSG_SPACE (sizeof (fds))];
+  struct iovec iov = { .iov_base = &version, .iov_len = 1 };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof (control),
+  };
+
+  ssize_t received = recvmsg (fd, &msg, 0);
+  if (received != 1)
+    {
+      if (received == 0)
+        close_received_fds (&msg);
+      return 1;
+    }
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET
+      || cmsg->cmsg_type != SCM_RIGHTS
+      || cmsg->cmsg_len != CMSG_LEN (sizeof (fds)))
+    {
+      fprintf (stderr, "daemon: request without output descriptors\n");
+      close_received_fds (&msg);
+      return 1;
+    }
+  memcpy (fds, CMSG_DATA (cmsg), sizeof (fds));
+
+  if (version != DAEMON_PROTO_VERSION)
+    {
+      fprintf (stderr, "daemon: unknown protocol version %d\n", version);
+      close (fds[0]);
+      close (fds[1]);
+      return 1;
+    }
+
+  size_t alloc = 4096;
+  *text = malloc (alloc);
+  *len = 0;
+  while (1)
+    {
+      if (*len == alloc)
+        *text = realloc (*text, alloc *= 2);
+      ssize_t n = read (fd, *text + *len, alloc - *len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        break;
+      *len += n;
+    }
+
+  *outfd = fds[0];
+  *errfd = fds[1];
+  return 0;
+}
+
+static void
+close_received_fds (struct msghdr *msg)
+{
+  // a malformed request may still carry descriptors, whatever their
+  // number: they are ours now
+  for (struct cmsghdr *c = CMSG_FIRSTHDR (msg); c; c = CMSG_NXTHDR (msg, c))
+    {
+      if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS)
+        continue;
+      size_t n = (c->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+      for (size_t i = 0; i < n; i++)
+        {
+          int received;
+          memcpy (&received, CMSG_DATA (c) + i * sizeof (int), sizeof (int));
+          close (received);
+        }
+    }
+}
+
+static void
+run_request (int outfd, int errfd, char *text, size_t len)
+{
+  // the stack is the fresh base frame of the daemon, globals are the
+  // ones it loaded
+  signal (SIGINT, SIG_DFL);
+  signal (SIGTERM, SIG_DFL);
+  dup2 (outfd, STDOUT_FILENO);
+  dup2 (errfd, STDERR_FILENO);
+  close (outfd);
+  close (errfd);
+
+  Lexer *l = lex_init ();
+  Stream *s = stream_string (text, len);
+  lex_set_stream (l, s);
+  Lisp_Object res = eval_toplevel (l);
+
+  print_form (res);
+  printf ("\n");
+  fflush (stdout);
+  exit (0);
+}
@@ -0,0 +1,35 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+/*
+  Persistent erlisp daemon, in the spirit of emacs --daemon.
+
+  The daemon loads its libraries once and then listens on a Unix domain
+  socket.  Every request is evaluated in a child forked from the warm
+  daemon: it starts with a fresh stack and dynamic context, but shares
+  the global environment (and the heap pages) loaded by the daemon, and
+  an error in a request cannot take the daemon down.
+
+  Protocol: the client connects and sends a DAEMON_PROTO_VERSION byte
+  carrying its stdout and stderr file descriptors (SCM_RIGHTS), then
+  the program text, then shuts down its writing side.  The request
+  writes straight to the client descriptors.  When it is over the
+  daemon replies with its exit status, 4 bytes little endian.
+
+  The daemon forks as soon as it accepts a connection, and the child
+  reads the request: clients are served concurrently, each getting its
+  status when its own child exits.
+
+  daemon_request lives in daemon_client.c, which depends on nothing
+  else, so that erlisp-client stays small and starts fast.
+ */
+
+#include <stddef.h>
+
+#define DAEMON_PROTO_VERSION 1
+
+int daemon_serve (const char *path);
+int daemon_request (const char *path, const char *text, size_t len,
+                    int outfd, int errfd, int *status);
+
+#endif /* DAEMON_H */
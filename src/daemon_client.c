@@ -0,0 +1,91 @@
+#include "daemon.h"
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+// not available on macos: a closed peer will raise SIGPIPE there
+#define MSG_NOSIGNAL 0
+#endif /* MSG_NOSIGNAL */
+
+int
+daemon_request (const char *path, const char *text, size_t len, int outfd,
+                int errfd, int *status)
+{
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path))
+    {
+      fprintf (stderr, "daemon path too long: %s\n", path);
+      return 1;
+    }
+  strcpy (addr.sun_path, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+    {
+      fprintf (stderr, "cannot connect to daemon %s: %s\n", path,
+               strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return 1;
+    }
+
+  // the version byte carries our output descriptors
+  unsigned char version = DAEMON_PROTO_VERSION;
+  int fds[2] = { outfd, errfd };
+  char control[CMSG_SPACE (sizeof (fds))];
+  struct iovec iov = { .iov_base = &version, .iov_len = 1 };
+  struct msghdr msg = {
+    .msg_iov = &iov,
+    .msg_iovlen = 1,
+    .msg_control = control,
+    .msg_controllen = sizeof (control),
+  };
+  memset (control, 0, sizeof (control));
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+  memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+
+  if (sendmsg (fd, &msg, MSG_NOSIGNAL) != 1)
+    goto fail;
+
+  for (size_t sent = 0; sent < len;)
+    {
+      ssize_t n = send (fd, text + sent, len - sent, MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        goto fail;
+      sent += n;
+    }
+  shutdown (fd, SHUT_WR);
+
+  unsigned char reply[4];
+  size_t got = 0;
+  while (got < sizeof (reply))
+    {
+      ssize_t n = read (fd, reply + got, sizeof (reply) - got);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        goto fail;
+      got += n;
+    }
+
+  *status = reply[0] | reply[1] << 8 | reply[2] << 16 | reply[3] << 24;
+  close (fd);
+  return 0;
+
+fail:
+  fprintf (stderr, "daemon request failed: %s\n",
+           errno ? strerror (errno) : "connection closed");
+  close (fd);
+  return 1;
+}
@@ -1,6 +1,7 @@
 /* #define DEBUG_PRINT 1 */
 
 #include "debug.h"
+#include "bignum.h"
 #include "lisp.h"
 #ifdef DEBUG_PRINT
 #include <stdarg.h>
@@ -37,6 +38,13 @@ print_form (Lisp_Object form)
               unbox_string (form)->data);
       break;
     case LISP_VECT:
+      if (bignum_p (form))
+        {
+          char *digits = bignum_to_string (form);
+          printf ("%s", digits);
+          free (digits);
+          break;
+        }
       printf ("[size:%zu]", unbox_vector (form)->size);
       break;
     case LISP_SUBR:
@@ -47,6 +55,10 @@ print_form (Lisp_Object form)
       printf ("[lambda,%d,%d]", unbox_lambda (form)->minargs,
               unbox_lambda (form)->maxargs);
       break;
+    case LISP_LREF:
+      printf ("#<lref %u %u%s>", lref_depth (form), lref_slot (form),
+              lref_boxed (form) ? " boxed" : "");
+      break;
     case LISP_SYMB:
       printf ("%.*s", (int)unbox_string (unbox_symbol (form)->name)->size,
               unbox_string (unbox_symbol (form)->name)->data);
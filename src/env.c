@@ -9,29 +9,56 @@ Lisp_Object
 env_init ()
 {
   Lisp_Object env = q_nil;
-  stack_push ((struct stackframe){ .fname = "base", .env = env });
+  stack_push ((struct stackframe){ .fun = q_nil, .env = env });
   return env;
 }
 
 Lisp_Object
 env_new (Lisp_Object parent, Lisp_Object symbol)
 {
-  Lisp_Object newcell = make_cons (unbox_symbol (symbol)->name, symbol);
-  return make_cons (newcell, parent);
+  return make_cons (symbol, parent);
 }
 
 Lisp_Object
 env_lookup (Lisp_Object env, Lisp_Object symbol)
 {
   // TODO type safety
-  return env_lookup_name (env, unbox_symbol (symbol)->name);
+  for (; type_of (env) == LISP_CONS; env = f_cdr (env))
+    if (eq (f_car (env), symbol))
+      return symbol;
+  return q_nil;
 }
 
 Lisp_Object
 env_lookup_name (Lisp_Object env, Lisp_Object name)
 {
   // TODO type safety
-  return f_cdr (f_assoc (name, env));
+  for (; type_of (env) == LISP_CONS; env = f_cdr (env))
+    if (!nil (f_string_equal_p (unbox_symbol (f_car (env))->name, name)))
+      return f_car (env);
+  return q_nil;
+}
+
+Lisp_Object
+env_frame_new (Lisp_Object parent, size_t nslots)
+{
+  Lisp_Object frame = make_vector (nslots + 1);
+  unbox_vector (frame)->contents[0] = parent;
+  return frame;
+}
+
+Lisp_Object
+env_closure (Lisp_Object frame, Lisp_Object *refs, size_t n)
+{
+  if (n == 0)
+    return q_nil;
+
+  // boxes are copied as is: the closure shares them
+  Lisp_Object closure = env_frame_new (q_nil, n);
+  for (size_t i = 0; i < n; i++)
+    unbox_vector (closure)->contents[i + 1]
+        = *env_frame_slot (frame, refs[i]);
+  return closure;
 }
 
 // TODO: this implementation makes multithreading impossible.
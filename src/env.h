@@ -3,10 +3,59 @@
 
 #include "lisp.h"
 
+/*
+  Two kinds of environments.
+
+  Global definitions live in the value cell of their symbol: symbols
+  are interned by the reader, so the same name is always the same (eq)
+  symbol and a global lookup is a single load.  An env is also a plain
+  list of symbols, searched by eq (env_lookup) or by name
+  (env_lookup_name); l_globalenv is the empty one at toplevel.
+
+  Lexical environments are frames: a frame is a vector whose first
+  element is the parent frame (nil at toplevel) and the others are the
+  slots of the variables bound by one lambda call or let.  Variable
+  references are resolved to (depth, slot) ahead of evaluation, see
+  resolve.h, so looking a variable up is just following DEPTH parents.
+
+  A closure does not keep the frames it is created in: it copies the
+  slots of the variables it references into a flat frame of its own,
+  with no parent (env_closure), that the frames of its calls chain to.
+ */
+
 Lisp_Object env_init ();
 Lisp_Object env_new (Lisp_Object parent, Lisp_Object symbol);
 Lisp_Object env_lookup (Lisp_Object env, Lisp_Object symbol);
 Lisp_Object env_lookup_name (Lisp_Object env, Lisp_Object name);
 Lisp_Object env_current ();
+Lisp_Object env_frame_new (Lisp_Object parent, size_t nslots);
+/* the frame of a closure created in FRAME, holding the N slots REFS
+   (lexical references from FRAME).  nil when N is 0 */
+Lisp_Object env_closure (Lisp_Object frame, Lisp_Object *refs, size_t n);
+
+static inline Lisp_Object *
+env_frame_slot (Lisp_Object frame, Lisp_Object lref)
+{
+  for (uint32_t depth = lref_depth (lref); depth > 0; depth--)
+    frame = unbox_vector (frame)->contents[0];
+  return &unbox_vector (frame)->contents[lref_slot (lref) + 1];
+}
+
+static inline Lisp_Object
+env_frame_ref (Lisp_Object frame, Lisp_Object lref)
+{
+  Lisp_Object value = *env_frame_slot (frame, lref);
+  return lref_boxed (lref) ? f_car (value) : value;
+}
+
+static inline void
+env_frame_set (Lisp_Object frame, Lisp_Object lref, Lisp_Object value)
+{
+  Lisp_Object *slot = env_frame_slot (frame, lref);
+  if (lref_boxed (lref))
+    f_setcar (*slot, value);
+  else
+    *slot = value;
+}
 
 #endif /* ENV_H */
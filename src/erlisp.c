@@ -1,17 +1,28 @@
 #include "alloc.h"
+#include "daemon.h"
 #include "debug.h"
 #include "env.h"
 #include "eval.h"
+#include "jit.h"
 #include "lexer.h"
 #include "lisp.h"
+#include "load.h"
+#include "obarray.h"
 #include "parser.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #ifdef HAVE_READLINE
 #include <readline/history.h>
 #include <readline/readline.h>
 #endif /* HAVE_READLINE */
 
+static Lisp_Object eval_file (Lexer *l, const char *filename);
+static int prefork (Lexer *l, int nworkers, const char *filename);
+static void print_worker_rss (int id);
+
 int
 main (int argc, char **argv)
 {
@@ -26,6 +37,15 @@ main (int argc, char **argv)
   init_builtins ();
   l = lex_init ();
 
+  if (argc > 1 && strcmp (argv[1], "--jit") == 0)
+    {
+      jit_enable ();
+      // drop the option, keeping the program name
+      argv[1] = argv[0];
+      argc--;
+      argv++;
+    }
+
   if (argc == 1)
     {
       // repl
@@ -82,9 +102,41 @@ main (int argc, char **argv)
       return 0;
     }
 
+  if (strcmp (argv[1], "--prefork") == 0)
+    {
+      if (argc != 4 || atoi (argv[2]) <= 0)
+        {
+          fprintf (stderr, "usage: %s --prefork N FILE\n", argv[0]);
+          exit (1);
+        }
+      return prefork (l, atoi (argv[2]), argv[3]);
+    }
+
+  if (strcmp (argv[1], "--daemon") == 0)
+    {
+      if (argc < 3)
+        {
+          fprintf (stderr, "usage: %s --daemon SOCKET [FILE...]\n",
+                   argv[0]);
+          exit (1);
+        }
+      // preload libraries, shared by every request
+      for (int i = 3; i < argc; i++)
+        load_file (argv[i], NULL);
+      return daemon_serve (argv[2]);
+    }
+
   // parse and eval file
 
-  const char *filename = argv[1];
+  res = eval_file (l, argv[1]);
+  print_form (res);
+  printf ("\n");
+  return 0;
+}
+
+static Lisp_Object
+eval_file (Lexer *l, const char *filename)
+{
   FILE *f = fopen (filename, "r");
   if (!f)
     {
@@ -92,14 +144,90 @@ main (int argc, char **argv)
       exit (2);
     }
 
-  s = stream_file (f);
+  Stream *s = stream_file (f);
   lex_set_stream (l, s);
-  prog = parse (l);
-  res = eval (l_globalenv, prog);
+  Lisp_Object res = eval_toplevel (l);
 
-  print_form (res);
-  printf ("\n");
   fclose (f);
   stream_close (s);
-  return 0;
+  return res;
+}
+
+/*
+  Load FILE once, then fork NWORKERS children sharing its heap pages
+  copy-on-write.  Each worker calls (worker-main ID) if FILE defines
+  it.  GC marks are kept out of the heap pages (see blkalloc.h), so a
+  gc in a worker only dirties pages it really writes to.
+ */
+static int
+prefork (Lexer *l, int nworkers, const char *filename)
+{
+  eval_file (l, filename);
+  // collect the garbage of loading now, or every worker would copy
+  // the pages freed by its own first gc
+  gc ();
+  fflush (stdout);
+
+  pid_t *pids = malloc (nworkers * sizeof (pid_t));
+  for (int i = 0; i < nworkers; i++)
+    {
+      pids[i] = fork ();
+      if (pids[i] < 0)
+        {
+          perror ("fork");
+          exit (2);
+        }
+      if (pids[i] > 0)
+        continue;
+
+      // worker
+      Lisp_Object mainsym = obarray_intern (v_obarray, "worker-main", 11);
+      if (!eq (unbox_symbol (mainsym)->value, q_unbound))
+        eval (env_current (),
+              f_cons (mainsym, f_cons (box_int (i), q_nil)));
+      gc ();
+      print_worker_rss (i);
+      exit (0);
+    }
+
+  int failed = 0;
+  for (int i = 0; i < nworkers; i++)
+    {
+      int status;
+      if (waitpid (pids[i], &status, 0) < 0 || !WIFEXITED (status)
+          || WEXITSTATUS (status) != 0)
+        failed = 1;
+    }
+  free (pids);
+  return failed;
+}
+
+static void
+print_worker_rss (int id)
+{
+  // smaps_rollup is linux only, from 4.14
+  FILE *f = fopen ("/proc/self/smaps_rollup", "r");
+  if (!f)
+    {
+      printf ("worker %d (%d): private RSS unavailable\n", id, getpid ());
+      fflush (stdout);
+      return;
+    }
+
+  char line[256];
+  long kb, private = 0, shared = 0;
+  while (fgets (line, sizeof (line), f))
+    {
+      if (sscanf (line, "Private_Clean: %ld kB", &kb) == 1
+          || sscanf (line, "Private_Dirty: %ld kB", &kb) == 1)
+        private += kb;
+      else if (sscanf (line, "Shared_Clean: %ld kB", &kb) == 1
+               || sscanf (line, "Shared_Dirty: %ld kB", &kb) == 1)
+        shared += kb;
+    }
+  fclose (f);
+
+  printf ("worker %d (%d): private RSS %ld kB, shared %ld kB\n", id,
+          getpid (), private, shared);
+  fflush (stdout);
 }
@@ -1,46 +1,190 @@
 #include "eval.h"
 #include "alloc.h"
+#include "bytecode.h"
 #include "debug.h"
 #include "env.h"
 #include "lisp.h"
+#include "macro.h"
 #include "obarray.h"
+#include "parser.h"
+#include "resolve.h"
+#include <stdlib.h>
+#include <string.h>
+
+static Lisp_Object function_of (Lisp_Object env, Lisp_Object funsym);
+static Lisp_Object apply_form (Lisp_Object env, Lisp_Object fun,
+                               Lisp_Object form);
+static Lisp_Object *eval_args (Lisp_Object env, Lisp_Object funargs,
+                               int minargs, int maxargs, int *arity);
+static Lisp_Object *eval_lambda_args (Lisp_Object env, Lisp_Lambda *lambda,
+                                      Lisp_Object funargs);
+static int has_args (Lisp_Object args, int n);
+static Lisp_Object progn_but_last (Lisp_Object env, Lisp_Object body);
+static enum special_form special_form_of (Lisp_Object head);
+static int arith_op (Lisp_Object fun, Lisp_Object args);
+static int tail_special (Lisp_Object env, enum special_form special,
+                         Lisp_Object args, Lisp_Object *out);
+static Lisp_Object eval_special (Lisp_Object env, enum special_form special,
+                                 Lisp_Object args);
+static int binds_special (Lisp_Vector *bindings);
+static Lisp_Object let_bind (Lisp_Object env, Lisp_Vector *bindings);
+static void enter_frame (int *pushed, Lisp_Object fun, Lisp_Object env);
+static Lisp_Object *iteration_var (Lisp_Object frame, Lisp_Object var);
 
 Lisp_Object
 eval (Lisp_Object env, Lisp_Object form)
 {
   Lisp_Object res;
+  // forms in tail position are evaluated by looping here instead of
+  // recursing: the last form of a body, the branches of if, when,
+  // unless and cond, the last operand of and and or.  interpreted
+  // lambdas and lets entered from there run in the single stack
+  // frame this eval pushes for the first of them, so tail recursion
+  // takes constant C and lisp stack
+  int pushed = 0;
+
   debug_printf ("EVAL ");
   debug_print_form (form);
   debug_printf (" --> ");
-  switch (type_of (form))
+
+  for (;;)
     {
-    case LISP_INTG:
-    case LISP_STRG:
-    case LISP_VECT:
-    case LISP_SUBR:
-    case LISP_LMBD:
-      // eval to themself
-      res = form;
-      break;
-    case LISP_SYMB:
-      res = eval_symbol (env, form);
-      break;
-    case LISP_CONS:
-      res = call_function (env, form);
-      break;
-    default:
-      // TODO
-      exit (666);
+      switch (type_of (form))
+        {
+        case LISP_INTG:
+        case LISP_STRG:
+        case LISP_VECT:
+        case LISP_SUBR:
+        case LISP_LMBD:
+          // eval to themself
+          res = form;
+          goto out;
+        case LISP_SYMB:
+          res = eval_symbol (form);
+          goto out;
+        case LISP_LREF:
+          res = env_frame_ref (env, form);
+          goto out;
+        case LISP_CONS:
+          break;
+        default:
+          // TODO
+          exit (666);
+        }
+
+      Lisp_Object head = f_car (form);
+      Lisp_Object args = f_cdr (form);
+      enum special_form special = special_form_of (head);
+
+      // too few args are reported by apply_form
+      if (special && has_args (args, unbox_subr (unbox_symbol (head)->value)
+                                          ->minargs))
+        switch (special)
+          {
+          case SF_QUOTE:
+            res = f_car (args);
+            goto out;
+          case SF_LET:
+            {
+              resolve_let_form (args, NULL);
+              Lisp_Vector *bindings = unbox_vector (f_car (args));
+              // dynamic bindings are undone after the body, which is
+              // then not in tail position
+              if (binds_special (bindings))
+                {
+                  res = let (env, args);
+                  goto out;
+                }
+              Lisp_Object letenv = let_bind (env, bindings);
+              enter_frame (&pushed, q_let, letenv);
+              env = letenv;
+              form = progn_but_last (env, f_cdr (args));
+              continue;
+            }
+          case SF_PROGN:
+          case SF_IF:
+          case SF_WHEN:
+          case SF_UNLESS:
+          case SF_COND:
+          case SF_AND:
+          case SF_OR:
+            if (!tail_special (env, special, args, &res))
+              // res is the value
+              goto out;
+            form = res;
+            continue;
+          default:
+            res = eval_special (env, special, args);
+            goto out;
+          }
+
+      Lisp_Object fun = function_of (env, head);
+
+      if (type_of (head) == LISP_SYMB && macro_p (fun))
+        {
+          // once: the call is replaced by its expansion, see macro.h
+          macroexpand (form);
+          continue;
+        }
+
+      int op = arith_op (fun, args);
+      if (op)
+        {
+          // binary arithmetic: no arg vector, no subr call on fixnums.
+          // X may be a bignum: the gc must see it while Y is evaluated
+          Lisp_Object *x = values_top ();
+          x = values_push (x, eval (env, f_car (args)));
+          Lisp_Object y = eval (env, f_car (f_cdr (args)));
+          res = byte_arith (op, *x, y);
+          values_unwind (x);
+          goto out;
+        }
+
+      if (type_of (fun) == LISP_LMBD && nil (unbox_lambda (fun)->bytecode))
+        {
+          Lisp_Lambda *lambda = unbox_lambda (fun);
+          Lisp_Object *argvals = eval_lambda_args (env, lambda, args);
+          if (!argvals)
+            {
+              res = q_nil;
+              goto out;
+            }
+
+          if (!lambda->resolved)
+            resolve_lambda (lambda);
+
+          // new frame binding the args, child of the frame the lambda
+          // was created in
+          Lisp_Object frame
+              = env_frame_new (lambda->env, lambda_nslots (lambda));
+          memcpy (unbox_vector (frame)->contents + 1, argvals,
+                  lambda_nslots (lambda) * sizeof (Lisp_Object));
+          values_unwind (argvals);
+
+          enter_frame (&pushed, fun, frame);
+          env = frame;
+          form = progn_but_last (env, lambda->form);
+          continue;
+        }
+
+      res = apply_form (env, fun, form);
+      goto out;
     }
 
+out:
+  if (pushed)
+    stack_pop_free ();
+
   debug_print_form (res);
   debug_printf ("\n");
   return res;
 }
 
 Lisp_Object
-eval_symbol (Lisp_Object env, Lisp_Object symbol)
+eval_symbol (Lisp_Object symbol)
 {
+  // only free variables get here: lexical ones are resolved to frame
+  // slots, see resolve.h
   if (eq (symbol, q_t))
     return q_t;
   if (eq (symbol, q_nil))
@@ -48,59 +192,435 @@ eval_symbol (Lisp_Object env, Lisp_Object symbol)
   if (eq (symbol, q_unbound))
     return q_unbound;
 
-  Lisp_Object val;
-  Lisp_Symbol *usymbol = unbox_symbol (symbol);
+  // global values live in the value cell of the (interned) symbol
+  Lisp_Object val = unbox_symbol (symbol)->value;
+  if (eq (val, q_unbound))
+    {
+      // todo err
+      fprintf (stderr, "unbound symbol: %s\n",
+               unbox_string (unbox_symbol (symbol)->name)->data);
+      print_backtrace (stderr);
+      exit (13);
+    }
+  return val;
+}
+
+Lisp_Object
+call_function (Lisp_Object env, Lisp_Object form)
+{
+  return apply_form (env, function_of (env, f_car (form)), form);
+}
+
+Lisp_Object
+call_unevalled_subr (Lisp_Subr *usubr, Lisp_Object form)
+{
+  return usubr->call (usubr, 1, &form);
+}
+
+Lisp_Object
+call_subr (Lisp_Subr *usubr, int argc, Lisp_Object *argvals)
+{
+  return usubr->call (usubr, argc, argvals);
+}
+
+// the calling convention of subrs, see lisp.h
 
-  val = usymbol->value;
-  if (!eq (val, q_unbound))
+Lisp_Object
+subr_call_0 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv UNUSED)
+{
+  return subr->function.f0 ();
+}
+
+Lisp_Object
+subr_call_1 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f1 (argv[0]);
+}
+
+Lisp_Object
+subr_call_2 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f2 (argv[0], argv[1]);
+}
+
+Lisp_Object
+subr_call_3 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f3 (argv[0], argv[1], argv[2]);
+}
+
+Lisp_Object
+subr_call_4 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f4 (argv[0], argv[1], argv[2], argv[3]);
+}
+
+Lisp_Object
+subr_call_5 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f5 (argv[0], argv[1], argv[2], argv[3], argv[4]);
+}
+
+Lisp_Object
+subr_call_6 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f6 (argv[0], argv[1], argv[2], argv[3], argv[4],
+                            argv[5]);
+}
+
+Lisp_Object
+subr_call_7 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f7 (argv[0], argv[1], argv[2], argv[3], argv[4],
+                            argv[5], argv[6]);
+}
+
+Lisp_Object
+subr_call_8 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f8 (argv[0], argv[1], argv[2], argv[3], argv[4],
+                            argv[5], argv[6], argv[7]);
+}
+
+Lisp_Object
+subr_call_888 (Lisp_Subr *subr, int argc UNUSED, Lisp_Object *argv)
+{
+  return subr->function.f888 (argv[0]);
+}
+
+Lisp_Object
+subr_call_999 (Lisp_Subr *subr, int argc, Lisp_Object *argv)
+{
+  return subr->function.f999 (argc, argv);
+}
+
+Lisp_Object
+call_lambda (Lisp_Lambda *ulambda, Lisp_Object *argvals)
+{
+  if (!nil (ulambda->bytecode))
+    return exec_byte_code (ulambda, argvals);
+
+  if (!ulambda->resolved)
+    resolve_lambda (ulambda);
+
+  // new frame binding the args, child of the frame the lambda was
+  // created in
+  Lisp_Object frame = env_frame_new (ulambda->env, lambda_nslots (ulambda));
+  Lisp_Object *slots = unbox_vector (frame)->contents + 1;
+  for (int i = 0; i < lambda_nslots (ulambda); i++)
+    slots[i] = argvals[i];
+
+  stack_current_set_env (frame);
+
+  // recursively eval the lambda body
+  return progn (frame, ulambda->form);
+}
+
+Lisp_Object *
+bind_args (Lisp_Lambda *lambda, Lisp_Object *argvals, int nargs)
+{
+  for (; nargs < lambda->maxargs; nargs++)
+    argvals = values_push (argvals, q_nil);
+  if (lambda->rest != REST_LIST)
+    return argvals;
+
+  // the extra args are left above the list, unwound with the others
+  Lisp_Object rest = q_nil;
+  for (int i = nargs - 1; i >= lambda->maxargs; i--)
+    rest = f_cons (argvals[i], rest);
+  if (nargs == lambda->maxargs)
+    argvals = values_push (argvals, rest);
+  else
+    argvals[lambda->maxargs] = rest;
+  return argvals;
+}
+
+Lisp_Object
+progn (Lisp_Object env, Lisp_Object form)
+{
+  // TODO it seems that in every function i have used a different way to
+  // traverse the list... awful, pls consistency!!!
+  Lisp_Object val = q_nil;
+  Lisp_Object tail = form;
+
+  while (!eq (tail, q_nil))
     {
-      // value already in the symbol
-      return val;
+      val = eval (env, f_car (tail));
+      tail = f_cdr (tail);
     }
 
-  Lisp_Object lookedup;
-  // lookup symbol in env
-  lookedup = env_lookup (env, symbol);
-  if (eq (lookedup, q_unbound) || eq (lookedup, q_nil))
+  return val;
+}
+
+Lisp_Object
+let (Lisp_Object env, Lisp_Object form)
+{
+  resolve_let_form (form, NULL);
+
+  // bindings are [var1 init1 var2 init2 ...], see resolve.h
+  Lisp_Vector *bindings = unbox_vector (f_car (form));
+  Lisp_Object body = f_cdr (form);
+
+  size_t count = specpdl_index ();
+  Lisp_Object letenv = let_bind (env, bindings);
+
+  stack_push ((struct stackframe){ .fun = q_let, .env = letenv });
+  Lisp_Object res = progn (letenv, body);
+  stack_pop_free ();
+  unbind_to (count);
+
+  return res;
+}
+
+Lisp_Object
+define (Lisp_Object env, Lisp_Object form)
+{
+  Lisp_Object var = f_car (form);
+  // type safe must be symbol
+  Lisp_Object value = eval (env, f_car (f_cdr (form)));
+  // definitions are always global: the symbol is interned, so its
+  // value cell is the global binding
+  unbox_symbol (var)->value = value;
+
+  return value;
+}
+
+Lisp_Object
+defvar (Lisp_Object env, Lisp_Object form)
+{
+  Lisp_Object var = f_car (form);
+  Lisp_Symbol *usymbol = unbox_symbol (var);
+  usymbol->special = 1;
+
+  // like emacs, an existing value is kept
+  if (eq (usymbol->value, q_unbound) && !nil (f_cdr (form)))
+    usymbol->value = eval (env, f_car (f_cdr (form)));
+
+  return var;
+}
+
+Lisp_Object
+lambda (Lisp_Object env, Lisp_Object form)
+{
+  // a lambda nested in a resolved body is already resolved, with its
+  // enclosing scope. otherwise it is a toplevel one
+  resolve_lambda_form (form, NULL);
+
+  // the args are followed by the references to the captured
+  // variables, see resolve.h
+  Lisp_Vector *args = unbox_vector (f_car (form));
+  Lisp_Object body = f_cdr (form);
+  size_t n = lambda_nargs (args);
+  Lisp_Object *names = malloc (n * sizeof (Lisp_Object));
+  int minargs, maxargs;
+  enum lambda_rest rest;
+  lambda_list (args->contents, n, names, &minargs, &maxargs, &rest);
+
+  Lisp_Object lambda = make_lambda (minargs, maxargs, rest, names, body);
+  free (names);
+  unbox_lambda (lambda)->env
+      = env_closure (env, args->contents + n, args->size - n);
+  unbox_lambda (lambda)->resolved = 1;
+  return lambda;
+}
+
+Lisp_Object
+setq (Lisp_Object env, Lisp_Object form)
+{
+  // (setq VAR VALUE ...), VARs resolved in place like any reference
+  Lisp_Object value = q_nil;
+
+  for (; !nil (form); form = f_cdr (f_cdr (form)))
     {
-      // lookup symbol in obarray
-      lookedup = obarray_lookup (v_obarray, symbol);
-      if (type_of (lookedup) != LISP_SYMB)
+      Lisp_Object var = f_car (form);
+      value = eval (env, f_car (f_cdr (form)));
+      switch (type_of (var))
         {
-          // todo err
-          fprintf (stderr, "unbound symbol: %s\n",
-                   unbox_string (unbox_symbol (symbol)->name)->data);
-          exit (13);
+        case LISP_LREF:
+          env_frame_set (env, var, value);
+          break;
+        case LISP_SYMB:
+          if (eq (var, q_nil) || eq (var, q_t))
+            {
+              // TODO err
+              fprintf (stderr, "setq: constant symbol\n");
+              exit (31);
+            }
+          // a global, or a special variable
+          unbox_symbol (var)->value = value;
+          break;
+        default:
+          // TODO err
+          fprintf (stderr, "setq: not a variable: %s\n",
+                   type_name (type_of (var)));
+          exit (31);
         }
     }
 
-  // store val in symbol for faster lookups. TODO is this dangerous?
-  val = unbox_symbol (lookedup)->value;
-  return val;
+  return value;
 }
 
 Lisp_Object
-call_function (Lisp_Object env, Lisp_Object form)
+while_loop (Lisp_Object env, Lisp_Object form)
 {
-  // TODO refactor and rationalize this function. rather ugly code.
-  Lisp_Object result;
-  Lisp_Subr *subr;
-  Lisp_Lambda *lambda;
-  int minargs;
-  int maxargs;
-  const char *fname;
+  Lisp_Object test = f_car (form);
+  Lisp_Object body = f_cdr (form);
 
-  Lisp_Object funsym = f_car (form);
-  Lisp_Object funargs = f_cdr (form);
+  while (!nil (eval (env, test)))
+    progn (env, body);
 
-  Lisp_Object fun = eval_symbol (env, funsym);
+  return q_nil;
+}
+
+Lisp_Object
+dotimes (Lisp_Object env, Lisp_Object form)
+{
+  resolve_iteration_form (form, NULL);
+
+  // spec is [var count result], see resolve.h
+  Lisp_Vector *spec = unbox_vector (f_car (form));
+  Lisp_Object body = f_cdr (form);
+  Lisp_Object count = eval (env, spec->contents[1]);
+  if (type_of (count) != LISP_INTG)
+    {
+      // TODO err
+      fprintf (stderr, "dotimes: count is not an integer\n");
+      exit (31);
+    }
+
+  size_t specount = specpdl_index ();
+  // one frame for the whole loop: the variable is set in place
+  Lisp_Object frame = env_frame_new (env, 1);
+  Lisp_Object *place = iteration_var (frame, spec->contents[0]);
+
+  stack_push ((struct stackframe){ .fun = q_dotimes, .env = frame });
+  for (Lisp_Integer i = 0, n = unbox_int (count); i < n; i++)
+    {
+      *place = box_int (i);
+      progn (frame, body);
+    }
+  *place = count;
+  Lisp_Object res = eval (frame, spec->contents[2]);
+  stack_pop_free ();
+  unbind_to (specount);
+
+  return res;
+}
+
+Lisp_Object
+dolist (Lisp_Object env, Lisp_Object form)
+{
+  resolve_iteration_form (form, NULL);
+
+  // spec is [var list result], see resolve.h
+  Lisp_Vector *spec = unbox_vector (f_car (form));
+  Lisp_Object body = f_cdr (form);
+  Lisp_Object list = eval (env, spec->contents[1]);
+
+  size_t specount = specpdl_index ();
+  // the second slot, never referenced, keeps the rest of the list
+  // from the gc
+  Lisp_Object frame = env_frame_new (env, 2);
+  Lisp_Object *tail = &unbox_vector (frame)->contents[2];
+  Lisp_Object *place = iteration_var (frame, spec->contents[0]);
+
+  stack_push ((struct stackframe){ .fun = q_dolist, .env = frame });
+  for (*tail = list; type_of (*tail) == LISP_CONS; *tail = f_cdr (*tail))
+    {
+      *place = f_car (*tail);
+      progn (frame, body);
+    }
+  *place = q_nil;
+  Lisp_Object res = eval (frame, spec->contents[2]);
+  stack_pop_free ();
+  unbind_to (specount);
+
+  return res;
+}
+
+void
+print_backtrace (FILE *out)
+{
+  // frames only keep what they call: names are looked up here, so
+  // that calls pay nothing for them
+  for (int i = stack_index (); i > 0; i--)
+    {
+      Lisp_Object fun = stack_at (i).fun;
+      Lisp_Object name;
+
+      switch (type_of (fun))
+        {
+        case LISP_SUBR:
+          fprintf (out, "  %s\n", unbox_subr (fun)->name);
+          break;
+        case LISP_LMBD:
+          // a global function, or an anonymous one
+          name = obarray_find_value (v_obarray, fun);
+          if (!nil (name))
+            fprintf (out, "  %s\n",
+                     unbox_string (unbox_symbol (name)->name)->data);
+          else
+            fprintf (out, "  lambda(%d, %d)\n", unbox_lambda (fun)->minargs,
+                     unbox_lambda (fun)->maxargs);
+          break;
+        case LISP_SYMB:
+          if (!nil (fun))
+            fprintf (out, "  %s\n",
+                     unbox_string (unbox_symbol (fun)->name)->data);
+          break;
+        default:
+          break;
+        }
+    }
+}
+
+Lisp_Object
+eval_toplevel (Lexer *l)
+{
+  // read and evaluate one form at a time in the base frame, like the
+  // repl does: a define inside a (progn ...) of the whole file would
+  // be gone when the progn returns, and forms not read yet are not
+  // exposed to a gc run by the ones before
+  Lisp_Object result = q_nil;
+  Token tok;
+  while ((tok = lex_next (l)).type != TOK_EOF)
+    result = eval (env_current (), parse_sexp_from_tok (l, tok));
+  return result;
+}
+
+// helpers
+
+static Lisp_Object
+function_of (Lisp_Object env, Lisp_Object funsym)
+{
+  // a symbol head is read straight from its value cell, so that an
+  // unbound one is reported as a function
+  if (type_of (funsym) != LISP_SYMB)
+    return eval (env, funsym);
+
+  Lisp_Object fun = unbox_symbol (funsym)->value;
   if (eq (fun, q_unbound))
     {
       // TODO err unbound function
       fprintf (stderr, "unbound function: '%s'\n",
                unbox_string (unbox_symbol (funsym)->name)->data);
+      print_backtrace (stderr);
       exit (2);
     }
+  return fun;
+}
+
+static Lisp_Object
+apply_form (Lisp_Object env, Lisp_Object fun, Lisp_Object form)
+{
+  // TODO refactor and rationalize this function. rather ugly code.
+  Lisp_Object result;
+  Lisp_Subr *subr;
+  Lisp_Lambda *lambda;
+  int minargs;
+  int maxargs;
+  Lisp_Object funsym = f_car (form);
+  Lisp_Object funargs = f_cdr (form);
 
   switch (type_of (fun))
     {
@@ -108,17 +628,12 @@ call_function (Lisp_Object env, Lisp_Object form)
       subr = unbox_subr (fun);
       minargs = subr->minargs;
       maxargs = subr->maxargs;
-      fname = subr->name;
       break;
     case LISP_LMBD:
       lambda = unbox_lambda (fun);
       minargs = lambda->minargs;
-      maxargs = lambda->maxargs;
-      {
-        char buf[30];
-        sprintf (buf, "lambda(%d, %d)", minargs, maxargs);
-        fname = buf;
-      }
+      // the args past maxargs go to bind_args
+      maxargs = lambda->rest ? MANY : lambda->maxargs;
       break;
     default:
       // TODO error
@@ -129,216 +644,300 @@ call_function (Lisp_Object env, Lisp_Object form)
       printf (" -> ");
       print_form (fun);
       printf ("\n");
+      print_backtrace (stderr);
       exit (12);
     }
 
-  int nargs = unbox_int (f_length (funargs));
-
-  if (nargs < minargs || nargs > maxargs)
-    {
-      // TODO error
-      fprintf (stderr,
-               "wrong n of arguments: got %d, expected min %d, max %d\n",
-               nargs, minargs, maxargs);
-      return q_nil;
-    }
-
-  stack_push ((struct stackframe){ .fname = fname, .env = env });
-
-  /* number of arguments the function will be called with */
-  int arity;
-  switch (maxargs)
+  if (maxargs == UNEVALLED)
     {
-    case MANY:
-      arity = nargs;
-      break;
-    case UNEVALLED:
       // this UNEVALLED in maxargs is a old dirty trick in emacs lisp.
       // what really this means is that this is not a real function ma like a
       // macro that directly manipulates lisp forms instead that data, and it
       // must be expanded rather than evaluated
-
       if (type_of (fun) == LISP_LMBD)
         {
           // TODO ugly if, this code sucks
           fprintf (stderr, "lambda cannot have unevalled args\n");
           exit (23);
         }
-      // TODO ugly return in a switch that should decide arity!
+      stack_push ((struct stackframe){ .fun = fun, .env = env });
       result = call_unevalled_subr (subr, funargs);
       stack_pop_free ();
       return result;
-    default:
-      arity = maxargs;
     }
 
-  Lisp_Object *argvals = malloc (arity * sizeof (Lisp_Object));
-  Lisp_Object argtail = funargs;
-
-  for (int i = 0; i < arity; i++)
-    {
-      if (i >= nargs)
-        {
-          // pad with nils
-          argvals[i] = q_nil;
-          continue;
-        }
+  int arity;
+  Lisp_Object *argvals = eval_args (env, funargs, minargs, maxargs, &arity);
+  if (!argvals)
+    return q_nil;
+  if (type_of (fun) == LISP_LMBD && lambda->rest)
+    argvals = bind_args (lambda, argvals, arity);
 
-      argvals[i] = eval (env, f_car (argtail));
-      argtail = f_cdr (argtail);
-    }
+  stack_push ((struct stackframe){ .fun = fun, .env = env });
 
   if (type_of (fun) == LISP_SUBR)
-    result = call_subr (subr, maxargs, arity, argvals);
+    result = call_subr (subr, arity, argvals);
   else // is lambda
-    result = call_lambda (env, lambda, argvals);
+    result = call_lambda (lambda, argvals);
 
-  free (argvals);
+  values_unwind (argvals);
 
   stack_pop_free ();
 
   return result;
 }
 
-Lisp_Object
-call_unevalled_subr (Lisp_Subr *usubr, Lisp_Object form)
+static Lisp_Object *
+eval_args (Lisp_Object env, Lisp_Object funargs, int minargs, int maxargs,
+           int *arity)
 {
-  return usubr->function.f888 (form);
-}
+  // evaluates FUNARGS on the value stack, padded with nils up to
+  // MAXARGS, ARITY of them.  returns where they start, to be unwound
+  // by the caller, or NULL if there are too few or too many
+  Lisp_Object *argvals = values_top ();
+  int nargs = 0;
 
-Lisp_Object
-call_subr (Lisp_Subr *usubr, int maxargs, int arity, Lisp_Object *argvals)
-{
-  if (maxargs == MANY)
-    return usubr->function.f999 (arity, argvals);
+  for (; type_of (funargs) == LISP_CONS && nargs != maxargs;
+       funargs = f_cdr (funargs), nargs++)
+    argvals = values_push (argvals, eval (env, f_car (funargs)));
 
-  switch (arity)
+  if (nargs < minargs || type_of (funargs) == LISP_CONS)
     {
-    case 0:
-      return usubr->function.f0 ();
-      break;
-    case 1:
-      return usubr->function.f1 (argvals[0]);
-      break;
-    case 2:
-      return usubr->function.f2 (argvals[0], argvals[1]);
-      break;
-    case 3:
-      return usubr->function.f3 (argvals[0], argvals[1], argvals[2]);
-      break;
-    case 4:
-      return usubr->function.f4 (argvals[0], argvals[1], argvals[2],
-                                 argvals[3]);
-      break;
-    case 5:
-      return usubr->function.f5 (argvals[0], argvals[1], argvals[2],
-                                 argvals[3], argvals[4]);
-      break;
-    case 6:
-      return usubr->function.f6 (argvals[0], argvals[1], argvals[2],
-                                 argvals[3], argvals[4], argvals[5]);
-      break;
-    case 7:
-      return usubr->function.f7 (argvals[0], argvals[1], argvals[2],
-                                 argvals[3], argvals[4], argvals[5],
-                                 argvals[6]);
-    case 8:
-      return usubr->function.f8 (argvals[0], argvals[1], argvals[2],
-                                 argvals[3], argvals[4], argvals[5],
-                                 argvals[6], argvals[7]);
-    default:
+      nargs += unbox_int (f_length (funargs));
       // TODO error
-      fprintf (stderr, "max explicit SUBR arguments is 8\n");
-      exit (321);
+      fprintf (stderr,
+               "wrong n of arguments: got %d, expected min %d, max %d\n",
+               nargs, minargs, maxargs);
+      print_backtrace (stderr);
+      values_unwind (argvals);
+      return NULL;
     }
+
+  /* number of arguments the function will be called with */
+  *arity = nargs;
+  if (maxargs != MANY)
+    for (; *arity < maxargs; (*arity)++)
+      argvals = values_push (argvals, q_nil);
+
+  return argvals;
 }
 
-Lisp_Object
-call_lambda (Lisp_Object env, Lisp_Lambda *ulambda, Lisp_Object *argvals)
+static Lisp_Object *
+eval_lambda_args (Lisp_Object env, Lisp_Lambda *lambda, Lisp_Object funargs)
 {
-  // create a new environment binding lambda arg symbols to actual values
-  Lisp_Object lambdaenv = env;
-  for (int i = 0; i < ulambda->maxargs; i++)
-    {
-      Lisp_Object argsym = make_symbol (unbox_symbol (ulambda->args[i])->name);
-      unbox_symbol (argsym)->value = argvals[i];
-      lambdaenv = env_new (lambdaenv, argsym);
-    }
+  // eval_args for a call to LAMBDA, see bind_args
+  int arity;
+  if (!lambda->rest)
+    return eval_args (env, funargs, lambda->minargs, lambda->maxargs,
+                      &arity);
 
-  stack_current_set_env (lambdaenv);
+  Lisp_Object *argvals
+      = eval_args (env, funargs, lambda->minargs, MANY, &arity);
+  return argvals ? bind_args (lambda, argvals, arity) : NULL;
+}
 
-  // recursively eval the lambda body
-  return progn (lambdaenv, ulambda->form);
+static int
+has_args (Lisp_Object args, int n)
+{
+  // whether ARGS has at least N elements, without walking all of it
+  for (; n > 0; n--, args = f_cdr (args))
+    if (type_of (args) != LISP_CONS)
+      return 0;
+  return 1;
 }
 
-Lisp_Object
-progn (Lisp_Object env, Lisp_Object form)
+static Lisp_Object
+progn_but_last (Lisp_Object env, Lisp_Object body)
 {
-  // TODO it seems that in every function i have used a different way to
-  // traverse the list... awful, pls consistency!!!
-  Lisp_Object val = q_nil;
-  Lisp_Object tail = form;
+  // evaluates BODY up to its last form, which is returned.  an empty
+  // body gives nil, that evaluates to itself
+  if (nil (body))
+    return q_nil;
 
-  while (!eq (tail, q_nil))
-    {
-      val = eval (env, f_car (tail));
-      tail = f_cdr (tail);
-      // reload env from the stack, as prviously evalled form could have
-      // changed it!
-      env = env_current ();
-    }
+  for (; !nil (f_cdr (body)); body = f_cdr (body))
+    eval (env, f_car (body));
+  return f_car (body);
+}
 
-  return val;
+static enum special_form
+special_form_of (Lisp_Object head)
+{
+  // redefining the symbol of a special form makes it a plain function
+  if (type_of (head) != LISP_SYMB)
+    return SF_NONE;
+  Lisp_Symbol *symbol = unbox_symbol (head);
+  if (symbol->form == SF_NONE || type_of (symbol->value) != LISP_SUBR
+      || unbox_subr (symbol->value)->maxargs != UNEVALLED)
+    return SF_NONE;
+  return symbol->form;
 }
 
-Lisp_Object
-let (Lisp_Object env, Lisp_Object form)
+static int
+arith_op (Lisp_Object fun, Lisp_Object args)
 {
-  Lisp_Object args = f_car (form);
-  Lisp_Object argstail = args;
-  Lisp_Object body = f_cdr (form);
-  Lisp_Object letenv = env;
-  Lisp_Object argform, arg, argval;
+  // the byte code of (FUN . ARGS) if it is a call to a binary
+  // arithmetic builtin, see byte_arith, or 0
+  if (type_of (fun) != LISP_SUBR || type_of (args) != LISP_CONS
+      || type_of (f_cdr (args)) != LISP_CONS || !nil (f_cdr (f_cdr (args))))
+    return 0;
+  int op = byte_inline_op (unbox_subr (fun), 2);
+  return op >= Bplus && op <= Bleq ? op : 0;
+}
+
+static int
+tail_special (Lisp_Object env, enum special_form special, Lisp_Object args,
+              Lisp_Object *out)
+{
+  // evaluates the special form SPECIAL on ARGS up to its form in tail
+  // position, stored in OUT.  if the value is known before, it is
+  // stored in OUT instead and 0 is returned
+  Lisp_Object tem;
+
+  if (special == SF_PROGN)
+    {
+      *out = progn_but_last (env, args);
+      return 1;
+    }
 
-  while (!eq (argstail, q_nil))
+  if (special == SF_IF)
     {
-      argform = f_car (argstail);
-      arg = f_car (argform);
-      if (type_of (arg) != LISP_SYMB)
+      if (!nil (eval (env, f_car (args))))
+        *out = f_car (f_cdr (args));
+      else
+        *out = progn_but_last (env, f_cdr (f_cdr (args)));
+      return 1;
+    }
+
+  if (special == SF_WHEN || special == SF_UNLESS)
+    {
+      int test = !nil (eval (env, f_car (args)));
+      if (test == (special == SF_WHEN))
         {
-          // TODO
-          fprintf (stderr, "malformed let, trying to assing to non symbol\n");
-          exit (31);
+          *out = progn_but_last (env, f_cdr (args));
+          return 1;
         }
-      argval = eval (letenv, f_car (f_cdr (argform)));
-      unbox_symbol (arg)->value = argval;
-      letenv = env_new (letenv, arg);
-      argstail = f_cdr (argstail);
+      *out = q_nil;
+      return 0;
     }
 
-  stack_push ((struct stackframe){ .fname = "let", .env = letenv });
-  Lisp_Object res = progn (letenv, body);
-  stack_pop_free ();
+  if (special == SF_COND)
+    {
+      for (Lisp_Object tail = args; !nil (tail); tail = f_cdr (tail))
+        {
+          Lisp_Object clause = f_car (tail);
+          tem = eval (env, f_car (clause));
+          if (nil (tem))
+            continue;
+          // a clause without body returns the value of its test
+          if (nil (f_cdr (clause)))
+            {
+              *out = tem;
+              return 0;
+            }
+          *out = progn_but_last (env, f_cdr (clause));
+          return 1;
+        }
+      *out = q_nil;
+      return 0;
+    }
 
-  return res;
+  // and, or
+  int and = special == SF_AND;
+  Lisp_Object tail = args;
+  if (nil (tail))
+    {
+      *out = BOOL (and);
+      return 0;
+    }
+  for (; !nil (f_cdr (tail)); tail = f_cdr (tail))
+    {
+      tem = eval (env, f_car (tail));
+      if (nil (tem) == and)
+        {
+          *out = tem;
+          return 0;
+        }
+    }
+  *out = f_car (tail);
+  return 1;
 }
 
-Lisp_Object
-define (Lisp_Object env, Lisp_Object form)
+static Lisp_Object
+eval_special (Lisp_Object env, enum special_form special, Lisp_Object args)
 {
-  Lisp_Object var = f_car (form);
-  // type safe must be symbol
-  Lisp_Object value = eval (env, f_car (f_cdr (form)));
-  unbox_symbol (var)->value = value;
+  // the special forms not in tail_special, with the current env
+  switch (special)
+    {
+    case SF_LAMBDA:
+      return lambda (env, args);
+    case SF_DEFINE:
+      return define (env, args);
+    case SF_DEFVAR:
+      return defvar (env, args);
+    case SF_SETQ:
+      return setq (env, args);
+    case SF_WHILE:
+      return while_loop (env, args);
+    case SF_DOTIMES:
+      return dotimes (env, args);
+    case SF_DOLIST:
+      return dolist (env, args);
+    default:
+      // TODO err
+      fprintf (stderr, "not a special form: %d\n", special);
+      exit (12);
+    }
+}
 
-  Lisp_Object newenv = env_new (env, var);
+static int
+binds_special (Lisp_Vector *bindings)
+{
+  for (size_t i = 0; i < bindings->size; i += 2)
+    if (unbox_symbol (bindings->contents[i])->special)
+      return 1;
+  return 0;
+}
 
-  // TODO this is not thread safe :(
-  // TODO this seems very wrong
+static Lisp_Object
+let_bind (Lisp_Object env, Lisp_Vector *bindings)
+{
+  size_t n = bindings->size / 2;
+  Lisp_Object letenv = env_frame_new (env, n);
 
-  // set new env in the parent stack (the current is the one in which
-  // "define" is evalled and will die afterwards
-  stack_parent_set_env (newenv);
+  // inits are evaluated in the new frame: each one sees the previous
+  // bindings (this is really a let*)
+  for (size_t i = 0; i < n; i++)
+    {
+      Lisp_Object var = bindings->contents[2 * i];
+      Lisp_Object val = eval (letenv, bindings->contents[2 * i + 1]);
+      if (unbox_symbol (var)->special)
+        // its slot stays unused, references read the value cell
+        specbind (var, val);
+      else
+        unbox_vector (letenv)->contents[i + 1] = val;
+    }
 
-  return value;
+  return letenv;
+}
+
+static void
+enter_frame (int *pushed, Lisp_Object fun, Lisp_Object env)
+{
+  // a tail call replaces the frame of its caller
+  if (*pushed)
+    stack_pop ();
+  stack_push ((struct stackframe){ .fun = fun, .env = env });
+  *pushed = 1;
+}
+
+static Lisp_Object *
+iteration_var (Lisp_Object frame, Lisp_Object var)
+{
+  // where the loop variable VAR lives: the first slot of FRAME, or
+  // the value cell of a special variable, bound until the loop ends
+  if (!unbox_symbol (var)->special)
+    return &unbox_vector (frame)->contents[1];
+
+  specbind (var, q_nil);
+  return &unbox_symbol (var)->value;
 }
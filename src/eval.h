@@ -1,18 +1,30 @@
 #ifndef EVAL_H
 #define EVAL_H
 
+#include "lexer.h"
 #include "lisp.h"
 
 Lisp_Object eval (Lisp_Object env, Lisp_Object form);
-Lisp_Object eval_symbol (Lisp_Object env, Lisp_Object form);
+Lisp_Object eval_symbol (Lisp_Object symbol);
 Lisp_Object call_function (Lisp_Object env, Lisp_Object form);
-Lisp_Object call_subr (Lisp_Subr *usubr, int maxargs, int arity,
-                       Lisp_Object *argvals);
+Lisp_Object call_subr (Lisp_Subr *usubr, int argc, Lisp_Object *argvals);
 Lisp_Object call_unevalled_subr (Lisp_Subr *usubr, Lisp_Object form);
-Lisp_Object call_lambda (Lisp_Object env, Lisp_Lambda *ulambda,
-                         Lisp_Object *argvals);
+/* ARGVALS holds the lambda_nslots values of the args, see bind_args */
+Lisp_Object call_lambda (Lisp_Lambda *ulambda, Lisp_Object *argvals);
+/* turns the NARGS args of a call to LAMBDA at ARGVALS, the last values
+   pushed on the value stack, into the slots binding them: padded with
+   nils up to maxargs, and the ones past it gathered in the &rest list.
+   returns where the slots start, see values_push */
+Lisp_Object *bind_args (Lisp_Lambda *lambda, Lisp_Object *argvals, int nargs);
 Lisp_Object progn (Lisp_Object env, Lisp_Object form);
 Lisp_Object let (Lisp_Object env, Lisp_Object form);
 Lisp_Object define (Lisp_Object env, Lisp_Object form);
+Lisp_Object defvar (Lisp_Object env, Lisp_Object form);
+Lisp_Object lambda (Lisp_Object env, Lisp_Object form);
+Lisp_Object setq (Lisp_Object env, Lisp_Object form);
+Lisp_Object while_loop (Lisp_Object env, Lisp_Object form);
+Lisp_Object dotimes (Lisp_Object env, Lisp_Object form);
+Lisp_Object dolist (Lisp_Object env, Lisp_Object form);
+Lisp_Object eval_toplevel (Lexer *l);
 
 #endif /* EVAL_H */
@@ -0,0 +1,656 @@
+#include "jit.h"
+#include "alloc.h"
+#include "bytecode.h"
+#include "env.h"
+#include "lisp.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+int jit_enabled = 0;
+
+void
+jit_enable ()
+{
+  // kill switch, for when native code is suspected of misbehaving
+  jit_enabled = getenv ("ERLISP_NO_JIT") == NULL;
+}
+
+#ifdef __x86_64__
+
+struct codebuf
+{
+  unsigned char *data;
+  size_t size;
+  size_t alloc;
+};
+
+// a rel32 operand at POS, to be pointed at the byte code address TARGET
+struct fixup
+{
+  size_t pos;
+  size_t target;
+};
+
+#define EMIT(b, ...)                                                          \
+  emit (b, (const unsigned char[]){ __VA_ARGS__ },                            \
+        sizeof ((const unsigned char[]){ __VA_ARGS__ }))
+
+#define SLOT(n) ((int32_t)((n) * sizeof (Lisp_Object)))
+#define FRAME(field) ((int32_t)offsetof (struct jit_frame, field))
+
+static void emit (struct codebuf *b, const unsigned char *bytes, size_t n);
+static void emit4 (struct codebuf *b, uint32_t v);
+static void emit8 (struct codebuf *b, uint64_t v);
+static void patch4 (struct codebuf *b, size_t pos, size_t target);
+static void emit_prologue (struct codebuf *b);
+static void emit_epilogue (struct codebuf *b);
+static void emit_push_rax (struct codebuf *b);
+static void emit_lea_top (struct codebuf *b, int32_t slots);
+static void emit_call (struct codebuf *b, void *helper, uint32_t a,
+                       uint32_t c);
+static void emit_arith (struct codebuf *b, int op);
+static size_t emit_jcc (struct codebuf *b, unsigned char cc);
+
+// helpers called by native code, doing what the dispatch loop does.
+// they get the activation and the top and return the new top
+static Lisp_Object *h_varref (struct jit_frame *f, Lisp_Object *top,
+                              uint32_t depth, uint32_t slot);
+static Lisp_Object *h_varset (struct jit_frame *f, Lisp_Object *top,
+                              uint32_t depth, uint32_t slot);
+static Lisp_Object *h_global_ref (struct jit_frame *f, Lisp_Object *top,
+                                  uint32_t k, uint32_t unused);
+static Lisp_Object *h_global_set (struct jit_frame *f, Lisp_Object *top,
+                                  uint32_t k, uint32_t unused);
+static Lisp_Object *h_specbind (struct jit_frame *f, Lisp_Object *top,
+                                uint32_t k, uint32_t unused);
+static Lisp_Object *h_unbind (struct jit_frame *f, Lisp_Object *top,
+                              uint32_t n, uint32_t unused);
+static Lisp_Object *h_push_frame (struct jit_frame *f, Lisp_Object *top,
+                                  uint32_t n, uint32_t unused);
+static Lisp_Object *h_pop_frame (struct jit_frame *f, Lisp_Object *top,
+                                 uint32_t unused1, uint32_t unused2);
+static Lisp_Object *h_call (struct jit_frame *f, Lisp_Object *top,
+                            uint32_t n, uint32_t unused);
+static Lisp_Object *h_call_global (struct jit_frame *f, Lisp_Object *top,
+                                   uint32_t k, uint32_t n);
+static Lisp_Object *h_make_closure (struct jit_frame *f, Lisp_Object *top,
+                                    uint32_t k, uint32_t unused);
+static Lisp_Object *h_op (struct jit_frame *f, Lisp_Object *top, uint32_t op,
+                          uint32_t unused);
+static enum jit_status h_tail_call (struct jit_frame *f, Lisp_Object *top,
+                                    uint32_t n, uint32_t unused);
+
+const char *
+jit_compile (Lisp_Lambda *lambda)
+{
+  Lisp_String *bytecode = unbox_string (lambda->bytecode);
+  const unsigned char *code = (const unsigned char *)bytecode->data;
+  size_t codesize = bytecode->size;
+
+  struct codebuf b = {};
+  size_t *offsets = malloc ((codesize + 1) * sizeof (size_t));
+  struct fixup *fixups = malloc (codesize * sizeof (struct fixup));
+  size_t nfixups = 0;
+  const char *err = NULL;
+
+  emit_prologue (&b);
+
+  size_t pc = 0;
+  while (pc < codesize && !err)
+    {
+      offsets[pc] = b.size;
+      int op = code[pc++];
+      uint32_t a = 0, c = 0;
+
+      switch (op)
+        {
+        case Bvarref:
+        case Bvarset:
+          a = code[pc];
+          c = code[pc + 1] | code[pc + 2] << 8;
+          pc += 3;
+          break;
+        case Bcall_global:
+          a = code[pc] | code[pc + 1] << 8;
+          c = code[pc + 2] | code[pc + 3] << 8;
+          pc += 4;
+          break;
+        case Bdiscard:
+        case Bpop_frame:
+        case Breturn:
+        case Bplus:
+        case Bminus:
+        case Bmult:
+        case Bgtr:
+        case Bgeq:
+        case Blss:
+        case Bleq:
+        case Beq:
+        case Bcar:
+        case Bcdr:
+        case Bcons:
+        case Bsetcar:
+        case Bconsp:
+          break;
+        default:
+          a = code[pc] | code[pc + 1] << 8;
+          pc += 2;
+          break;
+        }
+
+      switch (op)
+        {
+        case Bconst:
+          // mov rax, [r13 + k*8]
+          EMIT (&b, 0x49, 0x8b, 0x85);
+          emit4 (&b, SLOT (a));
+          emit_push_rax (&b);
+          break;
+        case Bdiscard:
+          emit_lea_top (&b, -1);
+          break;
+        case Bdiscard_n_keep:
+          // mov rax, [rbx]; lea rbx, [rbx - n*8]; mov [rbx], rax
+          EMIT (&b, 0x48, 0x8b, 0x03);
+          emit_lea_top (&b, -(int32_t)a);
+          EMIT (&b, 0x48, 0x89, 0x03);
+          break;
+        case Bstack_ref:
+          // mov rax, [r12 + i*8]
+          EMIT (&b, 0x49, 0x8b, 0x84, 0x24);
+          emit4 (&b, SLOT (a));
+          emit_push_rax (&b);
+          break;
+        case Bstack_set:
+          // mov rax, [rbx]; lea rbx, [rbx - 8]; mov [r12 + i*8], rax
+          EMIT (&b, 0x48, 0x8b, 0x03);
+          emit_lea_top (&b, -1);
+          EMIT (&b, 0x49, 0x89, 0x84, 0x24);
+          emit4 (&b, SLOT (a));
+          break;
+        case Bvarref:
+          emit_call (&b, h_varref, a, c);
+          break;
+        case Bvarset:
+          emit_call (&b, h_varset, a, c);
+          break;
+        case Bglobal_ref:
+          emit_call (&b, h_global_ref, a, 0);
+          break;
+        case Bglobal_set:
+          emit_call (&b, h_global_set, a, 0);
+          break;
+        case Bspecbind:
+          emit_call (&b, h_specbind, a, 0);
+          break;
+        case Bunbind:
+          emit_call (&b, h_unbind, a, 0);
+          break;
+        case Bpush_frame:
+          emit_call (&b, h_push_frame, a, 0);
+          break;
+        case Bpop_frame:
+          emit_call (&b, h_pop_frame, 0, 0);
+          break;
+        case Bgoto:
+          EMIT (&b, 0xe9);
+          fixups[nfixups++] = (struct fixup){ b.size, a };
+          emit4 (&b, 0);
+          break;
+        case Bgoto_if_nil:
+        case Bgoto_if_not_nil:
+        case Bgoto_if_nil_else_pop:
+        case Bgoto_if_not_nil_else_pop:
+          {
+            int pop = op == Bgoto_if_nil || op == Bgoto_if_not_nil;
+            int ifnil = op == Bgoto_if_nil || op == Bgoto_if_nil_else_pop;
+            // mov rax, [rbx]; mov rcx, nil; cmp rax, rcx
+            EMIT (&b, 0x48, 0x8b, 0x03);
+            if (pop)
+              emit_lea_top (&b, -1);
+            EMIT (&b, 0x48, 0xb9);
+            emit8 (&b, q_nil);
+            EMIT (&b, 0x48, 0x39, 0xc8);
+            // je / jne
+            fixups[nfixups++]
+                = (struct fixup){ emit_jcc (&b, ifnil ? 0x84 : 0x85), a };
+            if (!pop)
+              emit_lea_top (&b, -1);
+            break;
+          }
+        case Bcall:
+          emit_call (&b, h_call, a, 0);
+          break;
+        case Bcall_global:
+          emit_call (&b, h_call_global, a, c);
+          break;
+        case Btail_call:
+          // the status is already in eax
+          emit_call (&b, h_tail_call, a, 0);
+          emit_epilogue (&b);
+          break;
+        case Breturn:
+          // mov rax, [rbx]; mov [r14 + result], rax; mov eax, JIT_RETURN
+          EMIT (&b, 0x48, 0x8b, 0x03);
+          EMIT (&b, 0x49, 0x89, 0x86);
+          emit4 (&b, FRAME (result));
+          EMIT (&b, 0xb8);
+          emit4 (&b, JIT_RETURN);
+          emit_epilogue (&b);
+          break;
+        case Bmake_closure:
+          emit_call (&b, h_make_closure, a, 0);
+          break;
+        case Bplus:
+        case Bminus:
+        case Bmult:
+        case Bgtr:
+        case Bgeq:
+        case Blss:
+        case Bleq:
+        case Beq:
+          emit_arith (&b, op);
+          break;
+        case Bcar:
+        case Bcdr:
+        case Bcons:
+        case Bsetcar:
+        case Bconsp:
+          emit_call (&b, h_op, op, 0);
+          break;
+        default:
+          err = "unknown byte code";
+          break;
+        }
+    }
+  offsets[codesize] = b.size;
+
+  for (size_t i = 0; i < nfixups && !err; i++)
+    patch4 (&b, fixups[i].pos, offsets[fixups[i].target]);
+
+  free (offsets);
+  free (fixups);
+
+  if (!err)
+    {
+      size_t pagesize = sysconf (_SC_PAGESIZE);
+      size_t size = (b.size + pagesize - 1) / pagesize * pagesize;
+      void *mem = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (mem == MAP_FAILED)
+        {
+          // no executable memory for us: stop trying
+          jit_enabled = 0;
+          err = "cannot map code";
+        }
+      else
+        {
+          memcpy (mem, b.data, b.size);
+          mprotect (mem, size, PROT_READ | PROT_EXEC);
+          // native code lives as long as the process: lambdas freed
+          // by the gc leak theirs
+          lambda->jitcode = mem;
+        }
+    }
+
+  free (b.data);
+  return err;
+}
+
+// code emission
+
+static void
+emit (struct codebuf *b, const unsigned char *bytes, size_t n)
+{
+  if (b->size + n > b->alloc)
+    {
+      b->alloc = b->alloc ? b->alloc * 2 : 1024;
+      b->data = realloc (b->data, b->alloc);
+    }
+  memcpy (b->data + b->size, bytes, n);
+  b->size += n;
+}
+
+static void
+emit4 (struct codebuf *b, uint32_t v)
+{
+  EMIT (b, v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, (v >> 24) & 0xff);
+}
+
+static void
+emit8 (struct codebuf *b, uint64_t v)
+{
+  emit4 (b, v & 0xffffffff);
+  emit4 (b, v >> 32);
+}
+
+static void
+patch4 (struct codebuf *b, size_t pos, size_t target)
+{
+  // relative to the end of the operand
+  uint32_t rel = (uint32_t)(target - (pos + 4));
+  for (int i = 0; i < 4; i++)
+    b->data[pos + i] = (rel >> (8 * i)) & 0xff;
+}
+
+static void
+emit_prologue (struct codebuf *b)
+{
+  // push rbx, r12, r13, r14, r15: five pushes after the return
+  // address keep the stack 16 bytes aligned for the helpers
+  EMIT (b, 0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57);
+  // mov r14, rdi
+  EMIT (b, 0x49, 0x89, 0xfe);
+  // mov r12, [r14 + base]
+  EMIT (b, 0x4d, 0x8b, 0xa6);
+  emit4 (b, FRAME (base));
+  // mov r13, [r14 + constants]
+  EMIT (b, 0x4d, 0x8b, 0xae);
+  emit4 (b, FRAME (constants));
+  // mov rbx, [r14 + top]
+  EMIT (b, 0x49, 0x8b, 0x9e);
+  emit4 (b, FRAME (top));
+}
+
+static void
+emit_epilogue (struct codebuf *b)
+{
+  // pop r15, r14, r13, r12, rbx; ret
+  EMIT (b, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5b, 0xc3);
+}
+
+static void
+emit_push_rax (struct codebuf *b)
+{
+  // lea rbx, [rbx + 8]; mov [rbx], rax
+  emit_lea_top (b, 1);
+  EMIT (b, 0x48, 0x89, 0x03);
+}
+
+static void
+emit_lea_top (struct codebuf *b, int32_t slots)
+{
+  // lea rbx, [rbx + slots*8], leaving the flags alone
+  EMIT (b, 0x48, 0x8d, 0x9b);
+  emit4 (b, SLOT (slots));
+}
+
+static void
+emit_call (struct codebuf *b, void *helper, uint32_t a, uint32_t c)
+{
+  // mov rdi, r14; mov rsi, rbx; mov edx, a; mov ecx, c
+  EMIT (b, 0x4c, 0x89, 0xf7, 0x48, 0x89, 0xde, 0xba);
+  emit4 (b, a);
+  EMIT (b, 0xb9);
+  emit4 (b, c);
+  // mov rax, helper; call rax; mov rbx, rax
+  EMIT (b, 0x48, 0xb8);
+  emit8 (b, (uint64_t)(uintptr_t)helper);
+  EMIT (b, 0xff, 0xd0, 0x48, 0x89, 0xc3);
+}
+
+static size_t
+emit_jcc (struct codebuf *b, unsigned char cc)
+{
+  // 0f CC rel32, returns the position of rel32
+  EMIT (b, 0x0f, cc);
+  size_t pos = b->size;
+  emit4 (b, 0);
+  return pos;
+}
+
+static void
+emit_arith (struct codebuf *b, int op)
+{
+  // mov rax, [rbx - 8]; mov rcx, [rbx]
+  EMIT (b, 0x48, 0x8b, 0x43, 0xf8, 0x48, 0x8b, 0x0b);
+
+  size_t slow = 0;
+  if (op != Beq)
+    {
+      // both fixnums? the tag of integers is 0. mov rdx, rax;
+      // or rdx, rcx; test dl, TAGMASK
+      EMIT (b, 0x48, 0x89, 0xc2, 0x48, 0x09, 0xca, 0xf6, 0xc2, TAGMASK);
+      slow = emit_jcc (b, 0x85);
+    }
+
+  unsigned char cmov = 0;
+  size_t overflow = 0;
+  switch (op)
+    {
+    case Bplus:
+      // tagged add: (x << 3) + (y << 3) == (x + y) << 3
+      EMIT (b, 0x48, 0x01, 0xc8);
+      break;
+    case Bminus:
+      EMIT (b, 0x48, 0x29, 0xc8);
+      break;
+    case Bmult:
+      // sar rcx, 3; imul rax, rcx
+      EMIT (b, 0x48, 0xc1, 0xf9, TAGBITS, 0x48, 0x0f, 0xaf, 0xc1);
+      break;
+    case Bgtr:
+      cmov = 0x4f;
+      break;
+    case Bgeq:
+      cmov = 0x4d;
+      break;
+    case Blss:
+      cmov = 0x4c;
+      break;
+    case Bleq:
+      cmov = 0x4e;
+      break;
+    case Beq:
+      cmov = 0x44;
+      break;
+    }
+
+  // a result out of the fixnum range overflows the tagged one too:
+  // jo slow, the operands are still on the stack
+  if (op == Bplus || op == Bminus || op == Bmult)
+    overflow = emit_jcc (b, 0x80);
+
+  if (cmov)
+    {
+      // cmp rax, rcx; mov rax, nil; mov rdx, t; cmovCC rax, rdx
+      EMIT (b, 0x48, 0x39, 0xc8, 0x48, 0xb8);
+      emit8 (b, q_nil);
+      EMIT (b, 0x48, 0xba);
+      emit8 (b, q_t);
+      EMIT (b, 0x48, 0x0f, cmov, 0xc2);
+    }
+
+  // lea rbx, [rbx - 8]; mov [rbx], rax
+  emit_lea_top (b, -1);
+  EMIT (b, 0x48, 0x89, 0x03);
+
+  if (op != Beq)
+    {
+      // jmp done; slow: the generic operation
+      EMIT (b, 0xe9);
+      size_t done = b->size;
+      emit4 (b, 0);
+      patch4 (b, slow, b->size);
+      if (overflow)
+        patch4 (b, overflow, b->size);
+      emit_call (b, h_op, op, 0);
+      patch4 (b, done, b->size);
+    }
+}
+
+// helpers
+
+static Lisp_Object *
+h_varref (struct jit_frame *f, Lisp_Object *top, uint32_t depth,
+          uint32_t slot)
+{
+  *++top = *env_frame_slot (f->env, box_lref (depth, slot));
+  return top;
+}
+
+static Lisp_Object *
+h_varset (struct jit_frame *f, Lisp_Object *top, uint32_t depth,
+          uint32_t slot)
+{
+  *env_frame_slot (f->env, box_lref (depth, slot)) = *top--;
+  return top;
+}
+
+static Lisp_Object *
+h_global_ref (struct jit_frame *f, Lisp_Object *top, uint32_t k,
+              UNUSED uint32_t unused)
+{
+  Lisp_Object symbol = f->constants[k];
+  Lisp_Object val = unbox_symbol (symbol)->value;
+  if (eq (val, q_unbound))
+    {
+      // todo err
+      fprintf (stderr, "unbound symbol: %s\n",
+               unbox_string (unbox_symbol (symbol)->name)->data);
+      exit (13);
+    }
+  *++top = val;
+  return top;
+}
+
+static Lisp_Object *
+h_global_set (struct jit_frame *f, Lisp_Object *top, uint32_t k,
+              UNUSED uint32_t unused)
+{
+  unbox_symbol (f->constants[k])->value = *top;
+  return top;
+}
+
+static Lisp_Object *
+h_specbind (struct jit_frame *f, Lisp_Object *top, uint32_t k,
+            UNUSED uint32_t unused)
+{
+  specbind (f->constants[k], *top--);
+  return top;
+}
+
+static Lisp_Object *
+h_unbind (UNUSED struct jit_frame *f, Lisp_Object *top, uint32_t n,
+          UNUSED uint32_t unused)
+{
+  unbind_to (specpdl_index () - n);
+  return top;
+}
+
+static Lisp_Object *
+h_push_frame (struct jit_frame *f, Lisp_Object *top, uint32_t n,
+              UNUSED uint32_t unused)
+{
+  f->env = env_frame_new (f->env, n);
+  stack_current_set_env (f->env);
+  return top;
+}
+
+static Lisp_Object *
+h_pop_frame (struct jit_frame *f, Lisp_Object *top, UNUSED uint32_t unused1,
+             UNUSED uint32_t unused2)
+{
+  f->env = unbox_vector (f->env)->contents[0];
+  stack_current_set_env (f->env);
+  return top;
+}
+
+static Lisp_Object *
+h_call (UNUSED struct jit_frame *f, Lisp_Object *top, uint32_t n,
+        UNUSED uint32_t unused)
+{
+  top -= n;
+  *top = byte_call (*top, n, top + 1);
+  return top;
+}
+
+static Lisp_Object *
+h_call_global (struct jit_frame *f, Lisp_Object *top, uint32_t k, uint32_t n)
+{
+  top -= (int)n - 1;
+  *top = byte_call_cached (f->constants[k], n, top);
+  return top;
+}
+
+static Lisp_Object *
+h_make_closure (struct jit_frame *f, Lisp_Object *top, uint32_t k,
+                UNUSED uint32_t unused)
+{
+  *++top = make_closure (f->constants[k], f->env);
+  return top;
+}
+
+static Lisp_Object *
+h_op (UNUSED struct jit_frame *f, Lisp_Object *top, uint32_t op,
+      UNUSED uint32_t unused)
+{
+  Lisp_Object y = *top;
+  switch (op)
+    {
+    case Bcar:
+      *top = f_car (y);
+      return top;
+    case Bcdr:
+      *top = f_cdr (y);
+      return top;
+    case Bconsp:
+      *top = BOOL (type_of (y) == LISP_CONS);
+      return top;
+    }
+
+  Lisp_Object x = *--top;
+  switch (op)
+    {
+    case Bplus:
+    case Bminus:
+    case Bmult:
+    case Bgtr:
+    case Bgeq:
+    case Blss:
+    case Bleq:
+      *top = byte_arith (op, x, y);
+      break;
+    case Bcons:
+      *top = f_cons (x, y);
+      break;
+    case Bsetcar:
+      *top = f_setcar (x, y);
+      break;
+    }
+  return top;
+}
+
+static enum jit_status
+h_tail_call (struct jit_frame *f, Lisp_Object *top, uint32_t n,
+             UNUSED uint32_t unused)
+{
+  Lisp_Object fun = top[-(int)n];
+  if (type_of (fun) == LISP_LMBD && !nil (unbox_lambda (fun)->bytecode)
+      && (int)n == unbox_lambda (fun)->maxargs
+      && !unbox_lambda (fun)->rest)
+    {
+      // let exec_byte_code reuse the window
+      f->lambda = unbox_lambda (fun);
+      f->args = top - n + 1;
+      return JIT_TAIL_CALL;
+    }
+  top -= n;
+  f->result = byte_call (*top, n, top + 1);
+  return JIT_RETURN;
+}
+
+#else /* __x86_64__ */
+
+const char *
+jit_compile (UNUSED Lisp_Lambda *lambda)
+{
+  return "no JIT for this architecture";
+}
+
+#endif /* __x86_64__ */
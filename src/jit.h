@@ -0,0 +1,64 @@
+#ifndef JIT_H
+#define JIT_H
+
+/*
+  Baseline template JIT for compiled lambdas, x86-64 only.
+
+  When enabled (erlisp --jit), exec_byte_code counts the calls of each
+  compiled lambda and translates the ones reaching JIT_THRESHOLD to
+  machine code, one fixed template per byte code, in an mmap'd
+  executable buffer.  The VM still sets up the activation window (see
+  bytecode.h) and then runs the native code instead of the dispatch
+  loop.
+
+  The native code keeps the VM registers in callee saved machine
+  registers:
+
+    rbx   top of the stack
+    r12   base of the window
+    r13   constants
+    r14   the struct jit_frame of the activation
+
+  Stack and constant accesses, jumps and the fixnum arithmetic and
+  comparisons are inline, the latter guarded by a tag check and an
+  overflow check.  Every other byte code, and arithmetic on operands
+  that are not both fixnums or overflowing, calls a C helper doing
+  what the dispatch loop does.
+
+  Setting ERLISP_NO_JIT in the environment turns the JIT off even
+  with --jit.  So does failing to map executable memory.
+ */
+
+#include "lisp.h"
+
+#define JIT_THRESHOLD 1000
+
+// what native code returns
+enum jit_status
+{
+  JIT_RETURN,    // result is in the frame
+  JIT_TAIL_CALL, // run lambda on args in the same window
+};
+
+struct jit_frame
+{
+  Lisp_Object *base;
+  Lisp_Object *top;
+  Lisp_Object *constants;
+  Lisp_Object env;
+  Lisp_Object result;
+  Lisp_Lambda *lambda;
+  Lisp_Object *args;
+};
+
+typedef enum jit_status (*jit_code) (struct jit_frame *f);
+
+extern int jit_enabled;
+
+/* enables the JIT unless the kill switch is set */
+void jit_enable ();
+/* translates the byte code of LAMBDA, setting its jitcode.  returns
+   NULL or an error message, in which case it stays interpreted */
+const char *jit_compile (Lisp_Lambda *lambda);
+
+#endif /* JIT_H */
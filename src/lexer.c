@@ -1,6 +1,7 @@
 #include "lexer.h"
 #include "lisp.h"
 #include <ctype.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -194,7 +195,7 @@ parse_number (Lexer *l, int firstchar)
 
   sungetc (c, l->stream);
 
-  // TODO use strtol/strtod instead of atoi/atof
+  // TODO use strtod instead of atof
   if (is_float)
     {
       tok.type = TOK_FLOAT_LITERAL;
@@ -202,10 +203,19 @@ parse_number (Lexer *l, int firstchar)
     }
   else // is integer
     {
+      errno = 0;
+      tok.integer = strtol (buf, NULL, 10);
+      if (errno == ERANGE)
+        {
+          // the parser makes a bignum of the digits
+          tok.type = TOK_BIGINT_LITERAL;
+          tok.string = buf;
+          return tok;
+        }
       tok.type = TOK_INT_LITERAL;
-      tok.integer = atoi (buf);
     }
 
+  free (buf);
   return tok;
 }
 
@@ -311,6 +321,8 @@ lex_token_type (TokenType tt)
       return "STRING_LITERAL";
     case TOK_INT_LITERAL:
       return "INT_LITERAL";
+    case TOK_BIGINT_LITERAL:
+      return "BIGINT_LITERAL";
     case TOK_FLOAT_LITERAL:
       return "FLOAT_LITERAL";
     case TOK_SYMBOL:
@@ -353,9 +365,10 @@ stream_string_getc (Stream *s)
 }
 
 static int
-stream_string_ungetc (UNUSED int _, Stream *s)
+stream_string_ungetc (int c, Stream *s)
 {
-  if (s->source.string.pos < 1)
-    return 0;
+  // like ungetc: pushing back EOF does nothing, getc did not advance
+  if (c == EOF || s->source.string.pos < 1)
+    return EOF;
   return s->source.string.data[--s->source.string.pos];
 }
@@ -15,6 +15,7 @@ typedef enum
   TOK_RPAREN,
   TOK_STRING_LITERAL,
   TOK_INT_LITERAL,
+  TOK_BIGINT_LITERAL, // too large for a long, the digits in string
   TOK_FLOAT_LITERAL,
   TOK_SYMBOL,
   TOK_QUOTE,
@@ -17,17 +17,22 @@
 #define UNEVALLED 888
 
 #define ERRTYPE(expected, got)                                                \
-  fprintf (stderr, "type error. expected %s, got %s", type_name (expected),   \
-           type_name (got));                                                  \
+  fprintf (stderr, "type error. expected %s, got %s\n",                       \
+           type_name (expected), type_name (got));                            \
+  print_backtrace (stderr);                                                   \
   exit (123);
 
 #define ERRUNBOUND(symbol)                                                    \
-  fprintf (stderr, "unbound variable: %s",                                    \
+  fprintf (stderr, "unbound variable: %s\n",                                  \
            unbox_string (unbox_symbol (symbol)->name)->data);                 \
+  print_backtrace (stderr);                                                   \
   exit (171);
 
+// FUN must take N arguments: there is no lisp_subr_fun_N, and no
+// SUBR_CALL (N), for other arities, and _Generic has no default
 #define NSUBR(N, fun)                                                         \
-  (union lisp_subr_fun) { .f##N = fun }
+  (union lisp_subr_fun) { .f##N = _Generic ((fun), lisp_subr_fun_##N: (fun)) }
+#define SUBR_CALL(N) subr_call_##N
 
 #define BOOL(expr) (expr) ? q_t : q_nil
 
@@ -48,6 +53,7 @@ typedef enum
   LISP_VECT = 0x4,
   LISP_SUBR = 0x5,
   LISP_LMBD = 0x6,
+  LISP_LREF = 0x7, // lexical reference, see resolve.h
 } Lisp_Type;
 
 typedef int64_t Lisp_Integer;
@@ -55,6 +61,7 @@ typedef struct lisp_string Lisp_String;
 typedef struct lisp_symbol Lisp_Symbol;
 typedef struct lisp_cons Lisp_Cons;
 typedef struct lisp_vector Lisp_Vector;
+typedef struct lisp_bignum Lisp_Bignum;
 typedef struct lisp_subr Lisp_Subr;
 typedef struct lisp_lambda Lisp_Lambda;
 
@@ -80,32 +87,80 @@ typedef Lisp_Object (*lisp_subr_fun_8) (Lisp_Object arg1, Lisp_Object arg2,
                                         Lisp_Object arg5, Lisp_Object arg6,
                                         Lisp_Object arg7, Lisp_Object arg8);
 typedef Lisp_Object (*lisp_subr_fun_many) (int argc, Lisp_Object *argv);
+typedef lisp_subr_fun_1 lisp_subr_fun_888;    /* unevalled, see NSUBR */
+typedef lisp_subr_fun_many lisp_subr_fun_999; /* many */
 
 /*
-  TODO: gcmarks like that (char gcmark) are not compact in memory.
-  They screw alignment of structs, causing weird padding of all types,
-  incrementing memory usage and cpu cycles by a lot.
+  Every subr is called the same way, through its call function with
+  ARGC arguments in ARGV, ARGV[0] being the form for an UNEVALLED one.
+  The call function is one of the subr_call_N below, picked by DEFSUBR
+  from the arity at compile time, that passes the arguments on to the
+  C function of SUBR as the latter expects them.  Fixed arity subrs
+  get exactly maxargs arguments, missing optional ones set to nil.
+ */
+typedef Lisp_Object (*lisp_subr_call) (Lisp_Subr *subr, int argc,
+                                       Lisp_Object *argv);
+
+Lisp_Object subr_call_0 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_1 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_2 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_3 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_4 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_5 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_6 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_7 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_8 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_888 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+Lisp_Object subr_call_999 (Lisp_Subr *subr, int argc, Lisp_Object *argv);
+
+/*
+  Objects carry no gc mark: marks live in side tables (see blkalloc.h
+  and alloc.c), so a gc never writes to the memory of the objects.
  */
 
 struct lisp_cons
 {
-  char gcmark;
   Lisp_Object car;
   Lisp_Object cdr;
 };
 
 struct lisp_string
 {
-  char gcmark;
   size_t size;
   char data[];
 };
 
+// the special forms eval handles itself, see the form of symbols
+enum special_form
+{
+  SF_NONE,
+  SF_QUOTE,
+  SF_PROGN,
+  SF_IF,
+  SF_WHEN,
+  SF_UNLESS,
+  SF_COND,
+  SF_AND,
+  SF_OR,
+  SF_LET,
+  SF_LAMBDA,
+  SF_DEFINE,
+  SF_DEFVAR,
+  SF_SETQ,
+  SF_WHILE,
+  SF_DOTIMES,
+  SF_DOLIST,
+};
+
 struct lisp_symbol
 {
-  char gcmark;
   Lisp_Object name;
   Lisp_Object value;
+  // declared with defvar: let binds it dynamically, see specbind
+  int special;
+  // names a special form, dispatched on by eval as long as the value
+  // is still its UNEVALLED subr
+  enum special_form form;
   // next symbol in the obarray bucket, see obarray.h.  this is
   // inspired from emacs lisp
   struct lisp_symbol *next;
@@ -113,12 +168,27 @@ struct lisp_symbol
 
 struct lisp_vector
 {
-  char gcmark;
   size_t size;
   // flexible array member
   Lisp_Object contents[];
 };
 
+// a vector whose size has PSEUDOVECTOR_FLAG set is another kind of
+// object under the vector tag, like emacs pseudovectors: it holds no
+// lisp objects, and is always in the variable sized heap (see
+// alloc.c).  the bignum is the only one
+#define PSEUDOVECTOR_FLAG ((size_t)1 << 63)
+
+// an integer out of the fixnum range, see bignum.h
+struct lisp_bignum
+{
+  size_t size; // PSEUDOVECTOR_FLAG
+  int sign;    // 1 or -1
+  size_t nlimbs;
+  // magnitude, least significant limb first, the last one nonzero
+  uint64_t limbs[];
+};
+
 union lisp_subr_fun
 {
   lisp_subr_fun_0 f0;
@@ -142,19 +212,53 @@ struct lisp_subr
   // no gc mark, subr cannot be gc'd
   const char *name;
   union lisp_subr_fun function;
+  lisp_subr_call call;
   int minargs;
   int maxargs;
+  // nonzero when a call has no side effects and depends on its args
+  // only: the PURE_ARGS mask of the types of constant args on which
+  // the resolver folds it, see resolve.h
+  unsigned pure;
+};
+
+#define PURE_ARGS(type) (1u << (type))
+#define PURE_ANY_ARGS 0xffu
+
+// what a lambda does with the args past its maxargs
+enum lambda_rest
+{
+  REST_NONE,   // they are an error
+  REST_IGNORE, // &rest arg unused by the body: dropped, no list built
+  REST_LIST,   // &rest arg: a list of them, in the slot after the others
 };
 
 struct lisp_lambda
 {
-  char gcmark;
-  int minargs;
+  int minargs; // required args, then optional ones up to maxargs
   int maxargs;
+  enum lambda_rest rest;
+  int resolved;    // form went through the resolver, see resolve.h
+  Lisp_Object env; // frame the lambda was created in, see env.h
   Lisp_Object form;
+  // byte code string and constants, nil unless compiled. see bytecode.h
+  Lisp_Object bytecode;
+  Lisp_Object constants;
+  int maxdepth;
+  int stackargs;
+  // native code of the byte code and calls so far, see jit.h
+  void *jitcode;
+  int ncalls;
   Lisp_Object args[];
 };
 
+// the frame slots binding the args of a call to LAMBDA: maxargs of
+// them, nil for missing optional ones, and the &rest list if any
+static inline int
+lambda_nslots (Lisp_Lambda *lambda)
+{
+  return lambda->maxargs + (lambda->rest == REST_LIST);
+}
+
 /* Type checking */
 
 static inline Lisp_Type
@@ -189,6 +293,53 @@ unbox_int (Lisp_Object v)
   return ((int64_t)v) >> TAGBITS;
 }
 
+#define MOST_POSITIVE_FIXNUM ((Lisp_Integer)((1ULL << (VALBITS - 1)) - 1))
+#define MOST_NEGATIVE_FIXNUM (-MOST_POSITIVE_FIXNUM - 1)
+
+/* the fixnum fast paths of arithmetic, on the tagged values: the tag
+   of fixnums is 0, so that (x << 3) + (y << 3) == (x + y) << 3 and
+   the comparisons are the same.  the operations store X op Y in RES
+   and return 1 when X and Y are fixnums and the result fits one.
+   otherwise the arithmetic builtins do it, promoting the result to a
+   bignum, see bignum.h */
+static inline int
+fixnums (Lisp_Object x, Lisp_Object y)
+{
+  return ((x | y) & TAGMASK) == 0;
+}
+
+static inline int
+fixnum_add (Lisp_Object x, Lisp_Object y, Lisp_Object *res)
+{
+  int64_t r;
+  if (!fixnums (x, y) || __builtin_add_overflow ((int64_t)x, (int64_t)y, &r))
+    return 0;
+  *res = r;
+  return 1;
+}
+
+static inline int
+fixnum_sub (Lisp_Object x, Lisp_Object y, Lisp_Object *res)
+{
+  int64_t r;
+  if (!fixnums (x, y) || __builtin_sub_overflow ((int64_t)x, (int64_t)y, &r))
+    return 0;
+  *res = r;
+  return 1;
+}
+
+static inline int
+fixnum_mul (Lisp_Object x, Lisp_Object y, Lisp_Object *res)
+{
+  // x * (y << 3) == (x * y) << 3
+  int64_t r;
+  if (!fixnums (x, y)
+      || __builtin_mul_overflow (unbox_int (x), (int64_t)y, &r))
+    return 0;
+  *res = r;
+  return 1;
+}
+
 static inline Lisp_Object
 box_string (Lisp_String *s)
 {
@@ -237,6 +388,31 @@ unbox_vector (Lisp_Object v)
   return (Lisp_Vector *)unbox_pointer (v);
 }
 
+static inline int
+pseudovector_p (Lisp_Object v)
+{
+  return type_of (v) == LISP_VECT
+         && (unbox_vector (v)->size & PSEUDOVECTOR_FLAG);
+}
+
+static inline int
+bignum_p (Lisp_Object v)
+{
+  return pseudovector_p (v);
+}
+
+static inline Lisp_Object
+box_bignum (Lisp_Bignum *b)
+{
+  return ((uint64_t)b) | LISP_VECT;
+}
+
+static inline Lisp_Bignum *
+unbox_bignum (Lisp_Object v)
+{
+  return (Lisp_Bignum *)unbox_pointer (v);
+}
+
 static inline Lisp_Object
 box_subr (Lisp_Subr *s)
 {
@@ -261,6 +437,43 @@ unbox_lambda (Lisp_Object v)
   return (Lisp_Lambda *)unbox_pointer (v);
 }
 
+// a lexical reference is an immediate: slot SLOT of the frame DEPTH
+// frames up from the current one.  a boxed reference is to a slot
+// holding a box, the one element list of a variable captured by
+// closures and assigned (see resolve.h)
+
+#define LREF_BOXED 0x80000000u
+
+static inline Lisp_Object
+box_lref (uint32_t depth, uint32_t slot)
+{
+  return (((uint64_t)depth << 32 | slot) << TAGBITS) | LISP_LREF;
+}
+
+static inline uint32_t
+lref_depth (Lisp_Object v)
+{
+  return (v >> TAGBITS) >> 32;
+}
+
+static inline uint32_t
+lref_slot (Lisp_Object v)
+{
+  return (v >> TAGBITS) & (LREF_BOXED - 1);
+}
+
+static inline int
+lref_boxed (Lisp_Object v)
+{
+  return ((v >> TAGBITS) & LREF_BOXED) != 0;
+}
+
+static inline Lisp_Object
+lref_box (Lisp_Object v)
+{
+  return v | (Lisp_Object)LREF_BOXED << TAGBITS;
+}
+
 // TODO not inlined
 static inline const char *
 type_name (Lisp_Type t)
@@ -281,6 +494,8 @@ type_name (Lisp_Type t)
       return "SUBR";
     case LISP_LMBD:
       return "LMBD";
+    case LISP_LREF:
+      return "LREF";
     default:
       return "UNKN";
     }
@@ -299,6 +514,7 @@ Lisp_Object f_cdr (Lisp_Object cons);
 Lisp_Object f_eq_p (Lisp_Object x, Lisp_Object y);
 Lisp_Object f_equal_p (Lisp_Object key, Lisp_Object alist);
 Lisp_Object f_eval (Lisp_Object form);
+Lisp_Object f_eval_data (Lisp_Object form);
 Lisp_Object f_assoc (Lisp_Object key, Lisp_Object alist);
 Lisp_Object f_assq (Lisp_Object key, Lisp_Object alist);
 Lisp_Object f_rassoc (Lisp_Object key, Lisp_Object alist);
@@ -306,6 +522,7 @@ Lisp_Object f_rassq (Lisp_Object key, Lisp_Object alist);
 Lisp_Object f_string_equal_p (Lisp_Object x, Lisp_Object y);
 Lisp_Object f_string_length (Lisp_Object string);
 Lisp_Object f_length (Lisp_Object list);
+Lisp_Object f_append (int argc, Lisp_Object *argv);
 Lisp_Object f_sum (int argc, Lisp_Object *argv);
 Lisp_Object f_subtract (int argc, Lisp_Object *argv);
 Lisp_Object f_multiply (int argc, Lisp_Object *argv);
@@ -323,20 +540,64 @@ Lisp_Object f_if (Lisp_Object form);
 Lisp_Object f_when (Lisp_Object form);
 Lisp_Object f_unless (Lisp_Object form);
 Lisp_Object f_cond (Lisp_Object form);
+Lisp_Object f_setq (Lisp_Object form);
+Lisp_Object f_while (Lisp_Object form);
+Lisp_Object f_dotimes (Lisp_Object form);
+Lisp_Object f_dolist (Lisp_Object form);
 Lisp_Object f_lambda (Lisp_Object form);
 Lisp_Object f_define (Lisp_Object form);
+Lisp_Object f_defvar (Lisp_Object form);
+Lisp_Object f_defmacro (Lisp_Object form);
+Lisp_Object f_macroexpand (Lisp_Object form);
+Lisp_Object f_byte_compile (Lisp_Object fun);
+Lisp_Object f_load (Lisp_Object filename);
 Lisp_Object f_format (int argc, Lisp_Object *argv);
 Lisp_Object f_gc ();
+Lisp_Object f_backtrace ();
 Lisp_Object f_memstats ();
 Lisp_Object f_memdump ();
+Lisp_Object f_term_to_binary (Lisp_Object term);
+Lisp_Object f_binary_to_term (Lisp_Object binary);
+Lisp_Object f_node_start (Lisp_Object path);
+Lisp_Object f_send (Lisp_Object dest, Lisp_Object term);
+Lisp_Object f_receive (Lisp_Object timeout);
+Lisp_Object f_node_flush (Lisp_Object dest);
+Lisp_Object f_node_batch_size (Lisp_Object bytes);
+Lisp_Object f_node_nodelay (Lisp_Object flag);
+Lisp_Object f_table_new (Lisp_Object nshards);
+Lisp_Object f_table_put (Lisp_Object table, Lisp_Object key, Lisp_Object val);
+Lisp_Object f_table_get (Lisp_Object table, Lisp_Object key);
+Lisp_Object f_table_remove (Lisp_Object table, Lisp_Object key);
+Lisp_Object f_table_count (Lisp_Object table);
+Lisp_Object f_table_delete (Lisp_Object table);
 
 extern Lisp_Object q_nil;
 extern Lisp_Object q_t;
 extern Lisp_Object q_unbound;
+extern Lisp_Object q_quote;
+extern Lisp_Object q_lambda;
+extern Lisp_Object q_let;
+extern Lisp_Object q_let_star;
+extern Lisp_Object q_define;
+extern Lisp_Object q_defvar;
+extern Lisp_Object q_dotimes;
+extern Lisp_Object q_dolist;
+extern Lisp_Object q_optional;
+extern Lisp_Object q_rest;
+extern Lisp_Object q_progn;
+extern Lisp_Object q_cons;
+extern Lisp_Object q_append;
+extern Lisp_Object q_macro;
+extern Lisp_Object q_defmacro;
+extern Lisp_Object q_quasiquote;
+extern Lisp_Object q_unquote;
+extern Lisp_Object q_unquote_splicing;
 extern Lisp_Object v_obarray;
 extern Lisp_Object l_globalenv;
 
 void init_builtins ();
+/* prints the calls in progress, innermost first, see eval.c */
+void print_backtrace (FILE *out);
 
 // inlined helpers
 
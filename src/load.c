@@ -0,0 +1,270 @@
+#include "load.h"
+#include "bytecode.h"
+#include "env.h"
+#include "eval.h"
+#include "lexer.h"
+#include "lisp.h"
+#include "parser.h"
+#include "term.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// the term messages of the forms, written out once the load is over
+struct bytebuf
+{
+  unsigned char *data;
+  size_t size;
+  size_t alloc;
+};
+
+static char *read_file (const char *filename, size_t *size);
+static uint64_t hash_bytes (const unsigned char *data, size_t size);
+static int load_cache (const char *cachename, uint64_t hash,
+                       Lisp_Object *result);
+static Lisp_Object load_source (const char *src, size_t size, uint64_t hash,
+                                const char *cachename);
+static Lisp_Object compile_definition (Lisp_Object form);
+static void write_cache (const char *cachename, struct elc *header,
+                         struct bytebuf *forms);
+static void buf_put (struct bytebuf *b, const void *data, size_t size);
+
+Lisp_Object
+load_file (const char *filename, int *hit)
+{
+  size_t size;
+  char *src = read_file (filename, &size);
+  if (!src)
+    {
+      // TODO err
+      fprintf (stderr, "%s: cannot open file\n", filename);
+      exit (2);
+    }
+
+  char *cachename = malloc (strlen (filename) + 2);
+  sprintf (cachename, "%sc", filename);
+
+  uint64_t hash = hash_bytes ((const unsigned char *)src, size);
+  Lisp_Object result;
+  int cached = load_cache (cachename, hash, &result);
+  if (!cached)
+    result = load_source (src, size, hash, cachename);
+
+  if (hit)
+    *hit = cached;
+  free (cachename);
+  free (src);
+  return result;
+}
+
+// helpers
+
+static char *
+read_file (const char *filename, size_t *size)
+{
+  FILE *f = fopen (filename, "r");
+  if (!f)
+    return NULL;
+
+  struct stat st;
+  if (fstat (fileno (f), &st) < 0)
+    {
+      fclose (f);
+      return NULL;
+    }
+
+  char *data = malloc (st.st_size + 1);
+  *size = fread (data, 1, st.st_size, f);
+  fclose (f);
+  return data;
+}
+
+static uint64_t
+hash_bytes (const unsigned char *data, size_t size)
+{
+  // FNV-1a, like the tables
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++)
+    {
+      hash ^= data[i];
+      hash *= 0x100000001b3ULL;
+    }
+  return hash;
+}
+
+static int
+load_cache (const char *cachename, uint64_t hash, Lisp_Object *result)
+{
+  int fd = open (cachename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+
+  struct stat st;
+  if (fstat (fd, &st) < 0 || (size_t)st.st_size < sizeof (struct elc))
+    {
+      close (fd);
+      return 0;
+    }
+
+  size_t size = st.st_size;
+  const unsigned char *map = mmap (NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close (fd);
+  if (map == MAP_FAILED)
+    return 0;
+
+  const struct elc *header = (const struct elc *)map;
+  const unsigned char *end = map + size;
+  const unsigned char *pos = map + sizeof (struct elc);
+  int valid = memcmp (header->magic, LOAD_CACHE_MAGIC, 4) == 0
+              && header->bytecode == BYTE_CODE_VERSION
+              && header->term == TERM_VERSION && header->hash == hash;
+
+  // check the framing of every message before evaluating the first
+  // one: a truncated cache must not leave the file half loaded
+  for (uint32_t i = 0; valid && i < header->nforms; i++)
+    {
+      size_t msgsize = term_message_size (pos, end - pos);
+      if (msgsize == 0 || msgsize > (size_t)(end - pos))
+        valid = 0;
+      else
+        pos += msgsize;
+    }
+
+  if (valid && pos == end)
+    {
+      *result = q_nil;
+      pos = map + sizeof (struct elc);
+      for (uint32_t i = 0; i < header->nforms; i++)
+        {
+          size_t msgsize = term_message_size (pos, end - pos);
+          const char *err;
+          Lisp_Object form = term_decode (pos, msgsize, &err);
+          if (err)
+            {
+              // TODO err
+              fprintf (stderr, "%s: %s\n", cachename, err);
+              exit (2);
+            }
+          *result = eval (env_current (), form);
+          pos += msgsize;
+        }
+    }
+  else
+    valid = 0;
+
+  munmap ((void *)map, size);
+  return valid;
+}
+
+static Lisp_Object
+load_source (const char *src, size_t size, uint64_t hash,
+             const char *cachename)
+{
+  struct elc header = { .magic = LOAD_CACHE_MAGIC,
+                        .bytecode = BYTE_CODE_VERSION,
+                        .term = TERM_VERSION,
+                        .nforms = 0,
+                        .hash = hash };
+  struct bytebuf forms = {};
+  Lisp_Object result = q_nil;
+  Token tok;
+
+  Lexer *l = lex_init ();
+  Stream *s = stream_string (src, size);
+  lex_set_stream (l, s);
+
+  // one form at a time in the base frame, see eval_toplevel
+  while ((tok = lex_next (l)).type != TOK_EOF)
+    {
+      Lisp_Object form = parse_sexp_from_tok (l, tok);
+      // encoded before evaluation, which resolves lambda bodies in
+      // place
+      size_t msgsize;
+      unsigned char *msg = term_encode (form, &msgsize);
+
+      result = eval (env_current (), form);
+
+      Lisp_Object compiled = compile_definition (form);
+      if (!nil (compiled))
+        {
+          free (msg);
+          msg = term_encode (compiled, &msgsize);
+        }
+      buf_put (&forms, msg, msgsize);
+      header.nforms++;
+      free (msg);
+    }
+
+  stream_close (s);
+  free (l);
+
+  write_cache (cachename, &header, &forms);
+  free (forms.data);
+  return result;
+}
+
+static Lisp_Object
+compile_definition (Lisp_Object form)
+{
+  // (define NAME (lambda ...)), evaluated at toplevel
+  if (type_of (form) != LISP_CONS || !eq (f_car (form), q_define))
+    return q_nil;
+
+  Lisp_Object name = f_car (f_cdr (form));
+  Lisp_Object value = f_car (f_cdr (f_cdr (form)));
+  if (type_of (name) != LISP_SYMB || type_of (value) != LISP_CONS
+      || !eq (f_car (value), q_lambda))
+    return q_nil;
+
+  Lisp_Object lambda = unbox_symbol (name)->value;
+  if (type_of (lambda) != LISP_LMBD)
+    return q_nil;
+  // uncompilable lambdas stay interpreted, and cached as source
+  if (nil (unbox_lambda (lambda)->bytecode)
+      && byte_compile (unbox_lambda (lambda)))
+    return q_nil;
+
+  return f_cons (q_define, f_cons (name, f_cons (lambda, q_nil)));
+}
+
+static void
+write_cache (const char *cachename, struct elc *header,
+             struct bytebuf *forms)
+{
+  // write aside and rename, so that a concurrent load never maps a
+  // partial cache. failing to write it is not an error
+  char *tmpname = malloc (strlen (cachename) + 32);
+  sprintf (tmpname, "%s.%d", cachename, getpid ());
+
+  FILE *f = fopen (tmpname, "w");
+  if (!f)
+    {
+      free (tmpname);
+      return;
+    }
+
+  int ok = fwrite (header, sizeof (struct elc), 1, f) == 1
+           && fwrite (forms->data, 1, forms->size, f) == forms->size;
+  ok = fclose (f) == 0 && ok;
+  if (!ok || rename (tmpname, cachename) < 0)
+    unlink (tmpname);
+  free (tmpname);
+}
+
+static void
+buf_put (struct bytebuf *b, const void *data, size_t size)
+{
+  if (b->size + size > b->alloc)
+    {
+      b->alloc = b->alloc ? b->alloc : 4096;
+      while (b->size + size > b->alloc)
+        b->alloc *= 2;
+      b->data = realloc (b->data, b->alloc);
+    }
+  memcpy (b->data + b->size, data, size);
+  b->size += size;
+}
@@ -0,0 +1,48 @@
+#ifndef LOAD_H
+#define LOAD_H
+
+/*
+  Loading source files through an on-disk cache.
+
+  load_file evaluates the forms of a file one at a time in the base
+  frame, like eval_toplevel.  Next to FILE it keeps FILEc (lib.tl ->
+  lib.tlc, foo.el -> foo.elc), laid out as:
+
+    +-------------+----------------+----------------+---------------+
+    | header      | term message   | term message   | ...           |
+    | struct elc  | (see term.h)   |                |               |
+    +-------------+----------------+----------------+---------------+
+
+  The header holds the byte code and term format versions and a hash
+  of the source contents.  When all of them match, the cache is mapped
+  in memory and the forms are decoded straight from the mapping and
+  evaluated: the source is neither lexed nor parsed.  Otherwise the
+  source is evaluated and the cache is written again.
+
+  Toplevel (define NAME (lambda ...)) forms are byte compiled once
+  evaluated, and cached as (define NAME <compiled lambda>): a load from
+  the cache does not compile them again.  The other forms are cached
+  as read.
+
+  The header is in host byte order: a cache is not meant to be shared
+  between machines.
+ */
+
+#include "lisp.h"
+
+#define LOAD_CACHE_MAGIC "ELC"
+
+struct elc
+{
+  char magic[4];          // LOAD_CACHE_MAGIC
+  uint16_t bytecode;      // BYTE_CODE_VERSION
+  uint16_t term;          // TERM_VERSION
+  uint32_t nforms;        // term messages following the header
+  uint64_t hash;          // of the source file contents
+};
+
+/* load FILENAME, returning the value of its last form.  HIT, if not
+   NULL, is set to whether the cache was used */
+Lisp_Object load_file (const char *filename, int *hit);
+
+#endif /* LOAD_H */
@@ -0,0 +1,246 @@
+#include "macro.h"
+#include "alloc.h"
+#include "bytecode.h"
+#include "env.h"
+#include "eval.h"
+#include "lisp.h"
+#include "resolve.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void macroexpand_body (Lisp_Object body);
+static Lisp_Object qq_form (Lisp_Object x, int depth);
+static Lisp_Object qq_list (Lisp_Object x, int depth);
+static Lisp_Object qq_cons (Lisp_Object car, Lisp_Object cdr,
+                            Lisp_Object orig);
+static Lisp_Object qq_append (Lisp_Object list, Lisp_Object tail);
+static Lisp_Object list2 (Lisp_Object a, Lisp_Object b);
+static Lisp_Object list3 (Lisp_Object a, Lisp_Object b, Lisp_Object c);
+
+int
+macro_call_p (Lisp_Object form)
+{
+  if (type_of (form) != LISP_CONS)
+    return 0;
+  Lisp_Object head = f_car (form);
+  return type_of (head) == LISP_SYMB && macro_p (unbox_symbol (head)->value);
+}
+
+Lisp_Object
+macroexpand_1 (Lisp_Object form)
+{
+  if (!macro_call_p (form))
+    return form;
+
+  // the expander gets the args unevaluated
+  Lisp_Object fun = f_cdr (unbox_symbol (f_car (form))->value);
+  Lisp_Object *argv = values_top ();
+  int nargs = 0;
+  for (Lisp_Object args = f_cdr (form); type_of (args) == LISP_CONS;
+       args = f_cdr (args), nargs++)
+    argv = values_push (argv, f_car (args));
+
+  Lisp_Object expansion = byte_call (fun, nargs, argv);
+  values_unwind (argv);
+  return expansion;
+}
+
+Lisp_Object
+macroexpand (Lisp_Object form)
+{
+  // a macro can expand to another macro call
+  while (macro_call_p (form))
+    {
+      // the expansion may share conses with the template of the
+      // expander, or repeat an arg: the resolver rewrites code in
+      // place, so each call site gets code of its own
+      Lisp_Object expansion = copy_code (macroexpand_1 (form));
+      if (type_of (expansion) != LISP_CONS)
+        expansion = list2 (q_progn, expansion);
+      f_setcar (form, f_car (expansion));
+      f_setcdr (form, f_cdr (expansion));
+    }
+  return form;
+}
+
+void
+macroexpand_all (Lisp_Object form)
+{
+  if (type_of (form) != LISP_CONS)
+    return;
+
+  macroexpand (form);
+  Lisp_Object head = f_car (form);
+  // ((lambda ...) ARGS...)
+  if (type_of (head) == LISP_CONS)
+    macroexpand_all (head);
+  macroexpand_args (head, f_cdr (form));
+}
+
+void
+macroexpand_args (Lisp_Object head, Lisp_Object args)
+{
+  // the same walk as the resolver's: a form already resolved has no
+  // macro calls left
+  if (type_of (head) != LISP_SYMB)
+    {
+      macroexpand_body (args);
+      return;
+    }
+  if (eq (head, q_quote) || eq (head, q_defmacro))
+    return;
+
+  if (eq (head, q_lambda))
+    {
+      if (type_of (f_car (args)) == LISP_VECT)
+        return;
+      args = f_cdr (args);
+    }
+  else if (eq (head, q_let) || eq (head, q_let_star))
+    {
+      Lisp_Object bindings = f_car (args);
+      if (type_of (bindings) == LISP_VECT)
+        return;
+      for (; type_of (bindings) == LISP_CONS; bindings = f_cdr (bindings))
+        macroexpand_all (f_car (f_cdr (f_car (bindings))));
+      args = f_cdr (args);
+    }
+  else if (eq (head, q_dotimes) || eq (head, q_dolist))
+    {
+      Lisp_Object spec = f_car (args);
+      if (type_of (spec) == LISP_VECT)
+        return;
+      // INIT and RESULT
+      macroexpand_body (f_cdr (spec));
+      args = f_cdr (args);
+    }
+  else if (eq (head, q_define) || eq (head, q_defvar))
+    args = f_cdr (args);
+  else if (unbox_symbol (head)->form == SF_COND)
+    {
+      // clauses are lists of forms, not calls
+      for (; type_of (args) == LISP_CONS; args = f_cdr (args))
+        macroexpand_body (f_car (args));
+      return;
+    }
+
+  macroexpand_body (args);
+}
+
+Lisp_Object
+quasiquote_expand (Lisp_Object template)
+{
+  return qq_form (template, 1);
+}
+
+Lisp_Object
+defmacro (Lisp_Object form)
+{
+  Lisp_Object name = f_car (form);
+  if (type_of (name) != LISP_SYMB)
+    {
+      // TODO err
+      fprintf (stderr, "defmacro: name is not a symbol\n");
+      exit (31);
+    }
+
+  // macros are global, like definitions
+  Lisp_Object fun = lambda (env_current (), f_cdr (form));
+  unbox_symbol (name)->value = f_cons (q_macro, fun);
+  return name;
+}
+
+// helpers
+
+static void
+macroexpand_body (Lisp_Object body)
+{
+  for (; type_of (body) == LISP_CONS; body = f_cdr (body))
+    macroexpand_all (f_car (body));
+}
+
+static Lisp_Object
+qq_form (Lisp_Object x, int depth)
+{
+  // the code building X, a template DEPTH backquotes deep
+  if (type_of (x) != LISP_CONS)
+    return constant_form (x);
+
+  Lisp_Object head = f_car (x);
+  if (eq (head, q_unquote))
+    {
+      if (depth == 1)
+        return f_car (f_cdr (x));
+      return qq_list (x, depth - 1);
+    }
+  if (eq (head, q_unquote_splicing))
+    {
+      if (depth == 1)
+        {
+          // TODO err
+          fprintf (stderr, ",@ not in a list\n");
+          exit (31);
+        }
+      return qq_list (x, depth - 1);
+    }
+  if (eq (head, q_quasiquote))
+    return qq_list (x, depth + 1);
+  return qq_list (x, depth);
+}
+
+static Lisp_Object
+qq_list (Lisp_Object x, int depth)
+{
+  Lisp_Object elem = f_car (x);
+  Lisp_Object rest = f_cdr (x);
+
+  // `(a . ,b) reads as (a unquote b)
+  Lisp_Object tail;
+  if (type_of (rest) == LISP_CONS && eq (f_car (rest), q_unquote))
+    tail = qq_form (rest, depth);
+  else if (type_of (rest) == LISP_CONS)
+    tail = qq_list (rest, depth);
+  else
+    tail = constant_form (rest);
+
+  if (depth == 1 && type_of (elem) == LISP_CONS
+      && eq (f_car (elem), q_unquote_splicing))
+    return qq_append (f_car (f_cdr (elem)), tail);
+  return qq_cons (qq_form (elem, depth), tail, x);
+}
+
+static Lisp_Object
+qq_cons (Lisp_Object car, Lisp_Object cdr, Lisp_Object orig)
+{
+  Lisp_Object carval, cdrval;
+  if (!constant_p (car, &carval) || !constant_p (cdr, &cdrval))
+    return list3 (q_cons, car, cdr);
+
+  // a constant part of the template is quoted as it is, a constant
+  // built from rewritten parts is built now
+  if (eq (carval, f_car (orig)) && eq (cdrval, f_cdr (orig)))
+    return constant_form (orig);
+  return constant_form (f_cons (carval, cdrval));
+}
+
+static Lisp_Object
+qq_append (Lisp_Object list, Lisp_Object tail)
+{
+  // `(,@l) is l itself, as in emacs
+  Lisp_Object tailval;
+  if (constant_p (tail, &tailval) && nil (tailval))
+    return list;
+  return list3 (q_append, list, tail);
+}
+
+static Lisp_Object
+list2 (Lisp_Object a, Lisp_Object b)
+{
+  return f_cons (a, f_cons (b, q_nil));
+}
+
+static Lisp_Object
+list3 (Lisp_Object a, Lisp_Object b, Lisp_Object c)
+{
+  return f_cons (a, f_cons (b, f_cons (c, q_nil)));
+}
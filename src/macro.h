@@ -0,0 +1,68 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+/*
+  Macros and backquote.
+
+  (defmacro NAME ARGS . BODY) sets the value of NAME to
+
+    (macro . LAMBDA)
+
+  like emacs.  A call to NAME is expanded by calling LAMBDA on its
+  unevaluated args, and the expansion is evaluated in place of it.
+
+  Expansion is memoized in the code itself: the cons of the call gets
+  the car and cdr of a copy of the expansion (an atom is wrapped in a
+  progn), so that a call site is expanded once however many times it
+  runs.  The copy leaves quoted data shared, and gives each call site
+  code of its own, since the resolver rewrites it in place.  The
+  resolver expands every body before resolving it, see resolve.h, so
+  that resolved and compiled code is free of macro calls and the
+  capture analysis sees the expanded code.  Macro calls in forms that
+  are not resolved, a toplevel while body say, are expanded by eval
+  the first time it reaches them.  A macro must then be defined before
+  the first body using it is evaluated, and redefining it does not
+  change the call sites already expanded.
+
+  The reader turns `X, ,X and ,@X into (quasiquote X), (unquote X) and
+  (unquote-splicing X).  quasiquote is a macro whose expander is the
+  subr quasiquote_expand: it compiles the template to cons and append
+  calls, the constant parts of the template quoted as they are:
+
+    `(a b ,c d)             ->  (cons 'a (cons 'b (cons c '(d))))
+    `(a ,@l b)              ->  (cons 'a (append l '(b)))
+    `(a . ,b)               ->  (cons 'a b)
+
+  so that expanded code builds only the conses holding unquoted values.
+  Nested backquotes are kept as data, their unquotes evaluated only at
+  the matching depth.
+ */
+
+#include "lisp.h"
+
+/* whether FUN, the value of a symbol, is a macro */
+static inline int
+macro_p (Lisp_Object fun)
+{
+  return type_of (fun) == LISP_CONS && eq (f_car (fun), q_macro);
+}
+
+/* whether FORM is a call to a macro */
+int macro_call_p (Lisp_Object form);
+/* the expansion of FORM if it is a macro call, FORM otherwise.  FORM
+   is not modified */
+Lisp_Object macroexpand_1 (Lisp_Object form);
+/* expands FORM in place as long as it is a macro call.  returns FORM */
+Lisp_Object macroexpand (Lisp_Object form);
+/* expands in place every macro call in FORM and its subforms */
+void macroexpand_all (Lisp_Object form);
+/* expands in place the macro calls in the subforms of (HEAD . ARGS),
+   knowing the special forms: quoted data and binding lists are left
+   alone */
+void macroexpand_args (Lisp_Object head, Lisp_Object args);
+/* the code building the backquote template TEMPLATE */
+Lisp_Object quasiquote_expand (Lisp_Object template);
+/* (defmacro NAME ARGS . BODY), FORM is its cdr.  returns NAME */
+Lisp_Object defmacro (Lisp_Object form);
+
+#endif /* MACRO_H */
@@ -0,0 +1,506 @@
+#include "node.h"
+#include "term.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MSG_NOSIGNAL
+// not available on macos: a closed peer will raise SIGPIPE there
+#define MSG_NOSIGNAL 0
+#endif /* MSG_NOSIGNAL */
+
+struct conn
+{
+  int fd;
+  char *dest; // peer node path, NULL for accepted connections
+  unsigned char *out;
+  size_t outsize;
+  size_t outalloc;
+  unsigned char *in;
+  size_t insize;
+  size_t inalloc;
+  struct conn *next;
+};
+
+struct msg
+{
+  unsigned char *data;
+  size_t size;
+  struct msg *next;
+};
+
+static int listenfd = -1;
+static char *listenpath;
+static pid_t listenpid; // forked children must not unlink our socket
+static struct conn *conns;
+static struct msg *mboxhead;
+static struct msg *mboxtail;
+static size_t batchsize = NODE_DEFAULT_BATCH;
+static int nodelay;
+static int exithook;
+
+static struct conn *conn_find (const char *dest, size_t destlen);
+static struct conn *conn_open (const char *dest, size_t destlen);
+static void conn_close (struct conn *c);
+static int conn_write (struct conn *c);
+static int conn_read (struct conn *c);
+static void conn_accept ();
+static void drain (struct conn *c, int timeoutms);
+static long elapsed_ms (const struct timespec *start);
+static int set_sockaddr (struct sockaddr_un *addr, const char *path,
+                         size_t pathlen);
+static void grow (unsigned char **buf, size_t *alloc, size_t needed);
+static void flush_at_exit ();
+
+int
+node_start (const char *path, size_t pathlen)
+{
+  struct sockaddr_un addr;
+
+  if (listenfd >= 0)
+    {
+      fprintf (stderr, "node already started on %s\n", listenpath);
+      return 1;
+    }
+  if (set_sockaddr (&addr, path, pathlen))
+    return 1;
+
+  listenfd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (listenfd < 0)
+    {
+      perror ("node socket");
+      return 1;
+    }
+
+  // a stale socket file from a previous run would make bind fail
+  unlink (addr.sun_path);
+  if (bind (listenfd, (struct sockaddr *)&addr, sizeof (addr)) < 0
+      || listen (listenfd, 64) < 0)
+    {
+      perror ("node bind");
+      close (listenfd);
+      listenfd = -1;
+      return 1;
+    }
+
+  listenpath = strdup (addr.sun_path);
+  listenpid = getpid ();
+  if (!exithook)
+    {
+      atexit (flush_at_exit);
+      exithook = 1;
+    }
+  return 0;
+}
+
+void
+node_stop ()
+{
+  node_flush (NULL, 0);
+  while (conns)
+    conn_close (conns);
+
+  while (mboxhead)
+    {
+      struct msg *m = mboxhead;
+      mboxhead = m->next;
+      free (m->data);
+      free (m);
+    }
+  mboxtail = NULL;
+
+  if (listenfd >= 0)
+    {
+      close (listenfd);
+      if (listenpid == getpid ())
+        unlink (listenpath);
+      free (listenpath);
+      listenfd = -1;
+      listenpath = NULL;
+    }
+}
+
+int
+node_send (const char *dest, size_t destlen, const unsigned char *msg,
+           size_t size)
+{
+  struct conn *c = conn_find (dest, destlen);
+  if (!c)
+    c = conn_open (dest, destlen);
+  if (!c)
+    return 1;
+
+  grow (&c->out, &c->outalloc, c->outsize + size);
+  memcpy (c->out + c->outsize, msg, size);
+  c->outsize += size;
+
+  if (nodelay || c->outsize >= batchsize)
+    return conn_write (c);
+  return 0;
+}
+
+int
+node_flush (const char *dest, size_t destlen)
+{
+  if (dest)
+    {
+      struct conn *c = conn_find (dest, destlen);
+      return c ? conn_write (c) : 0;
+    }
+
+  // conn_write can close (and free) any connection, while it reads
+  // the others: look for the next one with pending bytes from the
+  // start each time
+  int err = 0;
+  for (;;)
+    {
+      struct conn *c = conns;
+      while (c && c->outsize == 0)
+        c = c->next;
+      if (!c)
+        return err;
+      err |= conn_write (c);
+    }
+}
+
+size_t
+node_pending (const char *dest, size_t destlen)
+{
+  struct conn *c = conn_find (dest, destlen);
+  return c ? c->outsize : 0;
+}
+
+void
+node_set_batch (size_t bytes)
+{
+  batchsize = bytes;
+}
+
+void
+node_set_nodelay (int flag)
+{
+  nodelay = flag;
+  if (nodelay)
+    node_flush (NULL, 0);
+}
+
+unsigned char *
+node_receive (int timeoutms, size_t *size)
+{
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  // whoever we are waiting for may be waiting for our pending batches
+  node_flush (NULL, 0);
+
+  while (!mboxhead)
+    {
+      int nconns = 0;
+      for (struct conn *c = conns; c; c = c->next)
+        nconns++;
+
+      struct pollfd *fds = calloc (nconns + 1, sizeof (struct pollfd));
+      struct conn **polled = calloc (nconns + 1, sizeof (struct conn *));
+      int nfds = 0;
+      if (listenfd >= 0)
+        fds[nfds++] = (struct pollfd){ .fd = listenfd, .events = POLLIN };
+      for (struct conn *c = conns; c; c = c->next)
+        {
+          polled[nfds] = c;
+          fds[nfds++] = (struct pollfd){ .fd = c->fd, .events = POLLIN };
+        }
+
+      int wait = timeoutms;
+      if (timeoutms > 0)
+        {
+          long elapsed = elapsed_ms (&start);
+          wait = elapsed >= timeoutms ? 0 : timeoutms - elapsed;
+        }
+
+      int ready = nfds ? poll (fds, nfds, wait) : 0;
+      if (ready < 0 && errno != EINTR)
+        perror ("node poll");
+
+      for (int i = 0; ready > 0 && i < nfds; i++)
+        {
+          if (!fds[i].revents)
+            continue;
+          if (fds[i].fd == listenfd && !polled[i])
+            conn_accept ();
+          else
+            conn_read (polled[i]);
+        }
+
+      free (fds);
+      free (polled);
+
+      if (mboxhead || timeoutms == 0 || !nfds)
+        break;
+      if (timeoutms > 0 && ready == 0 && wait == 0)
+        break;
+    }
+
+  if (!mboxhead)
+    return NULL;
+
+  struct msg *m = mboxhead;
+  mboxhead = m->next;
+  if (!mboxhead)
+    mboxtail = NULL;
+
+  unsigned char *data = m->data;
+  *size = m->size;
+  free (m);
+  return data;
+}
+
+// helpers
+
+static int
+set_sockaddr (struct sockaddr_un *addr, const char *path, size_t pathlen)
+{
+  memset (addr, 0, sizeof (*addr));
+  addr->sun_family = AF_UNIX;
+  if (pathlen >= sizeof (addr->sun_path))
+    {
+      fprintf (stderr, "node path too long: %.*s\n", (int)pathlen, path);
+      return 1;
+    }
+  memcpy (addr->sun_path, path, pathlen);
+  return 0;
+}
+
+static struct conn *
+conn_find (const char *dest, size_t destlen)
+{
+  for (struct conn *c = conns; c; c = c->next)
+    if (c->dest && strlen (c->dest) == destlen
+        && memcmp (c->dest, dest, destlen) == 0)
+      return c;
+  return NULL;
+}
+
+static struct conn *
+conn_open (const char *dest, size_t destlen)
+{
+  struct sockaddr_un addr;
+  if (set_sockaddr (&addr, dest, destlen))
+    return NULL;
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0 || connect (fd, (struct sockaddr *)&addr, sizeof (addr)) < 0)
+    {
+      fprintf (stderr, "cannot connect to node %s: %s\n", addr.sun_path,
+               strerror (errno));
+      if (fd >= 0)
+        close (fd);
+      return NULL;
+    }
+
+  struct conn *c = calloc (1, sizeof (struct conn));
+  c->fd = fd;
+  c->dest = strdup (addr.sun_path);
+  c->next = conns;
+  conns = c;
+
+  if (!exithook)
+    {
+      atexit (flush_at_exit);
+      exithook = 1;
+    }
+  return c;
+}
+
+static void
+conn_close (struct conn *c)
+{
+  struct conn **ptr = &conns;
+  while (*ptr && *ptr != c)
+    ptr = &(*ptr)->next;
+  if (*ptr)
+    *ptr = c->next;
+
+  close (c->fd);
+  free (c->dest);
+  free (c->out);
+  free (c->in);
+  free (c);
+}
+
+static int
+conn_write (struct conn *c)
+{
+  // see node.h: while C is full, read the others
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  size_t written = 0;
+  while (written < c->outsize)
+    {
+      ssize_t n = send (c->fd, c->out + written, c->outsize - written,
+                        MSG_NOSIGNAL | MSG_DONTWAIT);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+          long wait = NODE_SEND_TIMEOUT - elapsed_ms (&start);
+          if (wait > 0)
+            {
+              drain (c, wait);
+              continue;
+            }
+          // a partly written message cannot be taken back: the
+          // connection goes
+          fprintf (stderr, "node send to %s timed out\n",
+                   c->dest ? c->dest : "<accepted>");
+          conn_close (c);
+          return 1;
+        }
+      if (n < 0)
+        {
+          fprintf (stderr, "node send to %s failed: %s\n",
+                   c->dest ? c->dest : "<accepted>", strerror (errno));
+          conn_close (c);
+          return 1;
+        }
+      written += n;
+    }
+  c->outsize = 0;
+  return 0;
+}
+
+static int
+conn_read (struct conn *c)
+{
+  grow (&c->in, &c->inalloc, c->insize + 4096);
+  ssize_t n = read (c->fd, c->in + c->insize, c->inalloc - c->insize);
+  if (n <= 0)
+    {
+      if (n < 0 && errno == EINTR)
+        return 0;
+      // peer gone. a partial message left in the buffer is lost
+      conn_close (c);
+      return 1;
+    }
+  c->insize += n;
+
+  // move every complete message to the mailbox
+  size_t pos = 0;
+  while (c->insize - pos >= TERM_HEADER_SIZE)
+    {
+      size_t msgsize = term_message_size (c->in + pos, c->insize - pos);
+      if (msgsize == 0)
+        {
+          fprintf (stderr, "node: invalid message header, dropping peer\n");
+          conn_close (c);
+          return 1;
+        }
+      if (c->insize - pos < msgsize)
+        break;
+
+      struct msg *m = malloc (sizeof (struct msg));
+      m->data = malloc (msgsize);
+      memcpy (m->data, c->in + pos, msgsize);
+      m->size = msgsize;
+      m->next = NULL;
+      if (mboxtail)
+        mboxtail->next = m;
+      else
+        mboxhead = m;
+      mboxtail = m;
+
+      pos += msgsize;
+    }
+
+  memmove (c->in, c->in + pos, c->insize - pos);
+  c->insize -= pos;
+  return 0;
+}
+
+static void
+conn_accept ()
+{
+  int fd = accept (listenfd, NULL, NULL);
+  if (fd < 0)
+    return;
+  struct conn *c = calloc (1, sizeof (struct conn));
+  c->fd = fd;
+  c->next = conns;
+  conns = c;
+}
+
+static void
+drain (struct conn *c, int timeoutms)
+{
+  // waits up to TIMEOUTMS for C to be writable, reading the messages
+  // of the other connections and accepting new ones meanwhile
+  int nconns = 0;
+  for (struct conn *o = conns; o; o = o->next)
+    nconns++;
+
+  struct pollfd *fds = calloc (nconns + 1, sizeof (struct pollfd));
+  struct conn **polled = calloc (nconns + 1, sizeof (struct conn *));
+  int nfds = 0;
+  fds[nfds++] = (struct pollfd){ .fd = c->fd, .events = POLLOUT };
+  if (listenfd >= 0)
+    fds[nfds++] = (struct pollfd){ .fd = listenfd, .events = POLLIN };
+  for (struct conn *o = conns; o; o = o->next)
+    if (o != c)
+      {
+        polled[nfds] = o;
+        fds[nfds++] = (struct pollfd){ .fd = o->fd, .events = POLLIN };
+      }
+
+  int ready = poll (fds, nfds, timeoutms);
+  if (ready < 0 && errno != EINTR)
+    perror ("node poll");
+
+  // C itself is retried by the caller
+  for (int i = 1; ready > 0 && i < nfds; i++)
+    {
+      if (!fds[i].revents)
+        continue;
+      if (polled[i])
+        conn_read (polled[i]);
+      else
+        conn_accept ();
+    }
+
+  free (fds);
+  free (polled);
+}
+
+static long
+elapsed_ms (const struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000
+         + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void
+grow (unsigned char **buf, size_t *alloc, size_t needed)
+{
+  if (needed <= *alloc)
+    return;
+  size_t newalloc = *alloc ? *alloc : 4096;
+  while (newalloc < needed)
+    newalloc *= 2;
+  *buf = realloc (*buf, newalloc);
+  *alloc = newalloc;
+}
+
+static void
+flush_at_exit ()
+{
+  node_flush (NULL, 0);
+  if (listenfd >= 0 && listenpid == getpid ())
+    unlink (listenpath);
+}
@@ -0,0 +1,42 @@
+#ifndef NODE_H
+#define NODE_H
+
+/*
+  Node to node distribution over Unix domain sockets.
+
+  Every erlisp OS process can be a node, addressed by the path of its
+  listening socket.  A node has a single mailbox.  Sending a term to a
+  node encodes it with the external term format (see term.h) and
+  appends it to a persistent connection, opened the first time that
+  node is addressed.  The receiving side reads complete term messages
+  (they are length-prefixed) into its mailbox.
+
+  Outgoing messages are batched: they are written to the socket when
+  the pending bytes of a connection reach the batch size, on an
+  explicit flush, before blocking in a receive and at exit.  With
+  nodelay set every send is written immediately, trading throughput
+  for latency like TCP_NODELAY does.
+
+  Writing never blocks for good.  While a peer does not read, what the
+  other nodes send us is read into the mailbox, so that two nodes
+  flooding each other (or a node flooding itself) both make progress.
+  A peer that reads nothing for NODE_SEND_TIMEOUT milliseconds is
+  dropped, and the send fails.
+ */
+
+#include <stddef.h>
+
+#define NODE_DEFAULT_BATCH 65536
+#define NODE_SEND_TIMEOUT 10000
+
+int node_start (const char *path, size_t pathlen);
+int node_send (const char *dest, size_t destlen, const unsigned char *msg,
+               size_t size);
+int node_flush (const char *dest, size_t destlen);
+unsigned char *node_receive (int timeoutms, size_t *size);
+size_t node_pending (const char *dest, size_t destlen);
+void node_set_batch (size_t bytes);
+void node_set_nodelay (int nodelay);
+void node_stop ();
+
+#endif /* NODE_H */
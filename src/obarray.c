@@ -5,6 +5,8 @@
 #include <string.h>
 
 static int hash_string (const char *s, size_t size);
+static Lisp_Object lookup_data (Lisp_Object obarray, const char *data,
+                                size_t size);
 
 Lisp_Object
 obarray_init ()
@@ -50,16 +52,46 @@ obarray_lookup (Lisp_Object obarray, Lisp_Object symbol)
 Lisp_Object
 obarray_lookup_name (Lisp_Object obarray, Lisp_Object name)
 {
-  Lisp_Vector *uobarray = unbox_vector (obarray);
   Lisp_String *uname = unbox_string (name);
+  return lookup_data (obarray, uname->data, uname->size);
+}
+
+Lisp_Object
+obarray_intern (Lisp_Object obarray, const char *name, size_t size)
+{
+  // lookup first: no lisp allocation at all for known symbols
+  Lisp_Object found = lookup_data (obarray, name, size);
+  if (type_of (found) == LISP_SYMB)
+    return found;
+  return obarray_put (obarray, make_symbol (make_nstring (name, size)));
+}
+
+Lisp_Object
+obarray_find_value (Lisp_Object obarray, Lisp_Object value)
+{
+  Lisp_Vector *uobarray = unbox_vector (obarray);
+
+  for (size_t i = 0; i < uobarray->size; i++)
+    for (Lisp_Symbol *unode = unbox_symbol (uobarray->contents[i]); unode;
+         unode = unode->next)
+      if (eq (unode->value, value))
+        return box_symbol (unode);
+
+  return q_nil;
+}
+
+static Lisp_Object
+lookup_data (Lisp_Object obarray, const char *data, size_t size)
+{
+  Lisp_Vector *uobarray = unbox_vector (obarray);
 
-  int hash = hash_string (uname->data, uname->size);
+  int hash = hash_string (data, size);
   Lisp_Symbol *unode = unbox_symbol (uobarray->contents[hash]);
   while (unode)
     {
       Lisp_String *unodename = unbox_string (unode->name);
-      if (uname->size == unodename->size
-          && strncmp (uname->data, unodename->data, uname->size) == 0)
+      if (size == unodename->size
+          && strncmp (data, unodename->data, size) == 0)
         return box_symbol (unode);
       unode = unode->next;
     }
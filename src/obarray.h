@@ -17,5 +17,9 @@ Lisp_Object obarray_init();
 Lisp_Object obarray_put(Lisp_Object obarray, Lisp_Object symbol);
 Lisp_Object obarray_lookup(Lisp_Object obarray, Lisp_Object symbol);
 Lisp_Object obarray_lookup_name(Lisp_Object obarray, Lisp_Object name);
+/* returns the symbol named NAME, creating and adding it if needed */
+Lisp_Object obarray_intern(Lisp_Object obarray, const char *name, size_t size);
+/* returns a symbol whose value is VALUE, or nil. walks the whole obarray */
+Lisp_Object obarray_find_value(Lisp_Object obarray, Lisp_Object value);
 
 #endif /* OBARRAY_H */
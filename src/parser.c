@@ -1,13 +1,11 @@
 #include "parser.h"
 #include "alloc.h"
+#include "bignum.h"
 #include "lexer.h"
 #include "lisp.h"
 #include "obarray.h"
 #include <string.h>
 
-// Helper to parse a Lisp form starting from a given token
-static Lisp_Object parse_sexp_from_tok (Lexer *l, Token tok);
-
 static void
 parser_error (const char *msg, const Token *tok)
 {
@@ -41,7 +39,7 @@ parse_list (Lexer *l)
   return f_cons (car, cdr);
 }
 
-static Lisp_Object
+Lisp_Object
 parse_sexp_from_tok (Lexer *l, Token tok)
 {
   switch (tok.type)
@@ -49,38 +47,35 @@ parse_sexp_from_tok (Lexer *l, Token tok)
     case TOK_LPAREN:
       return parse_list (l);
     case TOK_QUOTE:
-      return f_cons (make_str_symbol ("quote"),
+      return f_cons (q_quote,
                      f_cons (parse_sexp (l), q_nil));
+    // backquotes are expanded by the quasiquote macro, see macro.h
+    case TOK_QUASIQUOTE:
+      return f_cons (q_quasiquote, f_cons (parse_sexp (l), q_nil));
+    case TOK_UNQUOTE:
+      return f_cons (q_unquote, f_cons (parse_sexp (l), q_nil));
+    case TOK_SPLICE:
+      return f_cons (q_unquote_splicing, f_cons (parse_sexp (l), q_nil));
     case TOK_RPAREN:
       parser_error ("Unexpected ')'", &tok);
       return q_nil;
     case TOK_INT_LITERAL:
-      return box_int (tok.integer);
+      // a long may still be out of the fixnum range
+      return bignum_from_int (tok.integer);
+    case TOK_BIGINT_LITERAL:
+      {
+        Lisp_Object big
+            = bignum_from_string (tok.string, strlen (tok.string));
+        free (tok.string);
+        return big;
+      }
     case TOK_STRING_LITERAL:
       // TODO lexer could get us the len too instead of null terminated string
       return make_string (tok.string);
     case TOK_SYMBOL:
-      {
-        // TODO this seems reeaaaally wrong
-
-        // fake string for lookup in obarray. we don't want to lisp
-        // alloc it, it should not be managed and gc'd.
-        int len = strlen (tok.string);
-        Lisp_String *s = malloc (len + sizeof (Lisp_String));
-        strncpy (s->data, tok.string, len);
-        s->size = len;
-        Lisp_Object obsym = obarray_lookup_name (v_obarray, box_string(s));
-        Lisp_Object ret;
-        if (type_of (obsym) == LISP_SYMB)
-          // return the symbol found
-          ret = obsym;
-        else
-          // create new symbol
-          ret = make_str_symbol (tok.symbol);
-        // cleanup
-        free(s);
-        return ret;
-      }
+      // symbols are interned: the same name always reads as the same
+      // (eq) symbol
+      return obarray_intern (v_obarray, tok.string, strlen (tok.string));
     case TOK_EOF:
       return q_nil;
     default:
@@ -98,7 +93,8 @@ parse_sexp (Lexer *l)
 Lisp_Object
 parse (Lexer *l)
 {
-  // Build up a list of forms
+  // the whole input at once.  files and the repl are read and
+  // evaluated form by form instead, see eval_toplevel
   Lisp_Object forms = q_nil;
   Lisp_Object tail = q_nil;
 
@@ -116,6 +112,5 @@ parse (Lexer *l)
       tail = cell;
     }
 
-  // wrap in (progn ...)
-  return f_cons (make_nstr_symbol ("progn", 5), forms);
+  return f_cons (q_progn, forms);
 }
@@ -5,6 +5,8 @@
 #include "lisp.h"
 
 Lisp_Object parse_sexp (Lexer *l);
+Lisp_Object parse_sexp_from_tok (Lexer *l, Token tok);
+/* all the forms up to the end of the input, in a (progn ...) */
 Lisp_Object parse (Lexer *l);
 
 #endif /* PARSER_H */
@@ -0,0 +1,524 @@
+#include "resolve.h"
+#include "alloc.h"
+#include "eval.h"
+#include "lisp.h"
+#include "macro.h"
+#include <stdlib.h>
+
+static Lisp_Object lookup (struct scope *scope, Lisp_Object symbol);
+static Lisp_Object capture (struct scope *scope, uint32_t depth,
+                            Lisp_Object symbol);
+static Lisp_Object slot_ref (struct scope *scope, uint32_t depth, int slot);
+static void resolve_body (Lisp_Object body, struct scope *scope);
+static Lisp_Object fold (Lisp_Object form);
+static int needs_box (Lisp_Object var, Lisp_Object bindings,
+                      Lisp_Object body, int *assigned);
+static void scan_var (Lisp_Object form, Lisp_Object var, int nested,
+                      int *assigned, int *captured);
+static Lisp_Object rebind_boxed (Lisp_Object *vars, int n, Lisp_Object body);
+static Lisp_Object bind_specials (Lisp_Object *vars, int n, Lisp_Object body);
+static Lisp_Object make_box_form (Lisp_Object init);
+
+// the most args of a call folded
+#define FOLD_MAXARGS 8
+
+Lisp_Object
+resolve (Lisp_Object form, struct scope *scope)
+{
+  switch (type_of (form))
+    {
+    case LISP_SYMB:
+      return lookup (scope, form);
+    case LISP_CONS:
+      break;
+    default:
+      return form;
+    }
+
+  Lisp_Object head = f_car (form);
+  if (eq (head, q_quote) || eq (head, q_defmacro))
+    return form;
+  if (eq (head, q_lambda))
+    {
+      resolve_lambda_form (f_cdr (form), scope);
+      return form;
+    }
+  // let is sequential already, let* is the same form
+  if (eq (head, q_let) || eq (head, q_let_star))
+    {
+      resolve_let_form (f_cdr (form), scope);
+      return form;
+    }
+  if (eq (head, q_dotimes) || eq (head, q_dolist))
+    {
+      resolve_iteration_form (f_cdr (form), scope);
+      return form;
+    }
+  if (eq (head, q_define) || eq (head, q_defvar))
+    {
+      // the name is not a variable reference
+      resolve_body (f_cdr (f_cdr (form)), scope);
+      return form;
+    }
+
+  // function call or special form evaluating all its subforms. the
+  // head is resolved too: a lexical variable can hold a function
+  resolve_body (form, scope);
+  return fold (form);
+}
+
+void
+resolve_lambda_form (Lisp_Object form, struct scope *scope)
+{
+  // FORM is (ARGS . BODY)
+  Lisp_Object args = f_car (form);
+  if (type_of (args) == LISP_VECT)
+    return;
+  // nested forms were expanded with the outermost one
+  if (!scope)
+    macroexpand_args (q_lambda, form);
+
+  int n = unbox_int (f_length (args));
+  Lisp_Object *list = malloc (n * sizeof (Lisp_Object));
+  for (int i = 0; i < n; i++, args = f_cdr (args))
+    list[i] = f_car (args);
+  f_setcdr (form, bind_specials (list, n, f_cdr (form)));
+
+  int minargs, maxargs;
+  enum lambda_rest rest;
+  Lisp_Object *names = malloc (n * sizeof (Lisp_Object));
+  int nargs = lambda_list (list, n, names, &minargs, &maxargs, &rest);
+  f_setcdr (form, rebind_boxed (names, nargs, f_cdr (form)));
+
+  char *used = calloc (nargs + 1, 1);
+  struct closure closure = { .outer = scope };
+  struct scope captured = { .closure = &closure };
+  struct scope inner = {
+    .names = names, .used = used, .n = nargs, .parent = &captured
+  };
+  resolve_body (f_cdr (form), &inner);
+  // an unused &rest arg is dropped, see resolve.h
+  if (rest == REST_LIST && !used[nargs - 1])
+    list[n - 1] = q_nil;
+
+  Lisp_Object vargs = make_vector (n + captured.n);
+  Lisp_Object *contents = unbox_vector (vargs)->contents;
+  for (int i = 0; i < n; i++)
+    contents[i] = list[i];
+  for (int i = 0; i < captured.n; i++)
+    contents[n + i] = closure.refs[i];
+  f_setcar (form, vargs);
+
+  free (list);
+  free (names);
+  free (used);
+  free (captured.names);
+  free (captured.boxed);
+  free (closure.refs);
+}
+
+void
+resolve_let_form (Lisp_Object form, struct scope *scope)
+{
+  // FORM is (BINDINGS . BODY). bindings are sequential (let*): each
+  // init form sees the variables bound before it
+  Lisp_Object bindings = f_car (form);
+  if (type_of (bindings) == LISP_VECT)
+    return;
+  if (!scope)
+    macroexpand_args (q_let, form);
+
+  int n = unbox_int (f_length (bindings));
+  Lisp_Object vbindings = make_vector (2 * n);
+  Lisp_Object *contents = unbox_vector (vbindings)->contents;
+  Lisp_Object *names = malloc (n * sizeof (Lisp_Object));
+  char *boxed = malloc (n);
+  Lisp_Object *values = malloc (n * sizeof (Lisp_Object));
+  struct scope inner = {
+    .names = names, .boxed = boxed, .values = values, .n = 0, .parent = scope
+  };
+
+  for (int i = 0; i < n; i++, bindings = f_cdr (bindings))
+    {
+      Lisp_Object binding = f_car (bindings);
+      Lisp_Object var = f_car (binding);
+      if (type_of (var) != LISP_SYMB)
+        {
+          // TODO
+          fprintf (stderr, "malformed let, trying to assing to non symbol\n");
+          exit (31);
+        }
+      Lisp_Object init = resolve (f_car (f_cdr (binding)), &inner);
+      // special variables are bound dynamically and stay free
+      // references: nil is never resolved, it holds their slot
+      int special = unbox_symbol (var)->special;
+      int assigned = 0;
+      boxed[i] = !special
+                 && needs_box (var, f_cdr (bindings), f_cdr (form),
+                               &assigned);
+      contents[2 * i] = var;
+      contents[2 * i + 1] = boxed[i] ? make_box_form (init) : init;
+      // references to a constant never assigned are the constant
+      Lisp_Object value;
+      values[i] = !special && !assigned && constant_p (init, &value)
+                      ? init
+                      : q_unbound;
+      names[inner.n++] = special ? q_nil : var;
+    }
+
+  resolve_body (f_cdr (form), &inner);
+  f_setcar (form, vbindings);
+  free (names);
+  free (boxed);
+  free (values);
+}
+
+void
+resolve_iteration_form (Lisp_Object form, struct scope *scope)
+{
+  // FORM is ((VAR INIT [RESULT]) . BODY), of dotimes or dolist. INIT
+  // is outside the scope of VAR, RESULT and BODY are inside
+  Lisp_Object spec = f_car (form);
+  if (type_of (spec) == LISP_VECT)
+    return;
+  if (!scope)
+    macroexpand_args (q_dotimes, form);
+
+  Lisp_Object var = f_car (spec);
+  if (type_of (var) != LISP_SYMB)
+    {
+      // TODO
+      fprintf (stderr, "malformed loop, trying to assing to non symbol\n");
+      exit (31);
+    }
+
+  Lisp_Object vspec = make_vector (3);
+  Lisp_Object *contents = unbox_vector (vspec)->contents;
+  // a special variable is bound dynamically, see resolve_let_form
+  Lisp_Object name = unbox_symbol (var)->special ? q_nil : var;
+  struct scope inner = { .names = &name, .n = 1, .parent = scope };
+
+  contents[0] = var;
+  contents[1] = resolve (f_car (f_cdr (spec)), scope);
+  contents[2] = resolve (f_car (f_cdr (f_cdr (spec))), &inner);
+  // the loop sets VAR in place: a box is only in a let of the body
+  f_setcdr (form, rebind_boxed (&name, 1, f_cdr (form)));
+  resolve_body (f_cdr (form), &inner);
+  f_setcar (form, vspec);
+}
+
+int
+lambda_list (Lisp_Object *list, int n, Lisp_Object *names, int *minargs,
+             int *maxargs, enum lambda_rest *rest)
+{
+  // (REQUIRED... [&optional OPTIONAL...] [&rest REST])
+  int nnames = 0;
+  int optional = 0;
+
+  *rest = REST_NONE;
+  for (int i = 0; i < n; i++)
+    {
+      if (type_of (list[i]) != LISP_SYMB)
+        goto malformed;
+      if (eq (list[i], q_optional))
+        {
+          if (optional)
+            goto malformed;
+          optional = 1;
+          *minargs = nnames;
+          continue;
+        }
+      if (eq (list[i], q_rest))
+        {
+          if (i != n - 2 || type_of (list[i + 1]) != LISP_SYMB)
+            goto malformed;
+          if (!optional)
+            *minargs = nnames;
+          *maxargs = nnames;
+          // nil when dropped by the resolver
+          if (nil (list[i + 1]))
+            *rest = REST_IGNORE;
+          else
+            {
+              *rest = REST_LIST;
+              names[nnames++] = list[i + 1];
+            }
+          return nnames;
+        }
+      names[nnames++] = list[i];
+    }
+
+  if (!optional)
+    *minargs = nnames;
+  *maxargs = nnames;
+  return nnames;
+
+malformed:
+  // TODO err
+  fprintf (stderr, "malformed lambda list\n");
+  exit (31);
+}
+
+Lisp_Object
+constant_form (Lisp_Object value)
+{
+  switch (type_of (value))
+    {
+    case LISP_INTG:
+    case LISP_STRG:
+      return value;
+    case LISP_SYMB:
+      if (nil (value) || eq (value, q_t))
+        return value;
+      break;
+    default:
+      break;
+    }
+  return f_cons (q_quote, f_cons (value, q_nil));
+}
+
+Lisp_Object
+copy_code (Lisp_Object form)
+{
+  if (type_of (form) != LISP_CONS || eq (f_car (form), q_quote))
+    return form;
+
+  Lisp_Object head = f_cons (copy_code (f_car (form)), q_nil);
+  Lisp_Object tail = head;
+  for (form = f_cdr (form); type_of (form) == LISP_CONS; form = f_cdr (form))
+    {
+      Lisp_Object cell = f_cons (copy_code (f_car (form)), q_nil);
+      f_setcdr (tail, cell);
+      tail = cell;
+    }
+  f_setcdr (tail, form);
+  return head;
+}
+
+int
+constant_p (Lisp_Object form, Lisp_Object *value)
+{
+  switch (type_of (form))
+    {
+    case LISP_INTG:
+    case LISP_STRG:
+      *value = form;
+      return 1;
+    case LISP_SYMB:
+      *value = form;
+      return nil (form) || eq (form, q_t);
+    case LISP_CONS:
+      *value = f_car (f_cdr (form));
+      return eq (f_car (form), q_quote);
+    default:
+      return 0;
+    }
+}
+
+void
+resolve_lambda (Lisp_Lambda *lambda)
+{
+  // lambdas built without going through the lambda special form
+  struct scope scope = {
+    .names = lambda->args,
+    .n = lambda_nslots (lambda),
+    .parent = NULL,
+  };
+  macroexpand_args (q_progn, lambda->form);
+  lambda->form = bind_specials (lambda->args, scope.n, lambda->form);
+  resolve_body (lambda->form, &scope);
+  lambda->resolved = 1;
+}
+
+// helpers
+
+static Lisp_Object
+lookup (struct scope *scope, Lisp_Object symbol)
+{
+  if (eq (symbol, q_nil) || eq (symbol, q_t))
+    return symbol;
+
+  uint32_t depth = 0;
+  for (; scope; scope = scope->parent, depth++)
+    {
+      // search backwards: a later binding shadows an earlier one.
+      // symbols are interned, so eq is enough
+      for (int i = scope->n - 1; i >= 0; i--)
+        if (eq (scope->names[i], symbol))
+          {
+            if (scope->values && !eq (scope->values[i], q_unbound))
+              return scope->values[i];
+            if (scope->used)
+              scope->used[i] = 1;
+            return slot_ref (scope, depth, i);
+          }
+      if (scope->closure)
+        return capture (scope, depth, symbol);
+    }
+
+  // free variable
+  return symbol;
+}
+
+static Lisp_Object
+capture (struct scope *scope, uint32_t depth, Lisp_Object symbol)
+{
+  // SCOPE is the closure frame of a lambda, DEPTH frames up. SYMBOL is
+  // not captured yet: look for it where the lambda is created
+  struct closure *closure = scope->closure;
+  Lisp_Object ref = lookup (closure->outer, symbol);
+  if (type_of (ref) != LISP_LREF)
+    return ref;
+
+  if (scope->n == closure->alloc)
+    {
+      closure->alloc = closure->alloc ? 2 * closure->alloc : 4;
+      scope->names
+          = realloc (scope->names, closure->alloc * sizeof (Lisp_Object));
+      scope->boxed = realloc (scope->boxed, closure->alloc);
+      closure->refs
+          = realloc (closure->refs, closure->alloc * sizeof (Lisp_Object));
+    }
+  scope->names[scope->n] = symbol;
+  scope->boxed[scope->n] = lref_boxed (ref);
+  closure->refs[scope->n] = ref;
+  return slot_ref (scope, depth, scope->n++);
+}
+
+static Lisp_Object
+slot_ref (struct scope *scope, uint32_t depth, int slot)
+{
+  Lisp_Object ref = box_lref (depth, slot);
+  return scope->boxed && scope->boxed[slot] ? lref_box (ref) : ref;
+}
+
+static void
+resolve_body (Lisp_Object body, struct scope *scope)
+{
+  for (; type_of (body) == LISP_CONS; body = f_cdr (body))
+    f_setcar (body, resolve (f_car (body), scope));
+}
+
+static Lisp_Object
+fold (Lisp_Object form)
+{
+  // FORM is a resolved call: its value if the function is a pure
+  // builtin and the args are constants it takes, see resolve.h
+  Lisp_Object head = f_car (form);
+  if (type_of (head) != LISP_SYMB
+      || type_of (unbox_symbol (head)->value) != LISP_SUBR)
+    return form;
+  Lisp_Subr *subr = unbox_subr (unbox_symbol (head)->value);
+  if (!subr->pure)
+    return form;
+
+  Lisp_Object argv[FOLD_MAXARGS];
+  int argc = 0;
+  for (Lisp_Object args = f_cdr (form); type_of (args) == LISP_CONS;
+       args = f_cdr (args), argc++)
+    if (argc == FOLD_MAXARGS || !constant_p (f_car (args), &argv[argc])
+        || !(subr->pure & PURE_ARGS (type_of (argv[argc]))))
+      return form;
+
+  // wrong arity is reported at run time, like division by zero
+  if (argc < subr->minargs || (subr->maxargs != MANY && argc != subr->maxargs))
+    return form;
+  if (subr->maxargs == MANY && subr->function.f999 == f_divide)
+    for (int i = 1; i < argc; i++)
+      if (eq (argv[i], box_int (0)))
+        return form;
+
+  return constant_form (call_subr (subr, argc, argv));
+}
+
+static int
+needs_box (Lisp_Object var, Lisp_Object bindings, Lisp_Object body,
+           int *assigned)
+{
+  // whether VAR, in scope in the let BINDINGS that follow its own and
+  // in BODY, must be boxed (see resolve.h).  sets ASSIGNED if it is
+  // assigned there
+  int captured = 0;
+  *assigned = 0;
+  for (; type_of (bindings) == LISP_CONS; bindings = f_cdr (bindings))
+    scan_var (f_car (f_cdr (f_car (bindings))), var, 0, assigned,
+              &captured);
+  for (; type_of (body) == LISP_CONS; body = f_cdr (body))
+    scan_var (f_car (body), var, 0, assigned, &captured);
+  return *assigned && captured;
+}
+
+static void
+scan_var (Lisp_Object form, Lisp_Object var, int nested, int *assigned,
+          int *captured)
+{
+  if (eq (form, var))
+    {
+      *captured |= nested;
+      return;
+    }
+  if (type_of (form) != LISP_CONS)
+    return;
+
+  Lisp_Object head = f_car (form);
+  if (eq (head, q_quote))
+    return;
+  if (type_of (head) == LISP_SYMB && unbox_symbol (head)->form == SF_SETQ)
+    for (Lisp_Object args = f_cdr (form); type_of (args) == LISP_CONS;
+         args = f_cdr (f_cdr (args)))
+      *assigned |= eq (f_car (args), var);
+  nested |= eq (head, q_lambda);
+
+  for (; type_of (form) == LISP_CONS; form = f_cdr (form))
+    scan_var (f_car (form), var, nested, assigned, captured);
+}
+
+static Lisp_Object
+rebind_boxed (Lisp_Object *vars, int n, Lisp_Object body)
+{
+  // BODY, or ((let ((VAR VAR) ...) . BODY)) for the VARS it must box:
+  // the let boxes them
+  Lisp_Object bindings = q_nil;
+  int assigned;
+  for (int i = n - 1; i >= 0; i--)
+    if (type_of (vars[i]) == LISP_SYMB && !eq (vars[i], q_nil)
+        && !unbox_symbol (vars[i])->special
+        && needs_box (vars[i], q_nil, body, &assigned))
+      bindings = f_cons (f_cons (vars[i], f_cons (vars[i], q_nil)),
+                         bindings);
+
+  if (nil (bindings))
+    return body;
+  return f_cons (f_cons (q_let, f_cons (bindings, body)), q_nil);
+}
+
+static Lisp_Object
+bind_specials (Lisp_Object *vars, int n, Lisp_Object body)
+{
+  // BODY, or ((let ((VAR ARG) ...) . BODY)) for the special VARS: they
+  // are bound dynamically like in a let, to the value of the arg, that
+  // gets an uninterned symbol of the same name in VARS
+  Lisp_Object bindings = q_nil;
+  for (int i = n - 1; i >= 0; i--)
+    if (type_of (vars[i]) == LISP_SYMB && unbox_symbol (vars[i])->special)
+      {
+        Lisp_Object arg = make_symbol (unbox_symbol (vars[i])->name);
+        bindings = f_cons (f_cons (vars[i], f_cons (arg, q_nil)), bindings);
+        vars[i] = arg;
+      }
+
+  if (nil (bindings))
+    return body;
+  return f_cons (f_cons (q_let, f_cons (bindings, body)), q_nil);
+}
+
+static Lisp_Object
+make_box_form (Lisp_Object init)
+{
+  // (cons INIT nil), calling the subr itself: a global redefinition
+  // of cons must not break the boxes
+  static Lisp_Object cons;
+  if (!cons)
+    cons = make_subr ("cons", 2, 2, NSUBR (2, f_cons), SUBR_CALL (2));
+  return f_cons (cons, f_cons (init, f_cons (q_nil, q_nil)));
+}
@@ -0,0 +1,123 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+/*
+  Lexical addressing.
+
+  Before a lambda or let body runs for the first time it goes through
+  the resolver, which replaces every reference to a lexically bound
+  variable with an LREF immediate (depth, slot): DEPTH frames up from
+  the current one, slot SLOT (see env.h).  Free variables are left as
+  symbols and looked up in the global environment.  So are variables
+  declared special with defvar: let binds them dynamically, see
+  specbind in alloc.h.  A lambda arg that is special is renamed to an
+  uninterned symbol, and the body wrapped in a let binding the
+  variable to it.
+
+  Resolution rewrites the forms in place, once, after expanding the
+  macro calls in them (see macro.h).  A resolved form is
+  recognizable by its binding list turned into a vector:
+
+    (lambda (a b) ...)          ->  (lambda [a b] ...)
+    (let ((a 1) (b 2)) ...)     ->  (let [a 1 b 2] ...)
+    (dolist (x l) ...)          ->  (dolist [x l nil] ...)
+
+  so that lambdas nested in a resolved body are not resolved again
+  with the wrong scope when they are evaluated.  Only code coming from
+  the reader or the loader is rewritten: the eval builtin runs a copy
+  of its arg (see copy_code), a list its caller keeps as data.
+
+  Closures are flat: the variables of enclosing scopes a lambda body
+  references (its free lexical variables) are found while resolving
+  it, and appended to its args vector as references in the scope the
+  lambda is created in:
+
+    (lambda (a) (+ a x y))      ->  (lambda [a #<lref x> #<lref y>] ...)
+
+  The args keep their lambda list keywords, &optional and &rest, but
+  a &rest arg the body never references becomes nil: calls do not
+  build its list.
+
+  Creating the closure copies these slots to its own frame (see
+  env_closure in env.h), where the body references them, one frame up
+  from the args: a closure only keeps alive what it uses, at a depth
+  that does not grow with the nesting.
+
+  Copies must not diverge, so a variable both assigned with setq and
+  referenced from a nested lambda lives in a box, a one element list
+  that the copies share.  Its let init is wrapped to build the box, and
+  its references are boxed LREFs that read and write through it.  An
+  arg or loop variable in that case is rebound by a let around the
+  body.  The test is syntactic and ignores shadowing: it may box a
+  variable that did not need it, never the reverse.
+
+  The resolver also evaluates what it can: a call to a pure builtin
+  (see the pure field of Lisp_Subr) whose args are all constants is
+  replaced by its value, and a let variable bound to a constant and
+  never assigned is replaced by the constant wherever it is
+  referenced:
+
+    (let ((d (* 60 60 24))) (+ x d))  ->  (let [d 86400] (+ x 86400))
+
+  A call that would fail, a division by zero say, is left to run
+  time.  Redefining a pure builtin does not change the calls already
+  folded.
+ */
+
+#include "lisp.h"
+
+struct closure
+{
+  struct scope *outer; // the scope the lambda is created in
+  Lisp_Object *refs;   // where each captured variable is in OUTER
+  int alloc;
+};
+
+struct scope
+{
+  Lisp_Object *names; // bound symbols, index is the frame slot
+  char *boxed;        // whether each slot holds a box, or NULL
+  char *used;         // set for each slot referenced, or NULL
+  // the constant each slot is bound to, q_unbound if none, or NULL
+  Lisp_Object *values;
+  int n;
+  struct scope *parent;
+  // set on the frame of a lambda closure, which has no parent: it
+  // grows as free variables found in the body are captured
+  struct closure *closure;
+};
+
+Lisp_Object resolve (Lisp_Object form, struct scope *scope);
+void resolve_lambda_form (Lisp_Object form, struct scope *scope);
+void resolve_let_form (Lisp_Object form, struct scope *scope);
+void resolve_iteration_form (Lisp_Object form, struct scope *scope);
+void resolve_lambda (Lisp_Lambda *lambda);
+
+/* the form evaluating to VALUE: VALUE itself if it evaluates to
+   itself, (quote VALUE) otherwise */
+Lisp_Object constant_form (Lisp_Object value);
+/* a copy of the conses of the code FORM, for the resolver to rewrite
+   in place, quoted data left shared */
+Lisp_Object copy_code (Lisp_Object form);
+/* whether FORM is a constant, self evaluating or quoted.  sets VALUE
+   to its value if it is */
+int constant_p (Lisp_Object form, Lisp_Object *value);
+
+/* parses the N elements of LIST, a lambda list: stores the names of
+   the args in NAMES, without the keywords, and sets the arity.  returns
+   the number of names */
+int lambda_list (Lisp_Object *list, int n, Lisp_Object *names, int *minargs,
+                 int *maxargs, enum lambda_rest *rest);
+
+/* the number of elements of the lambda list in the args vector ARGS of
+   a resolved lambda form, the captured references follow them */
+static inline size_t
+lambda_nargs (Lisp_Vector *args)
+{
+  size_t n = 0;
+  while (n < args->size && type_of (args->contents[n]) != LISP_LREF)
+    n++;
+  return n;
+}
+
+#endif /* RESOLVE_H */
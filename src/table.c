@@ -0,0 +1,420 @@
+#include "table.h"
+#include "lisp.h"
+#include "term.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_INITIAL_BUCKETS 16
+
+struct entry
+{
+  uint64_t hash;
+  size_t keysize;
+  size_t valsize;
+  _Atomic (struct entry *) next;
+  // encoded key followed by encoded value
+  unsigned char data[];
+};
+
+struct buckets
+{
+  size_t size; // always a power of two
+  _Atomic (struct entry *) heads[];
+};
+
+// memory unlinked by a writer, waiting for the end of a grace period
+struct retired
+{
+  void *ptr;
+  struct retired *next;
+};
+
+struct shard
+{
+  pthread_mutex_t lock; // taken by writers only
+  _Atomic (struct buckets *) buckets;
+  // readers entered in an even and an odd epoch
+  atomic_size_t readers[2];
+  atomic_size_t epoch;
+  size_t count;
+  // retired in the current epoch, and before it began
+  struct retired *retired;
+  struct retired *grace;
+  size_t nretired;
+};
+
+struct table
+{
+  int nshards;
+  struct shard *shards;
+};
+
+static Table *tables[TABLE_MAX_TABLES];
+static pthread_mutex_t tableslock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t hash_bytes (const unsigned char *data, size_t size);
+static struct buckets *buckets_new (size_t size);
+static struct shard *shard_of (Table *t, uint64_t hash);
+static int entry_matches (struct entry *e, uint64_t hash,
+                          const unsigned char *key, size_t keysize);
+static void retire (struct shard *s, void *ptr);
+static void reclaim (struct shard *s);
+static void release (struct retired *r);
+static void resize (struct shard *s);
+
+Table *
+table_new (int nshards)
+{
+  if (nshards <= 0)
+    nshards = TABLE_DEFAULT_SHARDS;
+
+  Table *t = malloc (sizeof (Table));
+  t->nshards = nshards;
+  t->shards = calloc (nshards, sizeof (struct shard));
+  for (int i = 0; i < nshards; i++)
+    {
+      pthread_mutex_init (&t->shards[i].lock, NULL);
+      atomic_init (&t->shards[i].buckets,
+                   buckets_new (TABLE_INITIAL_BUCKETS));
+      atomic_init (&t->shards[i].readers[0], 0);
+      atomic_init (&t->shards[i].readers[1], 0);
+      atomic_init (&t->shards[i].epoch, 0);
+    }
+  return t;
+}
+
+void
+table_free (Table *t)
+{
+  // no reader or writer can be around anymore
+  for (int i = 0; i < t->nshards; i++)
+    {
+      struct shard *s = &t->shards[i];
+      struct buckets *b = atomic_load (&s->buckets);
+      for (size_t j = 0; j < b->size; j++)
+        {
+          struct entry *e = atomic_load (&b->heads[j]);
+          while (e)
+            {
+              struct entry *next = atomic_load (&e->next);
+              free (e);
+              e = next;
+            }
+        }
+      free (b);
+      release (s->retired);
+      release (s->grace);
+      pthread_mutex_destroy (&s->lock);
+    }
+  free (t->shards);
+  free (t);
+}
+
+void
+table_put (Table *t, Lisp_Object key, Lisp_Object val)
+{
+  size_t keysize, valsize;
+  unsigned char *kbuf = term_encode (key, &keysize);
+  unsigned char *vbuf = term_encode (val, &valsize);
+  uint64_t hash = hash_bytes (kbuf, keysize);
+
+  struct entry *new = malloc (sizeof (struct entry) + keysize + valsize);
+  new->hash = hash;
+  new->keysize = keysize;
+  new->valsize = valsize;
+  memcpy (new->data, kbuf, keysize);
+  memcpy (new->data + keysize, vbuf, valsize);
+  free (kbuf);
+  free (vbuf);
+
+  struct shard *s = shard_of (t, hash);
+  pthread_mutex_lock (&s->lock);
+
+  struct buckets *b = atomic_load (&s->buckets);
+  _Atomic (struct entry *) *pred = &b->heads[hash & (b->size - 1)];
+  struct entry *cur;
+  for (cur = atomic_load (pred); cur; cur = atomic_load (pred))
+    {
+      if (entry_matches (cur, hash, new->data, keysize))
+        break;
+      pred = &cur->next;
+    }
+
+  if (cur)
+    {
+      // replace: readers see either the old or the new entry
+      atomic_init (&new->next, atomic_load (&cur->next));
+      atomic_store (pred, new);
+      retire (s, cur);
+    }
+  else
+    {
+      _Atomic (struct entry *) *head = &b->heads[hash & (b->size - 1)];
+      atomic_init (&new->next, atomic_load (head));
+      atomic_store (head, new);
+      if (++s->count > 2 * b->size)
+        resize (s);
+    }
+
+  reclaim (s);
+  pthread_mutex_unlock (&s->lock);
+}
+
+Lisp_Object
+table_get (Table *t, Lisp_Object key, int *found)
+{
+  size_t keysize;
+  unsigned char *kbuf = term_encode (key, &keysize);
+  uint64_t hash = hash_bytes (kbuf, keysize);
+  struct shard *s = shard_of (t, hash);
+  Lisp_Object val = q_nil;
+
+  *found = 0;
+
+  // lock free read section: writers will not free what we can see
+  // until we leave.  the epoch may change right after we load it, see
+  // reclaim
+  size_t epoch = atomic_load (&s->epoch) & 1;
+  atomic_fetch_add (&s->readers[epoch], 1);
+
+  struct buckets *b = atomic_load (&s->buckets);
+  struct entry *e = atomic_load (&b->heads[hash & (b->size - 1)]);
+  for (; e; e = atomic_load (&e->next))
+    {
+      if (!entry_matches (e, hash, kbuf, keysize))
+        continue;
+
+      const char *err;
+      val = term_decode (e->data + e->keysize, e->valsize, &err);
+      *found = !err;
+      break;
+    }
+
+  atomic_fetch_sub (&s->readers[epoch], 1);
+
+  free (kbuf);
+  return val;
+}
+
+int
+table_remove (Table *t, Lisp_Object key)
+{
+  size_t keysize;
+  unsigned char *kbuf = term_encode (key, &keysize);
+  uint64_t hash = hash_bytes (kbuf, keysize);
+  struct shard *s = shard_of (t, hash);
+  int removed = 0;
+
+  pthread_mutex_lock (&s->lock);
+
+  struct buckets *b = atomic_load (&s->buckets);
+  _Atomic (struct entry *) *pred = &b->heads[hash & (b->size - 1)];
+  for (struct entry *cur = atomic_load (pred); cur; cur = atomic_load (pred))
+    {
+      if (entry_matches (cur, hash, kbuf, keysize))
+        {
+          atomic_store (pred, atomic_load (&cur->next));
+          retire (s, cur);
+          s->count--;
+          removed = 1;
+          break;
+        }
+      pred = &cur->next;
+    }
+
+  reclaim (s);
+  pthread_mutex_unlock (&s->lock);
+
+  free (kbuf);
+  return removed;
+}
+
+size_t
+table_count (Table *t)
+{
+  size_t count = 0;
+  for (int i = 0; i < t->nshards; i++)
+    {
+      pthread_mutex_lock (&t->shards[i].lock);
+      count += t->shards[i].count;
+      pthread_mutex_unlock (&t->shards[i].lock);
+    }
+  return count;
+}
+
+size_t
+table_retired (Table *t)
+{
+  size_t retired = 0;
+  for (int i = 0; i < t->nshards; i++)
+    {
+      pthread_mutex_lock (&t->shards[i].lock);
+      retired += t->shards[i].nretired;
+      pthread_mutex_unlock (&t->shards[i].lock);
+    }
+  return retired;
+}
+
+int
+table_register (Table *t)
+{
+  int id = -1;
+  pthread_mutex_lock (&tableslock);
+  for (int i = 0; i < TABLE_MAX_TABLES; i++)
+    if (!tables[i])
+      {
+        tables[i] = t;
+        id = i;
+        break;
+      }
+  pthread_mutex_unlock (&tableslock);
+  return id;
+}
+
+Table *
+table_by_id (int id)
+{
+  if (id < 0 || id >= TABLE_MAX_TABLES)
+    return NULL;
+  return tables[id];
+}
+
+void
+table_unregister (int id)
+{
+  if (id < 0 || id >= TABLE_MAX_TABLES)
+    return;
+  pthread_mutex_lock (&tableslock);
+  tables[id] = NULL;
+  pthread_mutex_unlock (&tableslock);
+}
+
+// helpers
+
+static uint64_t
+hash_bytes (const unsigned char *data, size_t size)
+{
+  // FNV-1a
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < size; i++)
+    {
+      hash ^= data[i];
+      hash *= 0x100000001b3ULL;
+    }
+  return hash;
+}
+
+static struct buckets *
+buckets_new (size_t size)
+{
+  struct buckets *b
+      = malloc (sizeof (struct buckets) + size * sizeof (struct entry *));
+  b->size = size;
+  for (size_t i = 0; i < size; i++)
+    atomic_init (&b->heads[i], NULL);
+  return b;
+}
+
+static struct shard *
+shard_of (Table *t, uint64_t hash)
+{
+  // low bits select the bucket, use the high ones for the shard
+  return &t->shards[(hash >> 32) % t->nshards];
+}
+
+static int
+entry_matches (struct entry *e, uint64_t hash, const unsigned char *key,
+               size_t keysize)
+{
+  return e->hash == hash && e->keysize == keysize
+         && memcmp (e->data, key, keysize) == 0;
+}
+
+static void
+retire (struct shard *s, void *ptr)
+{
+  struct retired *r = malloc (sizeof (struct retired));
+  r->ptr = ptr;
+  r->next = s->retired;
+  s->retired = r;
+  s->nretired++;
+}
+
+static void
+reclaim (struct shard *s)
+{
+  // the readers of the previous epoch entered before the current one
+  // began.  once they are gone, nobody can reach what was unlinked
+  // back then: a late reader that loaded the previous epoch and counts
+  // itself only now, after this check, starts from the current links.
+  // the counter is left empty for the epoch after the current one
+  while (s->retired || s->grace)
+    {
+      size_t epoch = atomic_load (&s->epoch);
+      if (atomic_load (&s->readers[(epoch + 1) & 1]) != 0)
+        {
+          // readers coming in meanwhile count in the current epoch:
+          // only the ones already in are waited for
+          if (s->nretired <= TABLE_MAX_RETIRED)
+            return;
+          sched_yield ();
+          continue;
+        }
+
+      for (struct retired *r = s->grace; r; r = r->next)
+        s->nretired--;
+      release (s->grace);
+      s->grace = s->retired;
+      s->retired = NULL;
+      atomic_store (&s->epoch, epoch + 1);
+      if (s->nretired <= TABLE_MAX_RETIRED)
+        return;
+    }
+}
+
+static void
+release (struct retired *r)
+{
+  while (r)
+    {
+      struct retired *next = r->next;
+      free (r->ptr);
+      free (r);
+      r = next;
+    }
+}
+
+static void
+resize (struct shard *s)
+{
+  // entries are immutable for readers, so the new bucket array gets
+  // copies of them and the old array is retired as a whole
+  struct buckets *old = atomic_load (&s->buckets);
+  struct buckets *new = buckets_new (old->size * 2);
+
+  for (size_t i = 0; i < old->size; i++)
+    {
+      struct entry *e = atomic_load (&old->heads[i]);
+      while (e)
+        {
+          size_t size = sizeof (struct entry) + e->keysize + e->valsize;
+          struct entry *copy = malloc (size);
+          memcpy (copy, e, size);
+          _Atomic (struct entry *) *head
+              = &new->heads[copy->hash & (new->size - 1)];
+          atomic_init (&copy->next, atomic_load (head));
+          atomic_init (head, copy);
+
+          struct entry *next = atomic_load (&e->next);
+          retire (s, e);
+          e = next;
+        }
+    }
+
+  atomic_store (&s->buckets, new);
+  retire (s, old);
+}
@@ -0,0 +1,58 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+/*
+  Shared term tables, in the spirit of erlang's ETS.
+
+  A table maps terms to terms and lives outside the lisp heap: keys and
+  values are stored in their external term format (see term.h), so the
+  gc never walks them and every reader gets its own copy of the value.
+  Keys are compared by their encoding.
+
+  A table is split in shards by key hash.  Writers take the lock of the
+  shard they modify; readers take no lock at all: entries are immutable
+  once published, a write links a new entry with an atomic store and
+  retires the old one.
+
+  Retired memory is released by writers after a grace period.  A shard
+  counts its readers in two counters, and new readers enter the one of
+  the current epoch.  A writer that finds the counter of the previous
+  epoch empty frees what was retired before the current epoch began and
+  starts a new one.  Readers that keep coming in never delay this, only
+  a reader staying in one read section does.  Past TABLE_MAX_RETIRED
+  blocks waiting in a shard, the writer waits for the readers of the
+  previous epoch to leave, the others never.
+
+  Tables are referenced from lisp by an integer id.
+
+  A table lives in the memory of the process that created it, and is
+  shared by its threads only.  Processes forked afterwards, prefork
+  workers or daemon requests, each get their own copy, where writes
+  are not seen by the others.
+ */
+
+#include "lisp.h"
+#include <stddef.h>
+
+#define TABLE_DEFAULT_SHARDS 16
+#define TABLE_MAX_SHARDS 1024
+#define TABLE_MAX_TABLES 256
+#define TABLE_MAX_RETIRED 1024
+
+typedef struct table Table;
+
+Table *table_new (int nshards);
+void table_free (Table *t);
+void table_put (Table *t, Lisp_Object key, Lisp_Object val);
+/* returns a fresh copy of the value, setting FOUND */
+Lisp_Object table_get (Table *t, Lisp_Object key, int *found);
+int table_remove (Table *t, Lisp_Object key);
+size_t table_count (Table *t);
+/* the number of blocks retired and not released yet */
+size_t table_retired (Table *t);
+
+int table_register (Table *t);
+Table *table_by_id (int id);
+void table_unregister (int id);
+
+#endif /* TABLE_H */
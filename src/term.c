@@ -0,0 +1,847 @@
+#include "term.h"
+#include "alloc.h"
+#include "bignum.h"
+#include "lisp.h"
+#include "obarray.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// states of an object in the encoder pointer table. non negative
+// values are the back reference index assigned to a shared object
+#define SEEN_ONCE -1
+#define SHARED -2
+
+struct bytebuf
+{
+  unsigned char *data;
+  size_t size;
+  size_t alloc;
+};
+
+// open addressing hash table from pointers (heap objects) or names
+// (symbols) to an integer
+struct objtable
+{
+  uintptr_t *keys;
+  long *vals;
+  size_t size;
+  size_t alloc;
+  uint64_t (*hash) (uintptr_t key);
+  int (*keyeq) (uintptr_t k1, uintptr_t k2);
+};
+
+struct encoder
+{
+  struct bytebuf out;
+  struct objtable seen;  // heap objects -> SEEN_ONCE / SHARED / index
+  struct objtable atoms; // symbol name strings -> atom cache index
+  long natoms;
+  long nshared;
+};
+
+// a container waiting for its elements during decoding
+struct dframe
+{
+  enum
+  {
+    DF_LIST,
+    DF_LIST_TAIL,
+    DF_VECTOR,
+    DF_LAMBDA_ARGS,
+    DF_LAMBDA_ENV,
+    DF_LAMBDA_BYTECODE,
+    DF_LAMBDA_CONSTANTS,
+    DF_LAMBDA_FORM,
+  } kind;
+  Lisp_Object obj;  // the object being filled, delivered when complete
+  Lisp_Object cell; // current cons of a list
+  size_t remaining; // elements still to be read
+  size_t pos;       // next element index of vectors and lambda args
+};
+
+struct decoder
+{
+  const unsigned char *pos;
+  const unsigned char *end;
+  Lisp_Object *atoms;
+  size_t natoms;
+  size_t atomsalloc;
+  Lisp_Object *shared;
+  size_t nshared;
+  size_t sharedalloc;
+  int pendingshare;
+  const char *err;
+};
+
+static void buf_put (struct bytebuf *b, const void *data, size_t size);
+static void buf_byte (struct bytebuf *b, unsigned char c);
+static void buf_varint (struct bytebuf *b, uint64_t v);
+static long *objtable_get (struct objtable *t, uintptr_t key, int create);
+static void objtable_free (struct objtable *t);
+static int ptr_eq (uintptr_t k1, uintptr_t k2);
+static int name_eq (uintptr_t k1, uintptr_t k2);
+static uint64_t ptr_hash (uintptr_t k);
+static uint64_t name_hash (uintptr_t k);
+static void encode_scan (struct encoder *e, Lisp_Object o);
+static void encode_term (struct encoder *e, Lisp_Object o);
+static int is_heap_obj (Lisp_Object o);
+static Lisp_Object decode_body (struct decoder *d);
+
+unsigned char *
+term_encode (Lisp_Object term, size_t *size)
+{
+  struct encoder e = {
+    .seen = { .hash = ptr_hash, .keyeq = ptr_eq },
+    .atoms = { .hash = name_hash, .keyeq = name_eq },
+  };
+
+  // header, body length is patched once the body is complete
+  buf_byte (&e.out, TERM_MAGIC);
+  buf_byte (&e.out, TERM_VERSION);
+  buf_put (&e.out, "\0\0\0\0", 4);
+
+  encode_scan (&e, term);
+  encode_term (&e, term);
+
+  uint32_t bodysize = e.out.size - TERM_HEADER_SIZE;
+  for (int i = 0; i < 4; i++)
+    e.out.data[2 + i] = (bodysize >> (8 * i)) & 0xff;
+
+  objtable_free (&e.seen);
+  objtable_free (&e.atoms);
+
+  *size = e.out.size;
+  return e.out.data;
+}
+
+size_t
+term_message_size (const unsigned char *buf, size_t size)
+{
+  if (size < TERM_HEADER_SIZE)
+    return 0;
+  if (buf[0] != TERM_MAGIC || buf[1] != TERM_VERSION)
+    return 0;
+
+  uint32_t bodysize = 0;
+  for (int i = 0; i < 4; i++)
+    bodysize |= (uint32_t)buf[2 + i] << (8 * i);
+
+  return TERM_HEADER_SIZE + bodysize;
+}
+
+Lisp_Object
+term_decode (const unsigned char *buf, size_t size, const char **err)
+{
+  if (size < TERM_HEADER_SIZE || buf[0] != TERM_MAGIC)
+    {
+      *err = "not a term message";
+      return q_nil;
+    }
+  if (buf[1] != TERM_VERSION)
+    {
+      *err = "unsupported term format version";
+      return q_nil;
+    }
+  if (term_message_size (buf, size) != size)
+    {
+      *err = "term message length mismatch";
+      return q_nil;
+    }
+
+  struct decoder d = {
+    .pos = buf + TERM_HEADER_SIZE,
+    .end = buf + size,
+  };
+
+  Lisp_Object res = decode_body (&d);
+  if (!d.err && d.pos != d.end)
+    d.err = "trailing bytes after term";
+
+  free (d.atoms);
+  free (d.shared);
+
+  *err = d.err;
+  return d.err ? q_nil : res;
+}
+
+// encoder
+
+static int
+ptr_eq (uintptr_t k1, uintptr_t k2)
+{
+  return k1 == k2;
+}
+
+static int
+name_eq (uintptr_t k1, uintptr_t k2)
+{
+  Lisp_String *n1 = (Lisp_String *)k1;
+  Lisp_String *n2 = (Lisp_String *)k2;
+  return n1->size == n2->size && memcmp (n1->data, n2->data, n1->size) == 0;
+}
+
+static uint64_t
+ptr_hash (uintptr_t k)
+{
+  // objects are at least 8 bytes aligned, mix the bits a little
+  k >>= TAGBITS;
+  return k * 0x9E3779B97F4A7C15ULL;
+}
+
+static uint64_t
+name_hash (uintptr_t k)
+{
+  // djb2, like the obarray
+  Lisp_String *name = (Lisp_String *)k;
+  uint64_t hash = 5381;
+  for (size_t i = 0; i < name->size; i++)
+    hash = ((hash << 5) + hash) + (unsigned char)name->data[i];
+  return hash;
+}
+
+static int
+is_heap_obj (Lisp_Object o)
+{
+  switch (type_of (o))
+    {
+    case LISP_STRG:
+    case LISP_CONS:
+    case LISP_VECT:
+    case LISP_LMBD:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+static void
+encode_scan (struct encoder *e, Lisp_Object o)
+{
+  // first pass: find objects reachable more than once. we loop on cdr
+  // chains and recurse only on cars and other containers.
+  while (is_heap_obj (o))
+    {
+      long *state = objtable_get (&e->seen, o, 1);
+      if (*state != 0)
+        {
+          // second visit: shared (or cyclic), don't walk it again
+          *state = SHARED;
+          return;
+        }
+      *state = SEEN_ONCE;
+
+      switch (type_of (o))
+        {
+        case LISP_CONS:
+          encode_scan (e, unbox_cons (o)->car);
+          o = unbox_cons (o)->cdr;
+          break;
+        case LISP_VECT:
+          if (pseudovector_p (o))
+            return;
+          for (size_t i = 0; i < unbox_vector (o)->size; i++)
+            encode_scan (e, unbox_vector (o)->contents[i]);
+          return;
+        case LISP_LMBD:
+          for (int i = 0; i < lambda_nslots (unbox_lambda (o)); i++)
+            encode_scan (e, unbox_lambda (o)->args[i]);
+          encode_scan (e, unbox_lambda (o)->env);
+          encode_scan (e, unbox_lambda (o)->bytecode);
+          encode_scan (e, unbox_lambda (o)->constants);
+          o = unbox_lambda (o)->form;
+          break;
+        default:
+          return;
+        }
+    }
+}
+
+static void
+encode_string (struct encoder *e, unsigned char tag, Lisp_String *s)
+{
+  buf_byte (&e->out, tag);
+  buf_varint (&e->out, s->size);
+  buf_put (&e->out, s->data, s->size);
+}
+
+static void
+encode_bignum (struct encoder *e, Lisp_Bignum *b)
+{
+  buf_byte (&e->out, TERM_TAG_BIGNUM);
+  buf_byte (&e->out, b->sign < 0);
+  buf_varint (&e->out, b->nlimbs);
+  for (size_t i = 0; i < b->nlimbs; i++)
+    {
+      unsigned char limb[8];
+      for (int j = 0; j < 8; j++)
+        limb[j] = b->limbs[i] >> (8 * j);
+      buf_put (&e->out, limb, sizeof (limb));
+    }
+}
+
+static void
+encode_term (struct encoder *e, Lisp_Object o)
+{
+  for (;;)
+    {
+      if (eq (o, q_nil))
+        {
+          buf_byte (&e->out, TERM_TAG_NIL);
+          return;
+        }
+      if (eq (o, q_t))
+        {
+          buf_byte (&e->out, TERM_TAG_T);
+          return;
+        }
+      if (eq (o, q_unbound))
+        {
+          buf_byte (&e->out, TERM_TAG_UNBOUND);
+          return;
+        }
+
+      switch (type_of (o))
+        {
+        case LISP_INTG:
+          {
+            int64_t i = unbox_int (o);
+            buf_byte (&e->out, TERM_TAG_INT);
+            buf_varint (&e->out, ((uint64_t)i << 1) ^ (uint64_t)(i >> 63));
+            return;
+          }
+        case LISP_SYMB:
+          {
+            Lisp_String *name = unbox_string (unbox_symbol (o)->name);
+            long *index = objtable_get (&e->atoms, (uintptr_t)name, 1);
+            if (*index)
+              {
+                // atom cache hit. indexes are stored +1 to tell them
+                // apart from a new table entry
+                buf_byte (&e->out, TERM_TAG_ATOM_REF);
+                buf_varint (&e->out, *index - 1);
+                return;
+              }
+            *index = ++e->natoms;
+            encode_string (e, TERM_TAG_ATOM, name);
+            return;
+          }
+        case LISP_LREF:
+          buf_byte (&e->out, TERM_TAG_LREF);
+          buf_varint (&e->out, lref_depth (o));
+          // the slot keeps its boxed bit
+          buf_varint (&e->out,
+                      lref_slot (o) | (lref_boxed (o) ? LREF_BOXED : 0));
+          return;
+        case LISP_SUBR:
+          {
+            const char *name = unbox_subr (o)->name;
+            size_t size = strlen (name);
+            buf_byte (&e->out, TERM_TAG_SUBR);
+            buf_varint (&e->out, size);
+            buf_put (&e->out, name, size);
+            return;
+          }
+        default:
+          break;
+        }
+
+      // heap object: maybe shared
+      long *state = objtable_get (&e->seen, o, 0);
+      if (*state >= 0)
+        {
+          buf_byte (&e->out, TERM_TAG_BACK_REF);
+          buf_varint (&e->out, *state);
+          return;
+        }
+      if (*state == SHARED)
+        {
+          buf_byte (&e->out, TERM_TAG_SHARE);
+          *state = e->nshared++;
+        }
+
+      switch (type_of (o))
+        {
+        case LISP_STRG:
+          encode_string (e, TERM_TAG_STRING, unbox_string (o));
+          return;
+        case LISP_VECT:
+          {
+            if (bignum_p (o))
+              {
+                encode_bignum (e, unbox_bignum (o));
+                return;
+              }
+            Lisp_Vector *v = unbox_vector (o);
+            buf_byte (&e->out, TERM_TAG_VECTOR);
+            buf_varint (&e->out, v->size);
+            for (size_t i = 0; i < v->size; i++)
+              encode_term (e, v->contents[i]);
+            return;
+          }
+        case LISP_LMBD:
+          {
+            Lisp_Lambda *l = unbox_lambda (o);
+            buf_byte (&e->out, TERM_TAG_LAMBDA);
+            buf_varint (&e->out, l->minargs);
+            buf_varint (&e->out, lambda_nslots (l));
+            buf_varint (&e->out,
+                        l->resolved | l->stackargs << 1 | l->rest << 2);
+            buf_varint (&e->out, l->maxdepth);
+            for (int i = 0; i < lambda_nslots (l); i++)
+              encode_term (e, l->args[i]);
+            encode_term (e, l->env);
+            encode_term (e, l->bytecode);
+            encode_term (e, l->constants);
+            o = l->form;
+            continue;
+          }
+        case LISP_CONS:
+          {
+            // flatten the run of conses up to the first non cons cdr or
+            // the first shared cons, which becomes the tail
+            size_t n = 1;
+            Lisp_Object tail = unbox_cons (o)->cdr;
+            while (type_of (tail) == LISP_CONS
+                   && *objtable_get (&e->seen, tail, 0) == SEEN_ONCE)
+              {
+                n++;
+                tail = unbox_cons (tail)->cdr;
+              }
+
+            buf_byte (&e->out, TERM_TAG_LIST);
+            buf_varint (&e->out, n);
+            for (Lisp_Object c = o; n > 0; n--, c = unbox_cons (c)->cdr)
+              encode_term (e, unbox_cons (c)->car);
+            o = tail;
+            continue;
+          }
+        default:
+          return;
+        }
+    }
+}
+
+// decoder
+
+static int
+read_varint (struct decoder *d, uint64_t *v)
+{
+  uint64_t res = 0;
+  for (int shift = 0; shift < 64; shift += 7)
+    {
+      if (d->pos >= d->end)
+        break;
+      unsigned char c = *d->pos++;
+      res |= (uint64_t)(c & 0x7f) << shift;
+      if (!(c & 0x80))
+        {
+          *v = res;
+          return 0;
+        }
+    }
+  d->err = "truncated or invalid varint";
+  return 1;
+}
+
+static int
+read_count (struct decoder *d, size_t *n)
+{
+  // every element takes at least one byte: bound the counts with the
+  // remaining bytes so that corrupted messages cannot trigger huge
+  // allocations
+  uint64_t v;
+  if (read_varint (d, &v))
+    return 1;
+  if (v > (uint64_t)(d->end - d->pos))
+    {
+      d->err = "length exceeds message";
+      return 1;
+    }
+  *n = v;
+  return 0;
+}
+
+static void
+push_obj (Lisp_Object **arr, size_t *size, size_t *alloc, Lisp_Object o)
+{
+  if (*size >= *alloc)
+    {
+      *alloc = *alloc ? *alloc * 2 : 16;
+      *arr = realloc (*arr, *alloc * sizeof (Lisp_Object));
+    }
+  (*arr)[(*size)++] = o;
+}
+
+static void
+register_shared (struct decoder *d, Lisp_Object o)
+{
+  if (!d->pendingshare)
+    return;
+  d->pendingshare = 0;
+  push_obj (&d->shared, &d->nshared, &d->sharedalloc, o);
+}
+
+static Lisp_Object
+intern_name (const char *name, size_t size)
+{
+  // same as the parser: atoms are interned
+  return obarray_intern (v_obarray, name, size);
+}
+
+static Lisp_Object
+decode_body (struct decoder *d)
+{
+  struct dframe *stack = NULL;
+  size_t sp = 0;
+  size_t stackalloc = 0;
+  Lisp_Object v = q_nil;
+  uint64_t n;
+  size_t size;
+
+  for (;;)
+    {
+      if (d->pos >= d->end)
+        {
+          d->err = "truncated term";
+          goto out;
+        }
+
+      if (sp >= stackalloc)
+        {
+          stackalloc = stackalloc ? stackalloc * 2 : 32;
+          stack = realloc (stack, stackalloc * sizeof (struct dframe));
+        }
+      struct dframe *top = &stack[sp];
+
+      unsigned char tag = *d->pos++;
+      switch (tag)
+        {
+        case TERM_TAG_NIL:
+          v = q_nil;
+          break;
+        case TERM_TAG_T:
+          v = q_t;
+          break;
+        case TERM_TAG_UNBOUND:
+          v = q_unbound;
+          break;
+        case TERM_TAG_INT:
+          if (read_varint (d, &n))
+            goto out;
+          v = box_int ((int64_t)(n >> 1) ^ -(int64_t)(n & 1));
+          register_shared (d, v);
+          break;
+        case TERM_TAG_BIGNUM:
+          {
+            if (d->pos >= d->end)
+              {
+                d->err = "truncated term";
+                goto out;
+              }
+            int negative = *d->pos++;
+            if (read_count (d, &size))
+              goto out;
+            if (size > (size_t)(d->end - d->pos) / 8)
+              {
+                d->err = "length exceeds message";
+                goto out;
+              }
+            v = make_bignum (size);
+            Lisp_Bignum *b = unbox_bignum (v);
+            b->sign = negative ? -1 : 1;
+            for (size_t i = 0; i < size; i++)
+              for (int j = 0; j < 8; j++)
+                b->limbs[i] |= (uint64_t)*d->pos++ << (8 * j);
+            // a message may carry a denormalized one
+            v = bignum_normalize (v);
+            register_shared (d, v);
+            break;
+          }
+        case TERM_TAG_LREF:
+          {
+            uint64_t depth, slot;
+            if (read_varint (d, &depth) || read_varint (d, &slot))
+              goto out;
+            if (depth > UINT32_MAX || slot > UINT32_MAX)
+              {
+                d->err = "invalid lexical reference";
+                goto out;
+              }
+            v = box_lref (depth, slot);
+            break;
+          }
+        case TERM_TAG_STRING:
+          if (read_count (d, &size))
+            goto out;
+          v = make_nstring ((const char *)d->pos, size);
+          d->pos += size;
+          register_shared (d, v);
+          break;
+        case TERM_TAG_ATOM:
+          if (read_count (d, &size))
+            goto out;
+          v = intern_name ((const char *)d->pos, size);
+          d->pos += size;
+          push_obj (&d->atoms, &d->natoms, &d->atomsalloc, v);
+          break;
+        case TERM_TAG_ATOM_REF:
+          if (read_varint (d, &n))
+            goto out;
+          if (n >= d->natoms)
+            {
+              d->err = "atom cache index out of range";
+              goto out;
+            }
+          v = d->atoms[n];
+          break;
+        case TERM_TAG_SUBR:
+          {
+            if (read_count (d, &size))
+              goto out;
+            Lisp_Object sym = obarray_lookup_name (
+                v_obarray, make_nstring ((const char *)d->pos, size));
+            d->pos += size;
+            if (type_of (sym) != LISP_SYMB
+                || type_of (unbox_symbol (sym)->value) != LISP_SUBR)
+              {
+                d->err = "unknown subr";
+                goto out;
+              }
+            v = unbox_symbol (sym)->value;
+            break;
+          }
+        case TERM_TAG_SHARE:
+          d->pendingshare = 1;
+          continue;
+        case TERM_TAG_BACK_REF:
+          if (read_varint (d, &n))
+            goto out;
+          if (n >= d->nshared)
+            {
+              d->err = "back reference index out of range";
+              goto out;
+            }
+          v = d->shared[n];
+          break;
+        case TERM_TAG_LIST:
+          if (read_count (d, &size))
+            goto out;
+          if (size == 0)
+            {
+              d->err = "empty list run";
+              goto out;
+            }
+          // allocate the head now, so that back references from its
+          // elements (cycles) can already point to it
+          top->kind = DF_LIST;
+          top->obj = top->cell = make_cons (q_nil, q_nil);
+          top->remaining = size;
+          register_shared (d, top->obj);
+          sp++;
+          continue;
+        case TERM_TAG_VECTOR:
+          if (read_count (d, &size))
+            goto out;
+          v = make_vector (size);
+          register_shared (d, v);
+          if (size == 0)
+            break;
+          top->kind = DF_VECTOR;
+          top->obj = v;
+          top->remaining = size;
+          top->pos = 0;
+          sp++;
+          continue;
+        case TERM_TAG_LAMBDA:
+          {
+            uint64_t minargs, maxargs, flags, maxdepth;
+            if (read_varint (d, &minargs) || read_count (d, &size)
+                || read_varint (d, &flags) || read_varint (d, &maxdepth))
+              goto out;
+            // SIZE counts the &rest arg too, see lambda_nslots
+            enum lambda_rest rest = (flags >> 2) & 3;
+            maxargs = size - (rest == REST_LIST);
+            if (rest > REST_LIST || (rest == REST_LIST && size == 0)
+                || minargs > maxargs)
+              {
+                d->err = "invalid lambda arity";
+                goto out;
+              }
+            Lisp_Object *args = calloc (size + 1, sizeof (Lisp_Object));
+            for (size_t i = 0; i < size; i++)
+              args[i] = q_nil;
+            v = make_lambda (minargs, maxargs, rest, args, q_nil);
+            free (args);
+            unbox_lambda (v)->resolved = flags & 1;
+            unbox_lambda (v)->stackargs = (flags >> 1) & 1;
+            unbox_lambda (v)->maxdepth = maxdepth;
+            register_shared (d, v);
+            top->kind = size ? DF_LAMBDA_ARGS : DF_LAMBDA_ENV;
+            top->obj = v;
+            top->remaining = size;
+            top->pos = 0;
+            sp++;
+            continue;
+          }
+        default:
+          d->err = "unknown term tag";
+          goto out;
+        }
+
+      // deliver V to the containers waiting for it, completing as many
+      // of them as possible
+      for (;;)
+        {
+          if (sp == 0)
+            goto out;
+
+          struct dframe *f = &stack[sp - 1];
+          switch (f->kind)
+            {
+            case DF_LIST:
+              unbox_cons (f->cell)->car = v;
+              if (--f->remaining > 0)
+                {
+                  Lisp_Object next = make_cons (q_nil, q_nil);
+                  unbox_cons (f->cell)->cdr = next;
+                  f->cell = next;
+                }
+              else
+                f->kind = DF_LIST_TAIL;
+              break;
+            case DF_LIST_TAIL:
+              unbox_cons (f->cell)->cdr = v;
+              v = f->obj;
+              sp--;
+              continue;
+            case DF_VECTOR:
+              unbox_vector (f->obj)->contents[f->pos++] = v;
+              if (--f->remaining > 0)
+                break;
+              v = f->obj;
+              sp--;
+              continue;
+            case DF_LAMBDA_ARGS:
+              unbox_lambda (f->obj)->args[f->pos++] = v;
+              if (--f->remaining == 0)
+                f->kind = DF_LAMBDA_ENV;
+              break;
+            case DF_LAMBDA_ENV:
+              unbox_lambda (f->obj)->env = v;
+              f->kind = DF_LAMBDA_BYTECODE;
+              break;
+            case DF_LAMBDA_BYTECODE:
+              unbox_lambda (f->obj)->bytecode = v;
+              f->kind = DF_LAMBDA_CONSTANTS;
+              break;
+            case DF_LAMBDA_CONSTANTS:
+              unbox_lambda (f->obj)->constants = v;
+              f->kind = DF_LAMBDA_FORM;
+              break;
+            case DF_LAMBDA_FORM:
+              unbox_lambda (f->obj)->form = v;
+              v = f->obj;
+              sp--;
+              continue;
+            }
+          break;
+        }
+    }
+
+out:
+  free (stack);
+  return v;
+}
+
+// helpers
+
+static void
+buf_put (struct bytebuf *b, const void *data, size_t size)
+{
+  if (b->size + size > b->alloc)
+    {
+      size_t alloc = b->alloc ? b->alloc : 64;
+      while (alloc < b->size + size)
+        alloc *= 2;
+      b->data = realloc (b->data, alloc);
+      b->alloc = alloc;
+    }
+  memcpy (b->data + b->size, data, size);
+  b->size += size;
+}
+
+static void
+buf_byte (struct bytebuf *b, unsigned char c)
+{
+  buf_put (b, &c, 1);
+}
+
+static void
+buf_varint (struct bytebuf *b, uint64_t v)
+{
+  unsigned char tmp[10];
+  int n = 0;
+  do
+    {
+      tmp[n] = v & 0x7f;
+      v >>= 7;
+      if (v)
+        tmp[n] |= 0x80;
+      n++;
+    }
+  while (v);
+  buf_put (b, tmp, n);
+}
+
+static long *
+objtable_get (struct objtable *t, uintptr_t key, int create)
+{
+  static long zero;
+
+  if (create && (t->size + 1) * 2 > t->alloc)
+    {
+      // grow (keeping a power of two) and rehash
+      struct objtable old = *t;
+      t->alloc = old.alloc ? old.alloc * 2 : 64;
+      t->keys = calloc (t->alloc, sizeof (uintptr_t));
+      t->vals = calloc (t->alloc, sizeof (long));
+      t->size = 0;
+      for (size_t i = 0; i < old.alloc; i++)
+        if (old.keys[i])
+          *objtable_get (t, old.keys[i], 1) = old.vals[i];
+      objtable_free (&old);
+    }
+
+  if (!t->alloc)
+    {
+      zero = 0;
+      return &zero;
+    }
+
+  size_t mask = t->alloc - 1;
+  for (size_t i = t->hash (key) & mask;; i = (i + 1) & mask)
+    {
+      if (!t->keys[i])
+        {
+          if (!create)
+            {
+              zero = 0;
+              return &zero;
+            }
+          t->keys[i] = key;
+          t->vals[i] = 0;
+          t->size++;
+          return &t->vals[i];
+        }
+      if (t->keyeq (t->keys[i], key))
+        return &t->vals[i];
+    }
+}
+
+static void
+objtable_free (struct objtable *t)
+{
+  free (t->keys);
+  free (t->vals);
+}
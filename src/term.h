@@ -0,0 +1,72 @@
+#ifndef TERM_H
+#define TERM_H
+
+/*
+  External term format: a compact binary serialization of Lisp_Object
+  graphs, in the spirit of erlang's term_to_binary.
+
+  A message is laid out as:
+
+    +-------+---------+----------------+------------------+
+    | magic | version | body length    | body             |
+    | 1 B   | 1 B     | 4 B, little e. | body length B    |
+    +-------+---------+----------------+------------------+
+
+  The body is a single term.  Each term starts with a tag byte
+  (TERM_TAG_*), integers and lengths are encoded as LEB128 varints
+  (signed integers are zigzag encoded first).
+
+  - symbols go through a per-message atom cache: the first occurrence
+    of a name is written in full and gets the next cache index, every
+    other occurrence is just a TERM_TAG_ATOM_REF with that index.
+  - proper and improper lists are flattened: TERM_TAG_LIST is followed
+    by the number of elements, the elements and then the tail term, so
+    neither the encoder nor the decoder recurse on cdr chains.
+  - a bignum is a sign byte, its number of limbs and its limbs, 8
+    little endian bytes each, least significant first (see bignum.h).
+  - a lambda is its arity, its args (a &rest one included), the frame
+    it closes over, its byte code and constants if compiled (see
+    bytecode.h) and its (possibly resolved, see resolve.h) body.
+  - heap objects reachable more than once (shared substructure, and
+    cycles) are prefixed with TERM_TAG_SHARE the first time and then
+    referenced with TERM_TAG_BACK_REF.
+ */
+
+#include "lisp.h"
+#include <stddef.h>
+
+#define TERM_MAGIC 0x83
+#define TERM_VERSION 5
+#define TERM_HEADER_SIZE 6
+
+enum term_tag
+{
+  TERM_TAG_NIL = 0x00,
+  TERM_TAG_T = 0x01,
+  TERM_TAG_UNBOUND = 0x02,
+  TERM_TAG_INT = 0x10,
+  TERM_TAG_STRING = 0x11,
+  TERM_TAG_ATOM = 0x12,
+  TERM_TAG_ATOM_REF = 0x13,
+  TERM_TAG_LIST = 0x14,
+  TERM_TAG_VECTOR = 0x15,
+  TERM_TAG_SUBR = 0x16,
+  TERM_TAG_LAMBDA = 0x17,
+  TERM_TAG_LREF = 0x18,
+  TERM_TAG_BIGNUM = 0x19,
+  TERM_TAG_SHARE = 0x20,
+  TERM_TAG_BACK_REF = 0x21,
+};
+
+/* encode TERM in a malloc'd buffer, whose size is stored in SIZE */
+unsigned char *term_encode (Lisp_Object term, size_t *size);
+/* decode a full message (header included).  on success ERR is set to
+   NULL, otherwise it points to the reason why the message is invalid
+   and the returned object must be ignored */
+Lisp_Object term_decode (const unsigned char *buf, size_t size,
+                         const char **err);
+/* size of the full message starting in BUF, or 0 if the header is not
+   complete yet (SIZE < TERM_HEADER_SIZE) or invalid */
+size_t term_message_size (const unsigned char *buf, size_t size);
+
+#endif /* TERM_H */
@@ -0,0 +1,244 @@
+#include "test_bignum.h"
+#include "../src/bignum.h"
+#include "../src/eval.h"
+#include "../src/lisp.h"
+#include "../src/term.h"
+#include "test_lib.h"
+#include <stdlib.h>
+#include <string.h>
+
+// test cases
+static TestResult test_bignum_promotion ();
+static TestResult test_bignum_literal ();
+static TestResult test_bignum_sum ();
+static TestResult test_bignum_karatsuba ();
+static TestResult test_bignum_division ();
+static TestResult test_bignum_term ();
+static TestResult test_bignum_gc ();
+
+static TestCase test_bignum_cases[] = {
+  { .skip = 0, .name = "promotion", .run = test_bignum_promotion },
+  { .skip = 0, .name = "literal", .run = test_bignum_literal },
+  { .skip = 0, .name = "sum", .run = test_bignum_sum },
+  { .skip = 0, .name = "karatsuba", .run = test_bignum_karatsuba },
+  { .skip = 0, .name = "division", .run = test_bignum_division },
+  { .skip = 0, .name = "term", .run = test_bignum_term },
+  { .skip = 0, .name = "gc", .run = test_bignum_gc },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_bignum ()
+{
+  return test_suite_init ("bignum", test_bignum_cases);
+}
+
+// helpers
+
+static int
+prints_as (Lisp_Object x, const char *expected)
+{
+  char *digits = bignum_to_string (x);
+  int res = strcmp (digits, expected) == 0;
+  free (digits);
+  return res;
+}
+
+static char *
+repeat (char *p, char c, size_t n)
+{
+  memset (p, c, n);
+  return p + n;
+}
+
+static char *
+nines (size_t n)
+{
+  // 10^n - 1
+  char *s = malloc (n + 1);
+  *repeat (s, '9', n) = '\0';
+  return s;
+}
+
+static char *
+nines_product (size_t a, size_t b)
+{
+  // (10^a - 1) (10^b - 1) = 10^(a+b) - 10^a - 10^b + 1, for a >= b
+  char *s = malloc (a + b + 1);
+  char *p = repeat (s, '9', b - 1);
+  *p++ = '8';
+  p = repeat (p, '9', a - b);
+  p = repeat (p, '0', b - 1);
+  *p++ = '1';
+  *p = '\0';
+  return s;
+}
+
+// test cases implementation
+
+static TestResult
+test_bignum_promotion ()
+{
+  Lisp_Object most = box_int (MOST_POSITIVE_FIXNUM);
+  Lisp_Object res = bignum_add (most, box_int (1));
+  TEST_ASSERT (bignum_p (res), "overflow not promoted");
+  TEST_ASSERT (prints_as (res, "1152921504606846976"), "wrong sum");
+
+  // back to a fixnum
+  res = bignum_sub (res, box_int (1));
+  TEST_ASSERT (eq (res, most), "not demoted to a fixnum");
+  res = bignum_sub (box_int (MOST_NEGATIVE_FIXNUM), box_int (1));
+  TEST_ASSERT (bignum_p (res) && bignum_cmp (res, box_int (0)) < 0,
+               "negative overflow not promoted");
+
+  // through the builtins, interpreted and compiled
+  res = eval_string ("(* 4611686018427387904 4)");
+  TEST_ASSERT (prints_as (res, "18446744073709551616"), "wrong product");
+  res = eval_string ("(define tb-sq (lambda (x) (* x x)))"
+                     "(tb-sq (tb-sq (tb-sq 65536)))");
+  TEST_ASSERT (prints_as (res, "340282366920938463463374607431768211456"),
+               "wrong square");
+  res = eval_string ("(- (tb-sq 4294967296) (tb-sq 4294967296))");
+  TEST_ASSERT (eq (res, box_int (0)), "difference not demoted");
+  res = eval_string ("(< (tb-sq 4294967296) (tb-sq 4294967295))");
+  TEST_ASSERT (nil (res), "wrong comparison");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bignum_literal ()
+{
+  // longs out of the fixnum range, and past them
+  Lisp_Object res = eval_string ("9223372036854775807");
+  TEST_ASSERT (bignum_p (res), "long literal not a bignum");
+  TEST_ASSERT (prints_as (res, "9223372036854775807"), "wrong long literal");
+
+  const char *big = "123456789012345678901234567890123456789";
+  res = eval_string (big);
+  TEST_ASSERT (prints_as (res, big), "wrong bignum literal");
+  res = eval_string ("(equal? 123456789012345678901234567890"
+                     "        123456789012345678901234567890)");
+  TEST_ASSERT (eq (res, q_t), "equal bignums not equal?");
+
+  TEST_ASSERT (eq (bignum_from_string ("-1152921504606846976", 20),
+                   box_int (MOST_NEGATIVE_FIXNUM)),
+               "most negative fixnum read as a bignum");
+  TEST_ASSERT (nil (bignum_from_string ("12a", 3)), "malformed digits read");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bignum_sum ()
+{
+  // exact sums of 128 bit amounts
+  Lisp_Object res = eval_string (
+      "(define tb-total 0)"
+      "(dotimes (i 1000)"
+      "  (setq tb-total (+ tb-total 170141183460469231731687303715884105727)))"
+      "tb-total");
+  TEST_ASSERT (prints_as (res, "170141183460469231731687303715884105727000"),
+               "wrong sum");
+
+  res = eval_string ("(dotimes (i 1000)"
+                     "  (setq tb-total (- tb-total "
+                     "170141183460469231731687303715884105727)))"
+                     "tb-total");
+  TEST_ASSERT (eq (res, box_int (0)), "sum not back to 0");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bignum_karatsuba ()
+{
+  // balanced, nearly balanced and unbalanced products above the
+  // threshold, read past the chunked reading too
+  static const size_t sizes[][2] = { { 2000, 2000 }, { 2000, 1500 },
+                                     { 2000, 700 }, { 5000, 30 } };
+
+  for (size_t i = 0; i < sizeof (sizes) / sizeof (sizes[0]); i++)
+    {
+      size_t a = sizes[i][0];
+      size_t b = sizes[i][1];
+      char *x = nines (a);
+      char *y = nines (b);
+      char *expected = nines_product (a, b);
+
+      Lisp_Object bx = bignum_from_string (x, a);
+      Lisp_Object by = bignum_from_string (y, b);
+      TEST_ASSERT (prints_as (bx, x), "%zu nines misread", a);
+      Lisp_Object res = bignum_mul (bx, by);
+      TEST_ASSERT (prints_as (res, expected), "wrong product %zu x %zu", a,
+                   b);
+      TEST_ASSERT (bignum_cmp (bignum_mul (by, bx), res) == 0,
+                   "product not commutative %zu x %zu", a, b);
+
+      free (x);
+      free (y);
+      free (expected);
+    }
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bignum_division ()
+{
+  char *x = nines (700);
+  Lisp_Object bx = bignum_from_string (x, 700);
+  Lisp_Object by = bignum_from_string ("-98765432109876543210987654321", 30);
+  Lisp_Object p = bignum_mul (bx, by);
+
+  Lisp_Object res = bignum_div (p, by);
+  TEST_ASSERT (prints_as (res, x), "product divided back wrong");
+  res = bignum_div (bignum_sub (p, box_int (1)), bx);
+  TEST_ASSERT (bignum_cmp (res, by) == 0, "not truncated toward zero");
+  res = bignum_div (by, bx);
+  TEST_ASSERT (eq (res, box_int (0)), "smaller dividend");
+
+  res = eval_string ("(/ 340282366920938463463374607431768211457 3)");
+  TEST_ASSERT (prints_as (res, "113427455640312821154458202477256070485"),
+               "wrong quotient");
+
+  free (x);
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bignum_term ()
+{
+  const char *big = "-340282366920938463463374607431768211457";
+  Lisp_Object term = f_cons (bignum_from_string (big, strlen (big)), q_nil);
+
+  size_t size;
+  const char *err;
+  unsigned char *buf = term_encode (term, &size);
+  Lisp_Object res = term_decode (buf, size, &err);
+  free (buf);
+  TEST_ASSERT (!err, "decoding failed: %s", err);
+  TEST_ASSERT (prints_as (f_car (res), big), "bignum changed");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bignum_gc ()
+{
+  // the first operand of the inline arithmetic of eval stays alive
+  // while the second one runs a gc, and allocates bignums that would
+  // take its memory
+  Lisp_Object res = eval_string ("(define tb-sqr (lambda (x) (* x x)))"
+                                 "(define tb-y 0)"
+                                 "(+ (tb-sqr 99999999999999)"
+                                 "   (progn (gc)"
+                                 "          (dotimes (i 100)"
+                                 "            (setq tb-y"
+                                 "                  (tb-sqr 88888888888888)))"
+                                 "          tb-y))");
+  TEST_ASSERT (prints_as (res, "17901234567900876543209876545"),
+               "wrong sum");
+
+  return TEST_RESULT_SUCCESS;
+}
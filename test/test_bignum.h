@@ -0,0 +1,8 @@
+#ifndef _TEST_BIGNUM_H_
+#define _TEST_BIGNUM_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_bignum ();
+
+#endif /* _TEST_BIGNUM_H_ */
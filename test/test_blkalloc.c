@@ -1,5 +1,6 @@
 #include "../src/blkalloc.h"
 #include "test_lib.h"
+#include <stdlib.h>
 #include <string.h>
 
 // test cases
@@ -7,12 +8,14 @@ static TestResult test_blkalloc_alloc ();
 static TestResult test_blkalloc_2pages ();
 static TestResult test_blkalloc_gc ();
 static TestResult test_blkalloc_gc_3pages ();
+static TestResult test_blkalloc_sidemarks ();
 
 static TestCase test_blkalloc_cases[] = {
   { .skip = 0, .name = "alloc", .run = test_blkalloc_alloc },
   { .skip = 0, .name = "2pages", .run = test_blkalloc_2pages },
   { .skip = 0, .name = "gc", .run = test_blkalloc_gc },
   { .skip = 0, .name = "gc 3pages", .run = test_blkalloc_gc_3pages },
+  { .skip = 0, .name = "side marks", .run = test_blkalloc_sidemarks },
   {}, // terminator
 };
 
@@ -229,3 +232,43 @@ test_blkalloc_gc_3pages ()
 
   return TEST_RESULT_SUCCESS;
 }
+
+static TestResult
+test_blkalloc_sidemarks ()
+{
+  blkallocator *blka = blkalloc_init (sizeof (struct cust), test_free_cust);
+
+  size_t pageblknum
+      = (PAGE_SIZE - offsetof (struct blk, ptr) - 1) / sizeof (struct cust);
+  size_t N = pageblknum * 3;
+  struct cust **blocks = malloc (N * sizeof (struct cust *));
+
+  for (size_t i = 0; i < N; i++)
+    {
+      blocks[i] = blkalloc (blka);
+      blocks[i]->data = i;
+    }
+
+  for (size_t i = 0; i < N; i += 3)
+    blkmark (blka, blocks[i]);
+
+  for (size_t i = 0; i < N; i++)
+    {
+      TEST_ASSERT (!blkmarked (blka, blocks[i]) == !!(i % 3),
+                   "block %zu: wrong mark", i);
+      // marking must not touch the block memory
+      TEST_ASSERT (blocks[i]->data == i, "block %zu written by mark", i);
+    }
+
+  // unknown memory is never marked
+  struct cust other;
+  blkmark (blka, &other);
+  TEST_ASSERT (!blkmarked (blka, &other), "foreign pointer marked");
+
+  blkunmarkall (blka);
+  for (size_t i = 0; i < N; i++)
+    TEST_ASSERT (!blkmarked (blka, blocks[i]), "block %zu still marked", i);
+
+  free (blocks);
+  return TEST_RESULT_SUCCESS;
+}
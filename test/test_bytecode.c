@@ -0,0 +1,385 @@
+#include "test_bytecode.h"
+#include "../src/alloc.h"
+#include "../src/bytecode.h"
+#include "../src/eval.h"
+#include "../src/lisp.h"
+#include "test_lib.h"
+#include <string.h>
+
+// test cases
+static TestResult test_bytecode_fib ();
+static TestResult test_bytecode_closure ();
+static TestResult test_bytecode_let ();
+static TestResult test_bytecode_control ();
+static TestResult test_bytecode_tailcall ();
+static TestResult test_bytecode_gc ();
+static TestResult test_bytecode_uncompilable ();
+static TestResult test_bytecode_inline_cache ();
+static TestResult test_bytecode_loops ();
+static TestResult test_bytecode_iteration ();
+static TestResult test_bytecode_lambda_list ();
+static TestResult test_bytecode_deep ();
+
+static TestCase test_bytecode_cases[] = {
+  { .skip = 0, .name = "fib", .run = test_bytecode_fib },
+  { .skip = 0, .name = "closure", .run = test_bytecode_closure },
+  { .skip = 0, .name = "let", .run = test_bytecode_let },
+  { .skip = 0, .name = "control", .run = test_bytecode_control },
+  { .skip = 0, .name = "tail call", .run = test_bytecode_tailcall },
+  { .skip = 0, .name = "gc", .run = test_bytecode_gc },
+  { .skip = 0, .name = "uncompilable", .run = test_bytecode_uncompilable },
+  { .skip = 0, .name = "inline cache", .run = test_bytecode_inline_cache },
+  { .skip = 0, .name = "loops", .run = test_bytecode_loops },
+  { .skip = 0, .name = "dotimes dolist", .run = test_bytecode_iteration },
+  { .skip = 0, .name = "lambda list", .run = test_bytecode_lambda_list },
+  { .skip = 0, .name = "deep recursion", .run = test_bytecode_deep },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_bytecode ()
+{
+  return test_suite_init ("bytecode", test_bytecode_cases);
+}
+
+// helpers
+
+static Lisp_Lambda *
+lambda_of (const char *name)
+{
+  return unbox_lambda (unbox_symbol (eval_string (name))->value);
+}
+
+// test cases implementation
+
+static TestResult
+test_bytecode_fib ()
+{
+  eval_string ("(define bc-fib (lambda (n)"
+               "  (if (< n 2) n (+ (bc-fib (- n 1)) (bc-fib (- n 2))))))");
+  Lisp_Object interpreted = eval_string ("(bc-fib 15)");
+
+  Lisp_Object res = eval_string ("(byte-compile 'bc-fib)");
+  TEST_CHECK_TYPE ("compiled", res, LISP_LMBD);
+  TEST_CHECK_TYPE ("bytecode", unbox_lambda (res)->bytecode, LISP_STRG);
+  TEST_ASSERT (unbox_lambda (res)->stackargs, "args not on the stack");
+
+  Lisp_Object compiled = eval_string ("(bc-fib 15)");
+  TEST_ASSERT (eq (compiled, interpreted), "expected %ld, got %ld",
+               unbox_int (interpreted), unbox_int (compiled));
+  TEST_ASSERT (byte_stack_top == byte_stack, "byte stack not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_closure ()
+{
+  eval_string ("(define bc-adder (lambda (n) (lambda (x) (+ x n))))");
+  eval_string ("(byte-compile 'bc-adder)");
+
+  // closures need heap frames, the closure itself does not
+  Lisp_Lambda *adder = lambda_of ("'bc-adder");
+  TEST_ASSERT (!adder->stackargs, "closure creating lambda on the stack");
+
+  Lisp_Object add3 = eval_string ("(bc-adder 3)");
+  TEST_CHECK_TYPE ("closure", add3, LISP_LMBD);
+  TEST_CHECK_TYPE ("closure bytecode", unbox_lambda (add3)->bytecode,
+                   LISP_STRG);
+  TEST_ASSERT (unbox_lambda (add3)->stackargs, "closure args not on stack");
+
+  Lisp_Object res = eval_string ("(+ ((bc-adder 3) 4) ((bc-adder 5) 1))");
+  TEST_ASSERT (eq (res, box_int (13)), "expected 13, got %ld",
+               unbox_int (res));
+
+  // a captured variable assigned by the closure lives in a box
+  eval_string ("(define bc-counter (lambda (n)"
+               "  (lambda () (setq n (+ n 1)))))");
+  eval_string ("(byte-compile 'bc-counter)");
+  eval_string ("(define bc-count (bc-counter 10))");
+  eval_string ("(bc-count)");
+  res = eval_string ("(bc-count)");
+  TEST_ASSERT (eq (res, box_int (12)), "expected 12, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_let ()
+{
+  eval_string ("(defvar bc-dyn 1)");
+  eval_string ("(define bc-get-dyn (lambda () bc-dyn))");
+  eval_string ("(define bc-let (lambda (a)"
+               "  (let ((b (+ a 1)) (bc-dyn (* a 10)) (c (+ a b)))"
+               "    (+ b c (bc-get-dyn)))))");
+  Lisp_Object interpreted = eval_string ("(bc-let 2)");
+  eval_string ("(byte-compile 'bc-let)");
+
+  size_t count = specpdl_index ();
+  Lisp_Object res = eval_string ("(bc-let 2)");
+  TEST_ASSERT (eq (res, interpreted), "expected %ld, got %ld",
+               unbox_int (interpreted), unbox_int (res));
+  TEST_ASSERT (eq (res, box_int (28)), "expected 28, got %ld",
+               unbox_int (res));
+  TEST_ASSERT (specpdl_index () == count, "specpdl not unwound");
+  res = eval_string ("bc-dyn");
+  TEST_ASSERT (eq (res, box_int (1)), "dynamic binding not undone");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_control ()
+{
+  eval_string ("(define bc-control (lambda (x)"
+               "  (cond ((eq? x 0) (and 1 2 nil 3))"
+               "        ((eq? x 1) (or nil nil 7))"
+               "        ((eq? x 2) (when x 'w))"
+               "        ((eq? x 3) (unless x 'u))"
+               "        ((eq? x 4))"
+               "        (t (if nil 1 2 3)))))");
+
+  Lisp_Object interpreted[6];
+  char buf[32];
+  for (int i = 0; i < 6; i++)
+    {
+      snprintf (buf, sizeof (buf), "(bc-control %d)", i);
+      interpreted[i] = eval_string (buf);
+    }
+
+  eval_string ("(byte-compile 'bc-control)");
+  for (int i = 0; i < 6; i++)
+    {
+      snprintf (buf, sizeof (buf), "(bc-control %d)", i);
+      Lisp_Object res = eval_string (buf);
+      TEST_ASSERT (eq (res, interpreted[i]), "different result for %d", i);
+    }
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_tailcall ()
+{
+  // way deeper than the interpreter stack
+  eval_string ("(define bc-count (lambda (n acc)"
+               "  (if (eq? n 0) acc (bc-count (- n 1) (+ acc 1)))))");
+  eval_string ("(byte-compile 'bc-count)");
+
+  Lisp_Object res = eval_string ("(bc-count 100000 0)");
+  TEST_ASSERT (eq (res, box_int (100000)), "expected 100000, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_gc ()
+{
+  // values on the byte stack and in closure frames survive a gc
+  eval_string ("(define bc-mk (lambda (n)"
+               "  (let ((v (cons n n))) (lambda (x) (gc) (cons x v)))))");
+  eval_string ("(define bc-use (lambda (i)"
+               "  (let ((c (bc-mk i))) (gc) (c (cons i i)))))");
+  eval_string ("(byte-compile 'bc-mk)");
+  eval_string ("(byte-compile 'bc-use)");
+
+  Lisp_Object res = eval_string ("(bc-use 7)");
+  TEST_CHECK_TYPE ("result", res, LISP_CONS);
+  TEST_ASSERT (eq (f_car (f_car (res)), box_int (7))
+                   && eq (f_cdr (f_cdr (res)), box_int (7)),
+               "wrong result after gc");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_uncompilable ()
+{
+  eval_string ("(define bc-defvar (lambda () (defvar bc-x 1) bc-x))");
+
+  // the lambda is left interpreted
+  Lisp_Object res = eval_string ("(byte-compile 'bc-defvar)");
+  TEST_ASSERT (nil (res), "compiled a defvar");
+  TEST_ASSERT (nil (lambda_of ("'bc-defvar")->bytecode), "bytecode set");
+  res = eval_string ("(bc-defvar)");
+  TEST_ASSERT (eq (res, box_int (1)), "interpreted lambda broken");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_inline_cache ()
+{
+  eval_string ("(define bc-callee (lambda (x) (+ x 1)))");
+  eval_string ("(define bc-caller (lambda (x) (car (cons (bc-callee x) x))))");
+  eval_string ("(byte-compile 'bc-caller)");
+
+  Lisp_Object res = eval_string ("(bc-caller 1)");
+  TEST_ASSERT (eq (res, box_int (2)), "expected 2, got %ld", unbox_int (res));
+
+  // the call site remembers its callee
+  Lisp_Vector *constants
+      = unbox_vector (lambda_of ("'bc-caller")->constants);
+  Lisp_Object callee = eval_string ("bc-callee");
+  int cached = 0;
+  for (size_t i = 0; i < constants->size; i++)
+    if (type_of (constants->contents[i]) == LISP_VECT
+        && eq (unbox_vector (constants->contents[i])->contents[1], callee))
+      cached = 1;
+  TEST_ASSERT (cached, "callee not cached");
+
+  // and notices redefinitions, and dynamic bindings
+  eval_string ("(define bc-callee (lambda (x) (* x 10)))");
+  res = eval_string ("(bc-caller 2)");
+  TEST_ASSERT (eq (res, box_int (20)), "expected 20, got %ld",
+               unbox_int (res));
+
+  eval_string ("(defvar bc-callee car)");
+  eval_string ("(define bc-wrap (lambda (f) (let ((bc-callee f)) (bc-caller "
+               "'(5 6)))))");
+  res = eval_string ("(bc-wrap car)");
+  TEST_ASSERT (eq (res, box_int (5)), "expected 5, got %ld", unbox_int (res));
+  res = eval_string ("(bc-caller 3)");
+  TEST_ASSERT (eq (res, box_int (30)), "expected 30, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_loops ()
+{
+  // variables on the stack, and in heap frames when a lambda closes
+  // over them
+  eval_string ("(define bc-sum (lambda (n)"
+               "  (let ((i 0) (s 0))"
+               "    (while (< i n) (setq s (+ s i) i (+ i 1))) s)))");
+  eval_string ("(define bc-sumf (lambda (n)"
+               "  (let ((i 0) (s 0) (f (lambda () i)))"
+               "    (while (< i n) (setq s (+ s (f)) i (+ i 1))) s)))");
+  eval_string ("(define bc-global 0)");
+  eval_string ("(define bc-bump (lambda (n) (while (< bc-global n)"
+               "  (setq bc-global (+ bc-global 1)))))");
+
+  const char *names[] = { "bc-sum", "bc-sumf", "bc-bump" };
+  for (int i = 0; i < 3; i++)
+    {
+      char buf[64];
+      snprintf (buf, sizeof (buf), "(byte-compile '%s)", names[i]);
+      Lisp_Object res = eval_string (buf);
+      TEST_CHECK_TYPE (names[i], unbox_lambda (res)->bytecode, LISP_STRG);
+    }
+
+  Lisp_Object res = eval_string ("(bc-sum 10)");
+  TEST_ASSERT (eq (res, box_int (45)), "expected 45, got %ld",
+               unbox_int (res));
+  res = eval_string ("(bc-sumf 10)");
+  TEST_ASSERT (eq (res, box_int (45)), "expected 45, got %ld",
+               unbox_int (res));
+  res = eval_string ("(bc-bump 7)");
+  TEST_ASSERT (nil (res), "while returns nil");
+  res = eval_string ("bc-global");
+  TEST_ASSERT (eq (res, box_int (7)), "expected 7, got %ld", unbox_int (res));
+  TEST_ASSERT (byte_stack_top == byte_stack, "byte stack not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_iteration ()
+{
+  // loop variables on the stack, in heap frames, in boxes and bound
+  // dynamically, each compared with the interpreter
+  eval_string ("(defvar bc-loop-dyn 0)");
+  eval_string ("(define bc-loop-peek (lambda () bc-loop-dyn))");
+  eval_string ("(define bc-times (lambda (n)"
+               "  (let ((s 0)) (dotimes (i n (+ s i)) (setq s (+ s i))))))");
+  eval_string ("(define bc-times-set (lambda (n)"
+               "  (let ((k 0)) (dotimes (i n k) (setq i 100 k (+ k 1))))))");
+  eval_string ("(define bc-times-dyn (lambda (n)"
+               "  (let ((s 0)) (dotimes (bc-loop-dyn n s)"
+               "    (setq s (+ s (bc-loop-peek)))))))");
+  eval_string ("(define bc-list (lambda (l)"
+               "  (let ((s 0)) (dolist (x l (if x 0 s)) (setq s (+ s x))))))");
+  eval_string ("(define bc-listf (lambda (l)"
+               "  (let ((s 0)) (dolist (x l s)"
+               "    (setq s (+ s ((lambda () x))))))))");
+  eval_string ("(define bc-list-box (lambda (l)"
+               "  (let ((s 0)) (dolist (x l s)"
+               "    (setq x (+ x 1)) (setq s (+ s ((lambda () x))))))))");
+
+  const char *calls[][2] = {
+    { "bc-times", "(bc-times 10)" },
+    { "bc-times-set", "(bc-times-set 5)" },
+    { "bc-times-dyn", "(bc-times-dyn 10)" },
+    { "bc-list", "(bc-list '(1 2 3 4))" },
+    { "bc-listf", "(bc-listf '(1 2 . 3))" },
+    { "bc-list-box", "(bc-list-box '(1 2 3))" },
+  };
+  for (int i = 0; i < 6; i++)
+    {
+      Lisp_Object interpreted = eval_string (calls[i][1]);
+      char buf[64];
+      snprintf (buf, sizeof (buf), "(byte-compile '%s)", calls[i][0]);
+      eval_string (buf);
+      snprintf (buf, sizeof (buf), "'%s", calls[i][0]);
+      TEST_CHECK_TYPE (calls[i][0], lambda_of (buf)->bytecode, LISP_STRG);
+      Lisp_Object res = eval_string (calls[i][1]);
+      TEST_ASSERT (eq (res, interpreted), "%s: expected %ld, got %ld",
+                   calls[i][1], unbox_int (interpreted), unbox_int (res));
+    }
+
+  Lisp_Object res = eval_string ("bc-loop-dyn");
+  TEST_ASSERT (eq (res, box_int (0)), "bc-loop-dyn not unbound");
+  TEST_ASSERT (byte_stack_top == byte_stack, "byte stack not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_lambda_list ()
+{
+  eval_string ("(define bc-opt (lambda (a &optional b)"
+               "  (if b (+ a b) a)))");
+  eval_string ("(define bc-rest (lambda (a &rest r)"
+               "  (if r (+ a (length r)) a)))");
+  eval_string ("(define bc-lists (lambda (x)"
+               "  (+ (bc-opt x) (bc-opt x 1) (bc-rest x 2 3))))");
+  eval_string ("(define bc-tail (lambda (x) (bc-rest x x)))");
+
+  const char *names[] = { "bc-opt", "bc-rest", "bc-lists", "bc-tail" };
+  for (int i = 0; i < 4; i++)
+    {
+      char buf[64];
+      snprintf (buf, sizeof (buf), "(byte-compile '%s)", names[i]);
+      Lisp_Object res = eval_string (buf);
+      TEST_CHECK_TYPE (names[i], unbox_lambda (res)->bytecode, LISP_STRG);
+    }
+
+  Lisp_Object res = eval_string ("(bc-lists 10)");
+  TEST_ASSERT (eq (res, box_int (33)), "expected 33, got %ld",
+               unbox_int (res));
+  res = eval_string ("(bc-tail 7)");
+  TEST_ASSERT (eq (res, box_int (8)), "expected 8, got %ld", unbox_int (res));
+  TEST_ASSERT (byte_stack_top == byte_stack, "byte stack not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_bytecode_deep ()
+{
+  // windows of several slots each take the byte stack past 65536
+  // values, and compiled calls do not use the C stack
+  eval_string ("(define bc-count (lambda (n)"
+               "  (if (eq? n 0) 0 (+ 1 (bc-count (- n 1))))))");
+  eval_string ("(byte-compile 'bc-count)");
+  Lisp_Object res = eval_string ("(bc-count 50000)");
+  TEST_ASSERT (eq (res, box_int (50000)), "expected 50000, got %ld",
+               unbox_int (res));
+  TEST_ASSERT (byte_stack_top == byte_stack, "byte stack not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
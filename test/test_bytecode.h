@@ -0,0 +1,8 @@
+#ifndef _TEST_BYTECODE_H_
+#define _TEST_BYTECODE_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_bytecode ();
+
+#endif /* _TEST_BYTECODE_H_ */
@@ -0,0 +1,177 @@
+#include "test_daemon.h"
+#include "../src/daemon.h"
+#include "../src/eval.h"
+#include "../src/lexer.h"
+#include "../src/lisp.h"
+#include "test_lib.h"
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// test cases
+static TestResult test_daemon_eval ();
+static TestResult test_daemon_error ();
+static TestResult test_daemon_isolation ();
+static TestResult test_daemon_concurrent ();
+
+static TestCase test_daemon_cases[] = {
+  { .skip = 0, .name = "eval", .run = test_daemon_eval },
+  { .skip = 0, .name = "error", .run = test_daemon_error },
+  { .skip = 0, .name = "isolation", .run = test_daemon_isolation },
+  { .skip = 0, .name = "concurrent", .run = test_daemon_concurrent },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_daemon ()
+{
+  return test_suite_init ("daemon", test_daemon_cases);
+}
+
+// helpers
+
+static char sockpath[100];
+
+static pid_t
+start_daemon (const char *preload)
+{
+  snprintf (sockpath, sizeof (sockpath), "/tmp/erlisp-test-daemon-%d.sock",
+            (int)getpid ());
+  unlink (sockpath);
+
+  // or the child would print our pending output again
+  fflush (stdout);
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      Lexer *l = lex_init ();
+      lex_set_stream (l, stream_string (preload, strlen (preload)));
+      eval_toplevel (l);
+      _exit (daemon_serve (sockpath));
+    }
+
+  // wait for the socket to show up
+  for (int i = 0; i < 500 && access (sockpath, F_OK) != 0; i++)
+    usleep (10000);
+  return pid;
+}
+
+static void
+stop_daemon (pid_t pid)
+{
+  int status;
+  kill (pid, SIGTERM);
+  waitpid (pid, &status, 0);
+}
+
+static int
+request (const char *text, char *out, char *err, int *status)
+{
+  int outpipe[2], errpipe[2];
+  pipe (outpipe);
+  pipe (errpipe);
+
+  int res = daemon_request (sockpath, text, strlen (text), outpipe[1],
+                            errpipe[1], status);
+  close (outpipe[1]);
+  close (errpipe[1]);
+
+  // the request is over: everything it wrote is in the pipes
+  ssize_t n = read (outpipe[0], out, 255);
+  out[n > 0 ? n : 0] = '\0';
+  n = read (errpipe[0], err, 255);
+  err[n > 0 ? n : 0] = '\0';
+  close (outpipe[0]);
+  close (errpipe[0]);
+  return res;
+}
+
+// test cases implementation
+
+static TestResult
+test_daemon_eval ()
+{
+  char out[256], err[256];
+  int status;
+  pid_t pid = start_daemon ("(define daemon-answer 41)");
+
+  int res = request ("(+ daemon-answer 1)", out, err, &status);
+  stop_daemon (pid);
+
+  TEST_ASSERT (res == 0, "request failed");
+  TEST_ASSERT (status == 0, "wrong status %d", status);
+  TEST_ASSERT (strcmp (out, "42\n") == 0, "wrong output '%s'", out);
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_daemon_error ()
+{
+  char out[256], err[256];
+  int status;
+  pid_t pid = start_daemon ("");
+
+  // an error exits the request, not the daemon
+  int res = request ("(daemon-no-such-function 1)", out, err, &status);
+  TEST_ASSERT (res == 0, "request failed");
+  TEST_ASSERT (status != 0, "error request exited with 0");
+  TEST_ASSERT (strstr (err, "daemon-no-such-function") != NULL,
+               "error not reported to the client: '%s'", err);
+
+  res = request ("(+ 1 2)", out, err, &status);
+  stop_daemon (pid);
+
+  TEST_ASSERT (res == 0, "daemon died after an error");
+  TEST_ASSERT (strcmp (out, "3\n") == 0, "wrong output '%s'", out);
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_daemon_isolation ()
+{
+  char out[256], err[256];
+  int status;
+  pid_t pid = start_daemon ("");
+
+  request ("(define daemon-local 1)", out, err, &status);
+  TEST_ASSERT (status == 0, "define failed");
+
+  // each request starts from the environment loaded by the daemon
+  request ("daemon-local", out, err, &status);
+  stop_daemon (pid);
+
+  TEST_ASSERT (status != 0, "binding leaked across requests");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_daemon_concurrent ()
+{
+  char out[256], err[256];
+  int status;
+  pid_t pid = start_daemon ("");
+
+  // a client that connects and never sends its request
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  strcpy (addr.sun_path, sockpath);
+  int idle = socket (AF_UNIX, SOCK_STREAM, 0);
+  TEST_ASSERT (connect (idle, (struct sockaddr *)&addr, sizeof (addr)) == 0,
+               "cannot connect");
+
+  // neither does a request still running hold the others back
+  int res = request ("(+ 1 2)", out, err, &status);
+  close (idle);
+  stop_daemon (pid);
+
+  TEST_ASSERT (res == 0, "request failed");
+  TEST_ASSERT (strcmp (out, "3\n") == 0, "wrong output '%s'", out);
+
+  return TEST_RESULT_SUCCESS;
+}
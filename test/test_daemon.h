@@ -0,0 +1,8 @@
+#ifndef _TEST_DAEMON_H_
+#define _TEST_DAEMON_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_daemon ();
+
+#endif /* _TEST_DAEMON_H_ */
@@ -3,11 +3,21 @@
 #include "test_lib.h"
 
 #include "test_blkalloc.h"
+#include "test_bignum.h"
+#include "test_bytecode.h"
+#include "test_daemon.h"
 #include "test_env.h"
 #include "test_eval.h"
+#include "test_jit.h"
 #include "test_lexer.h"
 #include "test_lisp.h"
+#include "test_load.h"
+#include "test_macro.h"
+#include "test_node.h"
 #include "test_obarray.h"
+#include "test_resolve.h"
+#include "test_table.h"
+#include "test_term.h"
 #include <stdio.h>
 
 int
@@ -37,7 +47,17 @@ main (int argc, char **argv)
   test_execution_add (te, test_suite_obarray ());
   test_execution_add (te, test_suite_eval ());
   test_execution_add (te, test_suite_env ());
+  test_execution_add (te, test_suite_resolve ());
+  test_execution_add (te, test_suite_bytecode ());
+  test_execution_add (te, test_suite_jit ());
+  test_execution_add (te, test_suite_load ());
+  test_execution_add (te, test_suite_macro ());
+  test_execution_add (te, test_suite_bignum ());
   test_execution_add (te, test_suite_blkalloc ());
+  test_execution_add (te, test_suite_term ());
+  test_execution_add (te, test_suite_node ());
+  test_execution_add (te, test_suite_table ());
+  test_execution_add (te, test_suite_daemon ());
 
   // execute
   int failed = test_execution_run (te, suitename);
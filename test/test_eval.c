@@ -5,6 +5,7 @@
 #include "../src/lisp.h"
 #include "test_lib.h"
 #include <stdio.h>
+#include <string.h>
 
 // test cases
 static TestResult test_eval_symbol ();
@@ -20,6 +21,16 @@ static TestResult test_eval_lambda_nested ();
 static TestResult test_eval_progn ();
 static TestResult test_eval_progn_single ();
 static TestResult test_eval_quote ();
+static TestResult test_eval_tailcall ();
+static TestResult test_eval_tailcall_let ();
+static TestResult test_eval_deep ();
+static TestResult test_eval_loops ();
+static TestResult test_eval_loop_alloc ();
+static TestResult test_eval_value_stack ();
+static TestResult test_eval_backtrace ();
+static TestResult test_eval_special_forms ();
+static TestResult test_eval_lambda_list ();
+static TestResult test_eval_let_star ();
 
 static TestCase test_eval_cases[] = {
   { .skip = 0, .name = "symbol", .run = test_eval_symbol },
@@ -35,6 +46,16 @@ static TestCase test_eval_cases[] = {
   { .skip = 0, .name = "progn", .run = test_eval_progn },
   { .skip = 0, .name = "progn single", .run = test_eval_progn_single },
   { .skip = 0, .name = "quote", .run = test_eval_quote },
+  { .skip = 0, .name = "tail call", .run = test_eval_tailcall },
+  { .skip = 0, .name = "tail call let", .run = test_eval_tailcall_let },
+  { .skip = 0, .name = "deep recursion", .run = test_eval_deep },
+  { .skip = 0, .name = "loops", .run = test_eval_loops },
+  { .skip = 0, .name = "loop alloc", .run = test_eval_loop_alloc },
+  { .skip = 0, .name = "value stack", .run = test_eval_value_stack },
+  { .skip = 0, .name = "backtrace", .run = test_eval_backtrace },
+  { .skip = 0, .name = "special forms", .run = test_eval_special_forms },
+  { .skip = 0, .name = "lambda list", .run = test_eval_lambda_list },
+  { .skip = 0, .name = "let*", .run = test_eval_let_star },
   {}, // terminator
 };
 
@@ -114,7 +135,8 @@ test_eval_t ()
 static TestResult
 test_eval_subr_equal ()
 {
-  Lisp_Object subr = make_subr ("equal", 2, 2, NSUBR (2, f_equal_p));
+  Lisp_Object subr = make_subr ("equal", 2, 2, NSUBR (2, f_equal_p),
+                                SUBR_CALL (2));
   Lisp_Object subrsymb = make_nstr_symbol ("equal", 5);
   unbox_symbol (subrsymb)->value = subr;
   Lisp_Object test = make_cons (
@@ -133,7 +155,8 @@ test_eval_subr_equal ()
 static TestResult
 test_eval_subr_strlen ()
 {
-  Lisp_Object subr = make_subr ("string-length", 1, 1, NSUBR (1, f_string_length));
+  Lisp_Object subr = make_subr ("string-length", 1, 1,
+                                NSUBR (1, f_string_length), SUBR_CALL (1));
   Lisp_Object subrsymb = make_str_symbol ("string-length");
   Lisp_Object teststr = make_nstring ("test", 4);
   unbox_symbol (subrsymb)->value = subr;
@@ -184,7 +207,7 @@ test_eval_lambda_2args ()
       f_cons (subrcons, f_cons (make_string ("not return"),
                                 f_cons (make_string ("this"), q_nil))),
       f_cons (f_cons (subrsum, f_cons (arg1, f_cons (arg2, q_nil))), q_nil));
-  lambda = make_lambda (2, 2, args, lambdabody);
+  lambda = make_lambda (2, 2, REST_NONE, args, lambdabody);
   lambdasym = make_str_symbol ("something");
   unbox_symbol (lambdasym)->value = lambda;
 
@@ -236,13 +259,13 @@ test_eval_lambda_nested ()
   Lisp_Object callstrlen = f_cons (subrstrlen, f_cons (fun1arg2, q_nil));
   fun1body = f_cons (
       f_cons (subrsum, f_cons (fun1arg1, f_cons (callstrlen, q_nil))), q_nil);
-  fun1lambda = make_lambda (2, 2, fun1args, fun1body);
+  fun1lambda = make_lambda (2, 2, REST_NONE, fun1args, fun1body);
   fun1sym = make_str_symbol ("fun1");
   unbox_symbol (fun1sym)->value = fun1lambda;
 
   fun2body = f_cons (
       f_cons (fun1sym, f_cons (box_int (3), f_cons (fun2arg1, q_nil))), q_nil);
-  fun2lambda = make_lambda (1, 1, fun2args, fun2body);
+  fun2lambda = make_lambda (1, 1, REST_NONE, fun2args, fun2body);
   fun2sym = make_str_symbol ("fun2");
   unbox_symbol (fun2sym)->value = fun2lambda;
 
@@ -301,3 +324,303 @@ test_eval_quote ()
 
   return TEST_RESULT_SUCCESS;
 }
+
+static TestResult
+test_eval_tailcall ()
+{
+  // far deeper than the lisp stack: only runs in constant stack
+  eval_string ("(define te-loop (lambda (n acc)"
+               "  (cond ((eq? n 0) acc)"
+               "        ((and (< n 0) t) nil)"
+               "        (t (or nil (when t (if nil nil"
+               "             (progn 0 (te-loop (- n 1) (+ acc 1))))))))))");
+  Lisp_Object res = eval_string ("(te-loop 100000 0)");
+  TEST_ASSERT (eq (res, box_int (100000)), "expected 100000, got %ld",
+               unbox_int (res));
+
+  // not in tail position, the value of the call is needed
+  eval_string ("(define te-sum (lambda (n)"
+               "  (if (eq? n 0) 0 (+ n (te-sum (- n 1))))))");
+  res = eval_string ("(te-sum 100)");
+  TEST_ASSERT (eq (res, box_int (5050)), "expected 5050, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_tailcall_let ()
+{
+  // mutual recursion through a let and unless
+  eval_string ("(define te-even (lambda (n)"
+               "  (if (eq? n 0) t (let ((m (- n 1))) (te-odd m)))))");
+  eval_string ("(define te-odd (lambda (n)"
+               "  (unless (eq? n 0) (te-even (- n 1)))))");
+  Lisp_Object res = eval_string ("(te-even 100000)");
+  TEST_ASSERT (eq (res, q_t), "100000 is even");
+  res = eval_string ("(te-odd 100000)");
+  TEST_ASSERT (nil (res), "100000 is not odd");
+
+  // a let binding a special variable is undone after its body
+  eval_string ("(defvar te-depth 0)");
+  eval_string ("(define te-deep (lambda (n)"
+               "  (let ((te-depth n)) (if (eq? n 0) te-depth (te-deep (- n 1))))))");
+  res = eval_string ("(te-deep 50)");
+  TEST_ASSERT (eq (res, box_int (0)), "expected 0, got %ld", unbox_int (res));
+  res = eval_string ("te-depth");
+  TEST_ASSERT (eq (res, box_int (0)), "special not unbound, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_deep ()
+{
+  // grows the stack well past its initial STACKSIZE frames
+  eval_string ("(define te-count (lambda (n)"
+               "  (if (eq? n 0) 0 (+ 1 (te-count (- n 1))))))");
+  Lisp_Object res = eval_string ("(te-count 10000)");
+  TEST_ASSERT (eq (res, box_int (10000)), "expected 10000, got %ld",
+               unbox_int (res));
+
+  // and the specpdl past SPECPDLSIZE bindings
+  eval_string ("(defvar te-level 0)");
+  eval_string ("(define te-nest (lambda (n)"
+               "  (if (eq? n 0) te-level"
+               "    (let ((te-level (+ te-level 1))) (te-nest (- n 1))))))");
+  res = eval_string ("(te-nest 3000)");
+  TEST_ASSERT (eq (res, box_int (3000)), "expected 3000, got %ld",
+               unbox_int (res));
+  res = eval_string ("te-level");
+  TEST_ASSERT (eq (res, box_int (0)), "special not unbound, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_loops ()
+{
+  Lisp_Object res
+      = eval_string ("(let ((i 0) (s 0))"
+                     "  (while (< i 10) (setq s (+ s i) i (+ i 1))) s)");
+  TEST_ASSERT (eq (res, box_int (45)), "while: expected 45, got %ld",
+               unbox_int (res));
+
+  res = eval_string ("(let ((s 0)) (dotimes (i 10 (+ s i)) (setq s (+ s i))))");
+  TEST_ASSERT (eq (res, box_int (55)), "dotimes: expected 55, got %ld",
+               unbox_int (res));
+
+  res = eval_string ("(let ((s 0)) (dolist (x '(1 2 3) s) (setq s (+ s x))))");
+  TEST_ASSERT (eq (res, box_int (6)), "dolist: expected 6, got %ld",
+               unbox_int (res));
+
+  // setq of a closed over variable, of a global, of a special one
+  eval_string ("(define te-counter (lambda ()"
+               "  (let ((n 0)) (lambda () (setq n (+ n 1))))))");
+  eval_string ("(define te-next (te-counter))");
+  eval_string ("(te-next)");
+  res = eval_string ("(te-next)");
+  TEST_ASSERT (eq (res, box_int (2)), "closure: expected 2, got %ld",
+               unbox_int (res));
+
+  eval_string ("(define te-global 1)");
+  eval_string ("(setq te-global (+ te-global 1))");
+  res = eval_string ("te-global");
+  TEST_ASSERT (eq (res, box_int (2)), "global: expected 2, got %ld",
+               unbox_int (res));
+
+  eval_string ("(defvar te-item 0)");
+  eval_string ("(define te-item-of (lambda () te-item))");
+  res = eval_string ("(let ((s 0)) (dolist (te-item '(4 5) s)"
+                     "  (setq s (+ s (te-item-of)))))");
+  TEST_ASSERT (eq (res, box_int (9)), "special: expected 9, got %ld",
+               unbox_int (res));
+  res = eval_string ("te-item");
+  TEST_ASSERT (eq (res, box_int (0)), "special not unbound, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_loop_alloc ()
+{
+  eval_string ("(define te-spin (lambda (n)"
+               "  (let ((i 0)) (while (< i n) (setq i (+ i 1))) i)))");
+  eval_string ("(te-spin 1)");
+
+  // the same allocations, whatever the number of iterations
+  struct memstats before = memstats ();
+  eval_string ("(te-spin 10)");
+  struct memstats after = memstats ();
+  unsigned long conses = after.conses.numused - before.conses.numused;
+  unsigned long vectors
+      = after.smallvectors.numused - before.smallvectors.numused;
+
+  before = memstats ();
+  Lisp_Object res = eval_string ("(te-spin 100000)");
+  after = memstats ();
+  TEST_ASSERT (eq (res, box_int (100000)), "expected 100000, got %ld",
+               unbox_int (res));
+  TEST_ASSERT (after.conses.numused - before.conses.numused == conses,
+               "loop allocates conses");
+  TEST_ASSERT (after.smallvectors.numused - before.smallvectors.numused
+                   == vectors,
+               "loop allocates frames");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_value_stack ()
+{
+  // fill the current chunk
+  Lisp_Object *outer = values_top ();
+  for (;;)
+    {
+      Lisp_Object *top = values_top ();
+      Lisp_Object *base = values_push (top, q_t);
+      if (base != top)
+        {
+          // it was full: the value went to a new chunk
+          values_unwind (base);
+          break;
+        }
+    }
+
+  // the arguments in progress move to the next chunk along
+  Lisp_Object *args = values_top ();
+  Lisp_Object *moved = args;
+  for (int i = 0; i < 3; i++)
+    moved = values_push (moved, box_int (i));
+  TEST_ASSERT (moved != args, "arguments did not move");
+  for (int i = 0; i < 3; i++)
+    TEST_ASSERT (eq (moved[i], box_int (i)), "argument %d lost", i);
+
+  // and a call through the full chunk still works
+  Lisp_Object res = eval_string ("(+ 1 2 3)");
+  TEST_ASSERT (eq (res, box_int (6)), "expected 6, got %ld", unbox_int (res));
+
+  values_unwind (moved);
+  TEST_ASSERT (values_top () == args, "not unwound to the full chunk");
+  values_unwind (outer);
+  TEST_ASSERT (values_top () == outer, "not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_backtrace ()
+{
+  eval_string ("(define te-named (lambda (x y) x))");
+  Lisp_Object named = eval_string ("te-named");
+  Lisp_Object anonymous = eval_string ("(lambda (x) x)");
+  Lisp_Object car = eval_string ("car");
+
+  stack_push ((struct stackframe){ .fun = named, .env = q_nil });
+  stack_push ((struct stackframe){ .fun = q_let, .env = q_nil });
+  stack_push ((struct stackframe){ .fun = anonymous, .env = q_nil });
+  stack_push ((struct stackframe){ .fun = car, .env = q_nil });
+
+  char *buf;
+  size_t size;
+  FILE *out = open_memstream (&buf, &size);
+  print_backtrace (out);
+  fclose (out);
+  for (int i = 0; i < 4; i++)
+    stack_pop ();
+
+  // innermost first, named when printed
+  const char *expected = "  car\n  lambda(1, 1)\n  let\n  te-named\n";
+  int ok = strncmp (buf, expected, strlen (expected)) == 0;
+  free (buf);
+  TEST_ASSERT (ok, "unexpected backtrace");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_special_forms ()
+{
+  // dispatched on by eval, in the current env
+  Lisp_Object res = eval_string ("(let ((x 1)) (define te-f (lambda () x))"
+                                 "  (setq x 2) (if (eq? x 2) (te-f) 0))");
+  TEST_ASSERT (eq (res, box_int (2)), "expected 2, got %ld", unbox_int (res));
+
+  // too few args are still an error, that evaluates to nil
+  res = eval_string ("(if t)");
+  TEST_ASSERT (nil (res), "(if t) evaluated");
+
+  // a redefined special form symbol is a plain function
+  Lisp_Object symbol = eval_string ("'while");
+  Lisp_Object subr = unbox_symbol (symbol)->value;
+  eval_string ("(define while car)");
+  res = eval_string ("(while '(7 8))");
+  unbox_symbol (symbol)->value = subr;
+  TEST_ASSERT (eq (res, box_int (7)), "expected 7, got %ld", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_lambda_list ()
+{
+  eval_string ("(define te-opt (lambda (a &optional b c)"
+               "  (cons a (cons b (cons c nil)))))");
+  Lisp_Object res = eval_string ("(te-opt 1 2)");
+  TEST_ASSERT (eq (f_car (f_cdr (res)), box_int (2)), "optional not bound");
+  TEST_ASSERT (nil (f_car (f_cdr (f_cdr (res)))), "missing optional not nil");
+
+  eval_string ("(define te-rest (lambda (a &rest r) (cons a r)))");
+  res = eval_string ("(te-rest 1 2 3)");
+  TEST_ASSERT (eq (f_length (res), box_int (3)), "expected 3 elements");
+  TEST_ASSERT (eq (f_car (f_cdr (f_cdr (res))), box_int (3)),
+               "wrong rest list");
+  res = eval_string ("(te-rest 1)");
+  TEST_ASSERT (nil (f_cdr (res)), "empty rest list not nil");
+
+  // a rest arg the body does not use costs no list
+  eval_string ("(define te-ign (lambda (a &rest r) a))");
+  eval_string ("(define te-many (lambda (n)"
+               "  (dotimes (i n) (te-ign i i i i))))");
+  eval_string ("(te-many 1)");
+  struct memstats before = memstats ();
+  eval_string ("(te-many 10)");
+  struct memstats after = memstats ();
+  unsigned long conses = after.conses.numused - before.conses.numused;
+
+  before = memstats ();
+  eval_string ("(te-many 1000)");
+  after = memstats ();
+  TEST_ASSERT (after.conses.numused - before.conses.numused == conses,
+               "unused rest list built");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_eval_let_star ()
+{
+  // let* is let: resolved inside a lambda, each init seeing the
+  // variables bound before it
+  eval_string ("(define te-ls1 (lambda (n) (let* ((a n)) a)))");
+  Lisp_Object res = eval_string ("(te-ls1 1)");
+  TEST_ASSERT (eq (res, box_int (1)), "expected 1, got %ld", unbox_int (res));
+
+  eval_string ("(define te-ls2 (lambda (n)"
+               "  (let* ((a n) (b (+ a 1))) (cons a b))))");
+  res = eval_string ("(te-ls2 1)");
+  TEST_CHECK_TYPE ("let*", res, LISP_CONS);
+  TEST_ASSERT (eq (f_car (res), box_int (1)) && eq (f_cdr (res), box_int (2)),
+               "expected (1 . 2)");
+
+  res = eval_string ("(byte-compile 'te-ls2)");
+  TEST_CHECK_TYPE ("compiled", res, LISP_LMBD);
+  res = eval_string ("(te-ls2 5)");
+  TEST_ASSERT (eq (f_car (res), box_int (5)) && eq (f_cdr (res), box_int (6)),
+               "compiled: expected (5 . 6)");
+
+  return TEST_RESULT_SUCCESS;
+}
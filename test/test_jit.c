@@ -0,0 +1,222 @@
+#include "test_jit.h"
+#include "../src/alloc.h"
+#include "../src/bytecode.h"
+#include "../src/eval.h"
+#include "../src/jit.h"
+#include "../src/lisp.h"
+#include "test_lib.h"
+#include <string.h>
+
+// test cases
+static TestResult test_jit_fib ();
+static TestResult test_jit_closure ();
+static TestResult test_jit_let ();
+static TestResult test_jit_control ();
+static TestResult test_jit_tailcall ();
+static TestResult test_jit_threshold ();
+static TestResult test_jit_overflow ();
+
+static TestCase test_jit_cases[] = {
+  { .skip = 0, .name = "fib", .run = test_jit_fib },
+  { .skip = 0, .name = "closure", .run = test_jit_closure },
+  { .skip = 0, .name = "let", .run = test_jit_let },
+  { .skip = 0, .name = "control", .run = test_jit_control },
+  { .skip = 0, .name = "tail call", .run = test_jit_tailcall },
+  { .skip = 0, .name = "threshold", .run = test_jit_threshold },
+  { .skip = 0, .name = "overflow", .run = test_jit_overflow },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_jit ()
+{
+  return test_suite_init ("jit", test_jit_cases);
+}
+
+// helpers
+
+static Lisp_Lambda *
+lambda_of (const char *name)
+{
+  return unbox_lambda (unbox_symbol (eval_string (name))->value);
+}
+
+// byte compile and translate the function NAME right away
+static const char *
+jit (const char *name)
+{
+  char buf[64];
+  snprintf (buf, sizeof (buf), "(byte-compile '%s)", name);
+  eval_string (buf);
+  snprintf (buf, sizeof (buf), "'%s", name);
+  return jit_compile (lambda_of (buf));
+}
+
+// test cases implementation
+
+static TestResult
+test_jit_fib ()
+{
+  eval_string ("(define jt-fib (lambda (n)"
+               "  (if (< n 2) n (+ (jt-fib (- n 1)) (jt-fib (- n 2))))))");
+  Lisp_Object interpreted = eval_string ("(jt-fib 15)");
+
+  const char *err = jit ("jt-fib");
+  TEST_ASSERT (!err, "jit error: %s", err);
+  TEST_ASSERT (lambda_of ("'jt-fib")->jitcode, "no native code");
+
+  Lisp_Object res = eval_string ("(jt-fib 15)");
+  TEST_ASSERT (eq (res, interpreted), "expected %ld, got %ld",
+               unbox_int (interpreted), unbox_int (res));
+  TEST_ASSERT (byte_stack_top == byte_stack, "byte stack not unwound");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_jit_closure ()
+{
+  eval_string ("(define jt-adder (lambda (n) (lambda (x) (+ x n))))");
+  const char *err = jit ("jt-adder");
+  TEST_ASSERT (!err, "jit error: %s", err);
+
+  Lisp_Object res = eval_string ("(+ ((jt-adder 3) 4) ((jt-adder 5) 1))");
+  TEST_ASSERT (eq (res, box_int (13)), "expected 13, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_jit_let ()
+{
+  eval_string ("(defvar jt-dyn 1)");
+  eval_string ("(define jt-get-dyn (lambda () jt-dyn))");
+  eval_string ("(define jt-let (lambda (a)"
+               "  (let ((b (+ a 1)) (jt-dyn (* a 10)) (c (+ a b)))"
+               "    (+ b c (jt-get-dyn)))))");
+  const char *err = jit ("jt-let");
+  TEST_ASSERT (!err, "jit error: %s", err);
+
+  size_t count = specpdl_index ();
+  Lisp_Object res = eval_string ("(jt-let 2)");
+  TEST_ASSERT (eq (res, box_int (28)), "expected 28, got %ld",
+               unbox_int (res));
+  TEST_ASSERT (specpdl_index () == count, "specpdl not unwound");
+  res = eval_string ("jt-dyn");
+  TEST_ASSERT (eq (res, box_int (1)), "dynamic binding not undone");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_jit_control ()
+{
+  eval_string ("(define jt-control (lambda (x)"
+               "  (cond ((eq? x 0) (and 1 2 nil 3))"
+               "        ((eq? x 1) (or nil nil 7))"
+               "        ((eq? x 2) (when x (car (cons 'w x))))"
+               "        ((eq? x 3) (unless x 'u))"
+               "        ((eq? x 4) (cdr (cons x (>= x 4))))"
+               "        (t (if nil 1 (* x 3))))))");
+
+  Lisp_Object interpreted[6];
+  char buf[32];
+  for (int i = 0; i < 6; i++)
+    {
+      snprintf (buf, sizeof (buf), "(jt-control %d)", i);
+      interpreted[i] = eval_string (buf);
+    }
+
+  const char *err = jit ("jt-control");
+  TEST_ASSERT (!err, "jit error: %s", err);
+  for (int i = 0; i < 6; i++)
+    {
+      snprintf (buf, sizeof (buf), "(jt-control %d)", i);
+      Lisp_Object res = eval_string (buf);
+      TEST_ASSERT (eq (res, interpreted[i]), "different result for %d", i);
+    }
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_jit_tailcall ()
+{
+  eval_string ("(define jt-count (lambda (n acc)"
+               "  (if (eq? n 0) acc (jt-count (- n 1) (+ acc 1)))))");
+  const char *err = jit ("jt-count");
+  TEST_ASSERT (!err, "jit error: %s", err);
+
+  Lisp_Object res = eval_string ("(jt-count 100000 0)");
+  TEST_ASSERT (eq (res, box_int (100000)), "expected 100000, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_jit_threshold ()
+{
+  eval_string ("(define jt-sq (lambda (x) (* x x)))");
+  eval_string ("(byte-compile 'jt-sq)");
+  eval_string ("(define jt-sum (lambda (n acc)"
+               "  (if (eq? n 0) acc (jt-sum (- n 1) (+ acc (jt-sq n))))))");
+  eval_string ("(byte-compile 'jt-sum)");
+
+  // off unless asked for
+  eval_string ("(jt-sum 2000 0)");
+  TEST_ASSERT (!lambda_of ("'jt-sq")->jitcode, "translated while disabled");
+
+  jit_enabled = 1;
+  Lisp_Object res = eval_string ("(jt-sum 2000 0)");
+  jit_enabled = 0;
+  TEST_ASSERT (lambda_of ("'jt-sq")->jitcode, "hot lambda not translated");
+  TEST_ASSERT (eq (res, box_int (2668667000)), "expected 2668667000, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_jit_overflow ()
+{
+  // the fixnum fast paths of eval, the VM and native code fall back to
+  // the builtins on overflow: all three agree
+  const char *body = " (lambda (x y)"
+                     "  (cons (+ x y) (cons (- x y) (cons (* x y)"
+                     "    (cons (< x y) (cons (>= x y) nil))))))";
+  char buf[256];
+  snprintf (buf, sizeof (buf), "(define jt-arith %s)", body);
+  eval_string (buf);
+  snprintf (buf, sizeof (buf), "(define jt-arith-vm %s)", body);
+  eval_string (buf);
+  eval_string ("(byte-compile jt-arith-vm)");
+  const char *err = jit ("jt-arith");
+  TEST_ASSERT (!err, "jit error: %s", err);
+
+  Lisp_Integer most = ((Lisp_Integer)1 << (VALBITS - 1)) - 1;
+  Lisp_Integer pairs[][2] = {
+    { 3, -4 }, { most, 1 }, { -most - 1, 1 }, { most, most }, { most, -1 },
+  };
+  Lisp_Object x = eval_string ("'jt-x");
+  Lisp_Object y = eval_string ("'jt-y");
+  for (size_t i = 0; i < sizeof (pairs) / sizeof (pairs[0]); i++)
+    {
+      unbox_symbol (x)->value = box_int (pairs[i][0]);
+      unbox_symbol (y)->value = box_int (pairs[i][1]);
+      Lisp_Object interpreted = eval_string ("((lambda (x y)"
+                                             "  (cons (+ x y) (cons (- x y)"
+                                             "  (cons (* x y) (cons (< x y)"
+                                             "  (cons (>= x y) nil))))))"
+                                             " jt-x jt-y)");
+      Lisp_Object vm = eval_string ("(jt-arith-vm jt-x jt-y)");
+      Lisp_Object native = eval_string ("(jt-arith jt-x jt-y)");
+      TEST_ASSERT (!nil (f_equal_p (interpreted, vm)), "VM differs at %zu",
+                   i);
+      TEST_ASSERT (!nil (f_equal_p (interpreted, native)),
+                   "native code differs at %zu", i);
+    }
+
+  return TEST_RESULT_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef _TEST_JIT_H_
+#define _TEST_JIT_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_jit ();
+
+#endif /* _TEST_JIT_H_ */
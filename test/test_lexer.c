@@ -14,12 +14,14 @@ static TestResult test_lexer_mix ();
 static TestResult test_lexer_defer_eval ();
 static TestResult test_lexer_comments ();
 static TestResult test_lexer_unterminated_str ();
+static TestResult test_lexer_big_int ();
 
 static TestCase test_lexer_cases[] = {
   { .skip = 0, .name = "mix", .run = &test_lexer_mix },
   { .skip = 0, .name = "defer-eval", .run = &test_lexer_defer_eval },
   { .skip = 0, .name = "comments", .run = &test_lexer_comments },
   { .skip = 0, .name = "unterm-str", .run = &test_lexer_unterminated_str },
+  { .skip = 0, .name = "big-int", .run = &test_lexer_big_int },
   {}, // terminator
 };
 
@@ -364,6 +366,33 @@ test_lexer_unterminated_str ()
   return TEST_RESULT_SUCCESS;
 }
 
+static TestResult
+test_lexer_big_int ()
+{
+  const char *src = "9223372036854775807 9223372036854775808";
+  Lexer *l = lex_init ();
+  lex_set_stream (l, stream_string (src, strlen (src)));
+
+  // the largest long, and the digits of what is past it
+  Token tok = lex_next (l);
+  if (tok.type != TOK_INT_LITERAL || tok.integer != 9223372036854775807L)
+    return TEST_RESULT_FAIL ("expected %s 9223372036854775807, got %s",
+                             lex_token_type (TOK_INT_LITERAL),
+                             lex_token_type (tok.type));
+
+  tok = lex_next (l);
+  if (tok.type != TOK_BIGINT_LITERAL)
+    return TEST_RESULT_FAIL ("expected %s, got %s",
+                             lex_token_type (TOK_BIGINT_LITERAL),
+                             lex_token_type (tok.type));
+  if (strcmp (tok.string, "9223372036854775808") != 0)
+    return TEST_RESULT_FAIL ("expected 9223372036854775808, got %s",
+                             tok.string);
+  free (tok.string);
+
+  return TEST_RESULT_SUCCESS;
+}
+
 // assertion and helpers
 
 static TestResult
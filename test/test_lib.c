@@ -1,4 +1,6 @@
 #include "test_lib.h"
+#include "../src/eval.h"
+#include "../src/lexer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -155,3 +157,11 @@ test_execution_cleanup (TestExecution *te)
   free (te->suites);
   free (te);
 }
+
+Lisp_Object
+eval_string (const char *s)
+{
+  Lexer *l = lex_init ();
+  lex_set_stream (l, stream_string (s, strlen (s)));
+  return eval_toplevel (l);
+}
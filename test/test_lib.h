@@ -1,6 +1,7 @@
 #ifndef _TEST_LIB_H_
 #define _TEST_LIB_H_
 
+#include "../src/lisp.h"
 #include "stdarg.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -97,4 +98,8 @@ int test_execution_run (TestExecution *te, char *suitename);
 
 void test_execution_cleanup (TestExecution *te);
 
+/* reads and evaluates the forms of S one by one, like the repl does,
+   and returns the value of the last */
+Lisp_Object eval_string (const char *s);
+
 #endif /* _TEST_LIB_H_ */
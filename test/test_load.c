@@ -0,0 +1,174 @@
+#include "test_load.h"
+#include "../src/alloc.h"
+#include "../src/bytecode.h"
+#include "../src/eval.h"
+#include "../src/lisp.h"
+#include "../src/load.h"
+#include "../src/obarray.h"
+#include "test_lib.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// test cases
+static TestResult test_load_miss ();
+static TestResult test_load_hit ();
+static TestResult test_load_stale ();
+static TestResult test_load_version ();
+
+static TestCase test_load_cases[] = {
+  { .skip = 0, .name = "miss", .run = test_load_miss },
+  { .skip = 0, .name = "hit", .run = test_load_hit },
+  { .skip = 0, .name = "stale", .run = test_load_stale },
+  { .skip = 0, .name = "version", .run = test_load_version },
+  {}, // terminator
+};
+
+static const char *source
+    = "(define ld-fact (lambda (n) (if (< n 2) 1 (* n (ld-fact (- n 1))))))\n"
+      "(define ld-decl (lambda () (defvar ld-var 3) ld-var))\n"
+      "(ld-fact 5)\n";
+
+TestSuite *
+test_suite_load ()
+{
+  return test_suite_init ("load", test_load_cases);
+}
+
+// helpers
+
+static char srcpath[64];
+static char cachepath[sizeof (srcpath) + 1];
+
+static void
+write_source (const char *contents)
+{
+  snprintf (srcpath, sizeof (srcpath), "/tmp/erlisp-test-load-%d.el",
+            getpid ());
+  snprintf (cachepath, sizeof (cachepath), "%sc", srcpath);
+  FILE *f = fopen (srcpath, "w");
+  fputs (contents, f);
+  fclose (f);
+}
+
+static void
+cleanup ()
+{
+  unlink (srcpath);
+  unlink (cachepath);
+}
+
+static Lisp_Lambda *
+function (const char *name)
+{
+  Lisp_Object value = obarray_intern (v_obarray, name, strlen (name));
+  return unbox_lambda (unbox_symbol (value)->value);
+}
+
+// test cases implementation
+
+static TestResult
+test_load_miss ()
+{
+  int hit;
+
+  write_source (source);
+  unlink (cachepath);
+
+  Lisp_Object res = load_file (srcpath, &hit);
+  TEST_ASSERT (!hit, "cache hit without a cache");
+  TEST_ASSERT (eq (res, box_int (120)), "expected 120, got %ld",
+               unbox_int (res));
+  TEST_ASSERT (access (cachepath, R_OK) == 0, "cache not written");
+  TEST_ASSERT (!nil (function ("ld-fact")->bytecode),
+               "definition not compiled");
+
+  cleanup ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_load_hit ()
+{
+  int hit;
+
+  write_source (source);
+  unlink (cachepath);
+  load_file (srcpath, &hit);
+
+  // forget the definitions: they must come back from the cache
+  unbox_symbol (obarray_intern (v_obarray, "ld-fact", 7))->value = q_unbound;
+  unbox_symbol (obarray_intern (v_obarray, "ld-decl", 7))->value = q_unbound;
+
+  Lisp_Object res = load_file (srcpath, &hit);
+  TEST_ASSERT (hit, "cache not used");
+  TEST_ASSERT (eq (res, box_int (120)), "expected 120, got %ld",
+               unbox_int (res));
+
+  Lisp_Lambda *fact = function ("ld-fact");
+  TEST_ASSERT (!nil (fact->bytecode), "cached definition not compiled");
+  Lisp_Object arg = box_int (6);
+  stack_push ((struct stackframe){ .fun = q_nil, .env = q_nil });
+  res = call_lambda (fact, &arg);
+  TEST_ASSERT (eq (res, box_int (720)), "expected 720, got %ld",
+               unbox_int (res));
+
+  // not compilable, cached as source
+  Lisp_Lambda *decl = function ("ld-decl");
+  TEST_ASSERT (nil (decl->bytecode), "defvar compiled");
+  res = call_lambda (decl, NULL);
+  stack_pop ();
+  TEST_ASSERT (eq (res, box_int (3)), "expected 3, got %ld", unbox_int (res));
+
+  cleanup ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_load_stale ()
+{
+  int hit;
+
+  write_source (source);
+  unlink (cachepath);
+  load_file (srcpath, &hit);
+
+  write_source ("(define ld-fact (lambda (n) n))\n(ld-fact 5)\n");
+  Lisp_Object res = load_file (srcpath, &hit);
+  TEST_ASSERT (!hit, "stale cache used");
+  TEST_ASSERT (eq (res, box_int (5)), "expected 5, got %ld", unbox_int (res));
+
+  res = load_file (srcpath, &hit);
+  TEST_ASSERT (hit, "cache not written again");
+  TEST_ASSERT (eq (res, box_int (5)), "expected 5, got %ld", unbox_int (res));
+
+  cleanup ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_load_version ()
+{
+  int hit;
+
+  write_source (source);
+  unlink (cachepath);
+  load_file (srcpath, &hit);
+
+  // a cache written by another VM
+  struct elc header;
+  FILE *f = fopen (cachepath, "r+");
+  TEST_ASSERT (fread (&header, sizeof (header), 1, f) == 1, "short cache");
+  header.bytecode = BYTE_CODE_VERSION + 1;
+  rewind (f);
+  fwrite (&header, sizeof (header), 1, f);
+  fclose (f);
+
+  load_file (srcpath, &hit);
+  TEST_ASSERT (!hit, "cache of another VM version used");
+  load_file (srcpath, &hit);
+  TEST_ASSERT (hit, "cache not written again");
+
+  cleanup ();
+  return TEST_RESULT_SUCCESS;
+}
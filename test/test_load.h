@@ -0,0 +1,8 @@
+#ifndef _TEST_LOAD_H_
+#define _TEST_LOAD_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_load ();
+
+#endif /* _TEST_LOAD_H_ */
@@ -0,0 +1,200 @@
+#include "test_macro.h"
+#include "../src/bytecode.h"
+#include "../src/eval.h"
+#include "../src/lexer.h"
+#include "../src/lisp.h"
+#include "../src/macro.h"
+#include "../src/parser.h"
+#include "test_lib.h"
+#include <string.h>
+
+// test cases
+static TestResult test_macro_defmacro ();
+static TestResult test_macro_quasiquote ();
+static TestResult test_macro_expansion ();
+static TestResult test_macro_once ();
+static TestResult test_macro_capture ();
+static TestResult test_macro_shared ();
+static TestResult test_macro_repeated ();
+
+static TestCase test_macro_cases[] = {
+  { .skip = 0, .name = "defmacro", .run = test_macro_defmacro },
+  { .skip = 0, .name = "quasiquote", .run = test_macro_quasiquote },
+  { .skip = 0, .name = "expansion", .run = test_macro_expansion },
+  { .skip = 0, .name = "once", .run = test_macro_once },
+  { .skip = 0, .name = "capture", .run = test_macro_capture },
+  { .skip = 0, .name = "shared", .run = test_macro_shared },
+  { .skip = 0, .name = "repeated", .run = test_macro_repeated },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_macro ()
+{
+  return test_suite_init ("macro", test_macro_cases);
+}
+
+// helpers
+
+static Lisp_Object
+read_string (const char *s)
+{
+  Lexer *l = lex_init ();
+  lex_set_stream (l, stream_string (s, strlen (s)));
+  return parse_sexp (l);
+}
+
+// test cases implementation
+
+static TestResult
+test_macro_defmacro ()
+{
+  Lisp_Object res = eval_string ("(defmacro tm-flip (a op b)"
+                                 "  (cons op (cons b (cons a nil))))");
+  TEST_ASSERT (macro_p (unbox_symbol (res)->value), "not a macro");
+
+  res = eval_string ("(tm-flip 1 - 10)");
+  TEST_ASSERT (eq (res, box_int (9)), "expected 9, got %ld", unbox_int (res));
+
+  // an atom expansion
+  eval_string ("(defmacro tm-seven () 7)");
+  res = eval_string ("(tm-seven)");
+  TEST_ASSERT (eq (res, box_int (7)), "expected 7, got %ld", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_macro_quasiquote ()
+{
+  eval_string ("(define tm-x 3)"
+               "(define tm-l (quote (1 2)))");
+
+  Lisp_Object res = eval_string ("`(a ,tm-x ,@tm-l b)");
+  TEST_ASSERT (eq (f_length (res), box_int (5)), "expected 5 elements");
+  TEST_ASSERT (eq (f_car (f_cdr (res)), box_int (3)), "unquote not evaluated");
+  TEST_ASSERT (eq (f_car (f_cdr (f_cdr (f_cdr (res)))), box_int (2)),
+               "list not spliced");
+  res = eval_string ("`(a . ,tm-x)");
+  TEST_ASSERT (eq (f_cdr (res), box_int (3)), "dotted unquote");
+
+  // the spliced list is copied, the constant tail shared
+  Lisp_Object code = quasiquote_expand (read_string ("(,@tm-l c d)"));
+  TEST_ASSERT (eq (f_car (code), q_append), "splice not appended");
+  TEST_ASSERT (eq (f_car (f_car (f_cdr (f_cdr (code)))), q_quote),
+               "constant tail not quoted");
+
+  // a constant template is itself
+  Lisp_Object template = read_string ("(a (b c) d)");
+  code = quasiquote_expand (template);
+  TEST_ASSERT (eq (f_car (code), q_quote), "constant template not quoted");
+  TEST_ASSERT (eq (f_car (f_cdr (code)), template), "template copied");
+
+  // nested backquotes unquote at their own depth
+  res = eval_string ("``(a ,,tm-x)");
+  TEST_ASSERT (eq (f_car (res), q_quasiquote), "inner backquote evaluated");
+  Lisp_Object unquote = f_car (f_cdr (f_car (f_cdr (res))));
+  TEST_ASSERT (eq (f_car (f_cdr (unquote)), box_int (3)),
+               "outer unquote not evaluated");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_macro_expansion ()
+{
+  eval_string ("(defmacro tm-inc (v) `(setq ,v (+ ,v 1)))");
+
+  // macroexpand leaves the form alone, eval does not
+  Lisp_Object form = read_string ("(tm-inc tm-y)");
+  Lisp_Object res = f_macroexpand (form);
+  TEST_ASSERT (eq (unbox_symbol (f_car (res))->form, SF_SETQ),
+               "not expanded");
+  TEST_ASSERT (macro_call_p (form), "form modified");
+
+  macroexpand (form);
+  TEST_ASSERT (!macro_call_p (form), "not expanded in place");
+
+  // a macro expanding to another macro call
+  eval_string ("(defmacro tm-inc2 (v) `(progn (tm-inc ,v) (tm-inc ,v)))");
+  res = eval_string ("(define tm-f (lambda (n) (tm-inc2 n) n))"
+                     "(tm-f 5)");
+  TEST_ASSERT (eq (res, box_int (7)), "expected 7, got %ld", unbox_int (res));
+
+  // compiled bodies are expanded
+  Lisp_Lambda *f = unbox_lambda (eval_string ("tm-f"));
+  TEST_ASSERT (byte_compile (f) == NULL, "not compiled");
+  res = eval_string ("(tm-f 1)");
+  TEST_ASSERT (eq (res, box_int (3)), "expected 3, got %ld", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_macro_once ()
+{
+  // the expander runs once per call site, not per evaluation
+  eval_string ("(define tm-count 0)"
+               "(defmacro tm-counted (e)"
+               "  (setq tm-count (+ tm-count 1)) e)"
+               "(define tm-g (lambda (n) (tm-counted (+ n 1))))");
+  eval_string ("(tm-g 1) (tm-g 2) (tm-g 3)");
+  Lisp_Object res = eval_string ("tm-count");
+  TEST_ASSERT (eq (res, box_int (1)), "expanded %ld times", unbox_int (res));
+
+  // also in toplevel code that is not resolved
+  eval_string ("(define tm-i 0)"
+               "(while (< tm-i 5) (setq tm-i (tm-counted (+ tm-i 1))))");
+  res = eval_string ("tm-count");
+  TEST_ASSERT (eq (res, box_int (2)), "expanded %ld times", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_macro_capture ()
+{
+  // the setq of the expansion makes the captured variable a box
+  eval_string ("(defmacro tm-bump (v) `(setq ,v (+ ,v 1)))"
+               "(define tm-counter (lambda ()"
+               "  (let ((n 0)) (lambda () (tm-bump n)))))"
+               "(define tm-c (tm-counter))");
+  eval_string ("(tm-c) (tm-c)");
+  Lisp_Object res = eval_string ("(tm-c)");
+  TEST_ASSERT (eq (res, box_int (3)), "expected 3, got %ld", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_macro_shared ()
+{
+  // the constant template is the expansion of every call site: each
+  // one is resolved in its own scope
+  eval_string ("(defmacro tm-addq () `(+ tm-q 1))"
+               "(define tm-f2 (lambda (a tm-q) (tm-addq)))");
+  Lisp_Object res = eval_string ("(tm-f2 0 10)");
+  TEST_ASSERT (eq (res, box_int (11)), "expected 11, got %ld",
+               unbox_int (res));
+
+  res = eval_string ("(define tm-q 1000) (tm-addq)");
+  TEST_ASSERT (eq (res, box_int (1001)), "expected 1001, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_macro_repeated ()
+{
+  // the two ,e of the expansion are resolved under different frames
+  eval_string ("(defmacro tm-twice (e) `(cons ,e (let ((z 100)) ,e)))"
+               "(define tm-h (lambda (n) (tm-twice (+ n 1))))");
+  Lisp_Object res = eval_string ("(tm-h 5)");
+  TEST_ASSERT (eq (f_car (res), box_int (6)), "expected 6, got %ld",
+               unbox_int (f_car (res)));
+  TEST_ASSERT (eq (f_cdr (res), box_int (6)), "expected 6, got %ld",
+               unbox_int (f_cdr (res)));
+
+  return TEST_RESULT_SUCCESS;
+}
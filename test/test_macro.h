@@ -0,0 +1,8 @@
+#ifndef _TEST_MACRO_H_
+#define _TEST_MACRO_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_macro ();
+
+#endif /* _TEST_MACRO_H_ */
@@ -0,0 +1,179 @@
+#include "test_node.h"
+#include "../src/alloc.h"
+#include "../src/lisp.h"
+#include "../src/node.h"
+#include "test_lib.h"
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// test cases
+static TestResult test_node_self ();
+static TestResult test_node_batch ();
+static TestResult test_node_nodelay ();
+static TestResult test_node_flood ();
+static TestResult test_node_two_nodes ();
+
+static TestCase test_node_cases[] = {
+  { .skip = 0, .name = "self", .run = test_node_self },
+  { .skip = 0, .name = "batch", .run = test_node_batch },
+  { .skip = 0, .name = "nodelay", .run = test_node_nodelay },
+  { .skip = 0, .name = "flood", .run = test_node_flood },
+  { .skip = 0, .name = "two nodes", .run = test_node_two_nodes },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_node ()
+{
+  return test_suite_init ("node", test_node_cases);
+}
+
+// helpers
+
+static Lisp_Object
+node_path (const char *name)
+{
+  char buf[100];
+  snprintf (buf, sizeof (buf), "/tmp/erlisp-test-%s-%d.sock", name,
+            (int)getpid ());
+  return make_string (buf);
+}
+
+static size_t
+pending (Lisp_Object dest)
+{
+  return node_pending (unbox_string (dest)->data, unbox_string (dest)->size);
+}
+
+// test cases implementation
+
+static TestResult
+test_node_self ()
+{
+  Lisp_Object self = node_path ("self");
+  TEST_ASSERT (eq (f_node_start (self), q_t), "cannot start node");
+
+  Lisp_Object term = f_cons (make_str_symbol ("hello"),
+                             f_cons (box_int (42), q_nil));
+  f_send (self, term);
+  TEST_ASSERT (pending (self) > 0, "message should wait in the batch");
+
+  Lisp_Object res = f_receive (box_int (1000));
+  TEST_CHECK_TYPE ("received", res, LISP_CONS);
+  TEST_ASSERT (unbox_int (f_car (f_cdr (res))) == 42, "wrong message");
+  TEST_ASSERT (eq (f_receive (box_int (0)), q_nil), "mailbox not empty");
+
+  node_stop ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_node_batch ()
+{
+  Lisp_Object self = node_path ("batch");
+  f_node_start (self);
+  f_node_batch_size (box_int (64));
+
+  // each message is 8 bytes: the batch is written on the 8th send
+  for (int i = 0; i < 7; i++)
+    f_send (self, box_int (i));
+  TEST_ASSERT (pending (self) == 56, "expected 56 pending bytes, got %zu",
+               pending (self));
+  f_send (self, box_int (7));
+  TEST_ASSERT (pending (self) == 0, "batch not written");
+
+  for (int i = 0; i < 8; i++)
+    {
+      Lisp_Object res = f_receive (box_int (1000));
+      TEST_ASSERT (eq (res, box_int (i)), "message %d out of order", i);
+    }
+
+  f_node_batch_size (box_int (NODE_DEFAULT_BATCH));
+  node_stop ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_node_nodelay ()
+{
+  Lisp_Object self = node_path ("nodelay");
+  f_node_start (self);
+  f_node_nodelay (q_t);
+
+  f_send (self, make_string ("now"));
+  TEST_ASSERT (pending (self) == 0, "nodelay send was batched");
+  TEST_CHECK_TYPE ("received", f_receive (box_int (1000)), LISP_STRG);
+
+  f_node_nodelay (q_nil);
+  node_stop ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_node_flood ()
+{
+  // a batch far larger than the socket buffer: writing it to ourselves
+  // must read it back meanwhile instead of blocking
+  Lisp_Object self = node_path ("flood");
+  f_node_start (self);
+  f_node_batch_size (box_int (1 << 24));
+
+  char buf[1024];
+  memset (buf, 'x', sizeof (buf) - 1);
+  buf[sizeof (buf) - 1] = '\0';
+  Lisp_Object str = make_string (buf);
+  for (int i = 0; i < 4096; i++)
+    f_send (self, f_cons (box_int (i), str));
+  TEST_ASSERT (eq (f_node_flush (q_nil), q_t), "flush failed");
+
+  for (int i = 0; i < 4096; i++)
+    {
+      Lisp_Object res = f_receive (box_int (1000));
+      TEST_CHECK_TYPE ("received", res, LISP_CONS);
+      TEST_ASSERT (eq (f_car (res), box_int (i)), "message %d lost", i);
+    }
+  TEST_ASSERT (eq (f_receive (box_int (0)), q_nil), "mailbox not empty");
+
+  f_node_batch_size (box_int (NODE_DEFAULT_BATCH));
+  node_stop ();
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_node_two_nodes ()
+{
+  Lisp_Object parent = node_path ("parent");
+  Lisp_Object child = node_path ("child");
+  f_node_start (parent);
+
+  pid_t pid = fork ();
+  if (pid == 0)
+    {
+      // child node: announce itself, echo one message back reversed
+      node_stop ();
+      f_node_start (child);
+      f_send (parent, make_str_symbol ("ready"));
+      f_node_flush (q_nil);
+      Lisp_Object msg = f_receive (box_int (5000));
+      f_send (parent, f_cons (f_cdr (msg), f_car (msg)));
+      node_stop ();
+      _exit (0);
+    }
+
+  Lisp_Object ready = f_receive (box_int (5000));
+  TEST_CHECK_TYPE ("ready", ready, LISP_SYMB);
+
+  f_send (child, f_cons (box_int (1), make_string ("two")));
+  Lisp_Object reply = f_receive (box_int (5000));
+  TEST_CHECK_TYPE ("reply", reply, LISP_CONS);
+  TEST_CHECK_TYPE ("reply car", f_car (reply), LISP_STRG);
+  TEST_ASSERT (eq (f_cdr (reply), box_int (1)), "wrong reply");
+
+  int status;
+  waitpid (pid, &status, 0);
+  node_stop ();
+  TEST_ASSERT (WIFEXITED (status) && WEXITSTATUS (status) == 0,
+               "child node failed");
+  return TEST_RESULT_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef _TEST_NODE_H_
+#define _TEST_NODE_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_node ();
+
+#endif /* _TEST_NODE_H_ */
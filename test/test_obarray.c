@@ -8,6 +8,7 @@ static TestResult test_obarray_empty ();
 static TestResult test_obarray_notfound ();
 static TestResult test_obarray_found ();
 static TestResult test_obarray_foundall ();
+static TestResult test_obarray_intern ();
 
 static TestCase test_obarray_cases[] = {
   { .skip = 0, .name = "init", .run = &test_obarray_init },
@@ -15,6 +16,7 @@ static TestCase test_obarray_cases[] = {
   { .skip = 0, .name = "notfound", .run = &test_obarray_notfound },
   { .skip = 0, .name = "found", .run = &test_obarray_found },
   { .skip = 0, .name = "foundall", .run = &test_obarray_foundall },
+  { .skip = 0, .name = "intern", .run = &test_obarray_intern },
   {}, // terminator
 };
 
@@ -153,3 +155,23 @@ test_obarray_foundall ()
 
   return TEST_RESULT_SUCCESS;
 }
+
+static TestResult
+test_obarray_intern ()
+{
+  Lisp_Object obarray = obarray_init ();
+
+  Lisp_Object s = make_symbol (make_string ("s"));
+  obarray_put (obarray, s);
+  if (obarray_intern (obarray, "s", 1) != s)
+    return TEST_RESULT_FAIL ("existing symbol not returned");
+
+  Lisp_Object n = obarray_intern (obarray, "new", 3);
+  TEST_CHECK_TYPE ("interned", n, LISP_SYMB);
+  if (obarray_intern (obarray, "new", 3) != n)
+    return TEST_RESULT_FAIL ("new symbol interned twice");
+  if (obarray_lookup_name (obarray, make_string ("new")) != n)
+    return TEST_RESULT_FAIL ("new symbol not in obarray");
+
+  return TEST_RESULT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+#include "test_resolve.h"
+#include "../src/alloc.h"
+#include "../src/eval.h"
+#include "../src/lexer.h"
+#include "../src/lisp.h"
+#include "../src/parser.h"
+#include "../src/resolve.h"
+#include "test_lib.h"
+#include <string.h>
+
+// test cases
+static TestResult test_resolve_depth ();
+static TestResult test_resolve_quote ();
+static TestResult test_resolve_let ();
+static TestResult test_resolve_closure ();
+static TestResult test_resolve_lexical ();
+static TestResult test_resolve_interned ();
+static TestResult test_resolve_special ();
+static TestResult test_resolve_special_args ();
+static TestResult test_resolve_flat ();
+static TestResult test_resolve_boxed ();
+static TestResult test_resolve_fold ();
+static TestResult test_resolve_data ();
+
+static TestCase test_resolve_cases[] = {
+  { .skip = 0, .name = "depth", .run = test_resolve_depth },
+  { .skip = 0, .name = "quote", .run = test_resolve_quote },
+  { .skip = 0, .name = "let", .run = test_resolve_let },
+  { .skip = 0, .name = "closure", .run = test_resolve_closure },
+  { .skip = 0, .name = "lexical", .run = test_resolve_lexical },
+  { .skip = 0, .name = "interned", .run = test_resolve_interned },
+  { .skip = 0, .name = "special", .run = test_resolve_special },
+  { .skip = 0, .name = "special args", .run = test_resolve_special_args },
+  { .skip = 0, .name = "flat", .run = test_resolve_flat },
+  { .skip = 0, .name = "boxed", .run = test_resolve_boxed },
+  { .skip = 0, .name = "fold", .run = test_resolve_fold },
+  { .skip = 0, .name = "data", .run = test_resolve_data },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_resolve ()
+{
+  return test_suite_init ("resolve", test_resolve_cases);
+}
+
+// helpers
+
+static Lisp_Object
+read_string (const char *s)
+{
+  Lexer *l = lex_init ();
+  lex_set_stream (l, stream_string (s, strlen (s)));
+  return parse_sexp (l);
+}
+
+static Lisp_Object
+nth (int n, Lisp_Object list)
+{
+  while (n-- > 0)
+    list = f_cdr (list);
+  return f_car (list);
+}
+
+// test cases implementation
+
+static TestResult
+test_resolve_depth ()
+{
+  Lisp_Object form = read_string ("(lambda (a b) (lambda (c) (+ a c b)))");
+  resolve_lambda_form (f_cdr (form), NULL);
+
+  TEST_CHECK_TYPE ("args", nth (1, form), LISP_VECT);
+
+  Lisp_Object inner = nth (2, form);
+  TEST_CHECK_TYPE ("inner args", nth (1, inner), LISP_VECT);
+
+  // a and b are captured, in the order they are found
+  Lisp_Vector *args = unbox_vector (nth (1, inner));
+  TEST_ASSERT (args->size == 3, "expected 3 args and captures, got %zu",
+               args->size);
+  TEST_ASSERT (eq (args->contents[1], box_lref (0, 0)), "wrong capture of a");
+  TEST_ASSERT (eq (args->contents[2], box_lref (0, 1)), "wrong capture of b");
+
+  // (+ a c b) -> (+ (1 0) (0 0) (1 1)), a and b in the closure frame
+  Lisp_Object call = nth (2, inner);
+  TEST_CHECK_TYPE ("function", nth (0, call), LISP_SYMB);
+  TEST_ASSERT (eq (nth (1, call), box_lref (1, 0)), "wrong ref to a");
+  TEST_ASSERT (eq (nth (2, call), box_lref (0, 0)), "wrong ref to c");
+  TEST_ASSERT (eq (nth (3, call), box_lref (1, 1)), "wrong ref to b");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_quote ()
+{
+  Lisp_Object form = read_string ("(lambda (a) (quote a) a)");
+  resolve_lambda_form (f_cdr (form), NULL);
+
+  TEST_CHECK_TYPE ("quoted", nth (1, nth (2, form)), LISP_SYMB);
+  TEST_ASSERT (eq (nth (3, form), box_lref (0, 0)), "wrong ref to a");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_let ()
+{
+  Lisp_Object res
+      = eval_string ("(let ((a 1) (b (+ a 1)) (a (+ a b))) (+ a b))");
+  TEST_CHECK_TYPE ("result", res, LISP_INTG);
+  TEST_ASSERT (unbox_int (res) == 5, "expected 5, got %ld", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_closure ()
+{
+  Lisp_Object res = eval_string (
+      "(define resolve-adder (lambda (n) (lambda (x) (+ x n))))"
+      "(define resolve-add3 (resolve-adder 3))"
+      "(define resolve-add5 (resolve-adder 5))"
+      "(+ (resolve-add3 1) (resolve-add5 1))");
+  TEST_CHECK_TYPE ("result", res, LISP_INTG);
+  TEST_ASSERT (unbox_int (res) == 10, "expected 10, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_lexical ()
+{
+  // f sees the global x, not the one bound by the caller's let
+  Lisp_Object res = eval_string ("(define resolve-x 100)"
+                                 "(define resolve-f (lambda () resolve-x))"
+                                 "(let ((resolve-x 1)) (resolve-f))");
+  TEST_CHECK_TYPE ("result", res, LISP_INTG);
+  TEST_ASSERT (unbox_int (res) == 100, "expected 100, got %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_interned ()
+{
+  // the same name always reads as the same symbol
+  Lisp_Object form = read_string ("(resolve-sym resolve-sym)");
+  TEST_ASSERT (eq (nth (0, form), nth (1, form)), "symbols not interned");
+  TEST_ASSERT (eq (nth (0, read_string ("(resolve-sym)")), nth (0, form)),
+               "symbol not interned across reads");
+
+  // calls bind the arguments in a frame: no symbol is created
+  eval_string ("(define resolve-f (lambda (a b c) (+ a b c)))");
+  Lisp_Object call = read_string ("(resolve-f 1 2 3)");
+  unsigned long before = memstats ().symbols.numused;
+  for (int i = 0; i < 100; i++)
+    eval (q_nil, call);
+  unsigned long after = memstats ().symbols.numused;
+  TEST_ASSERT (before == after, "%lu symbols allocated by calls",
+               after - before);
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_special ()
+{
+  eval_string ("(defvar resolve-depth 0)");
+  eval_string ("(define resolve-show (lambda () resolve-depth))");
+
+  // the callee sees the dynamic binding of the caller
+  Lisp_Object res = eval_string ("(let ((resolve-depth 5)) (resolve-show))");
+  TEST_ASSERT (eq (res, box_int (5)), "expected 5, got %ld", unbox_int (res));
+
+  // the binding is undone on exit, and the specpdl left empty
+  size_t count = specpdl_index ();
+  res = eval_string ("(let ((resolve-depth 1))"
+                     "  (let ((resolve-depth (+ resolve-depth 1)))"
+                     "    (resolve-show)))");
+  TEST_ASSERT (eq (res, box_int (2)), "expected 2, got %ld", unbox_int (res));
+  res = eval_string ("resolve-depth");
+  TEST_ASSERT (eq (res, box_int (0)), "not unbound: %ld", unbox_int (res));
+  TEST_ASSERT (specpdl_index () == count, "specpdl not unwound");
+
+  // defvar does not override an existing value
+  eval_string ("(defvar resolve-depth 99)");
+  res = eval_string ("resolve-depth");
+  TEST_ASSERT (eq (res, box_int (0)), "defvar overrode value");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_special_args ()
+{
+  eval_string ("(defvar resolve-arg 0)");
+  eval_string ("(define resolve-show-arg (lambda () resolve-arg))");
+
+  // a special arg is bound dynamically, like in a let
+  eval_string ("(define resolve-call (lambda (resolve-arg)"
+               "  (resolve-show-arg)))");
+  Lisp_Object res = eval_string ("(resolve-call 1)");
+  TEST_ASSERT (eq (res, box_int (1)), "expected 1, got %ld", unbox_int (res));
+  res = eval_string ("resolve-arg");
+  TEST_ASSERT (eq (res, box_int (0)), "not unbound: %ld", unbox_int (res));
+
+  // optional ones too, compiled or not
+  eval_string ("(define resolve-opt (lambda (a &optional resolve-arg)"
+               "  (cons a (resolve-show-arg))))");
+  res = eval_string ("(resolve-opt 1 2)");
+  TEST_ASSERT (eq (f_cdr (res), box_int (2)), "optional arg not bound");
+  eval_string ("(byte-compile 'resolve-call)");
+  res = eval_string ("(resolve-call 3)");
+  TEST_ASSERT (eq (res, box_int (3)), "compiled: expected 3, got %ld",
+               unbox_int (res));
+  res = eval_string ("resolve-arg");
+  TEST_ASSERT (eq (res, box_int (0)), "compiled: not unbound: %ld",
+               unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_flat ()
+{
+  // only what the body references is captured, at depth 1 whatever
+  // the nesting it comes from
+  Lisp_Object form = read_string ("(lambda (a b)"
+                                  "  (let ((c 1)) (lambda () (+ b 1))))");
+  resolve_lambda_form (f_cdr (form), NULL);
+
+  Lisp_Object inner = nth (2, nth (2, form));
+  Lisp_Vector *args = unbox_vector (nth (1, inner));
+  TEST_ASSERT (args->size == 1, "expected 1 capture, got %zu", args->size);
+  TEST_ASSERT (eq (args->contents[0], box_lref (1, 1)), "wrong capture of b");
+  TEST_ASSERT (eq (nth (1, nth (2, inner)), box_lref (1, 0)),
+               "wrong ref to b");
+
+  // the closure frame holds the copies, and nothing else. y is not
+  // a constant, which would be propagated instead
+  Lisp_Object closure = eval_string ("(define resolve-two 2)"
+                                     "(let ((x 1) (y resolve-two) (z 3))"
+                                     "  (lambda () y))");
+  Lisp_Object env = unbox_lambda (closure)->env;
+  TEST_CHECK_TYPE ("closure frame", env, LISP_VECT);
+  TEST_ASSERT (unbox_vector (env)->size == 2, "expected 1 slot, got %zu",
+               unbox_vector (env)->size - 1);
+  TEST_ASSERT (nil (unbox_vector (env)->contents[0]), "closure frame parent");
+  TEST_ASSERT (eq (unbox_vector (env)->contents[1], box_int (2)),
+               "wrong copy of y");
+
+  closure = eval_string ("(let ((x 1)) (lambda () 1))");
+  TEST_ASSERT (nil (unbox_lambda (closure)->env), "empty closure frame");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_boxed ()
+{
+  // closures share the assigned variables they capture
+  Lisp_Object res
+      = eval_string ("(define resolve-cell (lambda (x)"
+                     "  (cons (lambda () x) (lambda (v) (setq x v)))))"
+                     "(let ((c (resolve-cell 1)))"
+                     "  ((cdr c) 7)"
+                     "  ((car c)))");
+  TEST_ASSERT (eq (res, box_int (7)), "expected 7, got %ld", unbox_int (res));
+
+  // and see the assignments made after their creation
+  res = eval_string ("(let ((n 1) (f (lambda () n)))"
+                     "  (setq n (+ n 1))"
+                     "  (f))");
+  TEST_ASSERT (eq (res, box_int (2)), "expected 2, got %ld", unbox_int (res));
+
+  Lisp_Object form = read_string ("(lambda () (let ((n 0) (m 0))"
+                                  "  (setq m 1)"
+                                  "  (lambda () (setq n (+ n 1)))))");
+  resolve_lambda_form (f_cdr (form), NULL);
+  Lisp_Object bindings = nth (1, nth (2, form));
+  TEST_CHECK_TYPE ("boxed init", unbox_vector (bindings)->contents[1],
+                   LISP_CONS);
+  TEST_CHECK_TYPE ("unboxed init", unbox_vector (bindings)->contents[3],
+                   LISP_INTG);
+
+  // each iteration of a loop is captured on its own
+  res = eval_string ("(let ((fs nil))"
+                     "  (dotimes (i 3) (setq fs (cons (lambda () i) fs)))"
+                     "  ((car (cdr fs))))");
+  TEST_ASSERT (eq (res, box_int (1)), "expected 1, got %ld", unbox_int (res));
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_fold ()
+{
+  // pure builtins on constant args are evaluated
+  Lisp_Object form = read_string ("(lambda (x)"
+                                  "  (+ x (* 60 60 24))"
+                                  "  (car (quote (1 2)))"
+                                  "  (string-length \"abc\")"
+                                  "  (< 1 2)"
+                                  "  (/ x 0)"
+                                  "  (/ 1 0)"
+                                  "  (cons 1 2))");
+  resolve_lambda_form (f_cdr (form), NULL);
+  TEST_ASSERT (eq (nth (2, nth (2, form)), box_int (86400)), "not folded");
+  TEST_ASSERT (eq (nth (3, form), box_int (1)), "car not folded");
+  TEST_ASSERT (eq (nth (4, form), box_int (3)), "string-length not folded");
+  TEST_ASSERT (eq (nth (5, form), q_t), "comparison not folded");
+  TEST_CHECK_TYPE ("non constant arg", nth (6, form), LISP_CONS);
+  TEST_CHECK_TYPE ("division by zero", nth (7, form), LISP_CONS);
+  TEST_CHECK_TYPE ("impure builtin", nth (8, form), LISP_CONS);
+
+  // let bound constants are propagated, unless assigned
+  form = read_string ("(lambda (x)"
+                      "  (let ((a 2) (b (+ a 1))) (+ x (* a b)))"
+                      "  (let ((c 1)) (setq c 2) c))");
+  resolve_lambda_form (f_cdr (form), NULL);
+  Lisp_Object let = nth (2, form);
+  TEST_ASSERT (eq (unbox_vector (nth (1, let))->contents[3], box_int (3)),
+               "init not folded");
+  TEST_ASSERT (eq (nth (2, nth (2, let)), box_int (6)),
+               "constants not propagated");
+  let = nth (3, form);
+  TEST_CHECK_TYPE ("assigned variable", nth (3, let), LISP_LREF);
+
+  // and seen from closures, which do not capture them
+  Lisp_Object closure = eval_string ("(let ((k 5)) (lambda () k))");
+  TEST_ASSERT (nil (unbox_lambda (closure)->env), "constant captured");
+  TEST_ASSERT (eq (f_car (unbox_lambda (closure)->form), box_int (5)),
+               "constant not propagated");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_resolve_data ()
+{
+  // eval resolves a copy of the list it is given
+  Lisp_Object res = eval_string ("(define tr-code '(let ((x 1) (y 2)) 3))"
+                                 "(eval tr-code)");
+  TEST_ASSERT (eq (res, box_int (3)), "expected 3, got %ld", unbox_int (res));
+  Lisp_Object code = eval_string ("tr-code");
+  TEST_CHECK_TYPE ("let bindings", nth (1, code), LISP_CONS);
+
+  res = eval_string ("(define tr-lambda '(lambda (x) (* x 2)))"
+                     "((eval tr-lambda) 4)");
+  TEST_ASSERT (eq (res, box_int (8)), "expected 8, got %ld", unbox_int (res));
+  code = eval_string ("tr-lambda");
+  TEST_CHECK_TYPE ("lambda args", nth (1, code), LISP_CONS);
+  TEST_CHECK_TYPE ("lambda body", nth (1, nth (2, code)), LISP_SYMB);
+
+  return TEST_RESULT_SUCCESS;
+}
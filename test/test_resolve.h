@@ -0,0 +1,8 @@
+#ifndef _TEST_RESOLVE_H_
+#define _TEST_RESOLVE_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_resolve ();
+
+#endif /* _TEST_RESOLVE_H_ */
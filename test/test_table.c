@@ -0,0 +1,239 @@
+#include "test_table.h"
+#include "../src/alloc.h"
+#include "../src/lisp.h"
+#include "../src/table.h"
+#include "test_lib.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define THREADS 4
+#define KEYS_PER_THREAD 5000
+
+// test cases
+static TestResult test_table_putget ();
+static TestResult test_table_overwrite ();
+static TestResult test_table_remove ();
+static TestResult test_table_grow ();
+static TestResult test_table_builtins ();
+static TestResult test_table_threads ();
+static TestResult test_table_reclaim ();
+
+static TestCase test_table_cases[] = {
+  { .skip = 0, .name = "put get", .run = test_table_putget },
+  { .skip = 0, .name = "overwrite", .run = test_table_overwrite },
+  { .skip = 0, .name = "remove", .run = test_table_remove },
+  { .skip = 0, .name = "grow", .run = test_table_grow },
+  { .skip = 0, .name = "builtins", .run = test_table_builtins },
+  { .skip = 0, .name = "threads", .run = test_table_threads },
+  { .skip = 0, .name = "reclaim", .run = test_table_reclaim },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_table ()
+{
+  return test_suite_init ("table", test_table_cases);
+}
+
+// test cases implementation
+
+static TestResult
+test_table_putget ()
+{
+  Table *t = table_new (0);
+  int found;
+
+  // structured keys are compared by value, not identity
+  table_put (t, f_cons (make_str_symbol ("user"), box_int (1)),
+             make_string ("alice"));
+  Lisp_Object val
+      = table_get (t, f_cons (make_str_symbol ("user"), box_int (1)), &found);
+  TEST_ASSERT (found, "key not found");
+  TEST_CHECK_TYPE ("value", val, LISP_STRG);
+  TEST_ASSERT (!nil (f_string_equal_p (val, make_string ("alice"))),
+               "wrong value");
+
+  table_get (t, f_cons (make_str_symbol ("user"), box_int (2)), &found);
+  TEST_ASSERT (!found, "missing key found");
+
+  table_free (t);
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_table_overwrite ()
+{
+  Table *t = table_new (1);
+  int found;
+
+  table_put (t, box_int (7), box_int (1));
+  table_put (t, box_int (7), box_int (2));
+  TEST_ASSERT (table_count (t) == 1, "count %zu", table_count (t));
+  TEST_ASSERT (eq (table_get (t, box_int (7), &found), box_int (2)),
+               "value not overwritten");
+
+  table_free (t);
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_table_remove ()
+{
+  Table *t = table_new (2);
+  int found;
+
+  table_put (t, make_string ("a"), box_int (1));
+  table_put (t, make_string ("b"), box_int (2));
+  TEST_ASSERT (table_remove (t, make_string ("a")), "remove failed");
+  TEST_ASSERT (!table_remove (t, make_string ("a")), "removed twice");
+  table_get (t, make_string ("a"), &found);
+  TEST_ASSERT (!found, "removed key found");
+  TEST_ASSERT (eq (table_get (t, make_string ("b"), &found), box_int (2)),
+               "other key lost");
+  TEST_ASSERT (table_count (t) == 1, "count %zu", table_count (t));
+
+  table_free (t);
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_table_grow ()
+{
+  Table *t = table_new (2);
+  int found;
+
+  for (int i = 0; i < 10000; i++)
+    table_put (t, box_int (i), box_int (-i));
+  TEST_ASSERT (table_count (t) == 10000, "count %zu", table_count (t));
+  for (int i = 0; i < 10000; i++)
+    TEST_ASSERT (eq (table_get (t, box_int (i), &found), box_int (-i))
+                     && found,
+                 "wrong value for %d", i);
+
+  table_free (t);
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_table_builtins ()
+{
+  Lisp_Object id = f_table_new (q_nil);
+  TEST_CHECK_TYPE ("table id", id, LISP_INTG);
+
+  f_table_put (id, make_str_symbol ("k"), f_cons (box_int (1), q_nil));
+  Lisp_Object val = f_table_get (id, make_str_symbol ("k"));
+  TEST_CHECK_TYPE ("value", val, LISP_CONS);
+  TEST_ASSERT (eq (f_table_count (id), box_int (1)), "wrong count");
+  TEST_ASSERT (eq (f_table_remove (id, make_str_symbol ("k")), q_t),
+               "remove failed");
+  TEST_ASSERT (eq (f_table_get (id, make_str_symbol ("k")), q_nil),
+               "removed key found");
+
+  f_table_delete (id);
+  TEST_ASSERT (table_by_id (unbox_int (id)) == NULL, "table not deleted");
+  return TEST_RESULT_SUCCESS;
+}
+
+// integers are immediate: encoding and decoding them never touches the
+// lisp heap, so worker threads can use the table directly
+
+static Table *threadtable;
+
+static void *
+writer (void *arg)
+{
+  long base = (long)arg * KEYS_PER_THREAD;
+  for (long i = base; i < base + KEYS_PER_THREAD; i++)
+    table_put (threadtable, box_int (i), box_int (i * 2));
+  return NULL;
+}
+
+static void *
+reader (void *arg)
+{
+  long *bad = arg;
+  int found;
+  for (long i = 0; i < THREADS * KEYS_PER_THREAD; i++)
+    {
+      Lisp_Object val = table_get (threadtable, box_int (i), &found);
+      if (found && !eq (val, box_int (i * 2)))
+        (*bad)++;
+    }
+  return NULL;
+}
+
+static TestResult
+test_table_threads ()
+{
+  pthread_t writers[THREADS], readers[THREADS];
+  long bad[THREADS] = { 0 };
+  int found;
+
+  threadtable = table_new (0);
+  for (long i = 0; i < THREADS; i++)
+    {
+      pthread_create (&writers[i], NULL, writer, (void *)i);
+      pthread_create (&readers[i], NULL, reader, &bad[i]);
+    }
+  for (int i = 0; i < THREADS; i++)
+    {
+      pthread_join (writers[i], NULL);
+      pthread_join (readers[i], NULL);
+      TEST_ASSERT (bad[i] == 0, "reader %d saw %ld wrong values", i, bad[i]);
+    }
+
+  TEST_ASSERT (table_count (threadtable) == THREADS * KEYS_PER_THREAD,
+               "count %zu", table_count (threadtable));
+  for (long i = 0; i < THREADS * KEYS_PER_THREAD; i++)
+    TEST_ASSERT (eq (table_get (threadtable, box_int (i), &found),
+                     box_int (i * 2)),
+                 "wrong value for %ld", i);
+
+  table_free (threadtable);
+  return TEST_RESULT_SUCCESS;
+}
+
+// readers one after the other, never leaving the shard empty
+
+static atomic_int stopreaders;
+
+static void *
+busy_reader (void *arg)
+{
+  (void)arg;
+  int found;
+  while (!atomic_load (&stopreaders))
+    table_get (threadtable, box_int (0), &found);
+  return NULL;
+}
+
+static TestResult
+test_table_reclaim ()
+{
+  pthread_t readers[THREADS];
+
+  threadtable = table_new (1);
+  atomic_store (&stopreaders, 0);
+  for (int i = 0; i < THREADS; i++)
+    pthread_create (&readers[i], NULL, busy_reader, NULL);
+
+  // every put retires the entry it replaces: what waits for the
+  // readers must stay bounded while they keep coming in
+  size_t most = 0;
+  for (long i = 0; i < 20000; i++)
+    {
+      table_put (threadtable, box_int (0), box_int (i));
+      size_t retired = table_retired (threadtable);
+      if (retired > most)
+        most = retired;
+    }
+
+  atomic_store (&stopreaders, 1);
+  for (int i = 0; i < THREADS; i++)
+    pthread_join (readers[i], NULL);
+  table_free (threadtable);
+
+  TEST_ASSERT (most <= TABLE_MAX_RETIRED, "up to %zu blocks retired",
+               most);
+  return TEST_RESULT_SUCCESS;
+}
@@ -0,0 +1,8 @@
+#ifndef _TEST_TABLE_H_
+#define _TEST_TABLE_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_table ();
+
+#endif /* _TEST_TABLE_H_ */
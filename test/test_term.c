@@ -0,0 +1,318 @@
+#include "test_term.h"
+#include "../src/alloc.h"
+#include "../src/eval.h"
+#include "../src/lexer.h"
+#include "../src/lisp.h"
+#include "../src/term.h"
+#include "test_lib.h"
+#include <string.h>
+
+// test cases
+static TestResult test_term_int ();
+static TestResult test_term_string ();
+static TestResult test_term_atoms ();
+static TestResult test_term_list ();
+static TestResult test_term_vector ();
+static TestResult test_term_shared ();
+static TestResult test_term_cycle ();
+static TestResult test_term_longlist ();
+static TestResult test_term_invalid ();
+static TestResult test_term_closure ();
+
+static TestCase test_term_cases[] = {
+  { .skip = 0, .name = "int", .run = test_term_int },
+  { .skip = 0, .name = "string", .run = test_term_string },
+  { .skip = 0, .name = "atoms", .run = test_term_atoms },
+  { .skip = 0, .name = "list", .run = test_term_list },
+  { .skip = 0, .name = "vector", .run = test_term_vector },
+  { .skip = 0, .name = "shared", .run = test_term_shared },
+  { .skip = 0, .name = "cycle", .run = test_term_cycle },
+  { .skip = 0, .name = "long list", .run = test_term_longlist },
+  { .skip = 0, .name = "invalid", .run = test_term_invalid },
+  { .skip = 0, .name = "closure", .run = test_term_closure },
+  {}, // terminator
+};
+
+TestSuite *
+test_suite_term ()
+{
+  return test_suite_init ("term", test_term_cases);
+}
+
+// helpers
+
+static Lisp_Object
+roundtrip (Lisp_Object term, size_t *size, const char **err)
+{
+  unsigned char *buf = term_encode (term, size);
+  Lisp_Object res = term_decode (buf, *size, err);
+  free (buf);
+  return res;
+}
+
+static int
+term_equal (Lisp_Object x, Lisp_Object y)
+{
+  while (type_of (x) == LISP_CONS && type_of (y) == LISP_CONS)
+    {
+      if (!term_equal (f_car (x), f_car (y)))
+        return 0;
+      x = f_cdr (x);
+      y = f_cdr (y);
+    }
+
+  if (type_of (x) != type_of (y))
+    return 0;
+
+  switch (type_of (x))
+    {
+    case LISP_STRG:
+    case LISP_SYMB:
+      return !nil (f_equal_p (x, y));
+    case LISP_VECT:
+      if (unbox_vector (x)->size != unbox_vector (y)->size)
+        return 0;
+      for (size_t i = 0; i < unbox_vector (x)->size; i++)
+        if (!term_equal (unbox_vector (x)->contents[i],
+                         unbox_vector (y)->contents[i]))
+          return 0;
+      return 1;
+    default:
+      return eq (x, y);
+    }
+}
+
+// test cases implementation
+
+static TestResult
+test_term_int ()
+{
+  Lisp_Integer ints[] = { 0, 1, -1, 63, -64, 123456789, INT64_MAX >> 3,
+                          INT64_MIN >> 3 };
+  size_t size;
+  const char *err;
+
+  for (size_t i = 0; i < sizeof (ints) / sizeof (ints[0]); i++)
+    {
+      Lisp_Object res = roundtrip (box_int (ints[i]), &size, &err);
+      TEST_ASSERT (!err, "decode error: %s", err);
+      TEST_CHECK_TYPE ("int", res, LISP_INTG);
+      TEST_ASSERT (unbox_int (res) == ints[i], "expected %ld, got %ld",
+                   ints[i], unbox_int (res));
+    }
+
+  // small integers take a single byte after header and tag
+  roundtrip (box_int (-3), &size, &err);
+  TEST_ASSERT (size == TERM_HEADER_SIZE + 2, "small int size: %zu", size);
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_string ()
+{
+  const char data[] = "binary\0data with a nul inside";
+  size_t size;
+  const char *err;
+
+  Lisp_Object str = make_nstring (data, sizeof (data) - 1);
+  Lisp_Object res = roundtrip (str, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_CHECK_TYPE ("string", res, LISP_STRG);
+  TEST_ASSERT (unbox_string (res)->size == sizeof (data) - 1,
+               "wrong size %zu", unbox_string (res)->size);
+  TEST_ASSERT (memcmp (unbox_string (res)->data, data, sizeof (data) - 1)
+                   == 0,
+               "wrong string data");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_atoms ()
+{
+  size_t size1, size3;
+  const char *err;
+
+  // different symbol objects with the same name share an atom cache
+  // entry: after the first one, each costs two bytes
+  Lisp_Object one = f_cons (make_str_symbol ("averylongsymbolname"), q_nil);
+  Lisp_Object three
+      = f_cons (make_str_symbol ("averylongsymbolname"),
+                f_cons (make_str_symbol ("averylongsymbolname"),
+                        f_cons (make_str_symbol ("averylongsymbolname"),
+                                q_nil)));
+
+  roundtrip (one, &size1, &err);
+  Lisp_Object res = roundtrip (three, &size3, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_ASSERT (size3 == size1 + 4, "atom cache not used: %zu vs %zu", size3,
+               size1);
+  TEST_ASSERT (term_equal (res, three), "wrong decoded atoms");
+  TEST_ASSERT (eq (f_car (res), f_car (f_cdr (res))),
+               "same atoms decoded to different symbols");
+
+  res = roundtrip (f_cons (q_nil, f_cons (q_t, q_nil)), &size1, &err);
+  TEST_ASSERT (eq (f_car (res), q_nil) && eq (f_car (f_cdr (res)), q_t),
+               "nil and t must decode to themselves");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_list ()
+{
+  size_t size;
+  const char *err;
+
+  // (1 "two" (three . 4) . 5)
+  Lisp_Object list
+      = f_cons (box_int (1),
+                f_cons (make_string ("two"),
+                        f_cons (f_cons (make_str_symbol ("three"),
+                                        box_int (4)),
+                                box_int (5))));
+
+  Lisp_Object res = roundtrip (list, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_ASSERT (term_equal (res, list), "wrong decoded list");
+  TEST_ASSERT (eq (f_cdr (f_cdr (f_cdr (res))), box_int (5)),
+               "improper tail lost");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_vector ()
+{
+  size_t size;
+  const char *err;
+
+  Lisp_Object vec = make_vector (3);
+  unbox_vector (vec)->contents[0] = make_string ("a");
+  unbox_vector (vec)->contents[1] = f_cons (box_int (2), q_nil);
+  unbox_vector (vec)->contents[2] = make_vector (0);
+
+  Lisp_Object res = roundtrip (vec, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_CHECK_TYPE ("vector", res, LISP_VECT);
+  TEST_ASSERT (term_equal (res, vec), "wrong decoded vector");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_shared ()
+{
+  size_t size;
+  const char *err;
+
+  Lisp_Object str = make_string ("shared string");
+  Lisp_Object tail = f_cons (box_int (1), f_cons (box_int (2), q_nil));
+  // ((1 2) "shared string" "shared string" 0 1 2)
+  Lisp_Object term
+      = f_cons (tail, f_cons (str, f_cons (str, f_cons (box_int (0), tail))));
+
+  Lisp_Object res = roundtrip (term, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_ASSERT (term_equal (res, term), "wrong decoded term");
+
+  Lisp_Object rstr = f_car (f_cdr (res));
+  TEST_ASSERT (eq (rstr, f_car (f_cdr (f_cdr (res)))),
+               "shared string decoded twice");
+  TEST_ASSERT (eq (f_car (res), f_cdr (f_cdr (f_cdr (f_cdr (res))))),
+               "shared tail decoded twice");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_cycle ()
+{
+  size_t size;
+  const char *err;
+
+  // #1=(a b . #1#)
+  Lisp_Object last = f_cons (make_str_symbol ("b"), q_nil);
+  Lisp_Object cycle = f_cons (make_str_symbol ("a"), last);
+  f_setcdr (last, cycle);
+
+  Lisp_Object res = roundtrip (cycle, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_CHECK_TYPE ("cycle", res, LISP_CONS);
+  TEST_ASSERT (eq (f_cdr (f_cdr (res)), res), "cycle not preserved");
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_longlist ()
+{
+  size_t size;
+  const char *err;
+  const int n = 200000;
+
+  Lisp_Object list = q_nil;
+  for (int i = n - 1; i >= 0; i--)
+    list = f_cons (box_int (i), list);
+
+  Lisp_Object res = roundtrip (list, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+
+  int i = 0;
+  for (Lisp_Object tail = res; !nil (tail); tail = f_cdr (tail), i++)
+    TEST_ASSERT (unbox_int (f_car (tail)) == i, "wrong element %d", i);
+  TEST_ASSERT (i == n, "expected %d elements, got %d", n, i);
+
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_invalid ()
+{
+  size_t size;
+  const char *err;
+
+  unsigned char *buf = term_encode (make_string ("abc"), &size);
+
+  term_decode (buf, size - 1, &err);
+  TEST_ASSERT (err != NULL, "truncated message accepted");
+
+  buf[1] = TERM_VERSION + 1;
+  term_decode (buf, size, &err);
+  TEST_ASSERT (err != NULL, "wrong version accepted");
+
+  buf[1] = TERM_VERSION;
+  buf[TERM_HEADER_SIZE] = 0xff;
+  term_decode (buf, size, &err);
+  TEST_ASSERT (err != NULL, "unknown tag accepted");
+
+  free (buf);
+  return TEST_RESULT_SUCCESS;
+}
+
+static TestResult
+test_term_closure ()
+{
+  size_t size;
+  const char *err;
+  const char *src = "((lambda (n) (lambda (x) (+ x n))) 3)";
+
+  Lexer *l = lex_init ();
+  lex_set_stream (l, stream_string (src, strlen (src)));
+  Lisp_Object closure = eval_toplevel (l);
+  TEST_CHECK_TYPE ("closure", closure, LISP_LMBD);
+
+  // the captured frame and the resolved body travel with the lambda
+  Lisp_Object res = roundtrip (closure, &size, &err);
+  TEST_ASSERT (!err, "decode error: %s", err);
+  TEST_CHECK_TYPE ("decoded", res, LISP_LMBD);
+
+  Lisp_Object arg = box_int (4);
+  stack_push ((struct stackframe){ .fun = q_nil, .env = q_nil });
+  Lisp_Object sum = call_lambda (unbox_lambda (res), &arg);
+  stack_pop ();
+  TEST_ASSERT (eq (sum, box_int (7)), "expected 7, got %ld", unbox_int (sum));
+
+  return TEST_RESULT_SUCCESS;
+}
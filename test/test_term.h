@@ -0,0 +1,8 @@
+#ifndef _TEST_TERM_H_
+#define _TEST_TERM_H_
+
+#include "test_lib.h"
+
+TestSuite *test_suite_term ();
+
+#endif /* _TEST_TERM_H_ */